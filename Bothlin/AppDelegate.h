@@ -9,6 +9,8 @@
 
 @class ImportCoordinator;
 @class LibraryWriteCoordinator;
+@class StorageMaintenance;
+@class ThumbnailPackStore;
 
 extern NSString * __nonnull const kUserDefaultsUsingDefaultStorage;
 extern NSString * __nonnull const kUserDefaultsDefaultStoragePath;
@@ -25,6 +27,8 @@ extern NSString * __nonnull const kUserDefaultsExpandedSidebarItems;
 @property (nonatomic, strong, readonly) NSPersistentContainer * _Nonnull persistentContainer;
 @property (nonatomic, strong, readonly) LibraryWriteCoordinator * _Nonnull libraryController;
 @property (nonatomic, strong, readonly) ImportCoordinator * _Nonnull importCoordinator;
+@property (nonatomic, strong, readonly) ThumbnailPackStore * _Nonnull thumbnailStore;
+@property (nonatomic, strong, readonly) StorageMaintenance * _Nonnull storageMaintenance;
 
 - (IBAction)import:(id _Nullable)sender;
 - (IBAction)settings:(id _Nullable)sender;
@@ -32,6 +36,8 @@ extern NSString * __nonnull const kUserDefaultsExpandedSidebarItems;
 - (IBAction)emptyTrash:(id _Nullable)sender;
 - (IBAction)debugRegenerateThumbnail:(id _Nullable)sender;
 - (IBAction)debugRegenerateScannedText:(id _Nullable)sender;
+- (IBAction)debugReclaimStorage:(id _Nullable)sender;
+- (IBAction)debugExportPerformanceSummary:(id _Nullable)sender;
 
 @end
 
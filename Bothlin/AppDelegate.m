@@ -10,6 +10,9 @@
 #import "RootWindowController.h"
 #import "SettingsWindowController.h"
 #import "ImportCoordinator.h"
+#import "ThumbnailPackStore.h"
+#import "StorageMaintenance.h"
+#import "PerformanceMetrics.h"
 #import "Helpers.h"
 
 NSString * __nonnull const kUserDefaultsUsingDefaultStorage = @"kUserDefaultsUsingDefaultStorage";
@@ -96,9 +99,18 @@ NSString * __nonnull const kUserDefaultsExpandedSidebarItems = @"kUserDefaultsEx
 
     // TODO: icky self use
     NSPersistentStoreCoordinator *store = self.persistentContainer.persistentStoreCoordinator;
-    self->_libraryController = [[LibraryWriteCoordinator alloc] initWithPersistentStore:store];
+    self->_thumbnailStore = [[ThumbnailPackStore alloc] initWithStorageDirectory:storageDirectory];
+    self->_libraryController = [[LibraryWriteCoordinator alloc] initWithPersistentStore:store
+                                                                         thumbnailStore:self.thumbnailStore
+                                                                  delegateCallbackQueue:dispatch_get_main_queue()];
     self->_importCoordinator = [[ImportCoordinator alloc] initWithPersistentStore:store
                                                                  storageDirectory:storageDirectory];
+    self->_storageMaintenance = [[StorageMaintenance alloc] initWithPersistentStore:store
+                                                                   storageDirectory:storageDirectory
+                                                                     thumbnailStore:self.thumbnailStore];
+
+    // Unlike the other house keeping this can't wait, as the sidebar needs the counts
+    [self.libraryController countUncountedTags];
 
     // We wait a minute, and then see if we need to do any house keeping, so as not to add load whilst the
     // user is in the "I launched this to do a specific thing" window
@@ -112,6 +124,15 @@ NSString * __nonnull const kUserDefaultsExpandedSidebarItems = @"kUserDefaultsEx
         }
 
         [self.libraryController carryOutCleanUp];
+
+        // Only report here: removing files is left for the user to ask for
+        [self.storageMaintenance scan:^(StorageScanReport * _Nullable report, NSError * _Nullable error) {
+            if (nil == report) {
+                NSLog(@"Failed to scan storage: %@", error);
+                return;
+            }
+            NSLog(@"Storage scan: %@", report);
+        }];
     }];
 
     NSFileManager *fm = [NSFileManager defaultManager];
@@ -179,7 +200,7 @@ NSString * __nonnull const kUserDefaultsExpandedSidebarItems = @"kUserDefaultsEx
             return;
         }
         NSAssert(NSAlertSecondButtonReturn == returnCode, @"Expected button %ld, got %ld", NSAlertSecondButtonReturn, returnCode);
-        [self.libraryController moveDeletedAssetsToTrash:^(BOOL success, NSError * _Nullable error) {
+        TrashPurgeJob *job = [self.libraryController moveDeletedAssetsToTrash:^(BOOL success, NSError * _Nullable error) {
             if (nil != error) {
                 NSAssert(NO == success, @"Got error but succcess");
                 dispatch_async(dispatch_get_main_queue(), ^{
@@ -189,6 +210,7 @@ NSString * __nonnull const kUserDefaultsExpandedSidebarItems = @"kUserDefaultsEx
             }
             NSAssert(NO != success, @"Got no error but not success");
         }];
+        [self.mainWindowController trackTrashPurgeJob:job];
     }];
 }
 
@@ -200,6 +222,57 @@ NSString * __nonnull const kUserDefaultsExpandedSidebarItems = @"kUserDefaultsEx
     [self.mainWindowController debugRegenerateScannedText:sender];
 }
 
+- (IBAction)debugReclaimStorage:(id)sender {
+    [self.storageMaintenance scan:^(StorageScanReport * _Nullable report, NSError * _Nullable error) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (nil == report) {
+                NSAlert *alert = [NSAlert alertWithError:error];
+                [alert runModal];
+                return;
+            }
+
+            NSAlert *alert = [[NSAlert alloc] init];
+            alert.messageText = NSLocalizedString(@"Reclaim Storage", nil);
+            alert.informativeText = [NSString stringWithFormat:NSLocalizedString(@"%@ can be freed from %lu unused folders and %lu old thumbnails. %lu assets are missing their file.", nil),
+                                     [NSByteCountFormatter stringFromByteCount:(long long)report.reclaimableBytes
+                                                                    countStyle:NSByteCountFormatterCountStyleFile],
+                                     (unsigned long)[report.orphanDirectories count],
+                                     (unsigned long)[report.staleThumbnails count],
+                                     (unsigned long)[report.missingOriginals count]];
+            [alert addButtonWithTitle:NSLocalizedString(@"Cancel", nil)];
+            [alert addButtonWithTitle:NSLocalizedString(@"Reclaim", nil)];
+            [alert beginSheetModalForWindow:self.mainWindowController.window
+                          completionHandler:^(NSModalResponse returnCode) {
+                if (NSAlertFirstButtonReturn == returnCode) {
+                    return;
+                }
+                [self.storageMaintenance reclaim:report
+                                        callback:^(unsigned long long reclaimedBytes) {
+                    NSLog(@"Reclaimed %llu bytes of storage", reclaimedBytes);
+                }];
+            }];
+        });
+    }];
+}
+
+- (IBAction)debugExportPerformanceSummary:(id)sender {
+    NSSavePanel *panel = [NSSavePanel savePanel];
+    panel.nameFieldStringValue = @"Bothlin Performance.json";
+    [panel beginSheetModalForWindow:self.mainWindowController.window
+                  completionHandler:^(NSModalResponse result) {
+        if (NSModalResponseOK != result) {
+            return;
+        }
+        NSError *error = nil;
+        BOOL success = [PerformanceMetrics exportSummaryToURL:panel.URL
+                                                        error:&error];
+        if (NO == success) {
+            NSAlert *alert = [NSAlert alertWithError:error];
+            [alert runModal];
+        }
+    }];
+}
+
 
 #pragma mark - Core Data stack
 
@@ -0,0 +1,58 @@
+//
+//  NSFileManager+ContentHash.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 02/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Which of the cheaper alternatives to a byte for byte copy transferItemAtURL: may use. A
+// streamed copy is always the fallback.
+typedef NS_OPTIONS(NSUInteger, FileTransferOptions) {
+    FileTransferOptionsNone = 0,
+    FileTransferOptionsAllowClone = 1 << 0, // APFS clone, which is copy on write so safe to always try
+    FileTransferOptionsAllowHardLink = 1 << 1, // Shares the file with the source, so edits to one show in both
+    FileTransferOptionsAllowMove = 1 << 2, // Consumes the source, which will be removed even if we fall back to copying
+};
+
+typedef NS_ENUM(NSInteger, FileTransferStrategy) {
+    FileTransferStrategyStreamedCopy = 0,
+    FileTransferStrategyClone = 1,
+    FileTransferStrategyHardLink = 2,
+    FileTransferStrategyMove = 3,
+};
+
+NSString *NSStringFromFileTransferStrategy(FileTransferStrategy strategy);
+
+@interface NSFileManager (ContentHash)
+
+// Returns the hex encoded SHA-256 of the file's contents, reading it in chunks so memory use
+// is constant regardless of file size.
+- (NSString * _Nullable)contentHashOfItemAtURL:(NSURL *)url
+                                         error:(NSError **)error;
+
+// Copies a single file, hashing it as it goes so we only read the source once. The file's
+// metadata is copied across as per copyItemAtURL:toURL:error:. On failure the partial
+// destination file is removed.
+- (BOOL)copyItemAtURL:(NSURL *)srcURL
+                toURL:(NSURL *)dstURL
+          contentHash:(NSString * _Nullable * _Nullable)contentHash
+                error:(NSError **)error;
+
+// Gets the item at srcURL to dstURL as cheaply as the options allow, telling you which way it
+// did it. If contentHash is not NULL the item must be a file, and the hash will be computed,
+// which for anything other than a streamed copy means reading the file once. Directories
+// can't be hard linked, and fall back to copyItemAtURL:toURL:error: rather than a streamed copy.
+- (BOOL)transferItemAtURL:(NSURL *)srcURL
+                    toURL:(NSURL *)dstURL
+                  options:(FileTransferOptions)options
+                 strategy:(FileTransferStrategy * _Nullable)strategy
+              contentHash:(NSString * _Nullable * _Nullable)contentHash
+                    error:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,301 @@
+//
+//  NSFileManager+ContentHash.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 02/12/2023.
+//
+
+#import <CommonCrypto/CommonDigest.h>
+#import <copyfile.h>
+#import <sys/clonefile.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+#import "NSFileManager+ContentHash.h"
+
+// Big enough that syscall overhead is lost in the noise, small enough that a handful of
+// concurrent imports don't add up to much memory.
+static const size_t kContentHashBufferSize = 1024 * 1024;
+
+static NSError *ContentHashPOSIXError(int errorNumber, NSURL *url) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:errorNumber
+                           userInfo:@{NSURLErrorKey: url}];
+}
+
+static NSString *ContentHashHexString(CC_SHA256_CTX *context) {
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, context);
+    NSMutableString *hash = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (NSUInteger index = 0; index < CC_SHA256_DIGEST_LENGTH; index++) {
+        [hash appendFormat:@"%02x", digest[index]];
+    }
+    return [NSString stringWithString:hash];
+}
+
+NSString *NSStringFromFileTransferStrategy(FileTransferStrategy strategy) {
+    switch (strategy) {
+        case FileTransferStrategyStreamedCopy:
+            return @"streamed copy";
+        case FileTransferStrategyClone:
+            return @"clone";
+        case FileTransferStrategyHardLink:
+            return @"hard link";
+        case FileTransferStrategyMove:
+            return @"move";
+    }
+    return @"unknown";
+}
+
+@implementation NSFileManager (ContentHash)
+
+- (NSString * _Nullable)contentHashOfItemAtURL:(NSURL *)url
+                                         error:(NSError **)error {
+    NSParameterAssert(nil != url);
+
+    int fd = open([url fileSystemRepresentation], O_RDONLY);
+    if (0 > fd) {
+        if (nil != error) {
+            *error = ContentHashPOSIXError(errno, url);
+        }
+        return nil;
+    }
+    // We're going to read this once, front to back, so don't pollute the cache with it
+    fcntl(fd, F_NOCACHE, 1);
+
+    void *buffer = malloc(kContentHashBufferSize);
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+
+    int readError = 0;
+    while (YES) {
+        ssize_t bytesRead = read(fd, buffer, kContentHashBufferSize);
+        if (0 > bytesRead) {
+            if (EINTR == errno) {
+                continue;
+            }
+            readError = errno;
+            break;
+        }
+        if (0 == bytesRead) {
+            break;
+        }
+        CC_SHA256_Update(&context, buffer, (CC_LONG)bytesRead);
+    }
+    free(buffer);
+    close(fd);
+
+    if (0 != readError) {
+        if (nil != error) {
+            *error = ContentHashPOSIXError(readError, url);
+        }
+        return nil;
+    }
+    return ContentHashHexString(&context);
+}
+
+- (BOOL)copyItemAtURL:(NSURL *)srcURL
+                toURL:(NSURL *)dstURL
+          contentHash:(NSString * _Nullable * _Nullable)contentHash
+                error:(NSError **)error {
+    NSParameterAssert(nil != srcURL);
+    NSParameterAssert(nil != dstURL);
+
+    int srcFD = open([srcURL fileSystemRepresentation], O_RDONLY);
+    if (0 > srcFD) {
+        if (nil != error) {
+            *error = ContentHashPOSIXError(errno, srcURL);
+        }
+        return NO;
+    }
+    fcntl(srcFD, F_NOCACHE, 1);
+
+    // O_EXCL to match copyItemAtURL:toURL:error:, which won't overwrite an existing item
+    int dstFD = open([dstURL fileSystemRepresentation], O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (0 > dstFD) {
+        if (nil != error) {
+            *error = ContentHashPOSIXError(errno, dstURL);
+        }
+        close(srcFD);
+        return NO;
+    }
+
+    void *buffer = malloc(kContentHashBufferSize);
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+
+    int failedErrorNumber = 0;
+    NSURL *failedURL = nil;
+    while (0 == failedErrorNumber) {
+        ssize_t bytesRead = read(srcFD, buffer, kContentHashBufferSize);
+        if (0 > bytesRead) {
+            if (EINTR == errno) {
+                continue;
+            }
+            failedErrorNumber = errno;
+            failedURL = srcURL;
+            break;
+        }
+        if (0 == bytesRead) {
+            break;
+        }
+        CC_SHA256_Update(&context, buffer, (CC_LONG)bytesRead);
+
+        ssize_t offset = 0;
+        while (offset < bytesRead) {
+            ssize_t bytesWritten = write(dstFD, (char *)buffer + offset, (size_t)(bytesRead - offset));
+            if (0 > bytesWritten) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                failedErrorNumber = errno;
+                failedURL = dstURL;
+                break;
+            }
+            offset += bytesWritten;
+        }
+    }
+    free(buffer);
+
+    if (0 == failedErrorNumber) {
+        // Bring across permissions, dates, and extended attributes (e.g., quarantine, tags)
+        if (0 != fcopyfile(srcFD, dstFD, NULL, COPYFILE_METADATA)) {
+            NSLog(@"Failed to copy metadata from %@ to %@: %d", srcURL, dstURL, errno);
+        }
+    }
+
+    close(srcFD);
+    if ((0 != close(dstFD)) && (0 == failedErrorNumber)) {
+        failedErrorNumber = errno;
+        failedURL = dstURL;
+    }
+
+    if (0 != failedErrorNumber) {
+        unlink([dstURL fileSystemRepresentation]);
+        if (nil != error) {
+            *error = ContentHashPOSIXError(failedErrorNumber, failedURL);
+        }
+        return NO;
+    }
+
+    NSString *hash = ContentHashHexString(&context);
+    if (nil != contentHash) {
+        *contentHash = hash;
+    }
+    return YES;
+}
+
+- (BOOL)transferItemAtURL:(NSURL *)srcURL
+                    toURL:(NSURL *)dstURL
+                  options:(FileTransferOptions)options
+                 strategy:(FileTransferStrategy * _Nullable)strategy
+              contentHash:(NSString * _Nullable * _Nullable)contentHash
+                    error:(NSError **)error {
+    NSParameterAssert(nil != srcURL);
+    NSParameterAssert(nil != dstURL);
+
+    const char *srcPath = [srcURL fileSystemRepresentation];
+    const char *dstPath = [dstURL fileSystemRepresentation];
+
+    // Each of the cheap strategies fails with EXDEV or ENOTSUP if the volumes or filesystem don't
+    // allow it, in which case we just move on to the next. The exception is EEXIST, as
+    // nothing further down will do any better if something is already at the destination.
+    FileTransferStrategy used = FileTransferStrategyStreamedCopy;
+    BOOL done = NO;
+    int lastErrorNumber = 0;
+
+    // If we're allowed to consume the source then a rename is cheaper than any copy
+    if ((NO == done) && (0 != (options & FileTransferOptionsAllowMove))) {
+        if (0 == rename(srcPath, dstPath)) {
+            used = FileTransferStrategyMove;
+            done = YES;
+        } else {
+            lastErrorNumber = errno;
+        }
+    }
+    if ((NO == done) && (EEXIST != lastErrorNumber) && (0 != (options & FileTransferOptionsAllowClone))) {
+        if (0 == clonefile(srcPath, dstPath, 0)) {
+            used = FileTransferStrategyClone;
+            done = YES;
+        } else {
+            lastErrorNumber = errno;
+        }
+    }
+    if ((NO == done) && (EEXIST != lastErrorNumber) && (0 != (options & FileTransferOptionsAllowHardLink))) {
+        if (0 == link(srcPath, dstPath)) {
+            used = FileTransferStrategyHardLink;
+            done = YES;
+        } else {
+            lastErrorNumber = errno;
+        }
+    }
+    if ((NO == done) && (EEXIST == lastErrorNumber)) {
+        if (nil != error) {
+            *error = ContentHashPOSIXError(lastErrorNumber, dstURL);
+        }
+        return NO;
+    }
+
+    if (NO != done) {
+        if (nil != contentHash) {
+            NSError *innerError = nil;
+            NSString *hash = [self contentHashOfItemAtURL:dstURL
+                                                    error:&innerError];
+            if (nil != innerError) {
+                NSAssert(nil == hash, @"Got error and hash");
+                // Don't leave a half imported item behind, unless we moved it in which case
+                // it's the only copy we have
+                if (FileTransferStrategyMove != used) {
+                    unlink(dstPath);
+                }
+                if (nil != error) {
+                    *error = innerError;
+                }
+                return NO;
+            }
+            *contentHash = hash;
+        }
+        if (nil != strategy) {
+            *strategy = used;
+        }
+        return YES;
+    }
+
+    // Nothing cheap worked, so we have to do it the hard way
+    NSError *innerError = nil;
+    BOOL success = NO;
+    if (nil != contentHash) {
+        success = [self copyItemAtURL:srcURL
+                                toURL:dstURL
+                          contentHash:contentHash
+                                error:&innerError];
+    } else {
+        success = [self copyItemAtURL:srcURL
+                                toURL:dstURL
+                                error:&innerError];
+    }
+    if (nil != innerError) {
+        NSAssert(NO == success, @"Got error and success copying");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(NO != success, @"Got no error and no success copying");
+
+    if (0 != (options & FileTransferOptionsAllowMove)) {
+        // We were asked to consume the source, so finish the job the rename couldn't
+        success = [self removeItemAtURL:srcURL
+                                  error:&innerError];
+        if (NO == success) {
+            NSLog(@"Failed to remove %@ after copying: %@", srcURL, innerError.localizedDescription);
+        }
+    }
+
+    if (nil != strategy) {
+        *strategy = FileTransferStrategyStreamedCopy;
+    }
+    return YES;
+}
+
+@end
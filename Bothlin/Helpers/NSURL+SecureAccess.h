@@ -11,8 +11,21 @@ NS_ASSUME_NONNULL_BEGIN
 
 @interface NSURL (SecureAccess)
 
+// Access to a URL is reference counted across the app, so the security scope is only started by
+// the first user and stopped by the last, however much the calls overlap.
 - (void)secureAccessWithBlock:(void (^)(NSURL *url, BOOL canAccess))block;
 
+// For batch work that touches the same URL many times: holds the scope open between the two calls,
+// so that each secureAccessWithBlock: in between costs nothing. Every call to begin that returns
+// YES must be matched by a call to end.
+- (BOOL)beginSecureAccess;
+- (void)endSecureAccess;
+
+// The same for a batch of URLs. Returns the ones that could be opened, which is what should be
+// passed to end.
++ (NSArray<NSURL *> *)beginSecureAccessToURLs:(NSArray<NSURL *> *)urls;
++ (void)endSecureAccessToURLs:(NSArray<NSURL *> *)urls;
+
 @end
 
 NS_ASSUME_NONNULL_END
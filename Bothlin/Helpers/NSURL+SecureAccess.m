@@ -7,17 +7,109 @@
 
 #import "NSURL+SecureAccess.h"
 
+// The URL that was actually started is kept, as the scope belongs to that instance rather than to
+// any URL that happens to be equal to it.
+@interface SecureAccessEntry : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *url;
+@property (nonatomic, readwrite) NSUInteger count;
+
+@end
+
+@implementation SecureAccessEntry
+
+- (instancetype)initWithURL:(NSURL *)url {
+    self = [super init];
+    if (nil != self) {
+        self->_url = url;
+        self->_count = 1;
+    }
+    return self;
+}
+
+@end
+
 @implementation NSURL (SecureAccess)
 
+// Only access on the queue returned by secureAccessSyncQ
++ (NSMutableDictionary<NSURL *, SecureAccessEntry *> *)secureAccessEntries {
+    static NSMutableDictionary<NSURL *, SecureAccessEntry *> *entries = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        entries = [NSMutableDictionary dictionary];
+    });
+    return entries;
+}
+
++ (dispatch_queue_t)secureAccessSyncQ {
+    static dispatch_queue_t syncQ = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        syncQ = dispatch_queue_create("com.digitalflapjack.SecureAccess.syncQ", DISPATCH_QUEUE_SERIAL);
+    });
+    return syncQ;
+}
+
+- (BOOL)beginSecureAccess {
+    __block BOOL canAccess = NO;
+    dispatch_sync([NSURL secureAccessSyncQ], ^{
+        NSMutableDictionary<NSURL *, SecureAccessEntry *> *entries = [NSURL secureAccessEntries];
+        SecureAccessEntry *entry = entries[self];
+        if (nil != entry) {
+            entry.count += 1;
+            canAccess = YES;
+            return;
+        }
+        canAccess = [self startAccessingSecurityScopedResource];
+        if (NO != canAccess) {
+            entries[self] = [[SecureAccessEntry alloc] initWithURL:self];
+        }
+    });
+    return canAccess;
+}
+
+- (void)endSecureAccess {
+    dispatch_sync([NSURL secureAccessSyncQ], ^{
+        NSMutableDictionary<NSURL *, SecureAccessEntry *> *entries = [NSURL secureAccessEntries];
+        SecureAccessEntry *entry = entries[self];
+        NSAssert(nil != entry, @"Ended secure access to %@ without beginning it", self);
+        if (nil == entry) {
+            return;
+        }
+        entry.count -= 1;
+        if (0 == entry.count) {
+            [entry.url stopAccessingSecurityScopedResource];
+            [entries removeObjectForKey:self];
+        }
+    });
+}
+
++ (NSArray<NSURL *> *)beginSecureAccessToURLs:(NSArray<NSURL *> *)urls {
+    NSParameterAssert(nil != urls);
+    NSMutableArray<NSURL *> *opened = [NSMutableArray arrayWithCapacity:[urls count]];
+    for (NSURL *url in urls) {
+        if (NO != [url beginSecureAccess]) {
+            [opened addObject:url];
+        }
+    }
+    return [NSArray arrayWithArray:opened];
+}
+
++ (void)endSecureAccessToURLs:(NSArray<NSURL *> *)urls {
+    NSParameterAssert(nil != urls);
+    for (NSURL *url in urls) {
+        [url endSecureAccess];
+    }
+}
 
 - (void)secureAccessWithBlock:(void (^)(NSURL *url, BOOL canAccess))block {
     if (nil == block) {
         return;
     }
-    BOOL canAccess = [self startAccessingSecurityScopedResource];
+    BOOL canAccess = [self beginSecureAccess];
     block(self, canAccess);
     if (NO != canAccess) {
-        [self stopAccessingSecurityScopedResource];
+        [self endSecureAccess];
     }
 }
 
@@ -0,0 +1,61 @@
+//
+//  PerformanceMetrics.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 16/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <os/signpost.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// The stages we time. Each shows up as a signpost interval under Points of Interest in Instruments,
+// and is also totted up for the summary below.
+typedef NS_ENUM(NSInteger, MetricsInterval) {
+    MetricsIntervalImportEnumerate,
+    MetricsIntervalImportCopy,
+    MetricsIntervalImportCommit,
+    MetricsIntervalFetch,
+    MetricsIntervalSave,
+    MetricsIntervalThumbnail,
+    MetricsIntervalThumbnailLoad,
+    MetricsIntervalScanText,
+};
+
+typedef struct {
+    MetricsInterval interval;
+    os_signpost_id_t signpostID;
+    uint64_t start;
+} MetricsIntervalToken;
+
+// Start and end an interval. The token is a plain struct, so can be captured by a block if the
+// interval ends on another queue.
+MetricsIntervalToken metrics_interval_begin(MetricsInterval interval);
+void metrics_interval_end(MetricsIntervalToken token);
+
+// Drop in replacements for dispatch_sync and dispatch_async that record, against the queue's label,
+// how long the block waited to get on the queue and how long it then ran for. On a serial queue a
+// wait much longer than the run time means the queue is contended.
+void metrics_dispatch_sync(dispatch_queue_t queue, DISPATCH_NOESCAPE dispatch_block_t block);
+void metrics_dispatch_async(dispatch_queue_t queue, dispatch_block_t block);
+
+@interface PerformanceMetrics : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+// Counts, totals, and maximums in seconds for every queue and interval seen since launch or the last
+// reset, suitable for writing out as JSON.
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *> *)summary;
+
+// The same as a table for people to read, busiest first.
++ (NSString *)summaryReport;
+
++ (BOOL)exportSummaryToURL:(NSURL *)url
+                     error:(NSError **)error;
+
++ (void)reset;
+
+@end
+
+NS_ASSUME_NONNULL_END
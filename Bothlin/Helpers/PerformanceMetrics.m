@@ -0,0 +1,325 @@
+//
+//  PerformanceMetrics.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 16/12/2023.
+//
+
+#import <os/lock.h>
+#import <os/log.h>
+#import <stdlib.h>
+#import <string.h>
+#import <time.h>
+
+#import "PerformanceMetrics.h"
+
+// We have a handful of queues per coordinator, and labels are fixed, so a small table searched
+// in order is cheaper than hashing a string on every dispatch.
+#define kMetricsMaximumQueues 64
+
+#define kMetricsIntervalCount (MetricsIntervalScanText + 1)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} MetricsStat;
+
+typedef struct {
+    char *label;
+    MetricsStat wait;
+    MetricsStat run;
+} MetricsQueueStat;
+
+static os_unfair_lock metricsLock = OS_UNFAIR_LOCK_INIT;
+static MetricsQueueStat queueStats[kMetricsMaximumQueues];
+static NSUInteger queueStatCount = 0;
+static MetricsStat intervalStats[kMetricsIntervalCount];
+
+static os_log_t metrics_log(void) {
+    static os_log_t log = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        log = os_log_create("com.digitalflapjack.Bothlin", OS_LOG_CATEGORY_POINTS_OF_INTEREST);
+    });
+    return log;
+}
+
+static uint64_t metrics_now(void) {
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+static void metrics_stat_add(MetricsStat *stat, uint64_t value) {
+    stat->count += 1;
+    stat->total += value;
+    if (value > stat->max) {
+        stat->max = value;
+    }
+}
+
+static void metrics_record_queue(const char *label, uint64_t wait, uint64_t run) {
+    os_unfair_lock_lock(&metricsLock);
+    MetricsQueueStat *entry = NULL;
+    for (NSUInteger index = 0; index < queueStatCount; index++) {
+        if (0 == strcmp(queueStats[index].label, label)) {
+            entry = &queueStats[index];
+            break;
+        }
+    }
+    if ((NULL == entry) && (queueStatCount < kMetricsMaximumQueues)) {
+        entry = &queueStats[queueStatCount];
+        entry->label = strdup(label);
+        queueStatCount += 1;
+    }
+    if (NULL != entry) {
+        metrics_stat_add(&entry->wait, wait);
+        metrics_stat_add(&entry->run, run);
+    }
+    os_unfair_lock_unlock(&metricsLock);
+}
+
+static NSString *metrics_interval_name(MetricsInterval interval) {
+    switch (interval) {
+        case MetricsIntervalImportEnumerate:
+            return @"Import enumerate";
+        case MetricsIntervalImportCopy:
+            return @"Import copy";
+        case MetricsIntervalImportCommit:
+            return @"Import commit";
+        case MetricsIntervalFetch:
+            return @"Fetch";
+        case MetricsIntervalSave:
+            return @"Save";
+        case MetricsIntervalThumbnail:
+            return @"Thumbnail";
+        case MetricsIntervalThumbnailLoad:
+            return @"Thumbnail load";
+        case MetricsIntervalScanText:
+            return @"Scan text";
+    }
+    return @"Unknown";
+}
+
+// Signpost names have to be string literals, hence the switches rather than using the names above.
+MetricsIntervalToken metrics_interval_begin(MetricsInterval interval) {
+    NSCParameterAssert((interval >= 0) && (interval < kMetricsIntervalCount));
+    os_log_t log = metrics_log();
+    os_signpost_id_t signpostID = os_signpost_id_generate(log);
+    switch (interval) {
+        case MetricsIntervalImportEnumerate:
+            os_signpost_interval_begin(log, signpostID, "Import enumerate");
+            break;
+        case MetricsIntervalImportCopy:
+            os_signpost_interval_begin(log, signpostID, "Import copy");
+            break;
+        case MetricsIntervalImportCommit:
+            os_signpost_interval_begin(log, signpostID, "Import commit");
+            break;
+        case MetricsIntervalFetch:
+            os_signpost_interval_begin(log, signpostID, "Fetch");
+            break;
+        case MetricsIntervalSave:
+            os_signpost_interval_begin(log, signpostID, "Save");
+            break;
+        case MetricsIntervalThumbnail:
+            os_signpost_interval_begin(log, signpostID, "Thumbnail");
+            break;
+        case MetricsIntervalThumbnailLoad:
+            os_signpost_interval_begin(log, signpostID, "Thumbnail load");
+            break;
+        case MetricsIntervalScanText:
+            os_signpost_interval_begin(log, signpostID, "Scan text");
+            break;
+    }
+    return (MetricsIntervalToken){
+        .interval = interval,
+        .signpostID = signpostID,
+        .start = metrics_now(),
+    };
+}
+
+void metrics_interval_end(MetricsIntervalToken token) {
+    uint64_t duration = metrics_now() - token.start;
+    os_log_t log = metrics_log();
+    switch (token.interval) {
+        case MetricsIntervalImportEnumerate:
+            os_signpost_interval_end(log, token.signpostID, "Import enumerate");
+            break;
+        case MetricsIntervalImportCopy:
+            os_signpost_interval_end(log, token.signpostID, "Import copy");
+            break;
+        case MetricsIntervalImportCommit:
+            os_signpost_interval_end(log, token.signpostID, "Import commit");
+            break;
+        case MetricsIntervalFetch:
+            os_signpost_interval_end(log, token.signpostID, "Fetch");
+            break;
+        case MetricsIntervalSave:
+            os_signpost_interval_end(log, token.signpostID, "Save");
+            break;
+        case MetricsIntervalThumbnail:
+            os_signpost_interval_end(log, token.signpostID, "Thumbnail");
+            break;
+        case MetricsIntervalThumbnailLoad:
+            os_signpost_interval_end(log, token.signpostID, "Thumbnail load");
+            break;
+        case MetricsIntervalScanText:
+            os_signpost_interval_end(log, token.signpostID, "Scan text");
+            break;
+    }
+
+    os_unfair_lock_lock(&metricsLock);
+    metrics_stat_add(&intervalStats[token.interval], duration);
+    os_unfair_lock_unlock(&metricsLock);
+}
+
+static const char *metrics_queue_label(dispatch_queue_t queue) {
+    const char *label = dispatch_queue_get_label(queue);
+    if ((NULL == label) || ('\0' == label[0])) {
+        return "(unlabelled)";
+    }
+    return label;
+}
+
+void metrics_dispatch_sync(dispatch_queue_t queue, DISPATCH_NOESCAPE dispatch_block_t block) {
+    const char *label = metrics_queue_label(queue);
+    uint64_t enqueued = metrics_now();
+    dispatch_sync(queue, ^{
+        uint64_t started = metrics_now();
+        block();
+        metrics_record_queue(label, started - enqueued, metrics_now() - started);
+    });
+}
+
+void metrics_dispatch_async(dispatch_queue_t queue, dispatch_block_t block) {
+    const char *label = metrics_queue_label(queue);
+    uint64_t enqueued = metrics_now();
+    dispatch_async(queue, ^{
+        uint64_t started = metrics_now();
+        block();
+        metrics_record_queue(label, started - enqueued, metrics_now() - started);
+    });
+}
+
+static NSDictionary<NSString *, NSNumber *> *metrics_stat_dictionary(MetricsStat stat, NSString *prefix) {
+    NSString *(^key)(NSString *) = ^NSString *(NSString *name) {
+        if (nil == prefix) {
+            return name;
+        }
+        return [prefix stringByAppendingString:[name capitalizedString]];
+    };
+    return @{
+        key(@"total"): @((double)stat.total / NSEC_PER_SEC),
+        key(@"max"): @((double)stat.max / NSEC_PER_SEC),
+    };
+}
+
+@implementation PerformanceMetrics
+
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *> *)summary {
+    os_unfair_lock_lock(&metricsLock);
+    NSUInteger count = queueStatCount;
+    MetricsQueueStat queues[kMetricsMaximumQueues];
+    memcpy(queues, queueStats, sizeof(MetricsQueueStat) * count);
+    MetricsStat intervals[kMetricsIntervalCount];
+    memcpy(intervals, intervalStats, sizeof(intervalStats));
+    os_unfair_lock_unlock(&metricsLock);
+
+    // Labels are never freed once added, so are still good to read outside the lock
+    NSMutableDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *queueSummary = [NSMutableDictionary dictionaryWithCapacity:count];
+    for (NSUInteger index = 0; index < count; index++) {
+        NSMutableDictionary<NSString *, NSNumber *> *entry = [NSMutableDictionary dictionaryWithObject:@(queues[index].run.count)
+                                                                                                forKey:@"count"];
+        [entry addEntriesFromDictionary:metrics_stat_dictionary(queues[index].wait, @"wait")];
+        [entry addEntriesFromDictionary:metrics_stat_dictionary(queues[index].run, @"run")];
+        queueSummary[[NSString stringWithUTF8String:queues[index].label]] = [NSDictionary dictionaryWithDictionary:entry];
+    }
+
+    NSMutableDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *intervalSummary = [NSMutableDictionary dictionaryWithCapacity:kMetricsIntervalCount];
+    for (NSInteger interval = 0; interval < kMetricsIntervalCount; interval++) {
+        if (0 == intervals[interval].count) {
+            continue;
+        }
+        NSMutableDictionary<NSString *, NSNumber *> *entry = [NSMutableDictionary dictionaryWithObject:@(intervals[interval].count)
+                                                                                                forKey:@"count"];
+        [entry addEntriesFromDictionary:metrics_stat_dictionary(intervals[interval], nil)];
+        intervalSummary[metrics_interval_name((MetricsInterval)interval)] = [NSDictionary dictionaryWithDictionary:entry];
+    }
+
+    return @{
+        @"queues": [NSDictionary dictionaryWithDictionary:queueSummary],
+        @"intervals": [NSDictionary dictionaryWithDictionary:intervalSummary],
+    };
+}
+
++ (NSString *)summaryReport {
+    NSDictionary<NSString *, NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *> *summary = [PerformanceMetrics summary];
+    NSMutableString *report = [NSMutableString string];
+
+    // Width doesn't apply to %@, so the columns are formatted as C strings
+    [report appendFormat:@"%-56s %10s %10s %10s %10s %10s\n", "Queue", "Blocks", "Wait", "Max wait", "Run", "Max run"];
+    NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *queues = summary[@"queues"];
+    NSArray<NSString *> *queueLabels = [queues keysSortedByValueUsingComparator:^NSComparisonResult(NSDictionary *a, NSDictionary *b) {
+        return [b[@"waitTotal"] compare:a[@"waitTotal"]];
+    }];
+    for (NSString *label in queueLabels) {
+        NSDictionary<NSString *, NSNumber *> *entry = queues[label];
+        [report appendFormat:@"%-56s %10lu %9.3fs %9.3fs %9.3fs %9.3fs\n",
+         [label UTF8String],
+         [entry[@"count"] unsignedLongValue],
+         [entry[@"waitTotal"] doubleValue],
+         [entry[@"waitMax"] doubleValue],
+         [entry[@"runTotal"] doubleValue],
+         [entry[@"runMax"] doubleValue]];
+    }
+
+    [report appendFormat:@"\n%-56s %10s %10s %10s\n", "Interval", "Count", "Total", "Max"];
+    NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *intervals = summary[@"intervals"];
+    NSArray<NSString *> *intervalNames = [intervals keysSortedByValueUsingComparator:^NSComparisonResult(NSDictionary *a, NSDictionary *b) {
+        return [b[@"total"] compare:a[@"total"]];
+    }];
+    for (NSString *name in intervalNames) {
+        NSDictionary<NSString *, NSNumber *> *entry = intervals[name];
+        [report appendFormat:@"%-56s %10lu %9.3fs %9.3fs\n",
+         [name UTF8String],
+         [entry[@"count"] unsignedLongValue],
+         [entry[@"total"] doubleValue],
+         [entry[@"max"] doubleValue]];
+    }
+
+    return [NSString stringWithString:report];
+}
+
++ (BOOL)exportSummaryToURL:(NSURL *)url
+                     error:(NSError **)error {
+    NSParameterAssert(nil != url);
+
+    NSError *innerError = nil;
+    NSData *data = [NSJSONSerialization dataWithJSONObject:[PerformanceMetrics summary]
+                                                   options:NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys
+                                                     error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == data, @"Got error and data");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != data, @"Got no error and no data");
+
+    return [data writeToURL:url
+                    options:NSDataWritingAtomic
+                      error:error];
+}
+
++ (void)reset {
+    os_unfair_lock_lock(&metricsLock);
+    for (NSUInteger index = 0; index < queueStatCount; index++) {
+        queueStats[index].wait = (MetricsStat){0, 0, 0};
+        queueStats[index].run = (MetricsStat){0, 0, 0};
+    }
+    memset(intervalStats, 0, sizeof(intervalStats));
+    os_unfair_lock_unlock(&metricsLock);
+}
+
+@end
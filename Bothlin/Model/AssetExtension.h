@@ -9,6 +9,21 @@
 
 @interface Asset (Helpers)
 
+// Resolved URLs are cached by asset, so this is cheap after the first call. A stale bookmark is
+// refreshed in the cache but left as is on the asset, so this is safe on a read only context.
 - (NSURL* _Nullable)decodeSecureURL:(NSError * _Nullable * _Nullable)error;
 
+// As above, but if the bookmark was stale also hands back the refreshed bookmark, for the caller
+// to store on the asset as part of a change of its own. The asset itself is left untouched.
+- (NSURL* _Nullable)decodeSecureURLRefreshingBookmark:(NSData * _Nullable * _Nullable)refreshedBookmark
+                                                error:(NSError * _Nullable * _Nullable)error;
+
+// Assets whose text has never been scanned. An empty string means it was scanned and nothing was
+// found, or that it couldn't be read as an image, so only nil counts as waiting.
++ (NSPredicate * _Nonnull)awaitingTextScanPredicate;
+
+// The directory in storage that holds everything for this asset, which is named by its UUID, other
+// than for snaps imported before they were given one, where it's the snap's bundle.
+- (NSURL* _Nonnull)itemDirectory;
+
 @end
@@ -8,37 +8,42 @@
 #import "AssetExtension.h"
 #import "AppDelegate.h"
 #import "NSURL+SecureAccess.h"
+#import "SecureURLCache.h"
 
 @implementation Asset (Helpers)
 
 - (NSURL*)decodeSecureURL:(NSError**)error {
-    BOOL isStale = NO;
-    NSError *innerError = nil;
-    NSURL *decoded = [NSURL URLByResolvingBookmarkData:self.bookmark
-                                               options:NSURLBookmarkResolutionWithSecurityScope
-                                         relativeToURL:nil
-                                   bookmarkDataIsStale:&isStale
-                                                 error:&innerError];
-    if (nil != innerError) {
-        NSAssert(nil == decoded, @"Got error decoding secure URL and a result");
-        if (nil != error) {
-            *error = innerError;
-        }
-        return nil;
+    return [[SecureURLCache sharedCache] URLForAssetID:self.objectID
+                                              bookmark:self.bookmark
+                                     refreshedBookmark:nil
+                                                 error:error];
+}
+
+- (NSURL*)decodeSecureURLRefreshingBookmark:(NSData**)refreshedBookmark
+                                      error:(NSError**)error {
+    return [[SecureURLCache sharedCache] URLForAssetID:self.objectID
+                                              bookmark:self.bookmark
+                                     refreshedBookmark:refreshedBookmark
+                                                 error:error];
+}
+
++ (NSPredicate*)awaitingTextScanPredicate {
+    return [NSPredicate predicateWithFormat:@"scannedText == nil"];
+}
+
+- (NSURL*)itemDirectory {
+    NSURL *parent = [self.path URLByDeletingLastPathComponent];
+    if (NO == [[parent pathExtension] isEqualToString:@"embersnap"]) {
+        // Going from UUID/original/filename.blah to just UUID/
+        return [parent URLByDeletingLastPathComponent];
     }
-    NSAssert(nil != decoded, @"Got no error and no result");
-    if (NO != isStale) {
-        if (nil != error) {
-            *error = [NSError errorWithDomain:NSPOSIXErrorDomain
-                                         code:ESTALE
-                                     userInfo:@{
-                @"ID": self.objectID,
-                @"Path": decoded
-            }];
-        }
-        return nil;
+    // Snaps are now stored as UUID/original/name.embersnap/image.blah, but older libraries have
+    // the bundle straight in storage, in which case the bundle is all there is.
+    NSURL *rawItemDirectory = [parent URLByDeletingLastPathComponent];
+    if ([[rawItemDirectory lastPathComponent] isEqualToString:@"original"]) {
+        return [rawItemDirectory URLByDeletingLastPathComponent];
     }
-    return decoded;
+    return parent;
 }
 
 @end
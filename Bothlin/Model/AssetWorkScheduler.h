@@ -0,0 +1,46 @@
+//
+//  AssetWorkScheduler.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 04/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSInteger, AssetWorkPriority) {
+    AssetWorkPriorityBackground = 0, // Backfill, e.g., after an import
+    AssetWorkPriorityVisible = 1, // The user is looking at it right now
+};
+
+// Called with a batch of assets to process. The handler must call itemCompleted exactly once for
+// each asset in the batch, from any queue, when it has finished with it, as that is what frees up
+// space for more work.
+typedef void (^AssetWorkBatchHandler)(NSArray<NSManagedObjectID *> *assetIDs, void (^itemCompleted)(NSManagedObjectID *assetID));
+
+// Feeds per-asset work to a handler in batches, with a cap on how many assets can be in progress
+// at once. Requests for an asset that is already pending or in progress are coalesced, and
+// visible work always goes ahead of background work.
+@interface AssetWorkScheduler : NSObject
+
+// Can be changed at any time, and takes effect as work completes.
+@property (atomic, readwrite) NSUInteger maximumConcurrency;
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithName:(NSString *)name
+          maximumConcurrency:(NSUInteger)maximumConcurrency
+                   batchSize:(NSUInteger)batchSize
+                 targetQueue:(dispatch_queue_t)targetQueue
+                batchHandler:(AssetWorkBatchHandler)batchHandler;
+
+- (void)scheduleAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+              priority:(AssetWorkPriority)priority;
+
+// The number of assets waiting or in progress.
+- (NSUInteger)outstandingCount;
+
+@end
+
+NS_ASSUME_NONNULL_END
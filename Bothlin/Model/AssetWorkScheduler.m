@@ -0,0 +1,150 @@
+//
+//  AssetWorkScheduler.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 04/12/2023.
+//
+
+#import "AssetWorkScheduler.h"
+
+#import "Helpers.h"
+
+@interface AssetWorkScheduler ()
+
+@property (nonatomic, readonly) NSUInteger batchSize;
+@property (nonatomic, copy, readonly) AssetWorkBatchHandler batchHandler;
+@property (nonatomic, strong, readonly) dispatch_queue_t workQ;
+
+// Only access on syncQ
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readonly) NSMutableOrderedSet<NSManagedObjectID *> *visiblePending;
+@property (nonatomic, strong, readonly) NSMutableOrderedSet<NSManagedObjectID *> *backgroundPending;
+@property (nonatomic, strong, readonly) NSMutableSet<NSManagedObjectID *> *inFlight;
+
+@end
+
+@implementation AssetWorkScheduler
+
+- (instancetype)initWithName:(NSString *)name
+          maximumConcurrency:(NSUInteger)maximumConcurrency
+                   batchSize:(NSUInteger)batchSize
+                 targetQueue:(dispatch_queue_t)targetQueue
+                batchHandler:(AssetWorkBatchHandler)batchHandler {
+    NSParameterAssert(nil != name);
+    NSParameterAssert(0 < maximumConcurrency);
+    NSParameterAssert(0 < batchSize);
+    NSParameterAssert(nil != targetQueue);
+    NSParameterAssert(nil != batchHandler);
+
+    self = [super init];
+    if (nil != self) {
+        self->_maximumConcurrency = maximumConcurrency;
+        self->_batchSize = batchSize;
+        self->_batchHandler = batchHandler;
+
+        NSString *syncLabel = [NSString stringWithFormat:@"com.digitalflapjack.AssetWorkScheduler.%@.syncQ", name];
+        self->_syncQ = dispatch_queue_create([syncLabel UTF8String], DISPATCH_QUEUE_SERIAL);
+        NSString *workLabel = [NSString stringWithFormat:@"com.digitalflapjack.AssetWorkScheduler.%@.workQ", name];
+        self->_workQ = dispatch_queue_create([workLabel UTF8String], DISPATCH_QUEUE_CONCURRENT);
+        dispatch_set_target_queue(self->_workQ, targetQueue);
+
+        self->_visiblePending = [NSMutableOrderedSet orderedSet];
+        self->_backgroundPending = [NSMutableOrderedSet orderedSet];
+        self->_inFlight = [NSMutableSet set];
+    }
+    return self;
+}
+
+- (void)scheduleAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+              priority:(AssetWorkPriority)priority {
+    NSParameterAssert(nil != assetIDs);
+    if (0 == [assetIDs count]) {
+        return;
+    }
+
+    dispatch_async(self.syncQ, ^{
+        for (NSManagedObjectID *assetID in assetIDs) {
+            if ([self.inFlight containsObject:assetID]) {
+                continue;
+            }
+            switch (priority) {
+                case AssetWorkPriorityVisible:
+                    // Promote it if it was waiting in the background
+                    [self.backgroundPending removeObject:assetID];
+                    [self.visiblePending addObject:assetID];
+                    break;
+                case AssetWorkPriorityBackground:
+                    if (NO == [self.visiblePending containsObject:assetID]) {
+                        [self.backgroundPending addObject:assetID];
+                    }
+                    break;
+            }
+        }
+        [self pump];
+    });
+}
+
+- (NSUInteger)outstandingCount {
+    dispatch_assert_queue_not(self.syncQ);
+    __block NSUInteger count = 0;
+    dispatch_sync(self.syncQ, ^{
+        count = [self.visiblePending count] + [self.backgroundPending count] + [self.inFlight count];
+    });
+    return count;
+}
+
+
+#pragma mark - internal
+
+- (void)pump {
+    dispatch_assert_queue(self.syncQ);
+
+    while (YES) {
+        NSUInteger pendingCount = [self.visiblePending count] + [self.backgroundPending count];
+        if (0 == pendingCount) {
+            return;
+        }
+        NSUInteger maximumConcurrency = self.maximumConcurrency;
+        NSUInteger freeSlots = maximumConcurrency > [self.inFlight count] ? maximumConcurrency - [self.inFlight count] : 0;
+
+        // Wait until we can send a reasonable sized batch, rather than dribbling work out one
+        // item at a time, as each batch has a fixed cost for the handler. Newly visible work
+        // doesn't wait though, as the user is looking at it.
+        NSUInteger wanted = MIN(MIN(self.batchSize, maximumConcurrency), pendingCount);
+        if ((0 == freeSlots) || ((freeSlots < wanted) && (0 == [self.visiblePending count]))) {
+            return;
+        }
+
+        NSUInteger batchCount = MIN(wanted, freeSlots);
+        NSMutableArray<NSManagedObjectID *> *batch = [NSMutableArray arrayWithCapacity:batchCount];
+        for (NSMutableOrderedSet<NSManagedObjectID *> *pending in @[self.visiblePending, self.backgroundPending]) {
+            NSUInteger take = MIN(batchCount - [batch count], [pending count]);
+            if (0 == take) {
+                continue;
+            }
+            NSRange range = NSMakeRange(0, take);
+            [batch addObjectsFromArray:[pending objectsAtIndexes:[NSIndexSet indexSetWithIndexesInRange:range]]];
+            [pending removeObjectsInRange:range];
+        }
+        [self.inFlight addObjectsFromArray:batch];
+
+        @weakify(self);
+        void (^itemCompleted)(NSManagedObjectID *) = ^(NSManagedObjectID *assetID) {
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            dispatch_async(self.syncQ, ^{
+                [self.inFlight removeObject:assetID];
+                [self pump];
+            });
+        };
+        AssetWorkBatchHandler batchHandler = self.batchHandler;
+        NSArray<NSManagedObjectID *> *work = [NSArray arrayWithArray:batch];
+        dispatch_async(self.workQ, ^{
+            batchHandler(work, itemCompleted);
+        });
+    }
+}
+
+@end
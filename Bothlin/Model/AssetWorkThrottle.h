@@ -0,0 +1,40 @@
+//
+//  AssetWorkThrottle.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 08/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AssetWorkScheduler;
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Periodically adjusts how much work an AssetWorkScheduler has in flight based on how busy the
+// machine is. It creeps the concurrency up whilst there's spare capacity, and backs off quickly
+// when the load average climbs past the number of cores, the machine gets hot, or low power mode
+// is on, so that heavy background work like OCR can use an idle machine without making a busy one
+// unusable.
+@interface AssetWorkThrottle : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithScheduler:(AssetWorkScheduler *)scheduler
+               minimumConcurrency:(NSUInteger)minimumConcurrency
+               maximumConcurrency:(NSUInteger)maximumConcurrency
+                         interval:(NSTimeInterval)interval;
+
+- (void)start;
+- (void)stop;
+
+// The decision made on each tick, split out so it can be tested without a real machine load.
++ (NSUInteger)concurrencyAfter:(NSUInteger)current
+                   loadPerCore:(double)loadPerCore
+                  thermalState:(NSProcessInfoThermalState)thermalState
+                  lowPowerMode:(BOOL)lowPowerMode
+                       minimum:(NSUInteger)minimum
+                       maximum:(NSUInteger)maximum;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,141 @@
+//
+//  AssetWorkThrottle.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 08/12/2023.
+//
+
+#import <stdlib.h>
+
+#import "AssetWorkThrottle.h"
+#import "AssetWorkScheduler.h"
+#import "Helpers.h"
+
+// Below this we assume there's room for more, above the upper one we back off. The gap stops us
+// flapping when the load sits close to a single threshold.
+static const double kAssetWorkThrottleLowLoad = 0.6;
+static const double kAssetWorkThrottleHighLoad = 1.0;
+
+@interface AssetWorkThrottle ()
+
+@property (nonatomic, weak, readonly) AssetWorkScheduler *scheduler;
+@property (nonatomic, readonly) NSUInteger minimumConcurrency;
+@property (nonatomic, readonly) NSUInteger maximumConcurrency;
+@property (nonatomic, readonly) NSTimeInterval interval;
+
+// Only access on syncQ
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readwrite, nullable) dispatch_source_t timer;
+
+@end
+
+@implementation AssetWorkThrottle
+
+- (instancetype)initWithScheduler:(AssetWorkScheduler *)scheduler
+               minimumConcurrency:(NSUInteger)minimumConcurrency
+               maximumConcurrency:(NSUInteger)maximumConcurrency
+                         interval:(NSTimeInterval)interval {
+    NSParameterAssert(nil != scheduler);
+    NSParameterAssert(0 < minimumConcurrency);
+    NSParameterAssert(minimumConcurrency <= maximumConcurrency);
+    NSParameterAssert(0.0 < interval);
+
+    self = [super init];
+    if (nil != self) {
+        self->_scheduler = scheduler;
+        self->_minimumConcurrency = minimumConcurrency;
+        self->_maximumConcurrency = maximumConcurrency;
+        self->_interval = interval;
+        self->_syncQ = dispatch_queue_create("com.digitalflapjack.AssetWorkThrottle.syncQ", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_syncQ, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (nil != self->_timer) {
+        dispatch_source_cancel(self->_timer);
+    }
+}
+
+- (void)start {
+    dispatch_sync(self.syncQ, ^{
+        if (nil != self.timer) {
+            return;
+        }
+        dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.syncQ);
+        uint64_t interval = (uint64_t)(self.interval * NSEC_PER_SEC);
+        dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 4);
+        @weakify(self);
+        dispatch_source_set_event_handler(timer, ^{
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            [self tick];
+        });
+        self.timer = timer;
+        dispatch_resume(timer);
+    });
+}
+
+- (void)stop {
+    dispatch_sync(self.syncQ, ^{
+        if (nil == self.timer) {
+            return;
+        }
+        dispatch_source_cancel(self.timer);
+        self.timer = nil;
+    });
+}
+
++ (NSUInteger)concurrencyAfter:(NSUInteger)current
+                   loadPerCore:(double)loadPerCore
+                  thermalState:(NSProcessInfoThermalState)thermalState
+                  lowPowerMode:(BOOL)lowPowerMode
+                       minimum:(NSUInteger)minimum
+                       maximum:(NSUInteger)maximum {
+    NSParameterAssert(minimum <= maximum);
+
+    NSUInteger next = current;
+    if ((NSProcessInfoThermalStateCritical == thermalState) || lowPowerMode) {
+        next = minimum;
+    } else if ((NSProcessInfoThermalStateSerious == thermalState) || (loadPerCore > kAssetWorkThrottleHighLoad)) {
+        next = current / 2;
+    } else if ((NSProcessInfoThermalStateNominal == thermalState) && (loadPerCore < kAssetWorkThrottleLowLoad)) {
+        next = current + 1;
+    }
+    return MIN(MAX(next, minimum), maximum);
+}
+
+
+#pragma mark - internal
+
+- (void)tick {
+    dispatch_assert_queue(self.syncQ);
+
+    AssetWorkScheduler *scheduler = self.scheduler;
+    if (nil == scheduler) {
+        return;
+    }
+
+    double loadAverage[1] = {0.0};
+    if (1 != getloadavg(loadAverage, 1)) {
+        return;
+    }
+    NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+    double loadPerCore = loadAverage[0] / (double)MAX([processInfo activeProcessorCount], (NSUInteger)1);
+
+    NSUInteger current = scheduler.maximumConcurrency;
+    NSUInteger next = [AssetWorkThrottle concurrencyAfter:current
+                                              loadPerCore:loadPerCore
+                                             thermalState:[processInfo thermalState]
+                                             lowPowerMode:[processInfo isLowPowerModeEnabled]
+                                                  minimum:self.minimumConcurrency
+                                                  maximum:self.maximumConcurrency];
+    if (next != current) {
+        scheduler.maximumConcurrency = next;
+    }
+}
+
+@end
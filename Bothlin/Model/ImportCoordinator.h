@@ -7,13 +7,40 @@
 
 #import <Cocoa/Cocoa.h>
 #import "ModelCoordinatorDelegate.h"
+#import "NSFileManager+ContentHash.h"
+#import "ImportJob.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
+// What to do when an imported file has the same contents as an asset already in the library.
+typedef NS_ENUM(NSInteger, ImportCoordinatorDuplicatePolicy) {
+    ImportCoordinatorDuplicatePolicyLink = 0, // Use the existing asset, adding it to the target group if there is one
+    ImportCoordinatorDuplicatePolicySkip = 1, // Ignore the file entirely
+};
+
+// How files get into the storage directory. In all cases we try an APFS clone before doing a
+// full copy, as that's near free on the same volume and leaves the source untouched.
+typedef NS_ENUM(NSInteger, ImportCoordinatorTransferMode) {
+    ImportCoordinatorTransferModeCopy = 0, // Clone, else copy
+    ImportCoordinatorTransferModeLink = 1, // Clone, else hard link, else copy
+    ImportCoordinatorTransferModeMove = 2, // Move, else copy and remove the source
+};
+
 @interface ImportCoordinator : NSObject
 
 @property (nonatomic, weak, readwrite) id<ModelCoordinatorDelegate> delegate;
 
+// Defaults to ImportCoordinatorDuplicatePolicyLink. Either way duplicates are not kept in
+// storage and are not included in the assets passed to the import callback.
+@property (atomic, readwrite) ImportCoordinatorDuplicatePolicy duplicatePolicy;
+
+// Defaults to ImportCoordinatorTransferModeCopy.
+@property (atomic, readwrite) ImportCoordinatorTransferMode transferMode;
+
+// If set, this is called for each file imported with how it was transferred into storage. It
+// is called on an internal worker queue, so must be thread safe.
+@property (atomic, copy, readwrite, nullable) void (^transferReportHandler)(NSURL *source, NSURL *destination, FileTransferStrategy strategy);
+
 - (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator * _Nonnull)store
                        storageDirectory:(NSURL *)storageDirectory;
 
@@ -21,9 +48,17 @@ NS_ASSUME_NONNULL_BEGIN
                        storageDirectory:(NSURL *)storageDirectory
                   delegateCallbackQueue:(dispatch_queue_t _Nonnull)delegateUpdateQueue;
 
-- (void)importURLs:(NSSet<NSURL *> *)urls
-           toGroup:(NSManagedObjectID * _Nullable)groupID
-          callback:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback;
+// Returns immediately with a job that can be used to track progress or cancel the import. If the
+// import fails or is cancelled, the callback is still given the assets that were imported before
+// it stopped. A cancelled import, or one cut short by the app quitting, can be continued later with
+// resumeInterruptedImports:, but one that failed can't, as it would most likely just fail again.
+- (ImportJob *)importURLs:(NSSet<NSURL *> *)urls
+                 toGroup:(NSManagedObjectID * _Nullable)groupID
+                callback:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback;
+
+// Restarts any imports that were cancelled or didn't finish last time, other than ones that
+// failed, skipping the files they had already imported. The callback is called once per job.
+- (NSArray<ImportJob *> *)resumeInterruptedImports:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback;
 
 + (NSSet<NSURL *> *)removeURLsForUnsupportedTypes:(NSSet<NSURL *> *)urls;
 
@@ -10,6 +10,9 @@
 #import "Asset+CoreDataClass.h"
 #import "Group+CoreDataClass.h"
 #import "Tag+CoreDataClass.h"
+#import "TagCache.h"
+#import "TagExtension.h"
+#import "AssetExtension.h"
 #import "NSURL+SecureAccess.h"
 #import "NSArray+Functional.h"
 #import "NSSet+Functional.h"
@@ -17,6 +20,7 @@
 #import "_EMBCommonSnapInfo.h"
 
 #import "Helpers.h"
+#import "PerformanceMetrics.h"
 
 NSErrorDomain __nonnull const ImportCoordinatorErrorDomain = @"com.digitalflapjack.ImportCoordinator";
 typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode) {
@@ -25,6 +29,127 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     ImportCoordinatorErrorNoMetadataForSnap,
 };
 
+// How many assets the writer stage inserts before it saves and resets the context. Big enough
+// that we're not saving constantly, small enough that the context never gets huge and the UI
+// sees progress as the import goes.
+static const NSUInteger kImportInsertBatchSize = 250;
+
+// Each import keeps a journal in the storage directory, so that if we crash or the user cancels we
+// can pick up where we left off. It's a directory per job, with a plist describing the import,
+// and a log of the source paths that have been committed to the store, one per line, which we
+// only ever append to.
+NSString * __nonnull const kImportJournalDirectoryName = @".import-journal";
+NSString * __nonnull const kImportJournalDescriptionName = @"job.plist";
+NSString * __nonnull const kImportJournalCompletedName = @"completed.log";
+NSString * __nonnull const kImportJournalSourcesKey = @"kImportJournalSourcesKey";
+NSString * __nonnull const kImportJournalGroupKey = @"kImportJournalGroupKey";
+NSString * __nonnull const kImportJournalDuplicatePolicyKey = @"kImportJournalDuplicatePolicyKey";
+NSString * __nonnull const kImportJournalTransferModeKey = @"kImportJournalTransferModeKey";
+
+
+// The output of the copy stage for a single item: everything the writer stage needs to
+// insert an Asset without having to go back to the filesystem.
+@interface ImportCoordinatorFileRecord : NSObject
+
+@property (nonatomic, strong, readwrite) NSURL *sourceURL;
+@property (nonatomic, readwrite) unsigned long long byteCount;
+@property (nonatomic, strong, readwrite) NSString *name;
+@property (nonatomic, strong, readwrite) NSURL *path;
+@property (nonatomic, strong, readwrite) NSData *bookmark;
+@property (nonatomic, strong, readwrite) NSString *type;
+@property (nonatomic, strong, readwrite) NSDate *created;
+@property (nonatomic, readwrite) BOOL favourite;
+@property (nonatomic, strong, readwrite, nullable) NSString *notes;
+@property (nonatomic, strong, readwrite, nullable) NSArray<NSString *> *tags;
+@property (nonatomic, strong, readwrite) NSString *contentHash;
+@property (nonatomic, readwrite) FileTransferStrategy transferStrategy;
+// The directory we created in storage for this item, which is what we remove if it turns out
+// to be a duplicate.
+@property (nonatomic, strong, readwrite) NSURL *storageItemURL;
+
+@end
+
+@implementation ImportCoordinatorFileRecord
+@end
+
+
+// State for a single call to importURLs:toGroup:callback:. Other than aborted and the job, which
+// the enumeration and copy stages peek at to stop early, this is only touched on dataQ.
+@interface ImportCoordinatorRun : NSObject
+
+@property (nonatomic, strong, readonly) ImportJob *job;
+@property (nonatomic, readonly) ImportCoordinatorTransferMode transferMode;
+// Source paths already committed by an earlier attempt at this job
+@property (nonatomic, strong, readwrite) NSSet<NSString *> *completedPaths;
+@property (nonatomic, strong, readwrite, nullable) NSFileHandle *journalHandle;
+@property (nonatomic, strong, readwrite, nullable) NSURL *journalURL;
+// For resumed jobs, the sources read back from the journal, and those of them whose security scope
+// we're holding open for the whole import, which must be ended once it's done.
+@property (nonatomic, strong, readwrite) NSArray<NSURL *> *sourceURLs;
+@property (nonatomic, strong, readwrite) NSArray<NSURL *> *scopedURLs;
+
+@property (nonatomic, strong, readonly, nullable) NSManagedObjectID *groupID;
+@property (nonatomic, strong, readonly) dispatch_group_t group;
+@property (nonatomic, strong, readonly) NSMutableArray<ImportCoordinatorFileRecord *> *pendingRecords;
+@property (nonatomic, strong, readonly) NSMutableSet<NSManagedObjectID *> *importedAssetIDs;
+@property (nonatomic, readonly) ImportCoordinatorDuplicatePolicy duplicatePolicy;
+@property (nonatomic, readonly) FileTransferOptions transferOptions;
+@property (nonatomic, copy, readonly, nullable) void (^transferReportHandler)(NSURL *source, NSURL *destination, FileTransferStrategy strategy);
+// Hashes of what we've written so far in this run, so that duplicates within a single import
+// are caught without having to wait for them to be visible to a fetch.
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, NSManagedObjectID *> *importedHashes;
+@property (nonatomic, strong, readwrite, nullable) NSError *error;
+@property (atomic, readwrite) BOOL aborted;
+// Either we've hit an error or the user cancelled the job
+@property (nonatomic, readonly) BOOL shouldStop;
+
+@end
+
+@implementation ImportCoordinatorRun
+
+- (instancetype)initWithJob:(ImportJob *)job
+                    groupID:(NSManagedObjectID * _Nullable)groupID
+            duplicatePolicy:(ImportCoordinatorDuplicatePolicy)duplicatePolicy
+               transferMode:(ImportCoordinatorTransferMode)transferMode
+      transferReportHandler:(void (^ _Nullable)(NSURL *source, NSURL *destination, FileTransferStrategy strategy))transferReportHandler {
+    NSParameterAssert(nil != job);
+    self = [super init];
+    if (nil != self) {
+        self->_job = job;
+        self->_groupID = groupID;
+        self->_duplicatePolicy = duplicatePolicy;
+        self->_transferMode = transferMode;
+        switch (transferMode) {
+            case ImportCoordinatorTransferModeCopy:
+                self->_transferOptions = FileTransferOptionsAllowClone;
+                break;
+            case ImportCoordinatorTransferModeLink:
+                self->_transferOptions = FileTransferOptionsAllowClone | FileTransferOptionsAllowHardLink;
+                break;
+            case ImportCoordinatorTransferModeMove:
+                self->_transferOptions = FileTransferOptionsAllowMove;
+                break;
+        }
+        self->_transferReportHandler = transferReportHandler;
+        self->_completedPaths = [NSSet set];
+        self->_sourceURLs = @[];
+        self->_scopedURLs = @[];
+        self->_importedHashes = [NSMutableDictionary dictionary];
+        self->_group = dispatch_group_create();
+        self->_pendingRecords = [NSMutableArray arrayWithCapacity:kImportInsertBatchSize];
+        self->_importedAssetIDs = [NSMutableSet set];
+        self->_aborted = NO;
+    }
+    return self;
+}
+
+- (BOOL)shouldStop {
+    return self.aborted || self.job.isCancelled;
+}
+
+@end
+
+
 @interface ImportCoordinator ()
 
 @property (strong, nonatomic, readonly) NSURL *storageDirectory;
@@ -32,21 +157,35 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
 // Queue used for core data work
 @property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull dataQ;
 @property (strong, nonatomic, readonly) NSManagedObjectContext * _Nonnull managedObjectContext;
+@property (strong, nonatomic, readonly) TagCache * _Nonnull tagCache;
 
 // Generally should be the mainQ, but for tests we need to redirect this
 @property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull updateDelegateQ;
 
+// Import is a three stage pipeline: enumerationQ walks the URLs we're given, handing each
+// file to copyWorkerQ, which copies and bookmarks them in parallel, and then the results
+// are batched up and written to the store on dataQ. The semaphore bounds how many copies
+// can be in flight, and because enumerationQ waits on it, it also stops us walking a huge
+// tree far ahead of the copies.
+@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull enumerationQ;
+@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull copyWorkerQ;
+@property (strong, nonatomic, readonly) dispatch_semaphore_t _Nonnull copySemaphore;
+
 @end
 
 @implementation ImportCoordinator
 
++ (BOOL)isSupportedURL:(NSURL *)url {
+    NSParameterAssert(nil != url);
+    NSString *lastPathComponent = [url lastPathComponent];
+    NSArray<NSString *> *knownSkip = @[@".DS_Store", @"desktop.ini"];
+    NSUInteger index = [knownSkip indexOfObject:lastPathComponent];
+    return index == NSNotFound;
+}
+
 + (NSSet<NSURL *> *)removeURLsForUnsupportedTypes:(NSSet<NSURL *> *)urls {
     NSPredicate *predicate = [NSPredicate predicateWithBlock:^BOOL(id _Nullable evaluatedObject, __unused NSDictionary<NSString *,id> * _Nullable bindings) {
-        NSURL *url = (NSURL*)evaluatedObject;
-        NSString *lastPathComponent = [url lastPathComponent];
-        NSArray<NSString *> *knownSkip = @[@".DS_Store", @"desktop.ini"];
-        NSUInteger index = [knownSkip indexOfObject:lastPathComponent];
-        return index == NSNotFound;
+        return [ImportCoordinator isSupportedURL:(NSURL*)evaluatedObject];
     }];
     return [urls filteredSetUsingPredicate:predicate];
 }
@@ -70,119 +209,415 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     self = [super init];
     if (nil != self) {
         self->_storageDirectory = storageDirectory;
-        self->_dataQ = dispatch_queue_create("com.digitalflapjack.LibraryController.dataQ", DISPATCH_QUEUE_SERIAL);
+        self->_dataQ = dispatch_queue_create("com.digitalflapjack.ImportCoordinator.dataQ", DISPATCH_QUEUE_SERIAL);
 
         NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
         context.persistentStoreCoordinator = store;
         self->_managedObjectContext = context;
+        self->_tagCache = [[TagCache alloc] initWithContext:context];
 
         self->_updateDelegateQ = delegateUpdateQueue;
+
+        self->_enumerationQ = dispatch_queue_create("com.digitalflapjack.ImportCoordinator.enumerationQ", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_enumerationQ, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0));
+        self->_copyWorkerQ = dispatch_queue_create("com.digitalflapjack.ImportCoordinator.copyWorkerQ", DISPATCH_QUEUE_CONCURRENT);
+        dispatch_set_target_queue(self->_copyWorkerQ, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0));
+        // Copies are mostly IO bound, but bookmarking and stat'ing are not free, so one per core
+        // is a reasonable balance that keeps the disk busy without us starving everything else.
+        NSUInteger copyWidth = MAX((NSUInteger)2, [[NSProcessInfo processInfo] activeProcessorCount]);
+        self->_copySemaphore = dispatch_semaphore_create((long)copyWidth);
+
+        self->_duplicatePolicy = ImportCoordinatorDuplicatePolicyLink;
+        self->_transferMode = ImportCoordinatorTransferModeCopy;
     }
     return self;
 }
 
-- (void)importURLs:(NSSet<NSURL *> *)urls
-           toGroup:(NSManagedObjectID * _Nullable)groupID
-          callback:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback {
+- (ImportJob *)importURLs:(NSSet<NSURL *> *)urls
+                 toGroup:(NSManagedObjectID * _Nullable)groupID
+                callback:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback {
     NSParameterAssert(nil != urls);
     dispatch_assert_queue_not(self.dataQ);
 
+    ImportJob *job = [[ImportJob alloc] initWithJobID:[NSUUID UUID]];
+    ImportCoordinatorRun *run = [[ImportCoordinatorRun alloc] initWithJob:job
+                                                                  groupID:groupID
+                                                          duplicatePolicy:self.duplicatePolicy
+                                                             transferMode:self.transferMode
+                                                    transferReportHandler:self.transferReportHandler];
+
     @weakify(self);
-    dispatch_async(self.dataQ, ^{
+    metrics_dispatch_async(self.enumerationQ, ^{
         @strongify(self);
         if (nil == self) {
             return;
         }
+        NSError *error = nil;
+        BOOL success = [self createJournalForRun:run
+                                            urls:urls
+                                           error:&error];
+        if (NO == success) {
+            // Not being able to resume is a shame, but not a reason to not import
+            NSLog(@"Failed to create import journal: %@", error.localizedDescription);
+        }
+    });
+    [self startRun:run
+              urls:urls
+          callback:callback];
 
-        __block NSError *innerError = nil;
-        __block NSSet<NSManagedObjectID *> *newAssetIDs = nil;
-        [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *newAssets = [self innerRecursiveImportURLs:urls
-                                                               recurse:YES // TODO: This should come from UI/defaults at some point
-                                                                 error:&innerError];
-            if (nil != innerError) {
-                return;
-            }
-            NSAssert(nil != newAssets, @"Got no error, but no assets also");
+    return job;
+}
 
-            BOOL success = [self.managedObjectContext obtainPermanentIDsForObjects:[newAssets allObjects]
-                                                                             error:&innerError];
-            if (nil != innerError) {
-                NSAssert(NO == success, @"Got error and success from obtainPermanentIDsForObjects.");
-                return;
-            }
-            NSAssert(NO != success, @"Got no success and error from obtainPermanentIDsForObjects.");
+- (NSArray<ImportJob *> *)resumeInterruptedImports:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback {
+    dispatch_assert_queue_not(self.dataQ);
 
-            if ((nil != groupID) && ([newAssets count] > 0)) {
-                Group *group = [self.managedObjectContext existingObjectWithID:groupID
-                                                                         error:&innerError];
-                if (nil != innerError) {
-                    NSAssert(nil == group, @"Got error and item fetching object with ID %@: %@", groupID, innerError.localizedDescription);
-                    return;
-                }
-                NSAssert(nil != group, @"Got no error but also no item fetching object with ID %@", groupID);
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *journalDirectory = [self.storageDirectory URLByAppendingPathComponent:kImportJournalDirectoryName];
 
-                [group addContains:newAssets];
-            }
+    __block NSArray<NSURL *> *journals = nil;
+    [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+        journals = [fm contentsOfDirectoryAtURL:journalDirectory
+                     includingPropertiesForKeys:nil
+                                        options:NSDirectoryEnumerationSkipsHiddenFiles
+                                          error:nil];
+    }];
+    if (nil == journals) {
+        // Most likely there's no journal directory as nothing was ever interrupted
+        return @[];
+    }
 
-            // I used to think that getting permanentIDs was equivelent to "Save", as you clearly got
-            // a final ID, but it seems it's not committed properly, as problems downstream of here
-            // can cause it not to be written. So I'm going to save also
-            success = [self.managedObjectContext save:&innerError];
-            if (nil != innerError) {
-                NSAssert(NO == success, @"Got error and success from save.");
-                return;
+    NSMutableArray<ImportJob *> *jobs = [NSMutableArray array];
+    for (NSURL *journalURL in journals) {
+        NSError *error = nil;
+        ImportCoordinatorRun *run = [self runFromJournalAtURL:journalURL
+                                                        error:&error];
+        if (nil == run) {
+            NSLog(@"Discarding unreadable import journal %@: %@", journalURL, error.localizedDescription);
+            [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+                [fm removeItemAtURL:journalURL
+                              error:nil];
+            }];
+            continue;
+        }
+        [jobs addObject:run.job];
+        [self startRun:run
+                  urls:[NSSet setWithArray:run.sourceURLs]
+              callback:callback];
+    }
+    return [NSArray arrayWithArray:jobs];
+}
+
+- (void)startRun:(ImportCoordinatorRun *)run
+            urls:(NSSet<NSURL *> *)urls
+        callback:(nullable void (^)(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError * _Nullable error))callback {
+    NSParameterAssert(nil != run);
+    NSParameterAssert(nil != urls);
+
+    @weakify(self);
+    metrics_dispatch_async(self.enumerationQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+
+        MetricsIntervalToken enumerateInterval = metrics_interval_begin(MetricsIntervalImportEnumerate);
+        [self enumerateURLs:urls
+                    recurse:YES // TODO: This should come from UI/defaults at some point
+                        run:run];
+        metrics_interval_end(enumerateInterval);
+        [run.job markEnumerationComplete];
+
+        // Once every copy has been handed to the writer we can flush the last partial batch
+        // and tell the caller how things went. We flush even if we've stopped early, as
+        // everything pending has already been copied into storage and would otherwise be lost.
+        dispatch_group_notify(run.group, self.dataQ, ^{
+            NSError *error = nil;
+            BOOL success = [self flushPendingRecordsForRun:run
+                                                     error:&error];
+            if (nil != error) {
+                NSAssert(NO == success, @"Got error and success flushing import");
+                if (nil == run.error) {
+                    run.error = error;
+                }
+                run.aborted = YES;
             }
-            NSAssert(NO != success, @"Got no success and error from save.");
 
-            newAssetIDs = [newAssets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
-        }];
+            [self closeJournalForRun:run];
+            [NSURL endSecureAccessToURLs:run.scopedURLs];
+            [run.job markFinished];
 
-        if (nil != innerError) {
             if (nil != callback) {
+                NSError *error = run.error;
+                if ((nil == error) && run.job.isCancelled) {
+                    error = [NSError errorWithDomain:NSCocoaErrorDomain
+                                                code:NSUserCancelledError
+                                            userInfo:nil];
+                }
+                NSSet<NSManagedObjectID *> *assetIDs = [NSSet setWithSet:run.importedAssetIDs];
                 dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                    callback(NO, nil, innerError);
+                    callback(nil == error, assetIDs, error);
                 });
             }
-        } else {
-            NSAssert(nil != newAssetIDs, @"Got no error, but also no asset IDs");
-            if (nil != callback) {
-                dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                    callback(YES, newAssetIDs, nil);
-                });
+        });
+    });
+}
+
+
+#pragma mark - Journal
+
+- (BOOL)createJournalForRun:(ImportCoordinatorRun *)run
+                       urls:(NSSet<NSURL *> *)urls
+                      error:(NSError **)error {
+    NSParameterAssert(nil != run);
+    NSParameterAssert(nil != urls);
+    dispatch_assert_queue(self.enumerationQ);
+
+    __block NSError *innerError = nil;
+    NSMutableArray<NSData *> *bookmarks = [NSMutableArray arrayWithCapacity:[urls count]];
+    for (NSURL *url in urls) {
+        __block NSData *bookmark = nil;
+        [url secureAccessWithBlock:^(__unused NSURL * _Nonnull secureURL, __unused BOOL canAccess) {
+            bookmark = [url bookmarkDataWithOptions:NSURLBookmarkCreationWithSecurityScope
+                     includingResourceValuesForKeys:nil
+                                      relativeToURL:nil
+                                              error:&innerError];
+        }];
+        if (nil != innerError) {
+            NSAssert(nil == bookmark, @"Got error and bookmark");
+            if (nil != error) {
+                *error = innerError;
             }
+            return NO;
+        }
+        NSAssert(nil != bookmark, @"Got no error but no bookmark");
+        [bookmarks addObject:bookmark];
+    }
 
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSInsertedObjectsKey:[newAssetIDs allObjects]}];
-            });
+    NSMutableDictionary<NSString *, id> *description = [NSMutableDictionary dictionaryWithDictionary:@{
+        kImportJournalSourcesKey: bookmarks,
+        kImportJournalDuplicatePolicyKey: @(run.duplicatePolicy),
+        kImportJournalTransferModeKey: @(run.transferMode),
+    }];
+    if (nil != run.groupID) {
+        [description setObject:[[run.groupID URIRepresentation] absoluteString]
+                        forKey:kImportJournalGroupKey];
+    }
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:description
+                                                              format:NSPropertyListBinaryFormat_v1_0
+                                                             options:0
+                                                               error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == data, @"Got error and data");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != data, @"Got no error but no data");
+
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *journalURL = [[self.storageDirectory URLByAppendingPathComponent:kImportJournalDirectoryName] URLByAppendingPathComponent:[run.job.jobID UUIDString]];
+    NSURL *completedURL = [journalURL URLByAppendingPathComponent:kImportJournalCompletedName];
+    __block NSFileHandle *handle = nil;
+    [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+        BOOL success = [fm createDirectoryAtURL:journalURL
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&innerError];
+        if (NO == success) {
+            return;
+        }
+        success = [data writeToURL:[journalURL URLByAppendingPathComponent:kImportJournalDescriptionName]
+                           options:NSDataWritingAtomic
+                             error:&innerError];
+        if (NO == success) {
+            return;
+        }
+        success = [fm createFileAtPath:completedURL.path
+                              contents:nil
+                            attributes:nil];
+        if (NO == success) {
+            innerError = [NSError errorWithDomain:NSCocoaErrorDomain
+                                             code:NSFileWriteUnknownError
+                                         userInfo:@{NSURLErrorKey: completedURL}];
+            return;
         }
-        
+        handle = [NSFileHandle fileHandleForWritingToURL:completedURL
+                                                   error:&innerError];
+    }];
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != handle, @"Got no error but no file handle");
+
+    metrics_dispatch_sync(self.dataQ, ^{
+        run.journalURL = journalURL;
+        run.journalHandle = handle;
     });
+    return YES;
 }
 
-- (NSSet<Asset *> *)innerRecursiveImportURLs:(NSSet<NSURL *> *)urls
-                                     recurse:(BOOL)recurse
-                                       error:(NSError **)error {
+- (ImportCoordinatorRun * _Nullable)runFromJournalAtURL:(NSURL *)journalURL
+                                                  error:(NSError **)error {
+    NSParameterAssert(nil != journalURL);
+
+    __block NSError *innerError = nil;
+    __block NSData *data = nil;
+    __block NSData *completedData = nil;
+    __block NSFileHandle *handle = nil;
+    NSURL *completedURL = [journalURL URLByAppendingPathComponent:kImportJournalCompletedName];
+    [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+        data = [NSData dataWithContentsOfURL:[journalURL URLByAppendingPathComponent:kImportJournalDescriptionName]
+                                     options:0
+                                       error:&innerError];
+        if (nil == data) {
+            return;
+        }
+        completedData = [NSData dataWithContentsOfURL:completedURL
+                                              options:NSDataReadingMappedIfSafe
+                                                error:&innerError];
+        if (nil == completedData) {
+            return;
+        }
+        handle = [NSFileHandle fileHandleForWritingToURL:completedURL
+                                                   error:&innerError];
+        [handle seekToEndReturningOffset:nil
+                                   error:&innerError];
+    }];
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+
+    NSDictionary<NSString *, id> *description = [NSPropertyListSerialization propertyListWithData:data
+                                                                                          options:NSPropertyListImmutable
+                                                                                           format:nil
+                                                                                            error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == description, @"Got error and description");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+    NSAssert(nil != description, @"Got no error but no description");
+
+    NSManagedObjectID *groupID = nil;
+    NSString *groupURI = [description objectForKey:kImportJournalGroupKey];
+    if (nil != groupURI) {
+        groupID = [self.managedObjectContext.persistentStoreCoordinator managedObjectIDForURIRepresentation:[NSURL URLWithString:groupURI]];
+    }
+
+    NSMutableArray<NSURL *> *sources = [NSMutableArray array];
+    for (NSData *bookmark in [description objectForKey:kImportJournalSourcesKey]) {
+        BOOL isStale = NO;
+        NSURL *url = [NSURL URLByResolvingBookmarkData:bookmark
+                                               options:NSURLBookmarkResolutionWithSecurityScope
+                                         relativeToURL:nil
+                                   bookmarkDataIsStale:&isStale
+                                                 error:&innerError];
+        if (nil == url) {
+            // The source may well have gone away, in which case there's nothing to resume for it
+            NSLog(@"Failed to resolve import source: %@", innerError.localizedDescription);
+            innerError = nil;
+            continue;
+        }
+        [sources addObject:url];
+    }
+
+    NSString *completedLog = [[NSString alloc] initWithData:completedData
+                                                   encoding:NSUTF8StringEncoding];
+    NSMutableSet<NSString *> *completedPaths = [NSMutableSet setWithArray:[completedLog componentsSeparatedByString:@"\n"]];
+    [completedPaths removeObject:@""];
+
+    ImportJob *job = [[ImportJob alloc] initWithJobID:[[NSUUID alloc] initWithUUIDString:[journalURL lastPathComponent]] ?: [NSUUID UUID]];
+    ImportCoordinatorRun *run = [[ImportCoordinatorRun alloc] initWithJob:job
+                                                                  groupID:groupID
+                                                          duplicatePolicy:[[description objectForKey:kImportJournalDuplicatePolicyKey] integerValue]
+                                                             transferMode:[[description objectForKey:kImportJournalTransferModeKey] integerValue]
+                                                    transferReportHandler:self.transferReportHandler];
+    run.completedPaths = [NSSet setWithSet:completedPaths];
+    run.sourceURLs = [NSArray arrayWithArray:sources];
+    run.scopedURLs = [NSURL beginSecureAccessToURLs:run.sourceURLs];
+    run.journalURL = journalURL;
+    run.journalHandle = handle;
+    return run;
+}
+
+- (void)appendRecords:(NSArray<ImportCoordinatorFileRecord *> *)records
+            toJournal:(ImportCoordinatorRun *)run {
+    NSParameterAssert(nil != records);
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.dataQ);
+
+    if (nil == run.journalHandle) {
+        return;
+    }
+    NSMutableString *lines = [NSMutableString string];
+    for (ImportCoordinatorFileRecord *record in records) {
+        [lines appendFormat:@"%@\n", record.sourceURL.path];
+    }
+    NSError *error = nil;
+    BOOL success = [run.journalHandle writeData:[lines dataUsingEncoding:NSUTF8StringEncoding]
+                                          error:&error];
+    if (NO == success) {
+        // We'll still import fine, we just won't be able to resume as well
+        NSLog(@"Failed to update import journal: %@", error.localizedDescription);
+    }
+}
+
+- (void)closeJournalForRun:(ImportCoordinatorRun *)run {
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.dataQ);
+
+    [run.journalHandle closeAndReturnError:nil];
+    run.journalHandle = nil;
+
+    // Only a cancelled import is left for resumeInterruptedImports: to find, along with any we
+    // never got to close as we crashed. One that stopped on an error has already reported it, and
+    // as whatever failed would most likely fail again, resuming it would just repeat that every
+    // launch, so it's tidied up along with ones that finished.
+    if ((nil == run.journalURL) || run.job.isCancelled) {
+        return;
+    }
+    NSURL *journalURL = run.journalURL;
+    [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+        NSError *error = nil;
+        BOOL success = [[NSFileManager defaultManager] removeItemAtURL:journalURL
+                                                                 error:&error];
+        if (NO == success) {
+            NSLog(@"Failed to remove import journal %@: %@", journalURL, error.localizedDescription);
+        }
+    }];
+}
+
+
+#pragma mark - Enumeration stage
+
+- (void)enumerateURLs:(NSSet<NSURL *> *)urls
+              recurse:(BOOL)recurse
+                  run:(ImportCoordinatorRun *)run {
     NSParameterAssert(nil != urls);
-    dispatch_assert_queue(self.dataQ); // TODO: is this needed here?
-    NSLog(@"inner %@", urls);
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.enumerationQ);
 
-    NSError *innerError = nil;
-    NSMutableSet<Asset *> *assets = [NSMutableSet set];
     NSFileManager *fm = [NSFileManager defaultManager];
 
     NSSet<NSURL *> *filteredURLs = [ImportCoordinator removeURLsForUnsupportedTypes:urls];
     for (NSURL *url in filteredURLs) {
+        if (run.shouldStop) {
+            return;
+        }
+
         // We hwave three options for importing:
         // 1. It's a basic file type we'll import (e.g., an image)
         // 2. It's an Ember snap that is a bundle we import as an asset with extra bits
-        // 3. It's a directory, and if permitted we'll recurse into it
+        // 3. It's a directory, and if permitted we'll walk it
         BOOL isDirectory = NO;
         BOOL exists = [fm fileExistsAtPath:[url path]
                                isDirectory:&isDirectory];
@@ -193,58 +628,122 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
 
         if (NO == isDirectory) {
             // 1. It's a basic file type we'll import (e.g., an image)
-            Asset *asset = [self importSimpleAssetAtURL:url
-                                                  error:&innerError];
-            if (nil != asset) {
-                [assets addObject:asset];
-            }
-        } else {
-            if ([[url pathExtension] compare:@"embersnap"] == NSOrderedSame) {
-                // 2. It's an Ember snap that is a bundle we import as an asset with extra bits
-                Asset *asset = [self importEmberSnapAtURL:url
-                                                    error:&innerError];
-                if (nil != asset) {
-                    [assets addObject:asset];
+            [self scheduleImportOfURL:url
+                          isEmberSnap:NO
+                                  run:run];
+        } else if ([[url pathExtension] compare:@"embersnap"] == NSOrderedSame) {
+            // 2. It's an Ember snap that is a bundle we import as an asset with extra bits
+            [self scheduleImportOfURL:url
+                          isEmberSnap:YES
+                                  run:run];
+        } else if (NO != recurse) {
+            // 3. It's a directory, and if permitted we'll walk it. We use an enumerator rather
+            // than recursing so we never hold more than the current directory in memory.
+            NSDirectoryEnumerator<NSURL *> *enumerator = [fm enumeratorAtURL:url
+                                                  includingPropertiesForKeys:@[NSURLIsDirectoryKey, NSURLFileSizeKey]
+                                                                     options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                errorHandler:^BOOL(NSURL * _Nonnull failedURL, NSError * _Nonnull error) {
+                NSLog(@"Failed to enumerate %@: %@", failedURL, error.localizedDescription);
+                return YES;
+            }];
+            for (NSURL *childURL in enumerator) {
+                if (run.shouldStop) {
+                    return;
                 }
-            } else {
-                // 3. It's a directory, and if permitted we'll recurse into it
-                if (NO != recurse) {
-                    NSArray<NSURL *> *files = [fm contentsOfDirectoryAtURL:url
-                                                includingPropertiesForKeys:nil
-                                                                   options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                     error:&innerError];
-                    if (nil == innerError) {
-                        NSAssert(nil != files, @"Got no error, expected files");
-                        NSSet<Asset *> *childAssets = [self innerRecursiveImportURLs:[NSSet setWithArray:files]
-                                                                             recurse:recurse
-                                                                               error:&innerError];
-                        if (nil == innerError) {
-                            NSAssert(nil != childAssets, @"Got no error, expect assets");
-                            [assets addObjectsFromArray:[childAssets allObjects]];
-                        }
-                    }
+                if (NO == [ImportCoordinator isSupportedURL:childURL]) {
+                    continue;
+                }
+
+                NSNumber *childIsDirectory = nil;
+                NSError *error = nil;
+                BOOL success = [childURL getResourceValue:&childIsDirectory
+                                                   forKey:NSURLIsDirectoryKey
+                                                    error:&error];
+                if (NO == success) {
+                    NSLog(@"Failed to stat %@: %@", childURL, error.localizedDescription);
+                    continue;
+                }
+
+                if (NO == [childIsDirectory boolValue]) {
+                    [self scheduleImportOfURL:childURL
+                                  isEmberSnap:NO
+                                          run:run];
+                } else if ([[childURL pathExtension] compare:@"embersnap"] == NSOrderedSame) {
+                    [enumerator skipDescendants];
+                    [self scheduleImportOfURL:childURL
+                                  isEmberSnap:YES
+                                          run:run];
                 }
             }
         }
+    }
+}
 
-        if (nil != innerError) {
-            break;
-        }
+- (void)scheduleImportOfURL:(NSURL *)url
+                isEmberSnap:(BOOL)isEmberSnap
+                        run:(ImportCoordinatorRun *)run {
+    NSParameterAssert(nil != url);
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.enumerationQ);
+
+    if ([run.completedPaths containsObject:url.path]) {
+        // Already done on an earlier attempt at this job
+        return;
     }
 
-    if (nil != innerError) {
-        if (nil != error) {
-            *error = innerError;
-        }
+    unsigned long long byteCount = 0;
+    if (NO == isEmberSnap) {
+        NSNumber *fileSize = nil;
+        [url getResourceValue:&fileSize
+                       forKey:NSURLFileSizeKey
+                        error:nil];
+        byteCount = [fileSize unsignedLongLongValue];
     }
-    return nil == innerError ? [NSSet setWithSet:assets] : nil;
+    [run.job addPendingFiles:1
+                       bytes:byteCount];
+
+    // Blocking here is deliberate: it's our back pressure on the enumeration stage.
+    dispatch_semaphore_wait(self.copySemaphore, DISPATCH_TIME_FOREVER);
+    dispatch_group_enter(run.group);
+    metrics_dispatch_async(self.copyWorkerQ, ^{
+        NSError *error = nil;
+        ImportCoordinatorFileRecord *record = nil;
+        if (NO == run.shouldStop) {
+            MetricsIntervalToken copyInterval = metrics_interval_begin(MetricsIntervalImportCopy);
+            if (isEmberSnap) {
+                record = [self copyEmberSnapAtURL:url
+                                              run:run
+                                            error:&error];
+            } else {
+                record = [self copySimpleAssetAtURL:url
+                                                run:run
+                                              error:&error];
+            }
+            record.sourceURL = url;
+            record.byteCount = byteCount;
+            metrics_interval_end(copyInterval);
+        }
+        dispatch_semaphore_signal(self.copySemaphore);
+
+        metrics_dispatch_async(self.dataQ, ^{
+            [self run:run
+       receivedRecord:record
+                error:error];
+            dispatch_group_leave(run.group);
+        });
+    });
 }
 
-- (Asset * _Nullable)importSimpleAssetAtURL:(NSURL *)url
-                                      error:(NSError **)error {
+
+#pragma mark - Copy stage
+
+- (ImportCoordinatorFileRecord * _Nullable)copySimpleAssetAtURL:(NSURL *)url
+                                                            run:(ImportCoordinatorRun *)run
+                                                          error:(NSError **)error {
     NSParameterAssert(nil != url);
-    dispatch_assert_queue(self.dataQ);
-    
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.copyWorkerQ);
+
     NSFileManager *fm = [NSFileManager defaultManager];
     __block NSError *innerError = nil;
 
@@ -264,9 +763,25 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     }
     NSAssert(NO != success, @"failure but with no error creating directory %@", itemDirectory);
 
+    // Stat before we transfer, as if we're moving the file the source will be gone after
+    NSDate *created = nil;
+    NSDictionary<NSFileAttributeKey, id> *attributes = [fm attributesOfItemAtPath:url.path
+                                                                            error:&innerError];
+    if (nil != innerError) {
+        NSLog(@"Failed to stat item: %@", innerError.localizedDescription);
+        innerError = nil;
+    } else {
+        created = [attributes objectForKey:NSFileCreationDate];
+    }
+    if (nil == created) {
+        created = [NSDate now];
+    }
+
     NSString *filename = [url lastPathComponent];
     NSURL *targetURL = [rawItemDirectory URLByAppendingPathComponent:filename];
     __block BOOL copySuccess = NO;
+    __block NSString *contentHash = nil;
+    __block FileTransferStrategy strategy = FileTransferStrategyStreamedCopy;
     // canAccess can still return NO with access if you already had some implicit
     // permission to special locations. Weirdly this does not include the folder
     // in our app's container, which I see YES for in the first call (even though this code
@@ -277,20 +792,34 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     // errors that occur instead of using canAccess to pre-empt that.
     [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
         [url secureAccessWithBlock:^(__unused NSURL * _Nonnull secureFileURL, __unused BOOL canAccess) {
-            copySuccess = [fm copyItemAtURL:url
-                                      toURL:targetURL
-                                      error:&innerError];
+            // We hash as we copy so that we only read the file once, and then the writer
+            // stage can use the hash to spot if we already have this file.
+            copySuccess = [fm transferItemAtURL:url
+                                          toURL:targetURL
+                                        options:run.transferOptions
+                                       strategy:&strategy
+                                    contentHash:&contentHash
+                                          error:&innerError];
 
         }];
     }];
     if (nil != innerError) {
         NSAssert(NO == copySuccess, @"Copy success despite error %@", innerError.localizedDescription);
+        // Don't leave an empty UUID directory behind
+        [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+            [fm removeItemAtURL:itemDirectory
+                          error:nil];
+        }];
         if (nil != error) {
             *error = innerError;
         }
         return nil;
     }
     NSAssert(NO != copySuccess, @"No error but copy failed");
+    NSAssert(nil != contentHash, @"Copy succeeded but no content hash");
+    if (nil != run.transferReportHandler) {
+        run.transferReportHandler(url, targetURL, strategy);
+    }
 
     __block NSData *bookmark = nil;
     [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
@@ -301,6 +830,13 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     }];
     if (nil != innerError) {
         NSLog(@"failed to make bookmark: %@", innerError.localizedDescription);
+        // If we moved the file in then this is the only copy, so we have to leave it for now
+        if (FileTransferStrategyMove != strategy) {
+            [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+                [fm removeItemAtURL:itemDirectory
+                              error:nil];
+            }];
+        }
         if (nil != error) {
             *error = innerError;
         }
@@ -308,38 +844,29 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     }
     NSAssert(nil != bookmark, @"Bookmark for %@ nil despite no error", url);
 
-    Asset *asset = [NSEntityDescription insertNewObjectForEntityForName:@"Asset"
-                                                 inManagedObjectContext:self.managedObjectContext];
-    asset.name = filename;
-    asset.path = targetURL;
-    asset.bookmark = bookmark;
-    asset.added = [NSDate now];
+    ImportCoordinatorFileRecord *record = [[ImportCoordinatorFileRecord alloc] init];
+    record.name = filename;
+    record.path = targetURL;
+    record.bookmark = bookmark;
+    record.contentHash = contentHash;
+    record.storageItemURL = itemDirectory;
+    record.transferStrategy = strategy;
 
     // Store the UTType, which is useful for exporting later
     NSString *uttype = (NSString *)CFBridgingRelease(UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)[url pathExtension], NULL));
-    asset.type = uttype;
+    record.type = uttype;
 
-    NSDictionary<NSFileAttributeKey, id> *attributes = [fm attributesOfItemAtPath:url.path
-                                                                            error:&innerError];
-    if (nil != innerError) {
-        NSLog(@"Failed to stat item: %@", innerError.localizedDescription);
-        asset.created = [NSDate now];
-    } else {
-        NSDate *creationDate = [attributes objectForKey:NSFileCreationDate];
-        if (nil != creationDate) {
-            asset.created = creationDate;
-        } else {
-            asset.created = [NSDate now];
-        }
-    }
+    record.created = created;
 
-    return asset;
+    return record;
 }
 
-- (Asset * _Nullable)importEmberSnapAtURL:(NSURL *)url
-                                    error:(NSError **)error {
+- (ImportCoordinatorFileRecord * _Nullable)copyEmberSnapAtURL:(NSURL *)url
+                                                          run:(ImportCoordinatorRun *)run
+                                                        error:(NSError **)error {
     NSParameterAssert(nil != url);
-    dispatch_assert_queue(self.dataQ);
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.copyWorkerQ);
 
     __block NSError *innerError = nil;
 
@@ -383,9 +910,32 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     }
 
 
+    // The bundle goes in its own item directory, laid out like any other asset's, so that importing
+    // the same snap twice doesn't collide, and the trash and storage checks can find it.
     NSFileManager *fm = [NSFileManager defaultManager];
-    NSURL *targetURL = [self.storageDirectory URLByAppendingPathComponent:[url lastPathComponent]];
+    NSURL *itemDirectory = [self.storageDirectory URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *rawItemDirectory = [itemDirectory URLByAppendingPathComponent:@"original"];
+    [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+        BOOL success = [fm createDirectoryAtURL:rawItemDirectory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&innerError];
+        if (nil != innerError) {
+            NSAssert(NO == success, @"success despite error creating directory %@: %@", itemDirectory, innerError.localizedDescription);
+            return;
+        }
+        NSAssert(NO != success, @"failure but with no error creating directory %@", itemDirectory);
+    }];
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+
+    NSURL *targetURL = [rawItemDirectory URLByAppendingPathComponent:[url lastPathComponent]];
     __block BOOL copySuccess = NO;
+    __block FileTransferStrategy strategy = FileTransferStrategyStreamedCopy;
     // canAccess can still return NO with access if you already had some implicit
     // permission to special locations. Weirdly this does not include the folder
     // in our app's container, which I see YES for in the first call (even though this code
@@ -396,20 +946,31 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     // errors that occur instead of using canAccess to pre-empt that.
     [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
         [url secureAccessWithBlock:^(__unused NSURL * _Nonnull secureFileURL, __unused BOOL canAccess) {
-            copySuccess = [fm copyItemAtURL:url
-                                      toURL:targetURL
-                                      error:&innerError];
+            copySuccess = [fm transferItemAtURL:url
+                                          toURL:targetURL
+                                        options:run.transferOptions
+                                       strategy:&strategy
+                                    contentHash:nil
+                                          error:&innerError];
 
         }];
     }];
     if (nil != innerError) {
         NSAssert(NO == copySuccess, @"Copy success despite error %@", innerError.localizedDescription);
+        // Don't leave an empty UUID directory behind
+        [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+            [fm removeItemAtURL:itemDirectory
+                          error:nil];
+        }];
         if (nil != error) {
             *error = innerError;
         }
         return nil;
     }
     NSAssert(NO != copySuccess, @"No error but copy failed");
+    if (nil != run.transferReportHandler) {
+        run.transferReportHandler(url, targetURL, strategy);
+    }
 
     __block NSData *bookmark = nil;
     NSURL *itemURL = [targetURL URLByAppendingPathComponent:metadata.imageFileName];
@@ -421,6 +982,13 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     }];
     if (nil != innerError) {
         NSLog(@"failed to make bookmark: %@", innerError.localizedDescription);
+        // If we moved the snap in then this is the only copy, so we have to leave it for now
+        if (FileTransferStrategyMove != strategy) {
+            [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+                [fm removeItemAtURL:itemDirectory
+                              error:nil];
+            }];
+        }
         if (nil != error) {
             *error = innerError;
         }
@@ -428,50 +996,332 @@ typedef NS_ERROR_ENUM(ImportCoordinatorErrorDomain, ImportCoordinatorErrorCode)
     }
     NSAssert(nil != bookmark, @"Bookmark for %@ nil despite no error", url);
 
-    Asset *asset = [NSEntityDescription insertNewObjectForEntityForName:@"Asset"
-                                                 inManagedObjectContext:self.managedObjectContext];
-    asset.name = metadata.title;
-    asset.path = itemURL;
-    asset.bookmark = bookmark;
-    asset.added = [NSDate now];
-    asset.created = creationTime;
-    asset.favourite = [metadata.rating integerValue] > 0;
-    if (nil != metadata.comments) {
-        asset.notes = metadata.comments;
+    // A snap is a bundle, but it's the image inside that defines whether we've seen it before
+    __block NSString *contentHash = nil;
+    [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+        contentHash = [fm contentHashOfItemAtURL:itemURL
+                                           error:&innerError];
+    }];
+    if (nil != innerError) {
+        NSAssert(nil == contentHash, @"Got error and content hash");
+        // If we moved the snap in then this is the only copy, so we have to leave it for now
+        if (FileTransferStrategyMove != strategy) {
+            [self.storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+                [fm removeItemAtURL:itemDirectory
+                              error:nil];
+            }];
+        }
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
     }
+    NSAssert(nil != contentHash, @"Got no error but no content hash");
+
+    ImportCoordinatorFileRecord *record = [[ImportCoordinatorFileRecord alloc] init];
+    record.name = metadata.title;
+    record.path = itemURL;
+    record.bookmark = bookmark;
+    record.created = creationTime;
+    record.favourite = [metadata.rating integerValue] > 0;
+    record.notes = metadata.comments;
+    record.tags = metadata.tags;
+    record.contentHash = contentHash;
+    record.storageItemURL = itemDirectory;
+    record.transferStrategy = strategy;
 
     // Store the UTType, which is useful for exporting later
     NSString *uttype = (NSString *)CFBridgingRelease(UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)[itemURL pathExtension], NULL));
-    asset.type = uttype;
+    record.type = uttype;
+
+    return record;
+}
 
-    // TODO: We should be somehow adding the inserted tags to a ledger to send upstream
-    NSSet<Tag *> *tagObjects = [metadata.tags compactMapUsingBlock:^id _Nullable(NSString * _Nonnull rawTag) {
-        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Tag"];
-        NSPredicate *predicate = [NSPredicate predicateWithFormat:@"name ==[c] %@", rawTag];
-        [fetch setPredicate:predicate];
 
-        NSError *error = nil;
-        NSArray<Tag *> *result = [self.managedObjectContext executeFetchRequest:fetch
-                                                                          error:&error];
+#pragma mark - Writer stage
+
+- (void)run:(ImportCoordinatorRun *)run
+receivedRecord:(ImportCoordinatorFileRecord * _Nullable)record
+      error:(NSError * _Nullable)error {
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.dataQ);
+
+    if (nil != error) {
+        NSAssert(nil == record, @"Got error and record");
+        // We only report the first error, as anything after that is likely just a consequence
+        if (nil == run.error) {
+            run.error = error;
+        }
+        run.aborted = YES;
+        return;
+    }
+    if (nil == record) {
+        // The copy was skipped because we'd already stopped
+        return;
+    }
+
+    // Even if we've stopped, this has been copied into storage by now, so we still write it
+    // rather than leave it orphaned.
+    [run.job addCompletedFiles:1
+                         bytes:record.byteCount];
+    [run.pendingRecords addObject:record];
+    if ([run.pendingRecords count] < kImportInsertBatchSize) {
+        return;
+    }
+
+    NSError *flushError = nil;
+    BOOL success = [self flushPendingRecordsForRun:run
+                                             error:&flushError];
+    if (nil != flushError) {
+        NSAssert(NO == success, @"Got error and success flushing import");
+        if (nil == run.error) {
+            run.error = flushError;
+        }
+        run.aborted = YES;
+    }
+}
+
+- (BOOL)flushPendingRecordsForRun:(ImportCoordinatorRun *)run
+                            error:(NSError **)error {
+    NSParameterAssert(nil != run);
+    dispatch_assert_queue(self.dataQ);
+
+    if (0 == [run.pendingRecords count]) {
+        return YES;
+    }
+    NSArray<ImportCoordinatorFileRecord *> *records = [NSArray arrayWithArray:run.pendingRecords];
+    [run.pendingRecords removeAllObjects];
+    MetricsIntervalToken commitInterval = metrics_interval_begin(MetricsIntervalImportCommit);
+
+    __block NSError *innerError = nil;
+    __block NSArray<NSManagedObjectID *> *newAssetIDs = nil;
+    __block NSArray<NSManagedObjectID *> *linkedAssetIDs = nil;
+    __block NSArray<NSManagedObjectID *> *tagIDs = @[];
+    __block NSArray<NSURL *> *duplicateItemURLs = nil;
+    [self.managedObjectContext performBlockAndWait:^{
+        // One indexed lookup for the whole batch to find which of these we already have
+        NSSet<NSString *> *hashes = [NSSet setWithArray:[records mapUsingBlock:^id _Nonnull(ImportCoordinatorFileRecord * _Nonnull record) {
+            return record.contentHash;
+        }]];
+        NSFetchRequest *fetchRequest = [Asset fetchRequest];
+        // Anything in the trash doesn't count, as its files go when the trash is emptied, and in
+        // move mode the copy we'd throw away as a duplicate is the user's only one
+        fetchRequest.predicate = [NSPredicate predicateWithFormat:@"(contentHash IN %@) AND (deletedAt == nil)", hashes];
+        MetricsIntervalToken fetchInterval = metrics_interval_begin(MetricsIntervalFetch);
+        NSArray<Asset *> *existingAssets = [self.managedObjectContext executeFetchRequest:fetchRequest
+                                                                                    error:&innerError];
+        metrics_interval_end(fetchInterval);
+        if (nil != innerError) {
+            NSAssert(nil == existingAssets, @"Got error and result");
+            return;
+        }
+        NSAssert(nil != existingAssets, @"Got no error but no result");
+        NSMutableDictionary<NSString *, Asset *> *knownAssets = [NSMutableDictionary dictionaryWithCapacity:[existingAssets count]];
+        for (Asset *asset in existingAssets) {
+            [knownAssets setObject:asset
+                            forKey:asset.contentHash];
+        }
+
+        // Likewise all the tags for the batch are found or made in one go
+        NSMutableSet<NSString *> *tagNames = [NSMutableSet set];
+        for (ImportCoordinatorFileRecord *record in records) {
+            if (nil != record.tags) {
+                [tagNames addObjectsFromArray:record.tags];
+            }
+        }
+        NSDictionary<NSString *, Tag *> *tags = @{};
+        if (0 < [tagNames count]) {
+            tags = [self.tagCache tagsForNames:tagNames
+                                  insertedTags:nil
+                                         error:&innerError];
+            if (nil != innerError) {
+                NSAssert(nil == tags, @"Got error and tags");
+                return;
+            }
+            NSAssert(nil != tags, @"Got no error and no tags");
+        }
+
+        NSMutableArray<Asset *> *newAssets = [NSMutableArray arrayWithCapacity:[records count]];
+        NSMutableSet<Asset *> *linkedAssets = [NSMutableSet set];
+        NSMutableArray<NSURL *> *duplicates = [NSMutableArray array];
+        for (ImportCoordinatorFileRecord *record in records) {
+            Asset *existing = [knownAssets objectForKey:record.contentHash];
+            if (nil == existing) {
+                NSManagedObjectID *earlierID = [run.importedHashes objectForKey:record.contentHash];
+                if (nil != earlierID) {
+                    existing = [self.managedObjectContext existingObjectWithID:earlierID
+                                                                         error:&innerError];
+                    if (nil != innerError) {
+                        NSAssert(nil == existing, @"Got error and item fetching object with ID %@: %@", earlierID, innerError.localizedDescription);
+                        return;
+                    }
+                    if (nil != existing.deletedAt) {
+                        existing = nil;
+                    }
+                }
+            }
+            if (nil != existing) {
+                [duplicates addObject:record.storageItemURL];
+                if (ImportCoordinatorDuplicatePolicyLink == run.duplicatePolicy) {
+                    [linkedAssets addObject:existing];
+                }
+                continue;
+            }
+
+            Asset *asset = [self insertAssetForRecord:record
+                                                 tags:tags];
+            [newAssets addObject:asset];
+            [knownAssets setObject:asset
+                            forKey:record.contentHash];
+        }
+
+        BOOL success = [self.managedObjectContext obtainPermanentIDsForObjects:newAssets
+                                                                         error:&innerError];
+        if (nil != innerError) {
+            NSAssert(NO == success, @"Got error and success from obtainPermanentIDsForObjects.");
+            return;
+        }
+        NSAssert(NO != success, @"Got no success and error from obtainPermanentIDsForObjects.");
+
+        if (nil != run.groupID) {
+            Group *group = [self.managedObjectContext existingObjectWithID:run.groupID
+                                                                     error:&innerError];
+            if (nil != innerError) {
+                NSAssert(nil == group, @"Got error and item fetching object with ID %@: %@", run.groupID, innerError.localizedDescription);
+                return;
+            }
+            NSAssert(nil != group, @"Got no error but also no item fetching object with ID %@", run.groupID);
+
+            [group addContains:[NSSet setWithArray:newAssets]];
+            [group addContains:linkedAssets];
+        }
+
+        // I used to think that getting permanentIDs was equivelent to "Save", as you clearly got
+        // a final ID, but it seems it's not committed properly, as problems downstream of here
+        // can cause it not to be written. So I'm going to save also
+        MetricsIntervalToken saveInterval = metrics_interval_begin(MetricsIntervalSave);
+        success = [self.managedObjectContext save:&innerError];
+        metrics_interval_end(saveInterval);
+        if (nil != innerError) {
+            NSAssert(NO == success, @"Got error and success from save.");
+            return;
+        }
+        NSAssert(NO != success, @"Got no success and error from save.");
+
+        newAssetIDs = [newAssets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+        linkedAssetIDs = nil != run.groupID ? [[linkedAssets allObjects] mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }] : @[];
+        // Their counts have changed, which the sidebar wants to know about
+        if (0 < [newAssets count]) {
+            tagIDs = [[tags allValues] mapUsingBlock:^id _Nonnull(Tag * _Nonnull tag) { return tag.objectID; }];
+        }
+        duplicateItemURLs = [NSArray arrayWithArray:duplicates];
+        for (Asset *asset in newAssets) {
+            [run.importedHashes setObject:asset.objectID
+                                   forKey:asset.contentHash];
+        }
+
+        // We only hand IDs onwards, so there's no reason to let the context grow over a large import
+        [self.managedObjectContext reset];
+    }];
+    metrics_interval_end(commitInterval);
+    if (nil != innerError) {
+        // These will never be written now, so don't leave their copies lying around in
+        // storage, unless we moved them there, in which case it's the only copy there is.
+        NSArray<NSURL *> *abandonedItemURLs = [records compactMapUsingBlock:^id _Nullable(ImportCoordinatorFileRecord * _Nonnull record) {
+            return FileTransferStrategyMove == record.transferStrategy ? nil : record.storageItemURL;
+        }];
+        [self removeStorageItems:abandonedItemURLs];
         if (nil != error) {
-            NSAssert(nil == result, @"Got error and result");
-            NSLog(@"Failed to look for %@ as tag: %@", rawTag, error.localizedDescription);
-            return nil;
+            *error = innerError;
         }
-        NSAssert(nil != result, @"Got no error but not result");
+        return NO;
+    }
+    NSAssert(nil != newAssetIDs, @"Got no error, but also no asset IDs");
 
-        if (0 == [result count]) {
-            Tag *tag = [NSEntityDescription insertNewObjectForEntityForName:@"Tag"
-                                                     inManagedObjectContext:self.managedObjectContext];
-            tag.name = rawTag;
-            return tag;
+    [run.importedAssetIDs addObjectsFromArray:newAssetIDs];
+    [self appendRecords:records
+              toJournal:run];
+
+    // We've already copied the duplicates by the time we know they're duplicates, as we hash
+    // during the copy, so tidy them up.
+    [self removeStorageItems:duplicateItemURLs];
+
+    if ((0 == [newAssetIDs count]) && (0 == [linkedAssetIDs count])) {
+        return YES;
+    }
+    @weakify(self);
+    dispatch_async(self.updateDelegateQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
         }
+        [self.delegate modelCoordinator:self
+                              didUpdate:@{
+            NSInsertedObjectsKey:newAssetIDs,
+            NSUpdatedObjectsKey:[linkedAssetIDs arrayByAddingObjectsFromArray:tagIDs],
+        }];
+    });
+
+    return YES;
+}
+
+- (void)removeStorageItems:(NSArray<NSURL *> *)itemURLs {
+    NSParameterAssert(nil != itemURLs);
+    if (0 == [itemURLs count]) {
+        return;
+    }
+
+    // Done off the writer queue, as there's no need to hold up the next batch for this
+    NSURL *storageDirectory = self.storageDirectory;
+    metrics_dispatch_async(self.copyWorkerQ, ^{
+        NSFileManager *fm = [NSFileManager defaultManager];
+        [storageDirectory secureAccessWithBlock:^(__unused NSURL * _Nonnull secureStorageURL, __unused BOOL canAccess) {
+            for (NSURL *itemURL in itemURLs) {
+                NSError *error = nil;
+                BOOL success = [fm removeItemAtURL:itemURL
+                                             error:&error];
+                if (NO == success) {
+                    NSLog(@"Failed to remove import %@: %@", itemURL, error.localizedDescription);
+                }
+            }
+        }];
+    });
+}
 
-        // We hope for a single tag here
-        NSAssert([result count] == 1, @"Unexpceted number of tags for %@: %@", rawTag, result);
-        return [result firstObject];
+- (Asset *)insertAssetForRecord:(ImportCoordinatorFileRecord *)record
+                           tags:(NSDictionary<NSString *, Tag *> *)tags {
+    NSParameterAssert(nil != record);
+    NSParameterAssert(nil != tags);
+    dispatch_assert_queue(self.dataQ);
+
+    Asset *asset = [NSEntityDescription insertNewObjectForEntityForName:@"Asset"
+                                                 inManagedObjectContext:self.managedObjectContext];
+    asset.name = record.name;
+    asset.path = record.path;
+    asset.bookmark = record.bookmark;
+    asset.added = [NSDate now];
+    asset.created = record.created;
+    asset.type = record.type;
+    asset.contentHash = record.contentHash;
+    asset.favourite = record.favourite;
+    if (nil != record.notes) {
+        asset.notes = record.notes;
+    }
+    // The model defaults this to an empty string, which would read as already scanned, and so the
+    // asset would never join the text scan backlog
+    asset.scannedText = nil;
+
+    if (0 == [record.tags count]) {
+        return asset;
+    }
+
+    NSSet<Tag *> *tagObjects = [[NSSet setWithArray:record.tags] compactMapUsingBlock:^id _Nullable(NSString * _Nonnull rawTag) {
+        return [tags objectForKey:[TagCache normalisedNameForTag:rawTag]];
     }];
-    [asset addTags:tagObjects];
+    NSSet<Asset *> *assets = [NSSet setWithObject:asset];
+    for (Tag *tag in tagObjects) {
+        [tag addAssetsUpdatingCount:assets];
+    }
 
     return asset;
 }
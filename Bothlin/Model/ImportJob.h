@@ -0,0 +1,59 @@
+//
+//  ImportJob.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 03/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+@class ImportJob;
+
+NS_ASSUME_NONNULL_BEGIN
+
+@protocol ImportJobDelegate <NSObject>
+
+// Called on the main queue, at most a few times a second, and always once when the job finishes.
+- (void)importJobDidUpdateProgress:(ImportJob *)job;
+
+@end
+
+// A handle on an import that's running in ImportCoordinator. All the progress values are
+// safe to read from any queue, but are only a snapshot.
+@interface ImportJob : NSObject
+
+@property (nonatomic, strong, readonly) NSUUID *jobID;
+@property (nonatomic, weak, readwrite) id<ImportJobDelegate> delegate;
+
+// Totals grow whilst we're still walking the directories, so until enumerationComplete is set
+// they are a lower bound.
+@property (atomic, readonly) NSUInteger totalFiles;
+@property (atomic, readonly) NSUInteger completedFiles;
+@property (atomic, readonly) unsigned long long totalBytes;
+@property (atomic, readonly) unsigned long long completedBytes;
+@property (atomic, readonly) BOOL enumerationComplete;
+
+@property (atomic, readonly) double filesPerSecond;
+// Negative if we don't have enough to go on yet.
+@property (atomic, readonly) NSTimeInterval estimatedTimeRemaining;
+
+@property (atomic, readonly, getter=isCancelled) BOOL cancelled;
+@property (atomic, readonly, getter=isFinished) BOOL finished;
+
+// Stops walking for new files, but lets anything already being copied finish and be saved. The
+// job's journal is kept, so the import will be picked up again by
+// resumeInterruptedImports: on ImportCoordinator.
+- (void)cancel;
+
+// The following are for ImportCoordinator to report progress, and aren't for anyone else to call.
+- (instancetype)initWithJobID:(NSUUID *)jobID;
+- (void)addPendingFiles:(NSUInteger)files
+                  bytes:(unsigned long long)bytes;
+- (void)addCompletedFiles:(NSUInteger)files
+                    bytes:(unsigned long long)bytes;
+- (void)markEnumerationComplete;
+- (void)markFinished;
+
+@end
+
+NS_ASSUME_NONNULL_END
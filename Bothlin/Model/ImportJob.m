@@ -0,0 +1,129 @@
+//
+//  ImportJob.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 03/12/2023.
+//
+
+#import "ImportJob.h"
+
+#import "Helpers.h"
+
+// How often we bother the delegate, which is likely going to redraw something on mainQ
+static const NSTimeInterval kImportJobProgressInterval = 0.25;
+
+@interface ImportJob ()
+
+@property (atomic, readwrite) NSUInteger totalFiles;
+@property (atomic, readwrite) NSUInteger completedFiles;
+@property (atomic, readwrite) unsigned long long totalBytes;
+@property (atomic, readwrite) unsigned long long completedBytes;
+@property (atomic, readwrite) BOOL enumerationComplete;
+@property (atomic, readwrite) double filesPerSecond;
+@property (atomic, readwrite) NSTimeInterval estimatedTimeRemaining;
+@property (atomic, readwrite, getter=isCancelled) BOOL cancelled;
+@property (atomic, readwrite, getter=isFinished) BOOL finished;
+
+// Guards the counters as they're updated together from both the enumeration and writer queues
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readonly) NSDate *started;
+@property (nonatomic, strong, readwrite, nullable) NSDate *lastPublished;
+
+@end
+
+@implementation ImportJob
+
+- (instancetype)initWithJobID:(NSUUID *)jobID {
+    NSParameterAssert(nil != jobID);
+    self = [super init];
+    if (nil != self) {
+        self->_jobID = jobID;
+        self->_syncQ = dispatch_queue_create("com.digitalflapjack.ImportJob.syncQ", DISPATCH_QUEUE_SERIAL);
+        self->_started = [NSDate now];
+        self->_estimatedTimeRemaining = -1.0;
+    }
+    return self;
+}
+
+- (void)cancel {
+    self.cancelled = YES;
+}
+
+- (void)addPendingFiles:(NSUInteger)files
+                  bytes:(unsigned long long)bytes {
+    dispatch_sync(self.syncQ, ^{
+        self.totalFiles += files;
+        self.totalBytes += bytes;
+        [self updateRates];
+    });
+    [self publishProgress:NO];
+}
+
+- (void)addCompletedFiles:(NSUInteger)files
+                    bytes:(unsigned long long)bytes {
+    dispatch_sync(self.syncQ, ^{
+        self.completedFiles += files;
+        self.completedBytes += bytes;
+        [self updateRates];
+    });
+    [self publishProgress:NO];
+}
+
+- (void)markEnumerationComplete {
+    self.enumerationComplete = YES;
+    [self publishProgress:NO];
+}
+
+- (void)markFinished {
+    dispatch_sync(self.syncQ, ^{
+        self.finished = YES;
+        self.estimatedTimeRemaining = 0.0;
+    });
+    [self publishProgress:YES];
+}
+
+- (void)updateRates {
+    dispatch_assert_queue(self.syncQ);
+
+    NSTimeInterval elapsed = -[self.started timeIntervalSinceNow];
+    if ((elapsed <= 0.0) || (0 == self.completedFiles)) {
+        return;
+    }
+    self.filesPerSecond = (double)self.completedFiles / elapsed;
+
+    // Bytes are a better guide than files, as one video can take as long as a thousand
+    // screenshots, but ember snaps don't have a meaningful size, so fall back to files.
+    if ((0 < self.totalBytes) && (0 < self.completedBytes)) {
+        double bytesPerSecond = (double)self.completedBytes / elapsed;
+        self.estimatedTimeRemaining = (double)(self.totalBytes - MIN(self.totalBytes, self.completedBytes)) / bytesPerSecond;
+    } else {
+        self.estimatedTimeRemaining = (double)(self.totalFiles - MIN(self.totalFiles, self.completedFiles)) / self.filesPerSecond;
+    }
+}
+
+- (void)publishProgress:(BOOL)force {
+    __block BOOL publish = force;
+    dispatch_sync(self.syncQ, ^{
+        NSDate *now = [NSDate now];
+        if ((nil == self.lastPublished) || ([now timeIntervalSinceDate:self.lastPublished] >= kImportJobProgressInterval)) {
+            publish = YES;
+        }
+        if (publish) {
+            self.lastPublished = now;
+        }
+    });
+    if (NO == publish) {
+        return;
+    }
+
+    @weakify(self);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        [self.delegate importJobDidUpdateProgress:self];
+    });
+}
+
+@end
@@ -9,6 +9,8 @@
 #import "ModelCoordinatorDelegate.h"
 
 @class LibraryWriteCoordinator;
+@class ThumbnailPackStore;
+@class TrashPurgeJob;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -31,10 +33,30 @@ NS_ASSUME_NONNULL_BEGIN
 - (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator * _Nonnull)store
                   delegateCallbackQueue:(dispatch_queue_t _Nonnull)delegateUpdateQueue;
 
+// Without a thumbnail store, thumbnails are written as files in each asset's directory.
+- (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator * _Nonnull)store
+                         thumbnailStore:(ThumbnailPackStore * _Nullable)thumbnailStore
+                  delegateCallbackQueue:(dispatch_queue_t _Nonnull)delegateUpdateQueue;
+
+// Thumbnails are generated in the background, with requests for the same asset coalesced.
 - (void)generateThumbnailForAssets:(NSSet<NSManagedObjectID *> *)assetIDs;
 
+// As above, but for assets currently on screen, which will jump ahead of any background work.
+- (void)generateThumbnailForVisibleAssets:(NSSet<NSManagedObjectID *> *)assetIDs;
+
+// Text is scanned in the background, with how much is done at once following the machine's load.
 - (void)generateScannedTextForAssets:(NSSet<NSManagedObjectID *> *)assetIDs;
 
+// The number of assets waiting for or having their text scanned.
+- (NSUInteger)pendingScannedTextCount;
+
+// The changes below return straight away without waiting on the store. Changes made close together
+// are run in the order they were made, and the delegate gets a single update for all that was saved,
+// after which the callbacks are called in the same order on a background queue. Most changes are
+// saved as one, and if that fails none of them are kept. Setting the favourite state, moving assets
+// in or out of the trash, emptying the trash, and adding or removing large numbers of assets to a
+// group instead save on their own, as they write to the store as they go: if one of those reports a
+// failure, some of its change may still have been kept, and the delegate will have been told of it.
 - (void)createGroup:(NSString *)name
            callback:(nullable void (^)(BOOL success, NSError * _Nullable error))callback;
 
@@ -53,7 +75,10 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)toggleSoftDeleteAssets:(NSSet<NSManagedObjectID *> *)assetIDs
                       callback:(nullable void (^)(BOOL success, NSError * _Nullable error))callback;
 
-- (void)moveDeletedAssetsToTrash:(nullable void (^)(BOOL success, NSError * _Nullable error))callback;
+// Returns straight away. The assets are removed from the store first, and the delegate told, then
+// their files are moved to the Finder's trash in the background whilst other changes carry on. The
+// callback is called once the files are done too.
+- (TrashPurgeJob *)moveDeletedAssetsToTrash:(nullable void (^)(BOOL success, NSError * _Nullable error))callback;
 
 - (void)addAssets:(NSSet<NSManagedObjectID *> *)assetIDs
            toTags:(NSSet<NSString *> *)tags
@@ -63,6 +88,10 @@ NS_ASSUME_NONNULL_BEGIN
         fromAssets:(NSSet<NSManagedObjectID *> *)assetIDs
           callback:(nullable void (^)(BOOL success, NSError * _Nullable error))callback;
 
+// Tags from before usage counts were kept have none, so don't show up as popular until this has
+// counted them. Does nothing once every tag has a count.
+- (void)countUncountedTags;
+
 - (void)carryOutCleanUp;
 
 @end
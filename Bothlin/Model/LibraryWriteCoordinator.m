@@ -5,6 +5,7 @@
 //  Created by Michael Dales on 19/09/2023.
 //
 
+#import <ImageIO/ImageIO.h>
 #import <NaturalLanguage/NaturalLanguage.h>
 #import <QuickLookThumbnailing/QuickLookThumbnailing.h>
 #import <Vision/Vision.h>
@@ -13,12 +14,21 @@
 #import "Asset+CoreDataClass.h"
 #import "Group+CoreDataClass.h"
 #import "Tag+CoreDataClass.h"
+#import "TagCache.h"
+#import "TagExtension.h"
 #import "AssetExtension.h"
 #import "Helpers.h"
+#import "PerformanceMetrics.h"
 #import "NSURL+SecureAccess.h"
 #import "NSArray+Functional.h"
 #import "NSSet+Functional.h"
 #import "NSManagedObjectContext+helpers.h"
+#import "AssetWorkScheduler.h"
+#import "AssetWorkThrottle.h"
+#import "ThumbnailPyramid.h"
+#import "ThumbnailPackStore.h"
+#import "TrashPurgeJob.h"
+#import "SecureURLCache.h"
 
 NSErrorDomain __nonnull const LibraryWriteCoordinatorErrorDomain = @"com.digitalflapjack.LibraryController";
 typedef NS_ERROR_ENUM(LibraryWriteCoordinatorErrorDomain, LibraryWriteCoordinatorErrorCode) {
@@ -34,51 +44,249 @@ typedef NS_ERROR_ENUM(LibraryWriteCoordinatorErrorDomain, LibraryWriteCoordinato
     LibraryWriteCoordinatorErrorCouldNotWriteThumbnailFile,
 };
 
+// Enough to keep QuickLook busy without swamping it
+static const NSUInteger kThumbnailMaximumConcurrency = 8;
+static const NSUInteger kThumbnailBatchSize = 4;
+
+// Text recognition is all in process and CPU/ANE heavy, so we start narrow and let the throttle
+// widen it whilst the machine is idle. Images are scaled down before recognition, as beyond this
+// size Vision gets slower without finding noticeably more text.
+static const NSUInteger kTextScanBatchSize = 4;
+static const NSTimeInterval kTextScanThrottleInterval = 5.0;
+static const CGFloat kTextScanMaximumPixelSize = 2048.0;
+
+// Relationships can't be batch updated, so group membership is changed this many assets at a time,
+// turning each lot back into faults once saved so memory doesn't grow with the selection.
+static const NSUInteger kRelationshipUpdateChunkSize = 500;
+
+// Writes that arrive within this long of each other are run as one transaction, with one save and
+// one update to the delegate. Short enough that the UI doesn't feel it.
+static const NSTimeInterval kWriteCoalescingInterval = 0.03;
+
+
+// What a batch of commands changed, which goes to the delegate as a single update once saved.
+@interface LibraryWriteChanges : NSObject
+
+@property (nonatomic, strong, readonly) NSMutableSet<NSManagedObjectID *> *inserted;
+@property (nonatomic, strong, readonly) NSMutableSet<NSManagedObjectID *> *updated;
+@property (nonatomic, strong, readonly) NSMutableSet<NSManagedObjectID *> *deleted;
+
+@end
+
+@implementation LibraryWriteChanges
+
+- (instancetype)init {
+    self = [super init];
+    if (nil != self) {
+        self->_inserted = [NSMutableSet set];
+        self->_updated = [NSMutableSet set];
+        self->_deleted = [NSMutableSet set];
+    }
+    return self;
+}
+
+- (void)addChanges:(LibraryWriteChanges *)changes {
+    NSParameterAssert(nil != changes);
+    [self.inserted unionSet:changes.inserted];
+    [self.updated unionSet:changes.updated];
+    [self.deleted unionSet:changes.deleted];
+}
+
+// In the form mergeChangesFromRemoteContextSave:intoContexts: expects, with empty kinds left out.
+- (NSDictionary<NSString *, NSArray<NSManagedObjectID *> *> *)notificationData {
+    NSMutableDictionary<NSString *, NSArray<NSManagedObjectID *> *> *data = [NSMutableDictionary dictionaryWithCapacity:3];
+    if (0 < [self.inserted count]) {
+        data[NSInsertedObjectsKey] = [self.inserted allObjects];
+    }
+    NSMutableSet<NSManagedObjectID *> *updated = [self.updated mutableCopy];
+    [updated minusSet:self.deleted];
+    if (0 < [updated count]) {
+        data[NSUpdatedObjectsKey] = [updated allObjects];
+    }
+    if (0 < [self.deleted count]) {
+        data[NSDeletedObjectsKey] = [self.deleted allObjects];
+    }
+    return [NSDictionary dictionaryWithDictionary:data];
+}
+
+@end
+
+
+// A change waiting to be run on dataQ. The work is run on the context's queue and records what it
+// changes. An atomic command must not save or write straight to the store, and should check
+// everything it needs before changing anything, so that if it fails it leaves nothing to be saved
+// along with the other commands in its batch. A non-atomic command may save as it goes or use batch
+// requests, so is run in a transaction of its own, and anything it has recorded is passed on to the
+// delegate even if it fails, as some of it may already be in the store.
+@interface LibraryWriteCommand : NSObject
+
+@property (nonatomic, copy, readonly) BOOL (^work)(LibraryWriteChanges *changes, NSError **error);
+@property (nonatomic, copy, readonly, nullable) void (^completion)(BOOL success, NSError * _Nullable error);
+@property (nonatomic, readonly) BOOL atomic;
+
+@end
+
+@implementation LibraryWriteCommand
+
+- (instancetype)initWithWork:(BOOL (^)(LibraryWriteChanges *changes, NSError **error))work
+                      atomic:(BOOL)atomic
+                  completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion {
+    NSParameterAssert(nil != work);
+    self = [super init];
+    if (nil != self) {
+        self->_work = work;
+        self->_atomic = atomic;
+        self->_completion = completion;
+    }
+    return self;
+}
+
+@end
+
 @interface LibraryWriteCoordinator ()
 
 // Queue used for core data work
 @property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull dataQ;
 @property (strong, nonatomic, readonly) NSManagedObjectContext * _Nonnull managedObjectContext;
+@property (strong, nonatomic, readonly) TagCache * _Nonnull tagCache;
 
 // Generally should be the mainQ, but for tests we need to redirect this
 @property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull updateDelegateQ;
 
-// Queue used for thumbnail processing
-@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull thumbnailWorkerQ;
-@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull textWorkerQ;
+// Thumbnail and text processing
+@property (strong, nonatomic, readonly) AssetWorkScheduler * _Nonnull thumbnailScheduler;
+@property (strong, nonatomic, readonly) ThumbnailPackStore * _Nullable thumbnailStore;
+@property (strong, nonatomic, readonly) AssetWorkScheduler * _Nonnull textScheduler;
+@property (strong, nonatomic, readonly) AssetWorkThrottle * _Nonnull textThrottle;
+
+// Removing files when emptying the trash
+@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull purgeQ;
+
+// Changes waiting to be run on dataQ. Only access on commandQ.
+@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull commandQ;
+@property (strong, nonatomic, readonly) NSMutableArray<LibraryWriteCommand *> * _Nonnull pendingCommands;
+@property (nonatomic, readwrite) BOOL commandRunScheduled;
+
+// Command callbacks are called in order on here, once the delegate has had the update for them.
+@property (strong, nonatomic, readonly) dispatch_queue_t _Nonnull callbackQ;
 
 @end
 
+// Decodes straight to a reduced size where ImageIO can, which for large photos is much cheaper
+// than decoding the whole thing and scaling, and falls back to NSImage for things like PDFs.
+// Follows the Create rule.
+static CGImageRef _Nullable CreateTextScanImage(NSURL * _Nonnull url) {
+    CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)url, NULL);
+    if (NULL != source) {
+        NSDictionary *options = @{
+            (__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways: @YES,
+            (__bridge NSString *)kCGImageSourceCreateThumbnailWithTransform: @YES,
+            (__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize: @(kTextScanMaximumPixelSize),
+            (__bridge NSString *)kCGImageSourceShouldCacheImmediately: @YES,
+        };
+        CGImageRef image = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+        CFRelease(source);
+        if (NULL != image) {
+            return image;
+        }
+    }
+
+    // Surprisingly we can get a NSImage object from non-image files, but this will be nil if it
+    // can't open them.
+    NSImage *image = [[NSImage alloc] initByReferencingURL:url];
+    NSSize size = image.size;
+    CGFloat scale = MIN(1.0, kTextScanMaximumPixelSize / MAX(MAX(size.width, size.height), 1.0));
+    NSRect rect = NSMakeRect(0.0, 0.0, size.width * scale, size.height * scale);
+    CGImageRef cgImage = [image CGImageForProposedRect:&rect
+                                               context:nil
+                                                 hints:nil];
+    return NULL != cgImage ? CGImageRetain(cgImage) : NULL;
+}
+
+
 @implementation LibraryWriteCoordinator
 
 - (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator * _Nonnull)store {
     return [self initWithPersistentStore:store
+                          thumbnailStore:nil
                    delegateCallbackQueue:dispatch_get_main_queue()];
 }
 
 - (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator * _Nonnull)store
                   delegateCallbackQueue:(dispatch_queue_t _Nonnull)delegateUpdateQueue {
+    return [self initWithPersistentStore:store
+                          thumbnailStore:nil
+                   delegateCallbackQueue:delegateUpdateQueue];
+}
+
+- (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator * _Nonnull)store
+                         thumbnailStore:(ThumbnailPackStore * _Nullable)thumbnailStore
+                  delegateCallbackQueue:(dispatch_queue_t _Nonnull)delegateUpdateQueue {
     NSParameterAssert(nil != store);
     NSParameterAssert(nil != delegateUpdateQueue);
 
     self = [super init];
     if (nil != self) {
-        self->_dataQ = dispatch_queue_create("com.digitalflapjack.LibraryController.dataQ", DISPATCH_QUEUE_SERIAL);
+        self->_thumbnailStore = thumbnailStore;
+        self->_dataQ = dispatch_queue_create("com.digitalflapjack.LibraryWriteCoordinator.dataQ", DISPATCH_QUEUE_SERIAL);
 
         NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
         context.persistentStoreCoordinator = store;
         self->_managedObjectContext = context;
+        self->_tagCache = [[TagCache alloc] initWithContext:context];
+        self->_purgeQ = dispatch_queue_create("com.digitalflapjack.LibraryWriteCoordinator.purgeQ", DISPATCH_QUEUE_CONCURRENT);
+        dispatch_set_target_queue(self->_purgeQ, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+        self->_commandQ = dispatch_queue_create("com.digitalflapjack.LibraryWriteCoordinator.commandQ", DISPATCH_QUEUE_SERIAL);
+        self->_pendingCommands = [NSMutableArray array];
+        self->_callbackQ = dispatch_queue_create("com.digitalflapjack.LibraryWriteCoordinator.callbackQ", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_callbackQ, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0));
 
         // Queue notes:
         // 1. We could just dispatch to the global queues directly, but going via our own queues means
         //    we get nice labels in the debugger.
-        // 2. The textWorkerQ used to be concurrent, but it looks like everything gets backed up in
-        //    [VNImageRequestHandler performRequests...] and we swamp the system, and so doing so
-        //    serially seems to be the safest option.
-        self->_textWorkerQ = dispatch_queue_create("com.digital.LibraryWriteCoordinator.textWorkerQ", DISPATCH_QUEUE_SERIAL);
-        dispatch_set_target_queue(self->_textWorkerQ, dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0));
-        self->_thumbnailWorkerQ = dispatch_queue_create("com.digitalflapjack.thumbnailWorkerQ", DISPATCH_QUEUE_CONCURRENT);
-        dispatch_set_target_queue(self->_thumbnailWorkerQ, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+        // 2. QuickLook does the thumbnail work out of process, so there's nothing to be gained by
+        //    having more than a handful of requests in flight, and the scheduler lets us put what
+        //    the user can see ahead of backfill after an import.
+        @weakify(self);
+        self->_thumbnailScheduler = [[AssetWorkScheduler alloc] initWithName:@"thumbnails"
+                                                          maximumConcurrency:kThumbnailMaximumConcurrency
+                                                                   batchSize:kThumbnailBatchSize
+                                                                 targetQueue:dispatch_get_global_queue(QOS_CLASS_UTILITY, 0)
+                                                                batchHandler:^(NSArray<NSManagedObjectID *> * _Nonnull assetIDs, void (^ _Nonnull itemCompleted)(NSManagedObjectID * _Nonnull)) {
+            @strongify(self);
+            if (nil == self) {
+                for (NSManagedObjectID *assetID in assetIDs) {
+                    itemCompleted(assetID);
+                }
+                return;
+            }
+            [self generateThumbnailsForBatch:assetIDs
+                               itemCompleted:itemCompleted];
+        }];
+        // 3. The text scanning used to be on a serial queue, as doing it concurrently on the
+        //    global queues backed everything up in [VNImageRequestHandler performRequests...] and
+        //    swamped the system. Now how many we run at once follows the machine's load instead.
+        NSUInteger textScanMaximumConcurrency = MAX([[NSProcessInfo processInfo] activeProcessorCount] / 2, (NSUInteger)1);
+        self->_textScheduler = [[AssetWorkScheduler alloc] initWithName:@"text"
+                                                     maximumConcurrency:1
+                                                              batchSize:kTextScanBatchSize
+                                                            targetQueue:dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0)
+                                                           batchHandler:^(NSArray<NSManagedObjectID *> * _Nonnull assetIDs, void (^ _Nonnull itemCompleted)(NSManagedObjectID * _Nonnull)) {
+            @strongify(self);
+            if (nil == self) {
+                for (NSManagedObjectID *assetID in assetIDs) {
+                    itemCompleted(assetID);
+                }
+                return;
+            }
+            [self generateScannedTextForBatch:assetIDs
+                                itemCompleted:itemCompleted];
+        }];
+        self->_textThrottle = [[AssetWorkThrottle alloc] initWithScheduler:self->_textScheduler
+                                                        minimumConcurrency:1
+                                                        maximumConcurrency:textScanMaximumConcurrency
+                                                                  interval:kTextScanThrottleInterval];
+        [self->_textThrottle start];
 
         self->_updateDelegateQ = delegateUpdateQueue;
     }
@@ -87,50 +295,72 @@ typedef NS_ERROR_ENUM(LibraryWriteCoordinatorErrorDomain, LibraryWriteCoordinato
 
 - (void)generateThumbnailForAssets:(NSSet<NSManagedObjectID *> *)assetIDs {
     NSParameterAssert(nil != assetIDs);
+    [self.thumbnailScheduler scheduleAssets:assetIDs
+                                   priority:AssetWorkPriorityBackground];
+}
 
-    @weakify(self);
-    for (NSManagedObjectID *assetID in assetIDs) {
-        dispatch_async(self.thumbnailWorkerQ, ^{
-            @strongify(self);
-            if (nil == self) {
-                return;
-            }
-            NSError *error = nil;
-            [self generateQuicklookPreviewForAssetWithID:assetID
-                                                   error:&error];
-            if (nil != error) {
-                NSLog(@"Failed to generate thumbnail: %@", error);
-            }
-        });
-    }
+- (void)generateThumbnailForVisibleAssets:(NSSet<NSManagedObjectID *> *)assetIDs {
+    NSParameterAssert(nil != assetIDs);
+    [self.thumbnailScheduler scheduleAssets:assetIDs
+                                   priority:AssetWorkPriorityVisible];
 }
 
 - (void)generateScannedTextForAssets:(NSSet<NSManagedObjectID *> *)assetIDs {
     NSParameterAssert(nil != assetIDs);
+    [self.textScheduler scheduleAssets:assetIDs
+                              priority:AssetWorkPriorityBackground];
+}
 
-    @weakify(self);
-    for (NSManagedObjectID *assetID in assetIDs) {
-        dispatch_async(self.textWorkerQ, ^{
-            @strongify(self);
-            if (nil == self) {
-                return;
-            }
-            NSError *error = nil;
-            [self generateScannedText:assetID
-                                error:&error];
+- (NSUInteger)pendingScannedTextCount {
+    return [self.textScheduler outstandingCount];
+}
+
+- (void)countUncountedTags {
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        NSFetchRequest *fetchRequest = [Tag fetchRequest];
+        [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"assetCount == nil"]];
+        NSError *innerError = nil;
+        NSArray<Tag *> *tags = [self.managedObjectContext executeFetchRequest:fetchRequest
+                                                                        error:&innerError];
+        if (nil != innerError) {
+            NSAssert(nil == tags, @"Got error and fetch results.");
             if (nil != error) {
-                NSLog(@"Failed to scan text: %@", error);
+                *error = innerError;
             }
+            return NO;
+        }
+        NSAssert(nil != tags, @"Got no error and no fetch results.");
 
-        });
+        for (Tag *tag in tags) {
+            [tag updateAssetCount];
+            [changes.updated addObject:tag.objectID];
+        }
+        return YES;
     }
+              completion:^(BOOL success, NSError * _Nullable error) {
+        if (NO == success) {
+            NSLog(@"Failed to count tags: %@", error);
+        }
+    }];
 }
 
 - (void)carryOutCleanUp {
     // thumbnails that are missing will auto generate on view, so here we focus
-    // on scanned text for now.
+    // on scanned text, and on reclaiming space from old thumbnails. Any asset without scanned text
+    // is still in the backlog, so this is also how a scan interrupted by quitting gets picked up.
+    ThumbnailPackStore *thumbnailStore = self.thumbnailStore;
+    if (nil != thumbnailStore) {
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0), ^{
+            NSError *error = nil;
+            BOOL success = [thumbnailStore compactIfNeeded:&error];
+            if (NO == success) {
+                NSLog(@"Failed to compact thumbnails: %@", error);
+            }
+        });
+    }
+
     @weakify(self);
-    dispatch_async(self.dataQ, ^{
+    metrics_dispatch_async(self.dataQ, ^{
         @strongify(self);
         if (nil == self) {
             return;
@@ -139,9 +369,11 @@ typedef NS_ERROR_ENUM(LibraryWriteCoordinatorErrorDomain, LibraryWriteCoordinato
         [self.managedObjectContext performBlockAndWait:^{
             NSError *error = nil;
             NSFetchRequest *unscanned = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
-            [unscanned setPredicate:[NSPredicate predicateWithFormat: @"scannedText == nil"]];
+            [unscanned setPredicate:[Asset awaitingTextScanPredicate]];
+            MetricsIntervalToken fetchInterval = metrics_interval_begin(MetricsIntervalFetch);
             NSArray<Asset *> *result = [self.managedObjectContext executeFetchRequest:unscanned
                                                                                 error:&error];
+            metrics_interval_end(fetchInterval);
             if (nil != error) {
                 NSLog(@"Failed to find unscanned images: %@", error);
                 return;
@@ -155,743 +387,1119 @@ typedef NS_ERROR_ENUM(LibraryWriteCoordinatorErrorDomain, LibraryWriteCoordinato
 }
 
 
-#pragma mark -
+#pragma mark - Commands
 
-- (BOOL)generateScannedText:(NSManagedObjectID *)itemID
-                      error:(NSError **)error {
-    NSParameterAssert(nil != itemID);
-    dispatch_assert_queue(self.textWorkerQ);
-    dispatch_assert_queue_not(self.dataQ);
-    id<LibraryWriteCoordinatorDelegate> thumbnailDelegate = self.thumbnailDelegate;
+// Callers never wait on dataQ: the command is queued, and the first one to arrive after a quiet
+// spell schedules a run of everything that's queued by then.
+- (void)enqueueCommand:(BOOL (^)(LibraryWriteChanges *changes, NSError **error))work
+            completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion {
+    [self enqueueCommand:work
+                  atomic:YES
+              completion:completion];
+}
 
-    __block NSURL *secureURL = nil;
-    __block NSError *innerError = nil;
-    dispatch_sync(self.dataQ, ^{
-        Asset *asset = [self.managedObjectContext existingObjectWithID:itemID
-                                                                 error:&innerError];
-        if (nil != innerError) {
-            NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", itemID, innerError.localizedDescription);
-            return;
-        }
-        NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", itemID);
+// For commands that save as they go or write straight to the store. See LibraryWriteCommand.
+- (void)enqueueNonAtomicCommand:(BOOL (^)(LibraryWriteChanges *changes, NSError **error))work
+                     completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion {
+    [self enqueueCommand:work
+                  atomic:NO
+              completion:completion];
+}
 
-        secureURL = [asset decodeSecureURL:&innerError];
-        if (nil != innerError) {
-            NSAssert(nil == secureURL, @"Got error and value");
-            return;
+- (void)enqueueCommand:(BOOL (^)(LibraryWriteChanges *changes, NSError **error))work
+                atomic:(BOOL)atomic
+            completion:(nullable void (^)(BOOL success, NSError * _Nullable error))completion {
+    NSParameterAssert(nil != work);
+
+    LibraryWriteCommand *command = [[LibraryWriteCommand alloc] initWithWork:work
+                                                                      atomic:atomic
+                                                                  completion:completion];
+    __block BOOL scheduleRun = NO;
+    metrics_dispatch_sync(self.commandQ, ^{
+        [self.pendingCommands addObject:command];
+        if (NO == self.commandRunScheduled) {
+            self.commandRunScheduled = YES;
+            scheduleRun = YES;
         }
-        NSAssert(nil != secureURL, @"Got no error and no value");
-
     });
-    if (nil != innerError) {
-        if (nil != error) {
-            *error = innerError;
-        }
-        return NO;
+    if (NO == scheduleRun) {
+        return;
     }
 
-    __block NSImage* image = nil;
-    [secureURL secureAccessWithBlock: ^(NSURL *url, BOOL canAccess) {
-        if (NO == canAccess) {
-            innerError = [NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
-                                             code:LibraryWriteCoordinatorErrorSecurePathNotAccessible
-                                         userInfo:@{@"URL": url, @"ID": itemID}];
+    @weakify(self);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kWriteCoalescingInterval * NSEC_PER_SEC)), self.dataQ, ^{
+        @strongify(self);
+        if (nil == self) {
             return;
         }
+        [self runPendingCommands];
+    });
+}
 
-        image = [[NSImage alloc] initByReferencingURL:url];
-    }];
-    if (nil == image) {
-        // TODO: we could error if we know this this was an image type, but otherwise just assume
-        // this is success for non-image types
-        return YES;
-    }
-
-    CGImageRef cgImage = [image CGImageForProposedRect:nil
-                                               context:nil
-                                                 hints:nil];
-    // Surprisingly we can get a NSImage object from non-image files, but this will be nil if it
-    // can't open them.
-    if (NULL == cgImage) {
-        // TODO: we could error if we know this this was an image type, but otherwise just assume
-        // this is success for non-image types
-        return YES;
+// Runs everything queued in order. Atomic commands that are next to each other are saved as one
+// transaction, and if that save fails it is rolled back and each of them is told, other than ones
+// that had already failed, which get their own error. A non-atomic command is run and saved on its
+// own, after everything before it has been saved. The delegate then gets a single update for all
+// that was saved, after which the callbacks are called in the order the commands were queued.
+- (void)runPendingCommands {
+    dispatch_assert_queue(self.dataQ);
+
+    __block NSArray<LibraryWriteCommand *> *commands = nil;
+    metrics_dispatch_sync(self.commandQ, ^{
+        commands = [NSArray arrayWithArray:self.pendingCommands];
+        [self.pendingCommands removeAllObjects];
+        self.commandRunScheduled = NO;
+    });
+    if (0 == [commands count]) {
+        return;
     }
 
-    VNRecognizeTextRequest *request = [[VNRecognizeTextRequest alloc] initWithCompletionHandler:^(VNRequest * _Nonnull request, NSError * _Nullable error) {
-        if (nil != error) {
-            // TODO: Needs own callback
-            [thumbnailDelegate libraryWriteCoordinator:self
-                                      thumbnailForItem:itemID
-                             generationFailedWithError:error];
-            return;
-        }
-        NSMutableSet<NSString *> *foundWords = [NSMutableSet set];
-        NSArray<VNObservation *> *observations = request.results;
-        for (VNObservation *observation in observations) {
-            NSAssert([observation isKindOfClass:[VNRecognizedTextObservation class]], @"Expected text observation");
-            NSArray<VNRecognizedText *> *potentialTexts = [(VNRecognizedTextObservation *)observation topCandidates:3];
-            NSArray<NSString *> *qualityTexts = [potentialTexts compactMapUsingBlock:^id _Nullable(VNRecognizedText * _Nonnull text) {
-                return text.confidence >= 1.0 ? text.string : nil;
-            }];
-
-            NLTagger *tagger = [[NLTagger alloc] initWithTagSchemes:@[NLTagSchemeNameTypeOrLexicalClass]];
-            for (NSString *string in qualityTexts) {
-                [tagger setString:string];
-                [tagger enumerateTagsInRange:NSMakeRange(0, [string length] - 1)
-                                        unit:NLTokenUnitWord
-                                      scheme:NLTagSchemeNameTypeOrLexicalClass
-                                     options:NLTaggerOmitWhitespace | NLTaggerOmitPunctuation
-                                  usingBlock:^(__unused NLTag  _Nullable tag, NSRange tokenRange, __unused BOOL * _Nonnull stop) {
-                    // TODO: Look at using the tag to help further cut out things
-                    NSString *substring = [string substringWithRange:tokenRange];
-                    [foundWords addObject:[substring lowercaseString]];
-                }];
+    LibraryWriteChanges *changes = [[LibraryWriteChanges alloc] init];
+    NSMutableArray<id> *commandErrors = [NSMutableArray arrayWithCapacity:[commands count]];
+    [self.managedObjectContext performBlockAndWait:^{
+        LibraryWriteChanges *transactionChanges = [[LibraryWriteChanges alloc] init];
+        NSUInteger transactionStart = 0;
+        for (NSUInteger idx = 0; idx < [commands count]; idx++) {
+            LibraryWriteCommand *command = commands[idx];
+            if (NO == command.atomic) {
+                [self saveCommandsInRange:NSMakeRange(transactionStart, idx - transactionStart)
+                       transactionChanges:transactionChanges
+                                  changes:changes
+                            commandErrors:commandErrors];
+                transactionChanges = [[LibraryWriteChanges alloc] init];
             }
-        }
-
-        NSString *searchableStringForDatabase = [[foundWords allObjects] componentsJoinedByString:@" "];
 
-        // now we've generated the text summary, we should update the record
-        dispatch_sync(self.dataQ, ^{
+            LibraryWriteChanges *commandChanges = [[LibraryWriteChanges alloc] init];
             NSError *error = nil;
-            Asset *asset = [self.managedObjectContext existingObjectWithID:itemID
-                                                                     error:&error];
-            if (nil != error) {
-                NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", itemID, innerError.localizedDescription);
-                [thumbnailDelegate libraryWriteCoordinator:self
-                                 thumbnailForItem:itemID
-                        generationFailedWithError:error];
-                return;
+            BOOL success = command.work(commandChanges, &error);
+            if (success) {
+                [transactionChanges addChanges:commandChanges];
+                [commandErrors addObject:[NSNull null]];
+            } else {
+                [commandErrors addObject:nil != error ? error : [NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
+                                                                                    code:LibraryWriteCoordinatorErrorUnknown
+                                                                                userInfo:nil]];
+                if (NO == command.atomic) {
+                    // Drop what it hadn't saved yet, but what it had is in the store now
+                    [self.managedObjectContext rollback];
+                    [changes addChanges:commandChanges];
+                }
             }
-            NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", itemID);
 
-            asset.scannedText = searchableStringForDatabase;
-            BOOL success = [self.managedObjectContext save:&error];
-            if (nil != error) {
-                NSAssert(NO == success, @"Got error and success from saving.");
-                [thumbnailDelegate libraryWriteCoordinator:self
-                                 thumbnailForItem:itemID
-                        generationFailedWithError:error];
-                return;
+            if (NO == command.atomic) {
+                [self saveCommandsInRange:NSMakeRange(idx, 1)
+                       transactionChanges:transactionChanges
+                                  changes:changes
+                            commandErrors:commandErrors];
+                transactionChanges = [[LibraryWriteChanges alloc] init];
+                transactionStart = idx + 1;
             }
-            NSAssert(NO != success, @"Got no error and no success from saving.");
-
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSUpdatedObjectsKey:@[itemID]}];
-            });
-        });
+        }
+        [self saveCommandsInRange:NSMakeRange(transactionStart, [commands count] - transactionStart)
+               transactionChanges:transactionChanges
+                          changes:changes
+                    commandErrors:commandErrors];
+    }];
 
+    NSMutableArray<dispatch_block_t> *callbacks = [NSMutableArray arrayWithCapacity:[commands count]];
+    [commands enumerateObjectsUsingBlock:^(LibraryWriteCommand * _Nonnull command, NSUInteger idx, __unused BOOL * _Nonnull stop) {
+        if (nil == command.completion) {
+            return;
+        }
+        NSError *error = [NSNull null] != commandErrors[idx] ? commandErrors[idx] : nil;
+        dispatch_block_t callback = ^{
+            command.completion(nil == error, error);
+        };
+        [callbacks addObject:callback];
     }];
-    [request setRecognitionLevel:VNRequestTextRecognitionLevelAccurate];
+    NSDictionary<NSString *, NSArray<NSManagedObjectID *> *> *notificationData = [changes notificationData];
+    if ((0 == [notificationData count]) && (0 == [callbacks count])) {
+        return;
+    }
 
-    VNImageRequestHandler *handler = [[VNImageRequestHandler alloc] initWithCGImage:cgImage
-                                                                            options:@{}];
-    return [handler performRequests:@[request]
-                              error:error];
+    // The callbacks go via updateDelegateQ even when there's no update, so that they can't overtake
+    // the update from an earlier run.
+    dispatch_queue_t callbackQ = self.callbackQ;
+    @weakify(self);
+    dispatch_async(self.updateDelegateQ, ^{
+        @strongify(self);
+        if ((nil != self) && (0 < [notificationData count])) {
+            [self.delegate modelCoordinator:self
+                                  didUpdate:notificationData];
+        }
+        if (0 == [callbacks count]) {
+            return;
+        }
+        dispatch_async(callbackQ, ^{
+            for (dispatch_block_t callback in callbacks) {
+                callback();
+            }
+        });
+    });
 }
 
-- (BOOL)generateQuicklookPreviewForAssetWithID:(NSManagedObjectID *)itemID
-                                         error:(NSError **)error {
-    NSParameterAssert(nil != itemID);
-    dispatch_assert_queue(self.thumbnailWorkerQ);
-    dispatch_assert_queue_not(self.dataQ);
-    id<LibraryWriteCoordinatorDelegate> thumbnailDelegate = self.thumbnailDelegate;
+// Saves the commands in the range as one transaction. If that works what they changed is added to
+// changes, and if not it's all rolled back and the save error is given to every command in the
+// range that hadn't already failed. Only call on managedObjectContext's queue.
+- (void)saveCommandsInRange:(NSRange)range
+         transactionChanges:(LibraryWriteChanges *)transactionChanges
+                    changes:(LibraryWriteChanges *)changes
+              commandErrors:(NSMutableArray<id> *)commandErrors {
+    NSParameterAssert(nil != transactionChanges);
+    NSParameterAssert(nil != changes);
+    NSParameterAssert(nil != commandErrors);
+    if (0 == range.length) {
+        return;
+    }
 
-    __block NSURL *secureURL = nil;
-    __block NSURL *assetPath = nil;
-    __block NSError *innerError = nil;
-    dispatch_sync(self.dataQ, ^{
-        Asset *asset = [self.managedObjectContext existingObjectWithID:itemID
-                                                                 error:&innerError];
-        if (nil != innerError) {
-            NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", itemID, innerError.localizedDescription);
+    if ([self.managedObjectContext hasChanges]) {
+        NSError *saveError = nil;
+        MetricsIntervalToken saveInterval = metrics_interval_begin(MetricsIntervalSave);
+        BOOL success = [self.managedObjectContext save:&saveError];
+        metrics_interval_end(saveInterval);
+        if (nil != saveError) {
+            NSAssert(NO == success, @"Got error and success from save.");
+            [self.managedObjectContext rollback];
+            for (NSUInteger idx = range.location; idx < NSMaxRange(range); idx++) {
+                if ([NSNull null] == commandErrors[idx]) {
+                    commandErrors[idx] = saveError;
+                }
+            }
             return;
         }
-        NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", itemID);
+        NSAssert(NO != success, @"Got no success and error from save.");
+    }
+    [changes addChanges:transactionChanges];
+}
 
-        secureURL = [asset decodeSecureURL:&innerError];
-        if (nil != innerError) {
-            NSAssert(nil == secureURL, @"Got error and value");
-            return;
-        }
-        NSAssert(nil != secureURL, @"Got no error and no value");
 
-        if (![[asset.path path] containsString:@"embersnap"]) {
-            // Going from UUID/original/filename.blah to just UUID/
-            assetPath = [[asset.path URLByDeletingLastPathComponent] URLByDeletingLastPathComponent];
-        } else {
-            assetPath = [asset.path URLByDeletingLastPathComponent];
+#pragma mark -
+
+// Batch updates go straight to the store without loading any objects, but only SQLite stores can
+// do them, so anything else (such as the in memory stores in tests) goes object by object.
+// Only call on managedObjectContext's queue.
+- (BOOL)canBatchUpdate {
+    for (NSPersistentStore *store in self.managedObjectContext.persistentStoreCoordinator.persistentStores) {
+        if (NO == [store.type isEqualToString:NSSQLiteStoreType]) {
+            return NO;
         }
-    });
+    }
+    return YES;
+}
+
+// Returns the IDs of the assets changed, having merged the change into our own context so it
+// doesn't hold on to old values. Only call on managedObjectContext's queue.
+- (nullable NSArray<NSManagedObjectID *> *)batchUpdateAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+                                                   predicate:(nullable NSPredicate *)predicate
+                                                  properties:(NSDictionary<NSString *, id> *)properties
+                                                       error:(NSError **)error {
+    NSParameterAssert(nil != assetIDs);
+    NSParameterAssert(nil != properties);
+    if (0 == [assetIDs count]) {
+        return @[];
+    }
+
+    NSPredicate *selected = [NSPredicate predicateWithFormat:@"SELF IN %@", assetIDs];
+    NSBatchUpdateRequest *request = [[NSBatchUpdateRequest alloc] initWithEntityName:NSStringFromClass([Asset class])];
+    [request setPredicate:nil != predicate ? [NSCompoundPredicate andPredicateWithSubpredicates:@[selected, predicate]] : selected];
+    [request setPropertiesToUpdate:properties];
+    [request setResultType:NSUpdatedObjectIDsResultType];
+
+    NSError *innerError = nil;
+    NSBatchUpdateResult *result = [self.managedObjectContext executeRequest:request
+                                                                      error:&innerError];
     if (nil != innerError) {
+        NSAssert(nil == result, @"Got error and batch update result.");
         if (nil != error) {
             *error = innerError;
         }
-        return NO;
+        return nil;
     }
+    NSAssert(nil != result, @"Got no error and no batch update result.");
 
-    NSAssert(nil != assetPath, @"Expected assert path by now");
-    NSURL *thumbnailFile = [assetPath URLByAppendingPathComponent:@"thumbnail.png"];
+    NSArray<NSManagedObjectID *> *updated = result.result;
+    [NSManagedObjectContext mergeChangesFromRemoteContextSave:@{NSUpdatedObjectsKey:updated}
+                                                 intoContexts:@[self.managedObjectContext]];
+    return updated;
+}
 
-    [secureURL secureAccessWithBlock: ^(NSURL *url, BOOL canAccess) {
-        if (NO == canAccess) {
-            innerError = [NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
-                                             code:LibraryWriteCoordinatorErrorSecurePathNotAccessible
-                                         userInfo:@{@"URL": url, @"ID": itemID}];
-            return;
-        }
-        QLThumbnailGenerationRequest *qlRequest = [[QLThumbnailGenerationRequest alloc] initWithFileAtURL:secureURL
-                                                                                                     size:CGSizeMake(400.0, 400.0)
-                                                                                                    scale:2.0
-                                                                                      representationTypes:QLThumbnailGenerationRequestRepresentationTypeThumbnail];
-        QLThumbnailGenerator *generator = [QLThumbnailGenerator sharedGenerator];
-        @weakify(self);
-        [generator generateRepresentationsForRequest:qlRequest
-                                       updateHandler:^(QLThumbnailRepresentation * _Nullable thumbnail, QLThumbnailRepresentationType type, NSError * _Nullable error) {
-            @strongify(self);
-            if (nil == self) {
-                return;
-            }
++ (BOOL)groupUpdateIsChunked:(NSSet<NSManagedObjectID *> *)assetIDs {
+    return [assetIDs count] > kRelationshipUpdateChunkSize;
+}
 
-            NSImage *image = nil;
+// Records each chunk in changes as it goes, as for big selections the chunks already saved stay saved
+// if a later one fails. Only call on managedObjectContext's queue.
+- (BOOL)updateAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+             inGroup:(NSManagedObjectID *)groupID
+              adding:(BOOL)adding
+             changes:(LibraryWriteChanges *)changes
+               error:(NSError **)error {
+    NSParameterAssert(nil != assetIDs);
+    NSParameterAssert(nil != groupID);
+    NSParameterAssert(nil != changes);
 
+    NSError *innerError = nil;
+    Group *group = [self.managedObjectContext existingObjectWithID:groupID
+                                                             error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == group, @"Got error and item fetching object with ID %@: %@", groupID, innerError.localizedDescription);
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != group, @"Got no error but also no group fetching object with ID %@", groupID);
+
+    // Small selections are left for the command run to save along with everything else, but big
+    // ones save as they go so memory doesn't grow with the selection, which is why the commands
+    // for those aren't atomic.
+    NSArray<NSManagedObjectID *> *allAssetIDs = [assetIDs allObjects];
+    BOOL chunked = [LibraryWriteCoordinator groupUpdateIsChunked:assetIDs];
+    for (NSUInteger start = 0; start < [allAssetIDs count]; start += kRelationshipUpdateChunkSize) {
+        NSRange range = NSMakeRange(start, MIN(kRelationshipUpdateChunkSize, [allAssetIDs count] - start));
+        // One fetch for the chunk, with the inverse relationship that'll need updating, rather
+        // than faulting in each asset in turn.
+        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:NSStringFromClass([Asset class])];
+        [request setPredicate:[NSPredicate predicateWithFormat:@"SELF IN %@", [allAssetIDs subarrayWithRange:range]]];
+        [request setRelationshipKeyPathsForPrefetching:@[@"groups"]];
+        MetricsIntervalToken fetchInterval = metrics_interval_begin(MetricsIntervalFetch);
+        NSArray<Asset *> *assets = [self.managedObjectContext executeFetchRequest:request
+                                                                            error:&innerError];
+        metrics_interval_end(fetchInterval);
+        if (nil != innerError) {
+            NSAssert(nil == assets, @"Got error and fetch results.");
             if (nil != error) {
-                // If quicklook fails to generate a preview, for now fall back to icon if we can
-                NSAssert(nil == thumbnail, @"Got error and thumbnail");
-                image = [[NSWorkspace sharedWorkspace] iconForFile:[secureURL path]];
-                if (nil == error) {
-                    // TODO: This should be more about the icon
-                    [thumbnailDelegate libraryWriteCoordinator:self
-                                     thumbnailForItem:itemID
-                            generationFailedWithError:error];
-                    return;
-                }
-            } else {
-                NSAssert(nil != thumbnail, @"Got no error and no thumbnail");
-                NSAssert(type == QLThumbnailRepresentationTypeThumbnail, @"Asked for thumbnail, got %ld", (long)type);
-                image = [thumbnail NSImage];
+                *error = innerError;
             }
+            return NO;
+        }
+        NSAssert(nil != assets, @"Got no error and no fetch results.");
 
-            // TODO: replace asserts once we have something working
-            NSData *tiffData = [image TIFFRepresentation];
-            if (nil == tiffData) {
-                [thumbnailDelegate libraryWriteCoordinator:self
-                                 thumbnailForItem:itemID
-                        generationFailedWithError:[NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
-                                                                      code:LibraryWriteCoordinatorErrorCouldNotReadThumbnail
-                                                                  userInfo:@{}]];
-                return;
-            }
-            NSBitmapImageRep *imageRep = [[NSBitmapImageRep alloc] initWithData:tiffData];
-            if (nil == imageRep) {
-                [thumbnailDelegate libraryWriteCoordinator:self
-                                 thumbnailForItem:itemID
-                        generationFailedWithError:[NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
-                                                                      code:LibraryWriteCoordinatorErrorCouldNotCreateImageRep
-                                                                  userInfo:@{}]];
-                return;
-            }
-            NSData *pngData = [imageRep representationUsingType:NSBitmapImageFileTypePNG
-                                                     properties:@{}];
-            if (nil == pngData) {
-                [thumbnailDelegate libraryWriteCoordinator:self
-                                 thumbnailForItem:itemID
-                        generationFailedWithError:[NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
-                                                                      code:LibraryWriteCoordinatorErrorCouldNotGeneratePNGData
-                                                                  userInfo:@{}]];
-                return;
-            }
-            BOOL success = [pngData writeToURL:thumbnailFile
-                                    atomically:YES];
-            if (NO == success) {
-                [thumbnailDelegate libraryWriteCoordinator:self
-                                 thumbnailForItem:itemID
-                        generationFailedWithError:[NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
-                                                                      code:LibraryWriteCoordinatorErrorCouldNotWriteThumbnailFile
-                                                                  userInfo:@{}]];
-                return;
+        if (adding) {
+            [group addContains:[NSSet setWithArray:assets]];
+        } else {
+            [group removeContains:[NSSet setWithArray:assets]];
+        }
+        [changes.updated addObjectsFromArray:[allAssetIDs subarrayWithRange:range]];
+        [changes.updated addObject:groupID];
+        if (NO == chunked) {
+            continue;
+        }
+        MetricsIntervalToken saveInterval = metrics_interval_begin(MetricsIntervalSave);
+        BOOL success = [self.managedObjectContext save:&innerError];
+        metrics_interval_end(saveInterval);
+        if (nil != innerError) {
+            NSAssert(NO == success, @"Got error and success");
+            if (nil != error) {
+                *error = innerError;
             }
+            return NO;
+        }
+        NSAssert(NO != success, @"Got no error and no success");
+
+        for (Asset *asset in assets) {
+            [self.managedObjectContext refreshObject:asset
+                                        mergeChanges:NO];
+        }
+    }
+    return YES;
+}
 
-            // now we've generated the thumbnail, we should update the record
-            dispatch_sync(self.dataQ, ^{
-                Asset *asset = [self.managedObjectContext existingObjectWithID:itemID
+// Bookmarks found to be stale while resolving a batch are only stored here, as part of the
+// batch's command, so they're saved and reported like any other change. Only call on
+// managedObjectContext's queue.
+- (void)storeRefreshedBookmarks:(NSDictionary<NSManagedObjectID *, NSData *> *)refreshedBookmarks
+                        changes:(LibraryWriteChanges *)changes {
+    NSParameterAssert(nil != refreshedBookmarks);
+    NSParameterAssert(nil != changes);
+
+    for (NSManagedObjectID *assetID in refreshedBookmarks) {
+        NSError *innerError = nil;
+        Asset *asset = [self.managedObjectContext existingObjectWithID:assetID
+                                                                 error:&innerError];
+        if (nil != innerError) {
+            NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", assetID, innerError.localizedDescription);
+            NSLog(@"Failed to update bookmark for %@: %@", assetID, innerError);
+            continue;
+        }
+        NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", assetID);
+        asset.bookmark = refreshedBookmarks[assetID];
+        [changes.updated addObject:assetID];
+    }
+}
+
+- (void)generateScannedTextForBatch:(NSArray<NSManagedObjectID *> *)assetIDs
+                      itemCompleted:(void (^)(NSManagedObjectID *assetID))itemCompleted {
+    NSParameterAssert(nil != assetIDs);
+    NSParameterAssert(nil != itemCompleted);
+    dispatch_assert_queue_not(self.dataQ);
+
+    NSMutableDictionary<NSManagedObjectID *, NSURL *> *secureURLs = [NSMutableDictionary dictionaryWithCapacity:[assetIDs count]];
+    NSMutableDictionary<NSManagedObjectID *, NSData *> *refreshedBookmarks = [NSMutableDictionary dictionary];
+    metrics_dispatch_sync(self.dataQ, ^{
+        [self.managedObjectContext performBlockAndWait:^{
+            for (NSManagedObjectID *assetID in assetIDs) {
+                NSError *innerError = nil;
+                Asset *asset = [self.managedObjectContext existingObjectWithID:assetID
                                                                          error:&innerError];
                 if (nil != innerError) {
-                    NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", itemID, innerError.localizedDescription);
-                    return;
+                    NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", assetID, innerError.localizedDescription);
+                    NSLog(@"Failed to scan text: %@", innerError);
+                    continue;
                 }
-                NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", itemID);
+                NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", assetID);
 
-                asset.thumbnailPath = thumbnailFile;
-                BOOL success = [self.managedObjectContext save:&innerError];
+                NSData *refreshedBookmark = nil;
+                NSURL *secureURL = [asset decodeSecureURLRefreshingBookmark:&refreshedBookmark
+                                                                      error:&innerError];
                 if (nil != innerError) {
-                    NSAssert(NO == success, @"Got error and success from saving.");
-                    return;
+                    NSAssert(nil == secureURL, @"Got error and value");
+                    NSLog(@"Failed to scan text: %@", innerError);
+                    continue;
                 }
-                NSAssert(NO != success, @"Got no error and no success from saving.");
-
-                @weakify(self);
-                dispatch_async(self.updateDelegateQ, ^{
-                    @strongify(self);
-                    if (nil == self) {
-                        return;
-                    }
-                    [self.delegate modelCoordinator:self
-                                didUpdate:@{NSUpdatedObjectsKey:@[itemID]}];
-                });
-            });
+                NSAssert(nil != secureURL, @"Got no error and no value");
+                secureURLs[assetID] = secureURL;
+                if (nil != refreshedBookmark) {
+                    refreshedBookmarks[assetID] = refreshedBookmark;
+                }
+            }
         }];
-    }];
-    if (nil != innerError) {
+    });
+
+    // The scheduler only gives us as many assets as it thinks the machine can cope with, so do
+    // them all at once, with each file's scope opened just the once for the batch.
+    NSArray<NSManagedObjectID *> *work = [secureURLs allKeys];
+    NSArray<NSURL *> *openedURLs = [NSURL beginSecureAccessToURLs:[secureURLs allValues]];
+    NSMutableDictionary<NSManagedObjectID *, NSString *> *results = [NSMutableDictionary dictionaryWithCapacity:[work count]];
+    dispatch_queue_t resultsQ = dispatch_queue_create("com.digitalflapjack.LibraryWriteCoordinator.textResultsQ", DISPATCH_QUEUE_SERIAL);
+    dispatch_apply([work count], DISPATCH_APPLY_AUTO, ^(size_t index) {
+        NSManagedObjectID *assetID = work[index];
+        NSError *error = nil;
+        MetricsIntervalToken scanInterval = metrics_interval_begin(MetricsIntervalScanText);
+        NSString *scannedText = [self scannedTextForAssetWithID:assetID
+                                                      secureURL:secureURLs[assetID]
+                                                          error:&error];
+        metrics_interval_end(scanInterval);
         if (nil != error) {
-            *error = innerError;
+            NSAssert(nil == scannedText, @"Got error and text");
+            NSLog(@"Failed to scan text for %@: %@", assetID, error);
+        } else {
+            dispatch_sync(resultsQ, ^{
+                results[assetID] = scannedText;
+            });
         }
-        return NO;
+    });
+    [NSURL endSecureAccessToURLs:openedURLs];
+    for (NSManagedObjectID *assetID in assetIDs) {
+        itemCompleted(assetID);
+    }
+    if ((0 == [results count]) && (0 == [refreshedBookmarks count])) {
+        return;
     }
 
-    return YES;
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, __unused NSError **error) {
+        [self storeRefreshedBookmarks:refreshedBookmarks
+                              changes:changes];
+        for (NSManagedObjectID *assetID in results) {
+            NSError *innerError = nil;
+            Asset *asset = [self.managedObjectContext existingObjectWithID:assetID
+                                                                     error:&innerError];
+            if (nil != innerError) {
+                NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", assetID, innerError.localizedDescription);
+                NSLog(@"Failed to update scanned text for %@: %@", assetID, innerError);
+                continue;
+            }
+            NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", assetID);
+            asset.scannedText = results[assetID];
+            [changes.updated addObject:assetID];
+        }
+        return YES;
+    }
+              completion:^(BOOL success, NSError * _Nullable error) {
+        if (NO == success) {
+            NSLog(@"Failed to save scanned text: %@", error);
+        }
+    }];
 }
 
-- (void)createGroup:(NSString *)name
-           callback:(void (^)(BOOL success, NSError *error)) callback {
+// Returns the words found in the asset as a single string for searching. Anything that can't be
+// read as an image gets an empty string, so that it leaves the backlog rather than being tried
+// again on every launch.
+- (nullable NSString *)scannedTextForAssetWithID:(NSManagedObjectID *)itemID
+                                       secureURL:(NSURL *)secureURL
+                                           error:(NSError **)error {
+    NSParameterAssert(nil != itemID);
+    NSParameterAssert(nil != secureURL);
     dispatch_assert_queue_not(self.dataQ);
 
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        __block NSManagedObjectID *groupID = nil;
-        [self.managedObjectContext performBlockAndWait:^{
-            Group *group = [NSEntityDescription insertNewObjectForEntityForName:@"Group"
-                                                         inManagedObjectContext:self.managedObjectContext];
-            group.name = name;
-
-            success = [self.managedObjectContext obtainPermanentIDsForObjects:@[group]
-                                                                        error:&error];
-            if ((nil == error) && success) {
-                groupID = group.objectID;
+    __block CGImageRef cgImage = NULL;
+    __block NSError *innerError = nil;
+    [secureURL secureAccessWithBlock: ^(NSURL *url, BOOL canAccess) {
+        if (NO == canAccess) {
+            innerError = [NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
+                                             code:LibraryWriteCoordinatorErrorSecurePathNotAccessible
+                                         userInfo:@{@"URL": url, @"ID": itemID}];
+            return;
+        }
+        cgImage = CreateTextScanImage(url);
+    }];
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+    if (NULL == cgImage) {
+        // TODO: we could error if we know this this was an image type, but otherwise just assume
+        // this is success for non-image types
+        return @"";
+    }
 
-                success = [self.managedObjectContext save:&error];
-            }
-        }];
-        if ((nil == error) && success && (nil != groupID)) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSInsertedObjectsKey:@[groupID]}];
-            });
+    VNRecognizeTextRequest *request = [[VNRecognizeTextRequest alloc] init];
+    [request setRecognitionLevel:VNRequestTextRecognitionLevelAccurate];
+    VNImageRequestHandler *handler = [[VNImageRequestHandler alloc] initWithCGImage:cgImage
+                                                                            options:@{}];
+    BOOL success = [handler performRequests:@[request]
+                                      error:&innerError];
+    CGImageRelease(cgImage);
+    if (nil != innerError) {
+        NSAssert(NO == success, @"Got error and success from text request");
+        if (nil != error) {
+            *error = innerError;
         }
+        return nil;
+    }
+    NSAssert(NO != success, @"Got no error and no success from text request");
+
+    NSMutableSet<NSString *> *foundWords = [NSMutableSet set];
+    NLTagger *tagger = [[NLTagger alloc] initWithTagSchemes:@[NLTagSchemeNameTypeOrLexicalClass]];
+    for (VNObservation *observation in request.results) {
+        NSAssert([observation isKindOfClass:[VNRecognizedTextObservation class]], @"Expected text observation");
+        NSArray<VNRecognizedText *> *potentialTexts = [(VNRecognizedTextObservation *)observation topCandidates:3];
+        NSArray<NSString *> *qualityTexts = [potentialTexts compactMapUsingBlock:^id _Nullable(VNRecognizedText * _Nonnull text) {
+            return text.confidence >= 1.0 ? text.string : nil;
+        }];
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error);
-            });
+        for (NSString *string in qualityTexts) {
+            [tagger setString:string];
+            [tagger enumerateTagsInRange:NSMakeRange(0, [string length] - 1)
+                                    unit:NLTokenUnitWord
+                                  scheme:NLTagSchemeNameTypeOrLexicalClass
+                                 options:NLTaggerOmitWhitespace | NLTaggerOmitPunctuation
+                              usingBlock:^(__unused NLTag  _Nullable tag, NSRange tokenRange, __unused BOOL * _Nonnull stop) {
+                // TODO: Look at using the tag to help further cut out things
+                NSString *substring = [string substringWithRange:tokenRange];
+                [foundWords addObject:[substring lowercaseString]];
+            }];
         }
-    });
+    }
+    return [[foundWords allObjects] componentsJoinedByString:@" "];
 }
 
-- (void)setFavouriteStateOnAssets:(NSSet<NSManagedObjectID *> *)assetIDs
-                         newState:(BOOL)state
-                         callback:(nullable void (^)(BOOL success, NSError * _Nullable error, BOOL newState)) callback {
+- (void)generateThumbnailsForBatch:(NSArray<NSManagedObjectID *> *)assetIDs
+                     itemCompleted:(void (^)(NSManagedObjectID *assetID))itemCompleted {
+    NSParameterAssert(nil != assetIDs);
+    NSParameterAssert(nil != itemCompleted);
     dispatch_assert_queue_not(self.dataQ);
+    id<LibraryWriteCoordinatorDelegate> thumbnailDelegate = self.thumbnailDelegate;
 
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
+    // One trip to dataQ to resolve everything in the batch, rather than one per asset, as that's
+    // where all the thumbnail workers used to end up queued.
+    NSMutableDictionary<NSManagedObjectID *, NSURL *> *secureURLs = [NSMutableDictionary dictionaryWithCapacity:[assetIDs count]];
+    NSMutableDictionary<NSManagedObjectID *, NSURL *> *thumbnailDirectories = [NSMutableDictionary dictionaryWithCapacity:[assetIDs count]];
+    NSMutableDictionary<NSManagedObjectID *, NSError *> *failures = [NSMutableDictionary dictionary];
+    NSMutableDictionary<NSManagedObjectID *, NSData *> *refreshedBookmarks = [NSMutableDictionary dictionary];
+    metrics_dispatch_sync(self.dataQ, ^{
         [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
-                                                                                 error:&error];
-            if (nil != error) {
-                return;
-            }
+            for (NSManagedObjectID *assetID in assetIDs) {
+                NSError *innerError = nil;
+                Asset *asset = [self.managedObjectContext existingObjectWithID:assetID
+                                                                         error:&innerError];
+                if (nil != innerError) {
+                    NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", assetID, innerError.localizedDescription);
+                    failures[assetID] = innerError;
+                    continue;
+                }
+                NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", assetID);
 
-            for (Asset *asset in assets) {
-                asset.favourite = state;
-            }
-            success = [self.managedObjectContext save:&error];
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
+                NSData *refreshedBookmark = nil;
+                NSURL *secureURL = [asset decodeSecureURLRefreshingBookmark:&refreshedBookmark
+                                                                      error:&innerError];
+                if (nil != innerError) {
+                    NSAssert(nil == secureURL, @"Got error and value");
+                    failures[assetID] = innerError;
+                    continue;
                 }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSUpdatedObjectsKey:[assetIDs allObjects]}];
-            });
-        }
+                NSAssert(nil != secureURL, @"Got no error and no value");
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error, state);
-            });
-        }
+                secureURLs[assetID] = secureURL;
+                if (nil != refreshedBookmark) {
+                    refreshedBookmarks[assetID] = refreshedBookmark;
+                }
+                thumbnailDirectories[assetID] = [asset itemDirectory];
+            }
+        }];
     });
-}
 
-- (void)addAssets:(NSSet<NSManagedObjectID *> *)assetIDs
-          toGroup:(NSManagedObjectID *)groupID
-         callback:(void (^)(BOOL success, NSError *error)) callback {
-    dispatch_assert_queue_not(self.dataQ);
+    for (NSManagedObjectID *assetID in failures) {
+        NSLog(@"Failed to generate thumbnail: %@", failures[assetID]);
+        itemCompleted(assetID);
+    }
 
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
-                                                                                 error:&error];
-            if (nil != error) {
+    // The new paths are gathered up as each thumbnail lands, and then written as one command for
+    // the batch, so neither the workers nor QuickLook's callbacks ever block on dataQ. The files
+    // stay open for the batch, rather than each being opened and closed around QuickLook.
+    NSArray<NSURL *> *openedURLs = [NSURL beginSecureAccessToURLs:[secureURLs allValues]];
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t resultsQ = dispatch_queue_create("com.digitalflapjack.LibraryWriteCoordinator.thumbnailResultsQ", DISPATCH_QUEUE_SERIAL);
+    NSMutableDictionary<NSManagedObjectID *, NSURL *> *thumbnailPaths = [NSMutableDictionary dictionaryWithCapacity:[secureURLs count]];
+    @weakify(self);
+    for (NSManagedObjectID *assetID in secureURLs) {
+        dispatch_group_enter(group);
+        MetricsIntervalToken thumbnailInterval = metrics_interval_begin(MetricsIntervalThumbnail);
+        [self generateQuicklookPreviewForAssetWithID:assetID
+                                           secureURL:secureURLs[assetID]
+                                  thumbnailDirectory:thumbnailDirectories[assetID]
+                                          completion:^(NSURL * _Nullable thumbnailPath, NSError * _Nullable error) {
+            metrics_interval_end(thumbnailInterval);
+            @strongify(self);
+            if (nil == self) {
+                itemCompleted(assetID);
+                dispatch_group_leave(group);
                 return;
             }
-
-            Group *group = [self.managedObjectContext existingObjectWithID:groupID
-                                                                     error:&error];
             if (nil != error) {
-                NSAssert(nil == group, @"Got error and item fetching object with ID %@: %@", groupID, error.localizedDescription);
+                [thumbnailDelegate libraryWriteCoordinator:self
+                                          thumbnailForItem:assetID
+                                 generationFailedWithError:error];
+                itemCompleted(assetID);
+                dispatch_group_leave(group);
                 return;
             }
-            NSAssert(nil != group, @"Got no error but also no group fetching object with ID %@", groupID);
-
-            [group addContains:assets];
-
-            success = [self.managedObjectContext save:&error];
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSUpdatedObjectsKey:[[assetIDs allObjects] arrayByAddingObject:groupID]}];
+            itemCompleted(assetID);
+            dispatch_sync(resultsQ, ^{
+                thumbnailPaths[assetID] = thumbnailPath;
             });
-        }
+            dispatch_group_leave(group);
+        }];
+    }
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error);
-            });
+    dispatch_group_notify(group, resultsQ, ^{
+        [NSURL endSecureAccessToURLs:openedURLs];
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        if ((0 == [thumbnailPaths count]) && (0 == [refreshedBookmarks count])) {
+            return;
+        }
+        NSMutableSet<NSURL *> *staleThumbnailPaths = [NSMutableSet set];
+        [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, __unused NSError **error) {
+            [self storeRefreshedBookmarks:refreshedBookmarks
+                                  changes:changes];
+            for (NSManagedObjectID *assetID in thumbnailPaths) {
+                NSError *innerError = nil;
+                Asset *asset = [self.managedObjectContext existingObjectWithID:assetID
+                                                                         error:&innerError];
+                if (nil != innerError) {
+                    NSAssert(nil == asset, @"Got error and item fetching object with ID %@: %@", assetID, innerError.localizedDescription);
+                    NSLog(@"Failed to update thumbnail for %@: %@", assetID, innerError);
+                    continue;
+                }
+                NSAssert(nil != asset, @"Got no error but also no item fetching object with ID %@", assetID);
+                NSURL *thumbnailPath = thumbnailPaths[assetID];
+                if ((nil != asset.thumbnailPath) && (NO == [asset.thumbnailPath isEqual:thumbnailPath])) {
+                    // Most likely thumbnail files from before we had the pack store
+                    [staleThumbnailPaths addObject:asset.thumbnailPath];
+                }
+                asset.thumbnailPath = thumbnailPath;
+                [changes.updated addObject:assetID];
+            }
+            return YES;
         }
+                  completion:^(BOOL success, NSError * _Nullable error) {
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            if (NO == success) {
+                NSLog(@"Failed to save thumbnails: %@", error);
+                return;
+            }
+            for (NSURL *staleThumbnailPath in staleThumbnailPaths) {
+                [ThumbnailPyramid removeThumbnailsForThumbnailPath:staleThumbnailPath
+                                                             store:self.thumbnailStore];
+            }
+        }];
     });
 }
 
-- (void)removeAssets:(NSSet<NSManagedObjectID *> *)assetIDs
-           fromGroup:(NSManagedObjectID *)groupID
-            callback:(void (^)(BOOL success, NSError *error)) callback {
-    dispatch_assert_queue_not(self.dataQ);
+- (void)generateQuicklookPreviewForAssetWithID:(NSManagedObjectID *)itemID
+                                     secureURL:(NSURL *)secureURL
+                            thumbnailDirectory:(NSURL *)thumbnailDirectory
+                                    completion:(void (^)(NSURL * _Nullable thumbnailPath, NSError * _Nullable error))completion {
+    NSParameterAssert(nil != itemID);
+    NSParameterAssert(nil != secureURL);
+    NSParameterAssert(nil != thumbnailDirectory);
+    NSParameterAssert(nil != completion);
+    ThumbnailPackStore *thumbnailStore = self.thumbnailStore;
+
+    [secureURL secureAccessWithBlock: ^(NSURL *url, BOOL canAccess) {
+        if (NO == canAccess) {
+            completion(nil, [NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
+                                                code:LibraryWriteCoordinatorErrorSecurePathNotAccessible
+                                            userInfo:@{@"URL": url, @"ID": itemID}]);
+            return;
+        }
+        // One request at the largest size we store, and then ThumbnailPyramid scales down from
+        // that for the smaller ones.
+        CGFloat largest = [ThumbnailPyramid pixelSizeForSize:ThumbnailSizeLarge] / 2.0;
+        QLThumbnailGenerationRequest *qlRequest = [[QLThumbnailGenerationRequest alloc] initWithFileAtURL:secureURL
+                                                                                                     size:CGSizeMake(largest, largest)
+                                                                                                    scale:2.0
+                                                                                      representationTypes:QLThumbnailGenerationRequestRepresentationTypeThumbnail];
+        QLThumbnailGenerator *generator = [QLThumbnailGenerator sharedGenerator];
+        [generator generateRepresentationsForRequest:qlRequest
+                                       updateHandler:^(QLThumbnailRepresentation * _Nullable thumbnail, QLThumbnailRepresentationType type, NSError * _Nullable error) {
+            CGImageRef image = NULL;
 
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
-                                                                                 error:&error];
             if (nil != error) {
+                // If quicklook fails to generate a preview, for now fall back to icon
+                NSAssert(nil == thumbnail, @"Got error and thumbnail");
+                NSImage *icon = [[NSWorkspace sharedWorkspace] iconForFile:[secureURL path]];
+                NSRect iconRect = NSMakeRect(0.0, 0.0, largest, largest);
+                image = [icon CGImageForProposedRect:&iconRect
+                                             context:nil
+                                               hints:nil];
+            } else {
+                NSAssert(nil != thumbnail, @"Got no error and no thumbnail");
+                NSAssert(type == QLThumbnailRepresentationTypeThumbnail, @"Asked for thumbnail, got %ld", (long)type);
+                image = [thumbnail CGImage];
+            }
+            if (NULL == image) {
+                completion(nil, [NSError errorWithDomain:LibraryWriteCoordinatorErrorDomain
+                                                    code:LibraryWriteCoordinatorErrorCouldNotReadThumbnail
+                                                userInfo:@{@"ID": itemID}]);
                 return;
             }
 
-            Group *group = [self.managedObjectContext existingObjectWithID:groupID
-                                                                     error:&error];
-            if (nil != error) {
-                NSAssert(nil == group, @"Got error and item fetching object with ID %@: %@", groupID, error.localizedDescription);
+            // The asset's directory name is its UUID, so makes a good key in the pack store
+            NSError *innerError = nil;
+            NSURL *thumbnailPath = nil;
+            if (nil != thumbnailStore) {
+                thumbnailPath = [ThumbnailPyramid writeThumbnailsForImage:image
+                                                                      key:[thumbnailDirectory lastPathComponent]
+                                                                  toStore:thumbnailStore
+                                                                    error:&innerError];
+            } else {
+                thumbnailPath = [ThumbnailPyramid writeThumbnailsForImage:image
+                                                              toDirectory:thumbnailDirectory
+                                                                    error:&innerError];
+            }
+            if (nil != innerError) {
+                NSAssert(nil == thumbnailPath, @"Got error and thumbnail path");
+                completion(nil, innerError);
                 return;
             }
-            NSAssert(nil != group, @"Got no error but also no group fetching object with ID %@", groupID);
+            NSAssert(nil != thumbnailPath, @"Got no error and no thumbnail path");
+            completion(thumbnailPath, nil);
+        }];
+    }];
+}
 
-            [group removeContains:assets];
+- (void)createGroup:(NSString *)name
+           callback:(void (^)(BOOL success, NSError *error)) callback {
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        Group *group = [NSEntityDescription insertNewObjectForEntityForName:@"Group"
+                                                     inManagedObjectContext:self.managedObjectContext];
+        group.name = name;
 
-            success = [self.managedObjectContext save:&error];
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSUpdatedObjectsKey:[[assetIDs allObjects] arrayByAddingObject:groupID]}];
-            });
+        NSError *innerError = nil;
+        BOOL success = [self.managedObjectContext obtainPermanentIDsForObjects:@[group]
+                                                                         error:&innerError];
+        if (nil != innerError) {
+            NSAssert(NO == success, @"Got error and success from obtainPermanentIDsForObjects.");
+            [self.managedObjectContext deleteObject:group];
+            if (nil != error) {
+                *error = innerError;
+            }
+            return NO;
         }
+        NSAssert(NO != success, @"Got no success and error from obtainPermanentIDsForObjects.");
+        [changes.inserted addObject:group.objectID];
+        return YES;
+    }
+              completion:callback];
+}
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error);
-            });
+- (void)setFavouriteStateOnAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+                         newState:(BOOL)state
+                         callback:(nullable void (^)(BOOL success, NSError * _Nullable error, BOOL newState)) callback {
+    [self enqueueNonAtomicCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        if ([self canBatchUpdate]) {
+            NSArray<NSManagedObjectID *> *updated = [self batchUpdateAssets:assetIDs
+                                                                  predicate:nil
+                                                                 properties:@{@"favourite": @(state)}
+                                                                      error:error];
+            if (nil == updated) {
+                return NO;
+            }
+            [changes.updated addObjectsFromArray:updated];
+            return YES;
         }
-    });
+
+        NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
+                                                                             error:error];
+        if (nil == assets) {
+            return NO;
+        }
+        for (Asset *asset in assets) {
+            asset.favourite = state;
+        }
+        [changes.updated unionSet:assetIDs];
+        return YES;
+    }
+              completion:nil == callback ? nil : ^(BOOL success, NSError * _Nullable error) {
+        callback(success, error, state);
+    }];
 }
 
-- (void)toggleSoftDeleteAssets:(NSSet<NSManagedObjectID *> *)assetIDs
-                      callback:(void (^)(BOOL success, NSError *error)) callback {
-    dispatch_assert_queue_not(self.dataQ);
+- (void)addAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+          toGroup:(NSManagedObjectID *)groupID
+         callback:(void (^)(BOOL success, NSError *error)) callback {
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        return [self updateAssets:assetIDs
+                          inGroup:groupID
+                           adding:YES
+                          changes:changes
+                            error:error];
+    }
+                  atomic:NO == [LibraryWriteCoordinator groupUpdateIsChunked:assetIDs]
+              completion:callback];
+}
 
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
-                                                                                 error:&error];
-            if (nil != error) {
-                return;
-            }
+- (void)removeAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+           fromGroup:(NSManagedObjectID *)groupID
+            callback:(void (^)(BOOL success, NSError *error)) callback {
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        return [self updateAssets:assetIDs
+                          inGroup:groupID
+                           adding:NO
+                          changes:changes
+                            error:error];
+    }
+                  atomic:NO == [LibraryWriteCoordinator groupUpdateIsChunked:assetIDs]
+              completion:callback];
+}
 
-            for (Asset *asset in assets) {
-                if (nil == asset.deletedAt) {
-                    asset.deletedAt = [NSDate now];
-                } else {
-                    asset.deletedAt = nil;
+- (void)toggleSoftDeleteAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+                      callback:(void (^)(BOOL success, NSError *error)) callback {
+    [self enqueueNonAtomicCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        if ([self canBatchUpdate]) {
+            // Find which are in the trash first, as after the first update we can't tell
+            NSError *innerError = nil;
+            NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:NSStringFromClass([Asset class])];
+            [request setPredicate:[NSPredicate predicateWithFormat:@"(SELF IN %@) AND (deletedAt != nil)", assetIDs]];
+            [request setResultType:NSManagedObjectIDResultType];
+            MetricsIntervalToken fetchInterval = metrics_interval_begin(MetricsIntervalFetch);
+            NSArray<NSManagedObjectID *> *trashedIDs = [self.managedObjectContext executeFetchRequest:request
+                                                                                                error:&innerError];
+            metrics_interval_end(fetchInterval);
+            if (nil != innerError) {
+                NSAssert(nil == trashedIDs, @"Got error and fetch results.");
+                if (nil != error) {
+                    *error = innerError;
                 }
+                return NO;
             }
-
-            success = [self.managedObjectContext save:&error];
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSUpdatedObjectsKey:[assetIDs allObjects]}];
-            });
+            NSAssert(nil != trashedIDs, @"Got no error and no fetch results.");
+            NSSet<NSManagedObjectID *> *restoreIDs = [NSSet setWithArray:trashedIDs];
+            NSMutableSet<NSManagedObjectID *> *trashIDs = [assetIDs mutableCopy];
+            [trashIDs minusSet:restoreIDs];
+
+            NSArray<NSManagedObjectID *> *restored = [self batchUpdateAssets:restoreIDs
+                                                                   predicate:nil
+                                                                  properties:@{@"deletedAt": [NSExpression expressionForConstantValue:nil]}
+                                                                       error:error];
+            if (nil == restored) {
+                return NO;
+            }
+            [changes.updated addObjectsFromArray:restored];
+            NSArray<NSManagedObjectID *> *trashed = [self batchUpdateAssets:trashIDs
+                                                                  predicate:nil
+                                                                 properties:@{@"deletedAt": [NSDate now]}
+                                                                      error:error];
+            if (nil == trashed) {
+                return NO;
+            }
+            [changes.updated addObjectsFromArray:trashed];
+            return YES;
         }
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error);
-            });
+        NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
+                                                                             error:error];
+        if (nil == assets) {
+            return NO;
         }
-    });
+        for (Asset *asset in assets) {
+            if (nil == asset.deletedAt) {
+                asset.deletedAt = [NSDate now];
+            } else {
+                asset.deletedAt = nil;
+            }
+        }
+        [changes.updated unionSet:assetIDs];
+        return YES;
+    }
+              completion:callback];
 }
 
 
-- (void)moveDeletedAssetsToTrash:(nullable void (^)(BOOL success, NSError * _Nullable error)) callback {
-    dispatch_assert_queue_not(self.dataQ);
-
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        __block NSArray<NSManagedObjectID *> *deletedItems = nil;
-        [self.managedObjectContext performBlockAndWait:^{
-            NSFetchRequest *trashReequest = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
-            [trashReequest setPredicate:[NSPredicate predicateWithFormat: @"deletedAt != nil"]];
-            NSArray<Asset *> *result = [self.managedObjectContext executeFetchRequest:trashReequest
-                                                                                error:&error];
+- (TrashPurgeJob *)moveDeletedAssetsToTrash:(nullable void (^)(BOOL success, NSError * _Nullable error)) callback {
+    TrashPurgeJob *job = [[TrashPurgeJob alloc] init];
+    __block NSArray<NSURL *> *assetPaths = @[];
+    __block NSArray<NSURL *> *itemDirectories = @[];
+    __block NSArray<NSURL *> *thumbnailPaths = @[];
+    [self enqueueNonAtomicCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        NSError *innerError = nil;
+        NSFetchRequest *trashRequest = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+        [trashRequest setPredicate:[NSPredicate predicateWithFormat: @"deletedAt != nil"]];
+        [trashRequest setPropertiesToFetch:@[@"path", @"thumbnailPath"]];
+        [trashRequest setReturnsObjectsAsFaults:NO];
+        MetricsIntervalToken fetchInterval = metrics_interval_begin(MetricsIntervalFetch);
+        NSArray<Asset *> *result = [self.managedObjectContext executeFetchRequest:trashRequest
+                                                                            error:&innerError];
+        metrics_interval_end(fetchInterval);
+        if (nil != innerError) {
+            NSAssert(nil == result, @"Got error and result!");
             if (nil != error) {
-                NSAssert(nil == result, @"Got error and result!");
-                return;
+                *error = innerError;
             }
-            NSAssert(nil != result, @"Got no error and no result");
+            return NO;
+        }
+        NSAssert(nil != result, @"Got no error and no result");
+        if (0 == [result count]) {
+            return YES;
+        }
 
-            NSArray<NSURL *> *thumbnailPaths = [result compactMapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) {
-                return asset.thumbnailPath;
-            }];
-            NSArray<NSURL *> *assetPaths = [result mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) {
-                return asset.path;
-            }];
+        NSArray<NSManagedObjectID *> *trashedIDs = [result mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) {
+            return asset.objectID;
+        }];
+        NSArray<NSURL *> *paths = [result mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) {
+            return asset.path;
+        }];
+        NSArray<NSURL *> *directories = [result mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) {
+            return [asset itemDirectory];
+        }];
+        NSArray<NSURL *> *thumbnails = [result compactMapUsingBlock:^id _Nullable(Asset * _Nonnull asset) {
+            return asset.thumbnailPath;
+        }];
 
-            NSFileManager *fm = [NSFileManager defaultManager];
+        // The batch delete doesn't go via the tags, so take the assets off their counts first
+        NSSet<NSManagedObjectID *> *updatedTagIDs = [self reduceTagCountsForTrashedAssets:&innerError];
+        if (nil != innerError) {
+            NSAssert(nil == updatedTagIDs, @"Got error and tags");
+            if (nil != error) {
+                *error = innerError;
+            }
+            return NO;
+        }
+        NSAssert(nil != updatedTagIDs, @"Got no error and no tags");
+        [changes.updated unionSet:updatedTagIDs];
+
+        if ([self canBatchUpdate]) {
+            NSBatchDeleteRequest *request = [[NSBatchDeleteRequest alloc] initWithObjectIDs:trashedIDs];
+            [request setResultType:NSBatchDeleteResultTypeObjectIDs];
+            NSBatchDeleteResult *deleteResult = [self.managedObjectContext executeRequest:request
+                                                                                     error:&innerError];
+            if (nil != innerError) {
+                NSAssert(nil == deleteResult, @"Got error and batch delete result.");
+                if (nil != error) {
+                    *error = innerError;
+                }
+                return NO;
+            }
+            NSAssert(nil != deleteResult, @"Got no error and no batch delete result.");
+            [NSManagedObjectContext mergeChangesFromRemoteContextSave:@{NSDeletedObjectsKey:deleteResult.result}
+                                                         intoContexts:@[self.managedObjectContext]];
+        } else {
             for (Asset *asset in result) {
                 [self.managedObjectContext deleteObject:asset];
             }
-            success = [self.managedObjectContext save:&error];
-            deletedItems = [result mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) {
-                return asset.objectID;
-            }];
-            if (success) {
-                for (NSURL *thumbnailPath in thumbnailPaths) {
-                    NSError *innerError = nil;
-                    [fm removeItemAtURL:thumbnailPath
-                                  error:&innerError];
-                    if (nil != innerError) {
-                        // Just warn on this failure, accept leaking thumbnails as better than distressing user
-                        NSLog(@"Failed to remove thumbnail %@: %@", thumbnailPath, innerError);
-                    }
-                }
-                for (NSURL *path in assetPaths) {
-                    NSError *innerError = nil;
-                    [fm trashItemAtURL:path
-                      resultingItemURL:nil
-                                 error:&innerError];
-                    if (nil != innerError) {
-                        // Just warn on this failure, accept leaking thumbnails as better than distressing user
-                        NSLog(@"Failed to remove asset %@: %@", path, innerError);
-                    }
-                }
+        }
+        [changes.deleted addObjectsFromArray:trashedIDs];
+        [[SecureURLCache sharedCache] removeURLsForAssetIDs:[NSSet setWithArray:trashedIDs]];
+        assetPaths = paths;
+        itemDirectories = directories;
+        thumbnailPaths = thumbnails;
+        return YES;
+    }
+              completion:^(BOOL success, NSError * _Nullable error) {
+        // The assets are gone from the store now, so the files can be tidied up without holding
+        // up dataQ. Failures are just logged, as leaking files is better than distressing the user.
+        NSArray<NSURL *> *paths = success ? assetPaths : @[];
+        NSArray<NSURL *> *thumbnails = success ? thumbnailPaths : @[];
+        ThumbnailPackStore *thumbnailStore = self.thumbnailStore;
+        dispatch_queue_t purgeQ = self.purgeQ;
+        [job addPendingItems:[paths count]];
+        dispatch_async(purgeQ, ^{
+            for (NSURL *thumbnailPath in thumbnails) {
+                [ThumbnailPyramid removeThumbnailsForThumbnailPath:thumbnailPath
+                                                             store:thumbnailStore];
             }
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSDeletedObjectsKey:deletedItems}];
+            dispatch_apply([paths count], purgeQ, ^(size_t index) {
+                [LibraryWriteCoordinator trashAssetAtPath:paths[index]
+                                            itemDirectory:itemDirectories[index]];
+                [job addCompletedItems:1];
             });
-        }
+            [job markFinished];
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            if (nil != callback) {
                 callback(success, error);
-            });
-        }
-    });
+            }
+        });
+    }];
+    return job;
 }
 
-- (void)addAssets:(NSSet<NSManagedObjectID *> *)assetIDs
-           toTags:(NSSet<NSString *> *)rawTags
-         callback:(nullable void (^)(BOOL success, NSError * _Nullable error))callback {
-    dispatch_assert_queue_not(self.dataQ);
-
-    // TODO: We should do some cleaning on the rawTags data: removing spaces at either end, splitting ones with commas in, etc.
-
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        __block NSArray<NSManagedObjectID *> *insertedTagIDs = nil;
-        __block NSArray<NSManagedObjectID *> *updatedTagIDs = @[];
-        [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
-                                                                                 error:&error];
+// There's one count query per affected tag, but only tags on something in the trash are looked at.
+// Returns the IDs of the tags changed.
+- (nullable NSSet<NSManagedObjectID *> *)reduceTagCountsForTrashedAssets:(NSError **)error {
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"deletedAt != nil"];
+    NSFetchRequest *tagRequest = [Tag fetchRequest];
+    [tagRequest setPredicate:[NSPredicate predicateWithFormat:@"ANY tags.deletedAt != nil"]];
+    NSError *innerError = nil;
+    NSArray<Tag *> *tags = [self.managedObjectContext executeFetchRequest:tagRequest
+                                                                    error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == tags, @"Got error and fetch results.");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+    NSAssert(nil != tags, @"Got no error and no fetch results.");
+
+    NSMutableSet<NSManagedObjectID *> *tagIDs = [NSMutableSet setWithCapacity:[tags count]];
+    for (Tag *tag in tags) {
+        NSFetchRequest *countRequest = [Asset fetchRequest];
+        NSPredicate *tagPredicate = [NSPredicate predicateWithFormat:@"ANY tags == %@", tag];
+        [countRequest setPredicate:[NSCompoundPredicate andPredicateWithSubpredicates:@[predicate, tagPredicate]]];
+        NSUInteger count = [self.managedObjectContext countForFetchRequest:countRequest
+                                                                     error:&innerError];
+        if (NSNotFound == count) {
             if (nil != error) {
-                return;
+                *error = innerError;
             }
+            return nil;
+        }
+        [tag reduceAssetCountBy:count];
+        [tagIDs addObject:tag.objectID];
+    }
+    return [NSSet setWithSet:tagIDs];
+}
 
-            // If we have a tag in any case we pick that up in preference to creating a new
-            // instance with a different case
-            __block NSSet<Tag *> *insertedTags = [NSSet set];
-            NSSet<Tag *> *tags = [rawTags compactMapUsingBlock:^id _Nullable(NSString * _Nonnull rawTag) {
-                NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Tag"];
-                NSPredicate *predicate = [NSPredicate predicateWithFormat:@"name ==[c] %@", rawTag];
-                [fetch setPredicate:predicate];
-
-                NSError *error = nil;
-                NSArray<Tag *> *result = [self.managedObjectContext executeFetchRequest:fetch
-                                                                                  error:&error];
-                if (nil != error) {
-                    NSAssert(nil == result, @"Got error and result");
-                    NSLog(@"Failed to look for %@ as tag: %@", rawTag, error.localizedDescription);
-                    return nil;
-                }
-                NSAssert(nil != result, @"Got no error but not result");
-
-                if (0 == [result count]) {
-                    Tag *tag = [NSEntityDescription insertNewObjectForEntityForName:@"Tag"
-                                                             inManagedObjectContext:self.managedObjectContext];
-                    tag.name = rawTag;
-                    insertedTags = [insertedTags setByAddingObject:tag];
-                    return tag;
-                }
+// Moves the asset's file to the Finder's trash so the user can still get it back, then removes
+// what's left of its directory, such as thumbnails. Safe to call on any queue.
++ (void)trashAssetAtPath:(NSURL *)path
+           itemDirectory:(NSURL *)itemDirectory {
+    NSParameterAssert(nil != path);
+    NSParameterAssert(nil != itemDirectory);
+
+    // A snap's path is the image inside its bundle, but it's the whole snap the user would want back
+    NSURL *trashURL = path;
+    NSURL *parent = [path URLByDeletingLastPathComponent];
+    if ([[parent pathExtension] isEqualToString:@"embersnap"]) {
+        trashURL = parent;
+    }
 
-                // We hope for a single tag here
-                NSAssert([result count] == 1, @"Unexpceted number of tags for %@: %@", rawTag, result);
-                return [result firstObject];
-            }];
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSError *error = nil;
+    BOOL success = [fm trashItemAtURL:trashURL
+                     resultingItemURL:nil
+                                error:&error];
+    if (NO == success) {
+        NSLog(@"Failed to remove asset %@: %@", trashURL, error);
+        return;
+    }
 
-            if ([insertedTags count] > 0) {
-                NSArray<Tag *> *insertedTagsArray = [insertedTags allObjects];
-                success = [self.managedObjectContext obtainPermanentIDsForObjects:insertedTagsArray
-                                                                            error:&error];
-                if (nil != error) {
-                    return;
-                }
-                insertedTagIDs = [insertedTagsArray mapUsingBlock:^id _Nonnull(Tag * _Nonnull tag) { return tag.objectID; }];
-            }
+    // Only ever remove a directory that's named like the ones import makes. Snaps from before they
+    // had one use their bundle, which has just gone to the trash anyway.
+    if ((nil == [[NSUUID alloc] initWithUUIDString:[itemDirectory lastPathComponent]]) || [itemDirectory isEqual:trashURL]) {
+        return;
+    }
+    success = [fm removeItemAtURL:itemDirectory
+                            error:&error];
+    if (NO == success) {
+        NSLog(@"Failed to remove asset directory %@: %@", itemDirectory, error);
+    }
+}
 
-            for (Tag *tag in tags) {
-                [tag addTags:assets];
-            }
-            updatedTagIDs = [[tags allObjects] mapUsingBlock:^id _Nonnull(Tag * _Nonnull tag) { return tag.objectID; }];
+- (void)addAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+           toTags:(NSSet<NSString *> *)rawTags
+         callback:(nullable void (^)(BOOL success, NSError * _Nullable error))callback {
+    // TODO: We should do some cleaning on the rawTags data: removing spaces at either end, splitting ones with commas in, etc.
 
-            success = [self.managedObjectContext save:&error];
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                NSDictionary *changes = @{NSUpdatedObjectsKey:[[assetIDs allObjects] arrayByAddingObjectsFromArray:updatedTagIDs]};
-                if (nil != insertedTagIDs) {
-                    NSMutableDictionary *mutableChanges = [NSMutableDictionary dictionaryWithDictionary:changes];
-                    mutableChanges[NSInsertedObjectsKey] = insertedTagIDs;
-                    changes = [NSDictionary dictionaryWithDictionary:mutableChanges];
-                }
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
+                                                                             error:error];
+        if (nil == assets) {
+            return NO;
+        }
 
-                [self.delegate modelCoordinator:self
-                                      didUpdate:changes];
-            });
+        // If we have a tag in any case we pick that up in preference to creating a new
+        // instance with a different case
+        NSError *innerError = nil;
+        NSSet<Tag *> *insertedTags = nil;
+        NSDictionary<NSString *, Tag *> *tagsByName = [self.tagCache tagsForNames:rawTags
+                                                                     insertedTags:&insertedTags
+                                                                            error:&innerError];
+        if (nil != innerError) {
+            NSAssert(nil == tagsByName, @"Got error and tags");
+            if (nil != error) {
+                *error = innerError;
+            }
+            return NO;
         }
+        NSAssert(nil != tagsByName, @"Got no error and no tags");
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error);
-            });
+        for (Tag *tag in [tagsByName allValues]) {
+            [tag addAssetsUpdatingCount:assets];
+            [changes.updated addObject:tag.objectID];
         }
-    });
+        for (Tag *tag in insertedTags) {
+            [changes.inserted addObject:tag.objectID];
+        }
+        [changes.updated unionSet:assetIDs];
+        return YES;
+    }
+              completion:callback];
 }
 
 - (void)removeTags:(NSSet<NSManagedObjectID *> *)tagIDs
         fromAssets:(NSSet<NSManagedObjectID *> *)assetIDs
           callback:(nullable void (^)(BOOL success, NSError * _Nullable error))callback {
-    dispatch_assert_queue_not(self.dataQ);
-
-    dispatch_sync(self.dataQ, ^() {
-        __block NSError *error = nil;
-        __block BOOL success = NO;
-        [self.managedObjectContext performBlockAndWait:^{
-            NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
-                                                                                 error:&error];
-            if (nil != error) {
-                return;
-            }
-
-            NSSet<Tag *> *tags = [self.managedObjectContext existingObjectsWithIDs:tagIDs
-                                                                             error:&error];
-            if (nil != error) {
-                return;
-            }
+    [self enqueueCommand:^BOOL(LibraryWriteChanges *changes, NSError **error) {
+        NSSet<Asset *> *assets = [self.managedObjectContext existingObjectsWithIDs:assetIDs
+                                                                             error:error];
+        if (nil == assets) {
+            return NO;
+        }
 
-            for (Tag *tag in tags) {
-                [tag removeTags:assets];
-            }
-            success = [self.managedObjectContext save:&error];
-        }];
-        if ((nil == error) && success) {
-            @weakify(self);
-            dispatch_async(self.updateDelegateQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                [self.delegate modelCoordinator:self
-                                      didUpdate:@{NSUpdatedObjectsKey:[[assetIDs allObjects] arrayByAddingObjectsFromArray:[tagIDs allObjects]]}];
-            });
+        NSSet<Tag *> *tags = [self.managedObjectContext existingObjectsWithIDs:tagIDs
+                                                                         error:error];
+        if (nil == tags) {
+            return NO;
         }
 
-        if (nil != callback) {
-            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
-                callback(success, error);
-            });
+        for (Tag *tag in tags) {
+            [tag removeAssetsUpdatingCount:assets];
         }
-    });
+        [changes.updated unionSet:assetIDs];
+        [changes.updated unionSet:tagIDs];
+        return YES;
+    }
+              completion:callback];
 }
 
 @end
@@ -0,0 +1,47 @@
+//
+//  SearchIndex.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 09/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// An in memory inverted index over each asset's name, notes, tags, and scanned text, so that
+// searching doesn't need SQLite to scan every asset's text on each keystroke. Words are matched on
+// prefix, ignoring case and diacritics, and every word in the query must match. Results are ranked,
+// with matches in the name counting for more than those in tags, then notes, then scanned text.
+//
+// The index reads the assets through its own context, so it can be kept up to date from any queue.
+@interface SearchIndex : NSObject
+
+// Set once the initial build is done. Until then searches return nothing useful, and callers
+// should fall back to a fetch predicate.
+@property (atomic, readonly, getter=isReady) BOOL ready;
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator *)store;
+
+// Builds the index from everything in the store in the background.
+- (void)rebuild;
+
+// Re-reads the given assets, and drops the removed ones. Work is done in the background, but any
+// search made after this call will see the removals and the first chunk of updates, which is all
+// of them unless there are more than a few hundred. Bigger updates do the rest a chunk at a time
+// behind any searches already waiting, so those may only see part of the update, but any search
+// made after those will see it all.
+- (void)updateAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+        removeAssets:(NSSet<NSManagedObjectID *> *)removedAssetIDs;
+
+// Best match first.
+- (NSArray<NSManagedObjectID *> *)assetIDsMatchingQuery:(NSString *)query;
+
+// Splits text into the lower case, diacritic free words that are indexed.
++ (NSArray<NSString *> *)tokensForString:(NSString *)string;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,381 @@
+//
+//  SearchIndex.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 09/12/2023.
+//
+
+#import "SearchIndex.h"
+#import "Asset+CoreDataClass.h"
+#import "Tag+CoreDataClass.h"
+#import "Helpers.h"
+
+// How much a word found in each field counts towards an asset's rank.
+static const double kSearchIndexNameWeight = 4.0;
+static const double kSearchIndexTagWeight = 3.0;
+static const double kSearchIndexNotesWeight = 2.0;
+static const double kSearchIndexScannedTextWeight = 1.0;
+
+// A whole word match beats a match on just the start of a word.
+static const double kSearchIndexPrefixMatchFactor = 0.5;
+
+// Updates are applied in chunks so that a big import doesn't hold up searches for long. See the
+// header for what searches see whilst that's going on.
+static const NSUInteger kSearchIndexUpdateChunkSize = 500;
+static const NSUInteger kSearchIndexFetchBatchSize = 1000;
+
+@interface SearchIndex ()
+
+@property (atomic, readwrite, getter=isReady) BOOL ready;
+
+// Only access on syncQ
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readonly) NSManagedObjectContext *context;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, NSMutableDictionary<NSManagedObjectID *, NSNumber *> *> *postings;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSManagedObjectID *, NSDictionary<NSString *, NSNumber *> *> *documents;
+// Built on first search after a rebuild, and then kept up to date as terms come and go.
+@property (nonatomic, strong, readwrite, nullable) NSMutableArray<NSString *> *sortedTerms;
+
+@end
+
+@implementation SearchIndex
+
+- (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator *)store {
+    NSParameterAssert(nil != store);
+    self = [super init];
+    if (nil != self) {
+        self->_syncQ = dispatch_queue_create("com.digitalflapjack.SearchIndex.syncQ", DISPATCH_QUEUE_SERIAL);
+        NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+        context.persistentStoreCoordinator = store;
+        self->_context = context;
+        self->_postings = [NSMutableDictionary dictionary];
+        self->_documents = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
++ (NSArray<NSString *> *)tokensForString:(NSString *)string {
+    NSParameterAssert(nil != string);
+    NSString *folded = [string stringByFoldingWithOptions:NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch
+                                                   locale:nil];
+    NSArray<NSString *> *parts = [folded componentsSeparatedByCharactersInSet:[[NSCharacterSet alphanumericCharacterSet] invertedSet]];
+    NSMutableArray<NSString *> *tokens = [NSMutableArray arrayWithCapacity:[parts count]];
+    for (NSString *part in parts) {
+        if (0 < [part length]) {
+            [tokens addObject:part];
+        }
+    }
+    return [NSArray arrayWithArray:tokens];
+}
+
+
+#pragma mark - Updates
+
+- (void)rebuild {
+    @weakify(self);
+    dispatch_async(self.syncQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        [self.postings removeAllObjects];
+        [self.documents removeAllObjects];
+        self.sortedTerms = nil;
+
+        __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+        [self.context performBlockAndWait:^{
+            NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+            [request setResultType:NSManagedObjectIDResultType];
+            NSError *error = nil;
+            assetIDs = [self.context executeFetchRequest:request
+                                                   error:&error];
+            if (nil != error) {
+                NSAssert(nil == assetIDs, @"Got error and fetch results.");
+                NSLog(@"Failed to build search index: %@", error);
+                return;
+            }
+            NSAssert(nil != assetIDs, @"Got no error and no fetch results.");
+        }];
+        for (NSUInteger start = 0; start < [assetIDs count]; start += kSearchIndexFetchBatchSize) {
+            @autoreleasepool {
+                NSRange range = NSMakeRange(start, MIN(kSearchIndexFetchBatchSize, [assetIDs count] - start));
+                [self indexAssetsWithIDs:[assetIDs subarrayWithRange:range]];
+            }
+        }
+        self.ready = YES;
+    });
+}
+
+- (void)updateAssets:(NSSet<NSManagedObjectID *> *)assetIDs
+        removeAssets:(NSSet<NSManagedObjectID *> *)removedAssetIDs {
+    NSParameterAssert(nil != assetIDs);
+    NSParameterAssert(nil != removedAssetIDs);
+    if ((0 == [assetIDs count]) && (0 == [removedAssetIDs count])) {
+        return;
+    }
+
+    @weakify(self);
+    dispatch_async(self.syncQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        for (NSManagedObjectID *assetID in removedAssetIDs) {
+            [self removeDocument:assetID];
+        }
+        [self updateAssetsInChunks:[assetIDs allObjects]
+                              from:0];
+    });
+}
+
+
+#pragma mark - Search
+
+- (NSArray<NSManagedObjectID *> *)assetIDsMatchingQuery:(NSString *)query {
+    NSParameterAssert(nil != query);
+    dispatch_assert_queue_not(self.syncQ);
+
+    NSArray<NSString *> *queryTokens = [SearchIndex tokensForString:query];
+    if (0 == [queryTokens count]) {
+        return @[];
+    }
+
+    __block NSArray<NSManagedObjectID *> *result = @[];
+    dispatch_sync(self.syncQ, ^{
+        if (nil == self.sortedTerms) {
+            self.sortedTerms = [[[self.postings allKeys] sortedArrayUsingSelector:@selector(compare:)] mutableCopy];
+        }
+        NSArray<NSString *> *sortedTerms = self.sortedTerms;
+
+        // Every word in the query has to match, so start with the rarest, as that keeps the
+        // candidate set small for the rest.
+        NSMutableArray<NSDictionary<NSManagedObjectID *, NSNumber *> *> *perToken = [NSMutableArray arrayWithCapacity:[queryTokens count]];
+        for (NSString *token in queryTokens) {
+            NSDictionary<NSManagedObjectID *, NSNumber *> *scores = [self scoresForPrefix:token
+                                                                              sortedTerms:sortedTerms];
+            if (0 == [scores count]) {
+                return;
+            }
+            [perToken addObject:scores];
+        }
+        [perToken sortUsingComparator:^NSComparisonResult(NSDictionary *a, NSDictionary *b) {
+            return [@([a count]) compare:@([b count])];
+        }];
+
+        NSMutableDictionary<NSManagedObjectID *, NSNumber *> *totals = [NSMutableDictionary dictionaryWithDictionary:perToken[0]];
+        for (NSUInteger index = 1; index < [perToken count]; index++) {
+            NSDictionary<NSManagedObjectID *, NSNumber *> *scores = perToken[index];
+            for (NSManagedObjectID *assetID in [totals allKeys]) {
+                NSNumber *score = scores[assetID];
+                if (nil == score) {
+                    [totals removeObjectForKey:assetID];
+                } else {
+                    totals[assetID] = @([totals[assetID] doubleValue] + [score doubleValue]);
+                }
+            }
+            if (0 == [totals count]) {
+                return;
+            }
+        }
+
+        result = [totals keysSortedByValueUsingComparator:^NSComparisonResult(NSNumber *a, NSNumber *b) {
+            return [b compare:a];
+        }];
+    });
+    return result;
+}
+
+
+#pragma mark - internal
+
+- (NSDictionary<NSManagedObjectID *, NSNumber *> *)scoresForPrefix:(NSString *)prefix
+                                                       sortedTerms:(NSArray<NSString *> *)sortedTerms {
+    dispatch_assert_queue(self.syncQ);
+
+    NSMutableDictionary<NSManagedObjectID *, NSNumber *> *scores = [NSMutableDictionary dictionary];
+    NSUInteger start = [SearchIndex indexOfTerm:prefix
+                                  inSortedTerms:sortedTerms];
+    for (NSUInteger index = start; index < [sortedTerms count]; index++) {
+        NSString *term = sortedTerms[index];
+        if (NO == [term hasPrefix:prefix]) {
+            break;
+        }
+        double factor = [term length] == [prefix length] ? 1.0 : kSearchIndexPrefixMatchFactor;
+        NSDictionary<NSManagedObjectID *, NSNumber *> *posting = self.postings[term];
+        for (NSManagedObjectID *assetID in posting) {
+            double score = [posting[assetID] doubleValue] * factor;
+            // Several words starting with the prefix in one asset shouldn't outrank one that
+            // matches it exactly, so take the best rather than adding them up.
+            if (score > [scores[assetID] doubleValue]) {
+                scores[assetID] = @(score);
+            }
+        }
+    }
+    return scores;
+}
+
+// Where the term is in the sorted terms, or where it would go if it's not there.
++ (NSUInteger)indexOfTerm:(NSString *)term
+            inSortedTerms:(NSArray<NSString *> *)sortedTerms {
+    return [sortedTerms indexOfObject:term
+                        inSortedRange:NSMakeRange(0, [sortedTerms count])
+                              options:NSBinarySearchingInsertionIndex | NSBinarySearchingFirstEqual
+                      usingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+        return [a compare:b];
+    }];
+}
+
+// Only call on syncQ. Not asserted, as it's called from within the context's perform blocks.
+- (void)addTerm:(NSString *)term {
+    NSParameterAssert(nil != term);
+    if (nil == self.sortedTerms) {
+        return;
+    }
+    NSUInteger index = [SearchIndex indexOfTerm:term
+                                  inSortedTerms:self.sortedTerms];
+    [self.sortedTerms insertObject:term
+                           atIndex:index];
+}
+
+// Only call on syncQ. Not asserted, as it's called from within the context's perform blocks.
+- (void)removeTerm:(NSString *)term {
+    NSParameterAssert(nil != term);
+    if (nil == self.sortedTerms) {
+        return;
+    }
+    NSUInteger index = [SearchIndex indexOfTerm:term
+                                  inSortedTerms:self.sortedTerms];
+    if ((index < [self.sortedTerms count]) && [self.sortedTerms[index] isEqualToString:term]) {
+        [self.sortedTerms removeObjectAtIndex:index];
+    }
+}
+
+- (void)updateAssetsInChunks:(NSArray<NSManagedObjectID *> *)assetIDs
+                        from:(NSUInteger)start {
+    dispatch_assert_queue(self.syncQ);
+
+    NSUInteger end = MIN(start + kSearchIndexUpdateChunkSize, [assetIDs count]);
+    [self indexAssetsWithIDs:[assetIDs subarrayWithRange:NSMakeRange(start, end - start)]];
+    if (end >= [assetIDs count]) {
+        return;
+    }
+
+    // Go to the back of the queue, so any searches waiting get a look in
+    @weakify(self);
+    dispatch_async(self.syncQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        [self updateAssetsInChunks:assetIDs
+                              from:end];
+    });
+}
+
+- (void)indexAssetsWithIDs:(NSArray<NSManagedObjectID *> *)assetIDs {
+    NSParameterAssert(nil != assetIDs);
+    dispatch_assert_queue(self.syncQ);
+
+    [self.context performBlockAndWait:^{
+        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+        [request setPredicate:[NSPredicate predicateWithFormat:@"SELF IN %@", assetIDs]];
+        [request setRelationshipKeyPathsForPrefetching:@[@"tags"]];
+        [request setReturnsObjectsAsFaults:NO];
+        NSError *error = nil;
+        NSArray<Asset *> *assets = [self.context executeFetchRequest:request
+                                                               error:&error];
+        if (nil != error) {
+            NSAssert(nil == assets, @"Got error and fetch results.");
+            NSLog(@"Failed to update search index: %@", error);
+            return;
+        }
+        NSAssert(nil != assets, @"Got no error and no fetch results.");
+
+        NSMutableSet<NSManagedObjectID *> *missing = [NSMutableSet setWithArray:assetIDs];
+        for (Asset *asset in assets) {
+            [self indexAsset:asset];
+            [missing removeObject:asset.objectID];
+        }
+        // Most likely deleted since the update was sent
+        for (NSManagedObjectID *assetID in missing) {
+            [self removeDocument:assetID];
+        }
+
+        // Don't keep anything around, as otherwise we'd hold the whole library's text twice, and
+        // next time could get stale values back.
+        [self.context reset];
+    }];
+}
+
+// Only call on syncQ. Not asserted, as it's called from within the context's perform blocks.
+- (void)indexAsset:(Asset *)asset {
+    NSParameterAssert(nil != asset);
+
+    NSMutableDictionary<NSString *, NSNumber *> *weights = [NSMutableDictionary dictionary];
+    void (^addText)(NSString *, double) = ^(NSString *text, double weight) {
+        if (nil == text) {
+            return;
+        }
+        for (NSString *token in [SearchIndex tokensForString:text]) {
+            weights[token] = @([weights[token] doubleValue] + weight);
+        }
+    };
+    addText(asset.name, kSearchIndexNameWeight);
+    addText(asset.notes, kSearchIndexNotesWeight);
+    addText(asset.scannedText, kSearchIndexScannedTextWeight);
+    for (Tag *tag in asset.tags) {
+        addText(tag.name, kSearchIndexTagWeight);
+    }
+
+    // Only take the asset out of terms it no longer has, as most edits leave most words alone, and
+    // that saves dropping terms only to add them straight back.
+    NSManagedObjectID *assetID = asset.objectID;
+    NSDictionary<NSString *, NSNumber *> *oldWeights = self.documents[assetID];
+    for (NSString *token in oldWeights) {
+        if (nil == weights[token]) {
+            [self removeAssetID:assetID
+                      fromToken:token];
+        }
+    }
+    for (NSString *token in weights) {
+        NSMutableDictionary<NSManagedObjectID *, NSNumber *> *posting = self.postings[token];
+        if (nil == posting) {
+            posting = [NSMutableDictionary dictionary];
+            self.postings[token] = posting;
+            [self addTerm:token];
+        }
+        posting[assetID] = weights[token];
+    }
+    self.documents[assetID] = [NSDictionary dictionaryWithDictionary:weights];
+}
+
+// Only call on syncQ. Not asserted, as it's called from within the context's perform blocks.
+- (void)removeDocument:(NSManagedObjectID *)assetID {
+    NSParameterAssert(nil != assetID);
+
+    NSDictionary<NSString *, NSNumber *> *weights = self.documents[assetID];
+    if (nil == weights) {
+        return;
+    }
+    for (NSString *token in weights) {
+        [self removeAssetID:assetID
+                  fromToken:token];
+    }
+    [self.documents removeObjectForKey:assetID];
+}
+
+// Only call on syncQ. Not asserted, as it's called from within the context's perform blocks.
+- (void)removeAssetID:(NSManagedObjectID *)assetID
+            fromToken:(NSString *)token {
+    NSParameterAssert(nil != assetID);
+    NSParameterAssert(nil != token);
+
+    NSMutableDictionary<NSManagedObjectID *, NSNumber *> *posting = self.postings[token];
+    [posting removeObjectForKey:assetID];
+    if (0 == [posting count]) {
+        [self.postings removeObjectForKey:token];
+        [self removeTerm:token];
+    }
+}
+
+@end
@@ -0,0 +1,39 @@
+//
+//  SecureURLCache.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 16/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Resolving a security scoped bookmark is slow enough to notice when done for every asset in a
+// batch, or for every cell in the grid, so the resolved URLs are kept here by asset. An entry is
+// only used whilst the asset still has the bookmark it was resolved from, so a changed bookmark is
+// resolved again without anyone having to tell the cache.
+//
+// Safe to use from any queue.
+@interface SecureURLCache : NSObject
+
++ (instancetype)sharedCache;
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit;
+
+// If the bookmark has gone stale a new one is made from the resolved URL, and handed back in
+// refreshedBookmark for the caller to store when it can. If that fails the URL can't be trusted,
+// and an ESTALE error is returned.
+- (nullable NSURL *)URLForAssetID:(NSManagedObjectID *)assetID
+                         bookmark:(NSData *)bookmark
+                refreshedBookmark:(NSData * _Nullable * _Nullable)refreshedBookmark
+                            error:(NSError **)error;
+
+- (void)removeURLsForAssetIDs:(NSSet<NSManagedObjectID *> *)assetIDs;
+- (void)removeAllURLs;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,153 @@
+//
+//  SecureURLCache.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 16/12/2023.
+//
+
+#import "SecureURLCache.h"
+#import "NSURL+SecureAccess.h"
+
+// Entries are small, so this is about not growing without bound on a big library rather than
+// about memory. It's comfortably more than a screen of grid plus a batch of background work.
+static const NSUInteger kSecureURLCacheCountLimit = 5000;
+
+@interface SecureURLCacheEntry : NSObject
+
+@property (nonatomic, strong, readonly) NSData *bookmark;
+@property (nonatomic, strong, readonly, nullable) NSData *refreshedBookmark;
+@property (nonatomic, strong, readonly) NSURL *url;
+
+@end
+
+@implementation SecureURLCacheEntry
+
+- (instancetype)initWithBookmark:(NSData *)bookmark
+               refreshedBookmark:(nullable NSData *)refreshedBookmark
+                             url:(NSURL *)url {
+    self = [super init];
+    if (nil != self) {
+        self->_bookmark = bookmark;
+        self->_refreshedBookmark = refreshedBookmark;
+        self->_url = url;
+    }
+    return self;
+}
+
+// Once the asset has been given the refreshed bookmark it should still find this entry.
+- (BOOL)matchesBookmark:(NSData *)bookmark {
+    return [self.bookmark isEqualToData:bookmark] || ((nil != self.refreshedBookmark) && [self.refreshedBookmark isEqualToData:bookmark]);
+}
+
+@end
+
+@interface SecureURLCache ()
+
+@property (nonatomic, strong, readonly) NSCache<NSManagedObjectID *, SecureURLCacheEntry *> *entries;
+
+@end
+
+@implementation SecureURLCache
+
++ (instancetype)sharedCache {
+    static SecureURLCache *cache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[SecureURLCache alloc] initWithCountLimit:kSecureURLCacheCountLimit];
+    });
+    return cache;
+}
+
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit {
+    self = [super init];
+    if (nil != self) {
+        NSCache<NSManagedObjectID *, SecureURLCacheEntry *> *entries = [[NSCache alloc] init];
+        entries.name = @"com.digitalflapjack.SecureURLCache";
+        entries.countLimit = countLimit;
+        self->_entries = entries;
+    }
+    return self;
+}
+
+- (nullable NSURL *)URLForAssetID:(NSManagedObjectID *)assetID
+                         bookmark:(NSData *)bookmark
+                refreshedBookmark:(NSData * _Nullable * _Nullable)refreshedBookmark
+                            error:(NSError **)error {
+    NSParameterAssert(nil != assetID);
+    NSParameterAssert(nil != bookmark);
+
+    SecureURLCacheEntry *entry = [self.entries objectForKey:assetID];
+    if ((nil != entry) && [entry matchesBookmark:bookmark]) {
+        if ((nil != refreshedBookmark) && (nil != entry.refreshedBookmark) && (NO == [entry.refreshedBookmark isEqualToData:bookmark])) {
+            *refreshedBookmark = entry.refreshedBookmark;
+        }
+        return entry.url;
+    }
+
+    BOOL isStale = NO;
+    NSError *innerError = nil;
+    NSURL *decoded = [NSURL URLByResolvingBookmarkData:bookmark
+                                               options:NSURLBookmarkResolutionWithSecurityScope
+                                         relativeToURL:nil
+                                   bookmarkDataIsStale:&isStale
+                                                 error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == decoded, @"Got error decoding secure URL and a result");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+    NSAssert(nil != decoded, @"Got no error and no result");
+
+    NSData *fresh = nil;
+    if (NO != isStale) {
+        __block NSData *innerFresh = nil;
+        [decoded secureAccessWithBlock:^(NSURL * _Nonnull url, BOOL canAccess) {
+            if (NO == canAccess) {
+                return;
+            }
+            innerFresh = [url bookmarkDataWithOptions:NSURLBookmarkCreationWithSecurityScope
+                       includingResourceValuesForKeys:nil
+                                        relativeToURL:nil
+                                                error:nil];
+        }];
+        if (nil == innerFresh) {
+            if (nil != error) {
+                *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                             code:ESTALE
+                                         userInfo:@{
+                    @"ID": assetID,
+                    @"Path": decoded
+                }];
+            }
+            return nil;
+        }
+        fresh = innerFresh;
+        if (nil != refreshedBookmark) {
+            *refreshedBookmark = fresh;
+        }
+    }
+
+    // Temporary IDs change on save, so would only ever be misses
+    if (NO == [assetID isTemporaryID]) {
+        [self.entries setObject:[[SecureURLCacheEntry alloc] initWithBookmark:bookmark
+                                                            refreshedBookmark:fresh
+                                                                          url:decoded]
+                         forKey:assetID];
+    }
+    return decoded;
+}
+
+- (void)removeURLsForAssetIDs:(NSSet<NSManagedObjectID *> *)assetIDs {
+    NSParameterAssert(nil != assetIDs);
+    for (NSManagedObjectID *assetID in assetIDs) {
+        [self.entries removeObjectForKey:assetID];
+    }
+}
+
+- (void)removeAllURLs {
+    [self.entries removeAllObjects];
+}
+
+@end
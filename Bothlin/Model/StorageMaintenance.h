@@ -0,0 +1,58 @@
+//
+//  StorageMaintenance.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class ThumbnailPackStore;
+
+NS_ASSUME_NONNULL_BEGIN
+
+// What a scan of the storage directory found. Nothing here has been changed on disk yet.
+@interface StorageScanReport : NSObject
+
+// Asset directories that no asset in the library refers to, say left behind by an import that was
+// interrupted, or by a failed trash purge.
+@property (nonatomic, strong, readonly) NSArray<NSURL *> *orphanDirectories;
+
+// Thumbnail files in an asset's directory that the asset no longer uses.
+@property (nonatomic, strong, readonly) NSArray<NSURL *> *staleThumbnails;
+
+// Assets whose file isn't in storage any more. These can't be fixed here, but the UI may want to
+// flag them.
+@property (nonatomic, strong, readonly) NSArray<NSManagedObjectID *> *missingOriginals;
+
+// Space taken by the orphans and stale thumbnails, plus dead space in the thumbnail packs.
+@property (nonatomic, readonly) unsigned long long reclaimableBytes;
+
+@end
+
+// Background housekeeping for the storage directory. A scan streams through the assets in the store
+// whilst listing the storage directory in parallel, so never holds the whole library in memory, and
+// reports what space could be got back. Reclaiming it is a separate step, so that it only happens
+// when asked for.
+//
+// All the file work happens at background QoS, so the system throttles its disk I/O, and it backs
+// off further when the machine is busy, hot, or in low power mode.
+@interface StorageMaintenance : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator *)store
+                       storageDirectory:(NSURL *)storageDirectory
+                         thumbnailStore:(nullable ThumbnailPackStore *)thumbnailStore;
+
+// Callback is on an arbitrary queue.
+- (void)scan:(void (^)(StorageScanReport * _Nullable report, NSError * _Nullable error))callback;
+
+// Removes the orphans and stale thumbnails in the report, and compacts the thumbnail packs. Callback
+// is on an arbitrary queue, with how many bytes were freed.
+- (void)reclaim:(StorageScanReport *)report
+       callback:(nullable void (^)(unsigned long long reclaimedBytes))callback;
+
+@end
+
+NS_ASSUME_NONNULL_END
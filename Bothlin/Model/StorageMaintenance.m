@@ -0,0 +1,467 @@
+//
+//  StorageMaintenance.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import "StorageMaintenance.h"
+
+#import "Asset+CoreDataClass.h"
+#import "AssetExtension.h"
+#import "AssetWorkThrottle.h"
+#import "ThumbnailPackStore.h"
+#import "ThumbnailPyramid.h"
+#import "NSURL+SecureAccess.h"
+#import "Helpers.h"
+
+// Anything changed more recently than this might belong to an import or thumbnail write that
+// hasn't saved yet, so we leave it be until a later scan.
+static const NSTimeInterval kStorageMaintenanceMinimumAge = 24.0 * 60.0 * 60.0;
+
+// How many assets we fault in from the store at a time, and then let go of again.
+static const NSUInteger kStorageMaintenanceFetchBatchSize = 500;
+
+// How many items we remove before checking whether the machine has got busy.
+static const NSUInteger kStorageMaintenanceReclaimBatchSize = 50;
+
+// How long to pause removals for when the machine is busy, and how many pauses in a row we'll take
+// before carrying on regardless, as in low power mode the machine may never look quiet.
+static const NSTimeInterval kStorageMaintenanceBackoffInterval = 2.0;
+static const NSUInteger kStorageMaintenanceMaximumBackoffs = 30;
+
+@interface StorageScanReport ()
+
+- (instancetype)initWithOrphanDirectories:(NSArray<NSURL *> *)orphanDirectories
+                          staleThumbnails:(NSArray<NSURL *> *)staleThumbnails
+                         missingOriginals:(NSArray<NSManagedObjectID *> *)missingOriginals
+                         reclaimableBytes:(unsigned long long)reclaimableBytes;
+
+@end
+
+@implementation StorageScanReport
+
+- (instancetype)initWithOrphanDirectories:(NSArray<NSURL *> *)orphanDirectories
+                          staleThumbnails:(NSArray<NSURL *> *)staleThumbnails
+                         missingOriginals:(NSArray<NSManagedObjectID *> *)missingOriginals
+                         reclaimableBytes:(unsigned long long)reclaimableBytes {
+    self = [super init];
+    if (nil != self) {
+        self->_orphanDirectories = [orphanDirectories copy];
+        self->_staleThumbnails = [staleThumbnails copy];
+        self->_missingOriginals = [missingOriginals copy];
+        self->_reclaimableBytes = reclaimableBytes;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<StorageScanReport: %lu orphans, %lu stale thumbnails, %lu missing originals, %llu bytes reclaimable>",
+            (unsigned long)[self.orphanDirectories count],
+            (unsigned long)[self.staleThumbnails count],
+            (unsigned long)[self.missingOriginals count],
+            self.reclaimableBytes];
+}
+
+@end
+
+
+@interface StorageMaintenance ()
+
+@property (nonatomic, strong, readonly) NSPersistentStoreCoordinator *store;
+@property (nonatomic, strong, readonly) NSURL *storageDirectory;
+@property (nonatomic, strong, readonly, nullable) ThumbnailPackStore *thumbnailStore;
+
+// Scans and reclaims run one at a time on here, so they never trip over each other
+@property (nonatomic, strong, readonly) dispatch_queue_t workQ;
+// Lists the storage directory whilst workQ walks the store
+@property (nonatomic, strong, readonly) dispatch_queue_t listQ;
+
+@end
+
+@implementation StorageMaintenance
+
+- (instancetype)initWithPersistentStore:(NSPersistentStoreCoordinator *)store
+                       storageDirectory:(NSURL *)storageDirectory
+                         thumbnailStore:(nullable ThumbnailPackStore *)thumbnailStore {
+    NSParameterAssert(nil != store);
+    NSParameterAssert(nil != storageDirectory);
+    self = [super init];
+    if (nil != self) {
+        self->_store = store;
+        self->_storageDirectory = storageDirectory;
+        self->_thumbnailStore = thumbnailStore;
+        // Background QoS gets the disk I/O throttled by the system, which is what we want for housekeeping
+        self->_workQ = dispatch_queue_create("com.digitalflapjack.StorageMaintenance.workQ", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_workQ, dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0));
+        self->_listQ = dispatch_queue_create("com.digitalflapjack.StorageMaintenance.listQ", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(self->_listQ, dispatch_get_global_queue(QOS_CLASS_BACKGROUND, 0));
+    }
+    return self;
+}
+
+- (void)scan:(void (^)(StorageScanReport * _Nullable report, NSError * _Nullable error))callback {
+    NSParameterAssert(nil != callback);
+
+    @weakify(self);
+    dispatch_async(self.workQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        [self.storageDirectory secureAccessWithBlock:^(NSURL * _Nonnull url, __unused BOOL canAccess) {
+            NSError *error = nil;
+            StorageScanReport *report = [self scanStorageDirectory:url
+                                                             error:&error];
+            callback(report, error);
+        }];
+    });
+}
+
+- (void)reclaim:(StorageScanReport *)report
+       callback:(nullable void (^)(unsigned long long reclaimedBytes))callback {
+    NSParameterAssert(nil != report);
+
+    @weakify(self);
+    dispatch_async(self.workQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        [self.storageDirectory secureAccessWithBlock:^(NSURL * _Nonnull url, __unused BOOL canAccess) {
+            unsigned long long reclaimed = [self reclaimReport:report
+                                              storageDirectory:url];
+            if (nil != callback) {
+                callback(reclaimed);
+            }
+        }];
+    });
+}
+
+
+#pragma mark - Scanning
+
+- (nullable StorageScanReport *)scanStorageDirectory:(NSURL *)storageDirectory
+                                               error:(NSError **)error {
+    dispatch_assert_queue(self.workQ);
+
+    NSDate *cutoff = [NSDate dateWithTimeIntervalSinceNow:-kStorageMaintenanceMinimumAge];
+
+    // The directory listing and the walk of the store don't depend on each other, so run them
+    // side by side, and only compare notes at the end.
+    __block NSDictionary<NSString *, NSURL *> *itemDirectories = nil;
+    __block NSError *listError = nil;
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_async(group, self.listQ, ^{
+        NSError *innerError = nil;
+        itemDirectories = [StorageMaintenance itemDirectoriesInStorageDirectory:storageDirectory
+                                                                   modifiedBefore:cutoff
+                                                                            error:&innerError];
+        listError = innerError;
+    });
+
+    NSMutableSet<NSString *> *referenced = [NSMutableSet set];
+    NSMutableArray<NSURL *> *staleThumbnails = [NSMutableArray array];
+    NSMutableArray<NSManagedObjectID *> *missingOriginals = [NSMutableArray array];
+    __block unsigned long long reclaimableBytes = 0;
+    NSError *walkError = nil;
+    BOOL success = [self walkAssets:^(Asset *asset) {
+        NSURL *itemDirectory = [asset itemDirectory];
+        [referenced addObject:[itemDirectory lastPathComponent]];
+
+        if (NO == [[NSFileManager defaultManager] fileExistsAtPath:[asset.path path]]) {
+            [missingOriginals addObject:asset.objectID];
+        }
+
+        for (NSURL *thumbnail in [StorageMaintenance staleThumbnailsInItemDirectory:itemDirectory
+                                                                  thumbnailPath:asset.thumbnailPath
+                                                                 modifiedBefore:cutoff]) {
+            [staleThumbnails addObject:thumbnail];
+            reclaimableBytes += [StorageMaintenance allocatedSizeOfItemAtURL:thumbnail];
+        }
+    }
+                              error:&walkError];
+
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    if (NO == success) {
+        if (nil != error) {
+            *error = walkError;
+        }
+        return nil;
+    }
+    if (nil == itemDirectories) {
+        if (nil != error) {
+            *error = listError;
+        }
+        return nil;
+    }
+
+    NSMutableArray<NSURL *> *orphanDirectories = [NSMutableArray array];
+    for (NSString *name in itemDirectories) {
+        if (NO != [referenced containsObject:name]) {
+            continue;
+        }
+        NSURL *directory = itemDirectories[name];
+        [orphanDirectories addObject:directory];
+        reclaimableBytes += [StorageMaintenance allocatedSizeOfItemAtURL:directory];
+    }
+
+    ThumbnailPackStore *thumbnailStore = self.thumbnailStore;
+    if (nil != thumbnailStore) {
+        unsigned long long total = [thumbnailStore totalBytes];
+        unsigned long long live = [thumbnailStore liveBytes];
+        if (total > live) {
+            reclaimableBytes += total - live;
+        }
+    }
+
+    return [[StorageScanReport alloc] initWithOrphanDirectories:orphanDirectories
+                                                staleThumbnails:staleThumbnails
+                                               missingOriginals:missingOriginals
+                                               reclaimableBytes:reclaimableBytes];
+}
+
+// Visits every asset, trash included, with only a batch of them in memory at a time. The asset
+// is only valid for the duration of the block.
+- (BOOL)walkAssets:(void (^)(Asset *asset))block
+             error:(NSError **)error {
+    NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+    context.persistentStoreCoordinator = self.store;
+    context.undoManager = nil;
+
+    __block BOOL success = NO;
+    [context performBlockAndWait:^{
+        NSFetchRequest *fetchRequest = [Asset fetchRequest];
+        fetchRequest.fetchBatchSize = kStorageMaintenanceFetchBatchSize;
+        fetchRequest.propertiesToFetch = @[@"path", @"thumbnailPath"];
+        fetchRequest.includesPropertyValues = YES;
+        NSError *innerError = nil;
+        NSArray<Asset *> *assets = [context executeFetchRequest:fetchRequest
+                                                          error:&innerError];
+        if (nil != innerError) {
+            NSAssert(nil == assets, @"Got error and fetch results.");
+            if (nil != error) {
+                *error = innerError;
+            }
+            return;
+        }
+        NSAssert(nil != assets, @"Got no error and no fetch results.");
+
+        NSUInteger count = [assets count];
+        for (NSUInteger start = 0; start < count; start += kStorageMaintenanceFetchBatchSize) {
+            @autoreleasepool {
+                NSUInteger end = MIN(start + kStorageMaintenanceFetchBatchSize, count);
+                for (NSUInteger index = start; index < end; index++) {
+                    Asset *asset = assets[index];
+                    // Gone from the store since we started
+                    if ((NO != asset.isDeleted) || (nil == asset.path)) {
+                        continue;
+                    }
+                    block(asset);
+                }
+                // Turn the batch back into faults so the row data can go
+                for (NSUInteger index = start; index < end; index++) {
+                    [context refreshObject:assets[index]
+                              mergeChanges:NO];
+                }
+            }
+        }
+        success = YES;
+    }];
+    return success;
+}
+
+// Only directories named like the ones import makes are considered, which skips the thumbnail
+// packs, the import journal, and anything else the user has put there.
++ (nullable NSDictionary<NSString *, NSURL *> *)itemDirectoriesInStorageDirectory:(NSURL *)storageDirectory
+                                                                   modifiedBefore:(NSDate *)cutoff
+                                                                            error:(NSError **)error {
+    NSParameterAssert(nil != storageDirectory);
+    NSParameterAssert(nil != cutoff);
+
+    NSError *innerError = nil;
+    NSArray<NSURL *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:storageDirectory
+                                                               includingPropertiesForKeys:@[NSURLIsDirectoryKey, NSURLContentModificationDateKey]
+                                                                                  options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                                    error:&innerError];
+    if (nil == contents) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+
+    NSMutableDictionary<NSString *, NSURL *> *directories = [NSMutableDictionary dictionaryWithCapacity:[contents count]];
+    for (NSURL *url in contents) {
+        NSString *name = [url lastPathComponent];
+        if (nil == [[NSUUID alloc] initWithUUIDString:name]) {
+            continue;
+        }
+        NSNumber *isDirectory = nil;
+        NSDate *modified = nil;
+        [url getResourceValue:&isDirectory
+                       forKey:NSURLIsDirectoryKey
+                        error:nil];
+        [url getResourceValue:&modified
+                       forKey:NSURLContentModificationDateKey
+                        error:nil];
+        if ((NO == [isDirectory boolValue]) || (nil == modified) || (NSOrderedDescending == [modified compare:cutoff])) {
+            continue;
+        }
+        [directories setObject:url
+                        forKey:name];
+    }
+    return [NSDictionary dictionaryWithDictionary:directories];
+}
+
+// Thumbnails are the files next to the original that ThumbnailPyramid names, so anything like
+// that which isn't in the asset's current set is left over from an older one. Assets with packed
+// thumbnails have no use for any of them.
++ (NSArray<NSURL *> *)staleThumbnailsInItemDirectory:(NSURL *)itemDirectory
+                                       thumbnailPath:(nullable NSURL *)thumbnailPath
+                                      modifiedBefore:(NSDate *)cutoff {
+    NSParameterAssert(nil != itemDirectory);
+    NSParameterAssert(nil != cutoff);
+
+    NSArray<NSURL *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:itemDirectory
+                                                               includingPropertiesForKeys:@[NSURLIsRegularFileKey, NSURLContentModificationDateKey]
+                                                                                  options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                                    error:nil];
+    if (0 == [contents count]) {
+        return @[];
+    }
+
+    NSMutableSet<NSString *> *current = [NSMutableSet set];
+    if ((nil != thumbnailPath) && (nil == [ThumbnailPackStore keyForURL:thumbnailPath])) {
+        for (NSURL *url in [ThumbnailPyramid allURLsForThumbnailPath:thumbnailPath]) {
+            [current addObject:[url lastPathComponent]];
+        }
+        [current addObject:[thumbnailPath lastPathComponent]];
+    }
+
+    NSMutableArray<NSURL *> *stale = [NSMutableArray array];
+    for (NSURL *url in contents) {
+        NSString *name = [url lastPathComponent];
+        if ((NO == [name hasPrefix:@"thumbnail"]) || (NO != [current containsObject:name])) {
+            continue;
+        }
+        NSNumber *isRegularFile = nil;
+        NSDate *modified = nil;
+        [url getResourceValue:&isRegularFile
+                       forKey:NSURLIsRegularFileKey
+                        error:nil];
+        [url getResourceValue:&modified
+                       forKey:NSURLContentModificationDateKey
+                        error:nil];
+        if ((NO == [isRegularFile boolValue]) || (nil == modified) || (NSOrderedDescending == [modified compare:cutoff])) {
+            continue;
+        }
+        [stale addObject:url];
+    }
+    return [NSArray arrayWithArray:stale];
+}
+
++ (unsigned long long)allocatedSizeOfItemAtURL:(NSURL *)url {
+    NSParameterAssert(nil != url);
+
+    NSArray<NSURLResourceKey> *keys = @[NSURLIsDirectoryKey, NSURLTotalFileAllocatedSizeKey];
+    NSDictionary<NSURLResourceKey, id> *values = [url resourceValuesForKeys:keys
+                                                                      error:nil];
+    if (NO == [values[NSURLIsDirectoryKey] boolValue]) {
+        return [values[NSURLTotalFileAllocatedSizeKey] unsignedLongLongValue];
+    }
+
+    unsigned long long total = 0;
+    NSDirectoryEnumerator<NSURL *> *enumerator = [[NSFileManager defaultManager] enumeratorAtURL:url
+                                                                      includingPropertiesForKeys:keys
+                                                                                         options:0
+                                                                                    errorHandler:nil];
+    for (NSURL *item in enumerator) {
+        NSNumber *size = nil;
+        [item getResourceValue:&size
+                        forKey:NSURLTotalFileAllocatedSizeKey
+                         error:nil];
+        total += [size unsignedLongLongValue];
+    }
+    return total;
+}
+
+
+#pragma mark - Reclaiming
+
+- (unsigned long long)reclaimReport:(StorageScanReport *)report
+                   storageDirectory:(NSURL *)storageDirectory {
+    dispatch_assert_queue(self.workQ);
+
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *storagePath = [[storageDirectory URLByStandardizingPath] path];
+    NSArray<NSURL *> *items = [report.orphanDirectories arrayByAddingObjectsFromArray:report.staleThumbnails];
+
+    unsigned long long reclaimed = 0;
+    NSUInteger index = 0;
+    for (NSURL *item in items) {
+        if ((0 < index) && (0 == (index % kStorageMaintenanceReclaimBatchSize))) {
+            [StorageMaintenance waitForQuietMachine];
+        }
+        index += 1;
+
+        // The report could be old, so be sure we're still only touching our own storage
+        NSString *parentPath = [[[item URLByDeletingLastPathComponent] URLByStandardizingPath] path];
+        if ((NO == [parentPath isEqualToString:storagePath]) && (NO == [parentPath hasPrefix:[storagePath stringByAppendingString:@"/"]])) {
+            continue;
+        }
+
+        unsigned long long size = [StorageMaintenance allocatedSizeOfItemAtURL:item];
+        NSError *error = nil;
+        BOOL success = [fm removeItemAtURL:item
+                                     error:&error];
+        if (NO == success) {
+            NSLog(@"Failed to remove %@: %@", item, error);
+            continue;
+        }
+        reclaimed += size;
+    }
+
+    ThumbnailPackStore *thumbnailStore = self.thumbnailStore;
+    if (nil != thumbnailStore) {
+        unsigned long long before = [thumbnailStore totalBytes];
+        NSError *error = nil;
+        BOOL success = [thumbnailStore compact:&error];
+        if (NO == success) {
+            NSLog(@"Failed to compact thumbnails: %@", error);
+        } else {
+            unsigned long long after = [thumbnailStore totalBytes];
+            if (before > after) {
+                reclaimed += before - after;
+            }
+        }
+    }
+
+    return reclaimed;
+}
+
+// Uses the same rule as AssetWorkThrottle: if that would halve our one worker to none, the machine
+// has better things to do, so sit it out for a bit.
++ (void)waitForQuietMachine {
+    NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+    for (NSUInteger attempt = 0; attempt < kStorageMaintenanceMaximumBackoffs; attempt++) {
+        double loadAverage[1] = {0.0};
+        if (1 != getloadavg(loadAverage, 1)) {
+            return;
+        }
+        double loadPerCore = loadAverage[0] / (double)MAX([processInfo activeProcessorCount], (NSUInteger)1);
+        NSUInteger next = [AssetWorkThrottle concurrencyAfter:1
+                                                  loadPerCore:loadPerCore
+                                                 thermalState:[processInfo thermalState]
+                                                 lowPowerMode:[processInfo isLowPowerModeEnabled]
+                                                      minimum:0
+                                                      maximum:1];
+        if (0 != next) {
+            return;
+        }
+        [NSThread sleepForTimeInterval:kStorageMaintenanceBackoffInterval];
+    }
+}
+
+@end
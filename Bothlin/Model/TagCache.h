@@ -0,0 +1,42 @@
+//
+//  TagCache.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 13/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class Tag;
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Maps tag names to tags for a single context, so that tagging lots of assets doesn't need a fetch
+// per tag per asset. Names are matched ignoring case, using the tag's indexed normalisedName, and
+// anything not already known is looked up in one fetch, with tags that don't exist yet created.
+//
+// The cache only holds object IDs. Tags added by other contexts are picked up the first time they're
+// asked for, and an ID that has since gone from the store is dropped and looked up again by name.
+//
+// Not thread safe: only call on the context's queue.
+@interface TagCache : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithContext:(NSManagedObjectContext *)context;
+
+// Returns the tags keyed by normalised name. Any tags created are also returned in insertedTags,
+// and already have permanent IDs.
+- (nullable NSDictionary<NSString *, Tag *> *)tagsForNames:(NSSet<NSString *> *)names
+                                              insertedTags:(NSSet<Tag *> * _Nullable * _Nullable)insertedTags
+                                                     error:(NSError **)error;
+
+// Forget everything, say if the context is reset.
+- (void)invalidate;
+
+// The key two tag names must share to be the same tag.
++ (NSString *)normalisedNameForTag:(NSString *)name;
+
+@end
+
+NS_ASSUME_NONNULL_END
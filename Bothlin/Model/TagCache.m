@@ -0,0 +1,189 @@
+//
+//  TagCache.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 13/12/2023.
+//
+
+#import "TagCache.h"
+#import "Tag+CoreDataClass.h"
+
+@interface TagCache ()
+
+// Only access on context's queue
+@property (nonatomic, strong, readonly) NSManagedObjectContext *context;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, NSManagedObjectID *> *tagIDs;
+@property (nonatomic, readwrite) BOOL loaded;
+
+@end
+
+@implementation TagCache
+
+- (instancetype)initWithContext:(NSManagedObjectContext *)context {
+    NSParameterAssert(nil != context);
+    self = [super init];
+    if (nil != self) {
+        self->_context = context;
+        self->_tagIDs = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
++ (NSString *)normalisedNameForTag:(NSString *)name {
+    NSParameterAssert(nil != name);
+    return [name stringByFoldingWithOptions:NSCaseInsensitiveSearch
+                                     locale:nil];
+}
+
+- (void)invalidate {
+    [self.tagIDs removeAllObjects];
+    self.loaded = NO;
+}
+
+// Tags are few compared to assets, so the first time we're used we just read them all. Tags from
+// before normalisedName was added to the model get it filled in here, and will be saved with
+// whatever the caller saves next.
+- (BOOL)load:(NSError **)error {
+    NSFetchRequest *fetchRequest = [Tag fetchRequest];
+    fetchRequest.returnsObjectsAsFaults = NO;
+    NSError *innerError = nil;
+    NSArray<Tag *> *tags = [self.context executeFetchRequest:fetchRequest
+                                                       error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == tags, @"Got error and fetch results.");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != tags, @"Got no error and no fetch results.");
+
+    for (Tag *tag in tags) {
+        if (nil == tag.normalisedName) {
+            tag.normalisedName = [TagCache normalisedNameForTag:tag.name];
+        }
+        if ((NO == tag.objectID.isTemporaryID) && (nil == [self.tagIDs objectForKey:tag.normalisedName])) {
+            [self.tagIDs setObject:tag.objectID
+                            forKey:tag.normalisedName];
+        }
+    }
+    self.loaded = YES;
+    return YES;
+}
+
+- (nullable NSDictionary<NSString *, Tag *> *)tagsForNames:(NSSet<NSString *> *)names
+                                              insertedTags:(NSSet<Tag *> * _Nullable * _Nullable)insertedTags
+                                                     error:(NSError **)error {
+    NSParameterAssert(nil != names);
+
+    if (NO == self.loaded) {
+        BOOL success = [self load:error];
+        if (NO == success) {
+            return nil;
+        }
+    }
+
+    // The first spelling we see of a name is the one any new tag gets
+    NSMutableDictionary<NSString *, NSString *> *namesByKey = [NSMutableDictionary dictionaryWithCapacity:[names count]];
+    for (NSString *name in names) {
+        NSString *key = [TagCache normalisedNameForTag:name];
+        if (nil == [namesByKey objectForKey:key]) {
+            [namesByKey setObject:name
+                           forKey:key];
+        }
+    }
+
+    // Anything the context already has in memory needs no trip to the store
+    NSMutableDictionary<NSString *, Tag *> *found = [NSMutableDictionary dictionaryWithCapacity:[namesByKey count]];
+    NSMutableSet<NSString *> *missingKeys = [NSMutableSet set];
+    NSMutableSet<NSManagedObjectID *> *unregisteredIDs = [NSMutableSet set];
+    for (NSString *key in namesByKey) {
+        NSManagedObjectID *tagID = [self.tagIDs objectForKey:key];
+        if (nil == tagID) {
+            [missingKeys addObject:key];
+            continue;
+        }
+        Tag *tag = (Tag *)[self.context objectRegisteredForID:tagID];
+        if ((nil != tag) && (NO == tag.isDeleted) && (NO == tag.isFault)) {
+            [found setObject:tag
+                      forKey:key];
+        } else {
+            [missingKeys addObject:key];
+            [unregisteredIDs addObject:tagID];
+        }
+    }
+
+    NSMutableSet<Tag *> *inserted = [NSMutableSet set];
+    if (0 < [missingKeys count]) {
+        // One indexed lookup for everything else, by ID where we know it, and by name where we don't
+        NSFetchRequest *fetchRequest = [Tag fetchRequest];
+        fetchRequest.predicate = [NSPredicate predicateWithFormat:@"(SELF IN %@) OR (normalisedName IN %@)", unregisteredIDs, missingKeys];
+        fetchRequest.returnsObjectsAsFaults = NO;
+        NSError *innerError = nil;
+        NSArray<Tag *> *tags = [self.context executeFetchRequest:fetchRequest
+                                                           error:&innerError];
+        if (nil != innerError) {
+            NSAssert(nil == tags, @"Got error and fetch results.");
+            if (nil != error) {
+                *error = innerError;
+            }
+            return nil;
+        }
+        NSAssert(nil != tags, @"Got no error and no fetch results.");
+
+        for (NSString *key in missingKeys) {
+            [self.tagIDs removeObjectForKey:key];
+        }
+        for (Tag *tag in tags) {
+            NSString *key = tag.normalisedName;
+            if ((nil == key) || (NO == [missingKeys containsObject:key]) || (nil != [found objectForKey:key])) {
+                continue;
+            }
+            [found setObject:tag
+                      forKey:key];
+        }
+
+        for (NSString *key in missingKeys) {
+            if (nil != [found objectForKey:key]) {
+                continue;
+            }
+            Tag *tag = [NSEntityDescription insertNewObjectForEntityForName:@"Tag"
+                                                     inManagedObjectContext:self.context];
+            tag.name = [namesByKey objectForKey:key];
+            tag.normalisedName = key;
+            tag.assetCount = @0;
+            [inserted addObject:tag];
+            [found setObject:tag
+                      forKey:key];
+        }
+
+        // Temporary IDs don't survive the save, so get the real ones now so we can cache them
+        if (0 < [inserted count]) {
+            BOOL success = [self.context obtainPermanentIDsForObjects:[inserted allObjects]
+                                                                error:&innerError];
+            if (nil != innerError) {
+                NSAssert(NO == success, @"Got error and success from obtainPermanentIDsForObjects.");
+                if (nil != error) {
+                    *error = innerError;
+                }
+                return nil;
+            }
+            NSAssert(NO != success, @"Got no success and error from obtainPermanentIDsForObjects.");
+        }
+
+        for (NSString *key in missingKeys) {
+            Tag *tag = [found objectForKey:key];
+            if (NO == tag.objectID.isTemporaryID) {
+                [self.tagIDs setObject:tag.objectID
+                                forKey:key];
+            }
+        }
+    }
+
+    if (nil != insertedTags) {
+        *insertedTags = [NSSet setWithSet:inserted];
+    }
+    return [NSDictionary dictionaryWithDictionary:found];
+}
+
+@end
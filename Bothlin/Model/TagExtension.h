@@ -0,0 +1,31 @@
+//
+//  TagExtension.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import "Tag+CoreDataClass.h"
+
+@class Asset;
+
+// A tag's assetCount is how many assets it's on, kept up to date as tags are added and removed so
+// that finding the most used tags is a walk down an index rather than counting the join table.
+// A nil count means the tag predates the counter, and it's left alone until updateAssetCount
+// fills it in. Assets in the trash still count until the trash is emptied, as they can be
+// restored with their tags, so the count can be higher than the number of assets the tag
+// shows, and is only a ranking.
+@interface Tag (Helpers)
+
+// Assets that already have the tag aren't counted twice.
+- (void)addAssetsUpdatingCount:(NSSet<Asset *> * _Nonnull)assets;
+// Assets that don't have the tag aren't counted.
+- (void)removeAssetsUpdatingCount:(NSSet<Asset *> * _Nonnull)assets;
+// For when the assets are going from the store by other means, such as a batch delete.
+- (void)reduceAssetCountBy:(NSUInteger)count;
+
+// Counts from scratch. This faults in the IDs of every asset with the tag, so is only for
+// filling in counts that have never been set.
+- (void)updateAssetCount;
+
+@end
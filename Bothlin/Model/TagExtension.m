@@ -0,0 +1,54 @@
+//
+//  TagExtension.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import "TagExtension.h"
+#import "Asset+CoreDataClass.h"
+
+@implementation Tag (Helpers)
+
+- (void)addAssetsUpdatingCount:(NSSet<Asset *> *)assets {
+    NSParameterAssert(nil != assets);
+
+    // Assets have few tags, so checking from their side is cheaper than faulting in all of ours
+    NSUInteger added = 0;
+    for (Asset *asset in assets) {
+        if (NO == [asset.tags containsObject:self]) {
+            added += 1;
+        }
+    }
+    [self addTags:assets];
+    if ((0 < added) && (nil != self.assetCount)) {
+        self.assetCount = @([self.assetCount unsignedLongLongValue] + added);
+    }
+}
+
+- (void)removeAssetsUpdatingCount:(NSSet<Asset *> *)assets {
+    NSParameterAssert(nil != assets);
+
+    NSUInteger removed = 0;
+    for (Asset *asset in assets) {
+        if (NO != [asset.tags containsObject:self]) {
+            removed += 1;
+        }
+    }
+    [self removeTags:assets];
+    [self reduceAssetCountBy:removed];
+}
+
+- (void)reduceAssetCountBy:(NSUInteger)count {
+    if ((0 == count) || (nil == self.assetCount)) {
+        return;
+    }
+    unsigned long long current = [self.assetCount unsignedLongLongValue];
+    self.assetCount = @(current > count ? current - count : 0);
+}
+
+- (void)updateAssetCount {
+    self.assetCount = @([self.tags count]);
+}
+
+@end
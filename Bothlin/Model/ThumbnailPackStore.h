@@ -0,0 +1,66 @@
+//
+//  ThumbnailPackStore.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 06/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+extern NSString * __nonnull const kThumbnailPackDirectoryName;
+
+// Keeps thumbnails in a handful of large append-only pack files rather than one file per
+// thumbnail, as with hundreds of thousands of assets the per file open/read/close and filesystem
+// metadata dominates scrolling. Packs are read via mmap, so a thumbnail costs page faults rather
+// than syscalls. An index log alongside the packs records where each thumbnail lives, and is
+// replayed when the store is opened.
+//
+// Replacing or removing a thumbnail just leaves dead space in its pack, which compact: reclaims.
+//
+// Thumbnails are identified by a key, and can also be referred to by a URL (which is what is
+// stored in the asset's thumbnailPath) so that they can sit alongside older per file thumbnails.
+@interface ThumbnailPackStore : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *directory;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+// The packs live in kThumbnailPackDirectoryName within the storage directory, which will be
+// created if needed. Security scoped access to the storage directory is held for the lifetime of
+// the store, as the packs stay mapped. The index is loaded in the background, and any calls made
+// before that's done will wait for it.
+- (instancetype)initWithStorageDirectory:(NSURL *)storageDirectory;
+
++ (NSURL *)URLForKey:(NSString *)key;
+// Returns nil if the URL isn't for a packed thumbnail.
++ (nullable NSString *)keyForURL:(NSURL *)url;
+
+// Stores the data for all the keys with a single index update. Existing data for any of the keys
+// is replaced.
+- (BOOL)storeThumbnails:(NSDictionary<NSString *, NSData *> *)thumbnails
+                  error:(NSError * _Nullable *)error;
+
+// The data returned is backed directly by the mapped pack, so is cheap to get, and stays valid
+// even if the thumbnail is later replaced or the pack compacted.
+- (nullable NSData *)thumbnailDataForKey:(NSString *)key;
+- (nullable NSData *)thumbnailDataForURL:(NSURL *)url;
+
+- (void)removeThumbnailsForKeys:(NSSet<NSString *> *)keys;
+
+// Bytes in use by current thumbnails, and bytes taken up by the packs in total.
+- (unsigned long long)liveBytes;
+- (unsigned long long)totalBytes;
+
+// Closes the pack currently being written to, rewrites the live thumbnails from every existing
+// pack into new packs, and deletes the old ones. Readers and writers can carry on whilst this
+// runs, with anything written in the meantime going to a fresh pack that is left alone.
+- (BOOL)compact:(NSError * _Nullable *)error;
+
+// Only compacts if enough of the store is dead space to make it worthwhile.
+- (BOOL)compactIfNeeded:(NSError * _Nullable *)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,794 @@
+//
+//  ThumbnailPackStore.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 06/12/2023.
+//
+
+#import <sys/mman.h>
+#import <sys/stat.h>
+
+#import "ThumbnailPackStore.h"
+
+NSString * __nonnull const kThumbnailPackDirectoryName = @".thumbnails";
+static NSString * __nonnull const kThumbnailPackURLScheme = @"bothlin-thumbnail";
+static NSString * __nonnull const kThumbnailPackIndexName = @"index.log";
+static NSString * __nonnull const kThumbnailPackFilePrefix = @"pack-";
+static NSString * __nonnull const kThumbnailPackFileExtension = @"bin";
+
+// Big enough that even a large library only has a few dozen packs, small enough that compacting
+// one doesn't mean copying gigabytes.
+static const unsigned long long kThumbnailPackMaximumSize = 64 * 1024 * 1024;
+static const unsigned long long kThumbnailPackCompactionMinimumDeadBytes = 16 * 1024 * 1024;
+static const double kThumbnailPackCompactionDeadRatio = 0.5;
+
+NSErrorDomain __nonnull const ThumbnailPackStoreErrorDomain = @"com.digitalflapjack.ThumbnailPackStore";
+typedef NS_ERROR_ENUM(ThumbnailPackStoreErrorDomain, ThumbnailPackStoreErrorCode) {
+    ThumbnailPackStoreErrorUnknown = 0,
+    ThumbnailPackStoreErrorNotOpen = 1,
+    ThumbnailPackStoreErrorInvalidKey = 2,
+};
+
+
+@interface ThumbnailPackEntry : NSObject
+
+@property (nonatomic, readonly) NSUInteger pack;
+@property (nonatomic, readonly) unsigned long long offset;
+@property (nonatomic, readonly) NSUInteger length;
+
+- (instancetype)initWithPack:(NSUInteger)pack
+                      offset:(unsigned long long)offset
+                      length:(NSUInteger)length;
+
+@end
+
+@implementation ThumbnailPackEntry
+
+- (instancetype)initWithPack:(NSUInteger)pack
+                      offset:(unsigned long long)offset
+                      length:(NSUInteger)length {
+    self = [super init];
+    if (nil != self) {
+        self->_pack = pack;
+        self->_offset = offset;
+        self->_length = length;
+    }
+    return self;
+}
+
+@end
+
+
+// Owns a read only mapping of a whole pack, and unmaps it when the last NSData using it goes.
+@interface ThumbnailPackMapping : NSObject
+
+@property (nonatomic, readonly) const uint8_t *bytes;
+@property (nonatomic, readonly) size_t length;
+
++ (nullable instancetype)mappingOfFileAtURL:(NSURL *)url
+                                      error:(NSError **)error;
+
+@end
+
+@implementation ThumbnailPackMapping
+
++ (nullable instancetype)mappingOfFileAtURL:(NSURL *)url
+                                      error:(NSError **)error {
+    NSParameterAssert(nil != url);
+
+    int fd = open([url fileSystemRepresentation], O_RDONLY | O_CLOEXEC);
+    if (0 > fd) {
+        if (nil != error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                         code:errno
+                                     userInfo:@{NSURLErrorKey: url}];
+        }
+        return nil;
+    }
+    struct stat info;
+    int statResult = fstat(fd, &info);
+    if ((0 != statResult) || (0 >= info.st_size)) {
+        int statErrno = 0 != statResult ? errno : EINVAL;
+        close(fd);
+        if (nil != error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                         code:statErrno
+                                     userInfo:@{NSURLErrorKey: url}];
+        }
+        return nil;
+    }
+    size_t length = (size_t)info.st_size;
+    void *bytes = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    int mapErrno = errno;
+    close(fd);
+    if (MAP_FAILED == bytes) {
+        if (nil != error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                         code:mapErrno
+                                     userInfo:@{NSURLErrorKey: url}];
+        }
+        return nil;
+    }
+
+    ThumbnailPackMapping *mapping = [[ThumbnailPackMapping alloc] init];
+    mapping->_bytes = bytes;
+    mapping->_length = length;
+    return mapping;
+}
+
+- (void)dealloc {
+    if (NULL != self->_bytes) {
+        munmap((void *)self->_bytes, self->_length);
+    }
+}
+
+@end
+
+
+@interface ThumbnailPackStore ()
+
+@property (nonatomic, strong, readonly) NSURL *storageDirectory;
+@property (nonatomic, readonly) BOOL hasSecureAccess;
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+
+// Only access on syncQ
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, ThumbnailPackEntry *> *index;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSNumber *, NSNumber *> *packSizes;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSNumber *, ThumbnailPackMapping *> *mappings;
+@property (nonatomic, strong, readwrite, nullable) NSFileHandle *indexHandle;
+@property (nonatomic, strong, readwrite, nullable) NSFileHandle *currentPackHandle;
+@property (nonatomic, readwrite) NSUInteger currentPack;
+@property (nonatomic, readwrite) NSUInteger nextPack;
+@property (nonatomic, readwrite) unsigned long long liveByteCount;
+@property (nonatomic, readwrite) BOOL compacting;
+
+@end
+
+@implementation ThumbnailPackStore
+
+- (instancetype)initWithStorageDirectory:(NSURL *)storageDirectory {
+    NSParameterAssert(nil != storageDirectory);
+    self = [super init];
+    if (nil != self) {
+        self->_storageDirectory = storageDirectory;
+        self->_directory = [storageDirectory URLByAppendingPathComponent:kThumbnailPackDirectoryName];
+        self->_hasSecureAccess = [storageDirectory startAccessingSecurityScopedResource];
+        self->_syncQ = dispatch_queue_create("com.digitalflapjack.ThumbnailPackStore.syncQ", DISPATCH_QUEUE_SERIAL);
+        self->_index = [NSMutableDictionary dictionary];
+        self->_packSizes = [NSMutableDictionary dictionary];
+        self->_mappings = [NSMutableDictionary dictionary];
+        self->_currentPack = NSNotFound;
+
+        dispatch_async(self->_syncQ, ^{
+            NSError *error = nil;
+            BOOL success = [self loadIndex:&error];
+            if (NO == success) {
+                NSLog(@"Failed to open thumbnail packs in %@: %@", self.directory, error);
+            }
+        });
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self->_indexHandle closeAndReturnError:nil];
+    [self->_currentPackHandle closeAndReturnError:nil];
+    if (self->_hasSecureAccess) {
+        [self->_storageDirectory stopAccessingSecurityScopedResource];
+    }
+}
+
++ (NSURL *)URLForKey:(NSString *)key {
+    NSParameterAssert(nil != key);
+    return [NSURL URLWithString:[NSString stringWithFormat:@"%@:%@", kThumbnailPackURLScheme, key]];
+}
+
++ (nullable NSString *)keyForURL:(NSURL *)url {
+    NSParameterAssert(nil != url);
+    if (NO == [[url scheme] isEqualToString:kThumbnailPackURLScheme]) {
+        return nil;
+    }
+    return [url resourceSpecifier];
+}
+
+
+#pragma mark - Reading and writing
+
+- (BOOL)storeThumbnails:(NSDictionary<NSString *, NSData *> *)thumbnails
+                  error:(NSError **)error {
+    NSParameterAssert(nil != thumbnails);
+    dispatch_assert_queue_not(self.syncQ);
+
+    __block NSError *innerError = nil;
+    dispatch_sync(self.syncQ, ^{
+        if (nil == self.indexHandle) {
+            innerError = [NSError errorWithDomain:ThumbnailPackStoreErrorDomain
+                                             code:ThumbnailPackStoreErrorNotOpen
+                                         userInfo:@{NSURLErrorKey: self.directory}];
+            return;
+        }
+
+        // Write all the data first, so the index never refers to anything that isn't there.
+        NSMutableDictionary<NSString *, ThumbnailPackEntry *> *entries = [NSMutableDictionary dictionaryWithCapacity:[thumbnails count]];
+        NSMutableString *lines = [NSMutableString string];
+        for (NSString *key in [[thumbnails allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+            if ([key rangeOfCharacterFromSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]].location != NSNotFound) {
+                innerError = [NSError errorWithDomain:ThumbnailPackStoreErrorDomain
+                                                 code:ThumbnailPackStoreErrorInvalidKey
+                                             userInfo:@{@"Key": key}];
+                return;
+            }
+            NSData *data = thumbnails[key];
+            ThumbnailPackEntry *entry = [self appendData:data
+                                                   error:&innerError];
+            if (nil == entry) {
+                return;
+            }
+            entries[key] = entry;
+            [lines appendFormat:@"P\t%@\t%lu\t%llu\t%lu\n", key, (unsigned long)entry.pack, entry.offset, (unsigned long)entry.length];
+        }
+
+        BOOL success = [self.indexHandle writeData:[lines dataUsingEncoding:NSUTF8StringEncoding]
+                                             error:&innerError];
+        if (NO == success) {
+            return;
+        }
+        for (NSString *key in entries) {
+            ThumbnailPackEntry *previous = self.index[key];
+            if (nil != previous) {
+                self.liveByteCount -= previous.length;
+            }
+            self.index[key] = entries[key];
+            self.liveByteCount += entries[key].length;
+        }
+    });
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (nullable NSData *)thumbnailDataForKey:(NSString *)key {
+    NSParameterAssert(nil != key);
+    dispatch_assert_queue_not(self.syncQ);
+
+    __block ThumbnailPackEntry *entry = nil;
+    __block ThumbnailPackMapping *mapping = nil;
+    dispatch_sync(self.syncQ, ^{
+        entry = self.index[key];
+        if (nil == entry) {
+            return;
+        }
+        mapping = [self mappingForEntry:entry];
+    });
+    if (nil == mapping) {
+        return nil;
+    }
+    return [self dataForEntry:entry
+                    inMapping:mapping];
+}
+
+- (nullable NSData *)thumbnailDataForURL:(NSURL *)url {
+    NSParameterAssert(nil != url);
+    NSString *key = [ThumbnailPackStore keyForURL:url];
+    if (nil == key) {
+        return nil;
+    }
+    return [self thumbnailDataForKey:key];
+}
+
+- (void)removeThumbnailsForKeys:(NSSet<NSString *> *)keys {
+    NSParameterAssert(nil != keys);
+    if (0 == [keys count]) {
+        return;
+    }
+
+    dispatch_async(self.syncQ, ^{
+        NSMutableString *lines = [NSMutableString string];
+        for (NSString *key in keys) {
+            ThumbnailPackEntry *entry = self.index[key];
+            if (nil == entry) {
+                continue;
+            }
+            self.liveByteCount -= entry.length;
+            [self.index removeObjectForKey:key];
+            [lines appendFormat:@"D\t%@\n", key];
+        }
+        if (0 == [lines length]) {
+            return;
+        }
+        NSError *error = nil;
+        BOOL success = [self.indexHandle writeData:[lines dataUsingEncoding:NSUTF8StringEncoding]
+                                             error:&error];
+        if (NO == success) {
+            // Worst case they come back as dead space until the next compaction
+            NSLog(@"Failed to record thumbnail removal: %@", error);
+        }
+    });
+}
+
+- (unsigned long long)liveBytes {
+    dispatch_assert_queue_not(self.syncQ);
+    __block unsigned long long liveBytes = 0;
+    dispatch_sync(self.syncQ, ^{
+        liveBytes = self.liveByteCount;
+    });
+    return liveBytes;
+}
+
+- (unsigned long long)totalBytes {
+    dispatch_assert_queue_not(self.syncQ);
+    __block unsigned long long totalBytes = 0;
+    dispatch_sync(self.syncQ, ^{
+        for (NSNumber *size in [self.packSizes allValues]) {
+            totalBytes += [size unsignedLongLongValue];
+        }
+    });
+    return totalBytes;
+}
+
+
+#pragma mark - Compaction
+
+- (BOOL)compactIfNeeded:(NSError **)error {
+    unsigned long long totalBytes = [self totalBytes];
+    unsigned long long liveBytes = [self liveBytes];
+    unsigned long long deadBytes = totalBytes - MIN(totalBytes, liveBytes);
+    if ((deadBytes < kThumbnailPackCompactionMinimumDeadBytes) ||
+        ((double)deadBytes / (double)totalBytes < kThumbnailPackCompactionDeadRatio)) {
+        return YES;
+    }
+    return [self compact:error];
+}
+
+- (BOOL)compact:(NSError **)error {
+    dispatch_assert_queue_not(self.syncQ);
+
+    // Stop writing to the current pack, so that every pack that exists now can be retired once
+    // we've copied what's live out of it. New thumbnails will go to fresh packs in the meantime.
+    __block BOOL alreadyCompacting = NO;
+    __block NSSet<NSNumber *> *retiredPacks = nil;
+    __block NSDictionary<NSString *, ThumbnailPackEntry *> *snapshot = nil;
+    __block NSError *innerError = nil;
+    dispatch_sync(self.syncQ, ^{
+        if (nil == self.indexHandle) {
+            innerError = [NSError errorWithDomain:ThumbnailPackStoreErrorDomain
+                                             code:ThumbnailPackStoreErrorNotOpen
+                                         userInfo:@{NSURLErrorKey: self.directory}];
+            return;
+        }
+        if (self.compacting) {
+            alreadyCompacting = YES;
+            return;
+        }
+        self.compacting = YES;
+        [self.currentPackHandle closeAndReturnError:nil];
+        self.currentPackHandle = nil;
+        self.currentPack = NSNotFound;
+        retiredPacks = [NSSet setWithArray:[self.packSizes allKeys]];
+        snapshot = [NSDictionary dictionaryWithDictionary:self.index];
+    });
+    if (alreadyCompacting) {
+        return YES;
+    }
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+
+    // The copying is done without holding syncQ, so the grid can keep reading. Go in pack order
+    // so we read each old pack sequentially.
+    NSArray<NSString *> *keys = [[snapshot allKeys] sortedArrayUsingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+        ThumbnailPackEntry *entryA = snapshot[a];
+        ThumbnailPackEntry *entryB = snapshot[b];
+        if (entryA.pack != entryB.pack) {
+            return entryA.pack < entryB.pack ? NSOrderedAscending : NSOrderedDescending;
+        }
+        if (entryA.offset != entryB.offset) {
+            return entryA.offset < entryB.offset ? NSOrderedAscending : NSOrderedDescending;
+        }
+        return NSOrderedSame;
+    }];
+    NSMutableDictionary<NSString *, ThumbnailPackEntry *> *moved = [NSMutableDictionary dictionaryWithCapacity:[keys count]];
+    NSFileHandle *outputHandle = nil;
+    NSUInteger outputPack = NSNotFound;
+    unsigned long long outputSize = 0;
+    for (NSString *key in keys) {
+        ThumbnailPackEntry *entry = snapshot[key];
+        __block ThumbnailPackMapping *mapping = nil;
+        dispatch_sync(self.syncQ, ^{
+            mapping = [self mappingForEntry:entry];
+        });
+        if (nil == mapping) {
+            continue;
+        }
+        NSData *data = [self dataForEntry:entry
+                                inMapping:mapping];
+
+        if ((nil == outputHandle) || (outputSize + [data length] > kThumbnailPackMaximumSize)) {
+            [outputHandle closeAndReturnError:nil];
+            __block NSUInteger pack = NSNotFound;
+            dispatch_sync(self.syncQ, ^{
+                pack = self.nextPack;
+                self.nextPack += 1;
+                self.packSizes[@(pack)] = @(0);
+            });
+            outputHandle = [self createPack:pack
+                                      error:&innerError];
+            if (nil == outputHandle) {
+                dispatch_sync(self.syncQ, ^{
+                    [self.packSizes removeObjectForKey:@(pack)];
+                });
+                break;
+            }
+            outputPack = pack;
+            outputSize = 0;
+        }
+        BOOL success = [outputHandle writeData:data
+                                         error:&innerError];
+        if (NO == success) {
+            break;
+        }
+        moved[key] = [[ThumbnailPackEntry alloc] initWithPack:outputPack
+                                                       offset:outputSize
+                                                       length:[data length]];
+        outputSize += [data length];
+        dispatch_sync(self.syncQ, ^{
+            self.packSizes[@(outputPack)] = @(outputSize);
+        });
+    }
+    if (nil != outputHandle) {
+        [outputHandle synchronizeAndReturnError:nil];
+        [outputHandle closeAndReturnError:nil];
+    }
+
+    dispatch_sync(self.syncQ, ^{
+        self.compacting = NO;
+        if (nil != innerError) {
+            // Anything we did copy is now just dead space in the new packs
+            return;
+        }
+
+        // Anything replaced or removed whilst we were copying has moved on, and so our copy of it
+        // is dead already.
+        for (NSString *key in moved) {
+            if (self.index[key] == snapshot[key]) {
+                self.index[key] = moved[key];
+            }
+        }
+        BOOL success = [self rewriteIndex:&innerError];
+        if (NO == success) {
+            // Put back the old locations, as that's what the index on disk still says
+            for (NSString *key in moved) {
+                if (self.index[key] == moved[key]) {
+                    self.index[key] = snapshot[key];
+                }
+            }
+            return;
+        }
+
+        NSFileManager *fm = [NSFileManager defaultManager];
+        for (NSNumber *pack in retiredPacks) {
+            NSError *removeError = nil;
+            [fm removeItemAtURL:[self URLForPack:[pack unsignedIntegerValue]]
+                          error:&removeError];
+            if (nil != removeError) {
+                NSLog(@"Failed to remove old thumbnail pack %@: %@", pack, removeError);
+                continue;
+            }
+            [self.packSizes removeObjectForKey:pack];
+            // Any data already handed out keeps its mapping alive
+            [self.mappings removeObjectForKey:pack];
+        }
+    });
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+
+#pragma mark - internal
+
+- (NSURL *)URLForPack:(NSUInteger)pack {
+    NSString *name = [NSString stringWithFormat:@"%@%04lu", kThumbnailPackFilePrefix, (unsigned long)pack];
+    return [[self.directory URLByAppendingPathComponent:name] URLByAppendingPathExtension:kThumbnailPackFileExtension];
+}
+
+- (BOOL)loadIndex:(NSError **)error {
+    dispatch_assert_queue(self.syncQ);
+
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSError *innerError = nil;
+    BOOL success = [fm createDirectoryAtURL:self.directory
+                withIntermediateDirectories:YES
+                                 attributes:nil
+                                      error:&innerError];
+    if (NO == success) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+
+    NSArray<NSURL *> *contents = [fm contentsOfDirectoryAtURL:self.directory
+                                   includingPropertiesForKeys:@[NSURLFileSizeKey]
+                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                        error:&innerError];
+    if (nil == contents) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSUInteger lastPack = NSNotFound;
+    for (NSURL *url in contents) {
+        NSString *name = [[url lastPathComponent] stringByDeletingPathExtension];
+        if ((NO == [name hasPrefix:kThumbnailPackFilePrefix]) || (NO == [[url pathExtension] isEqualToString:kThumbnailPackFileExtension])) {
+            continue;
+        }
+        NSInteger pack = [[name substringFromIndex:[kThumbnailPackFilePrefix length]] integerValue];
+        NSNumber *size = nil;
+        [url getResourceValue:&size
+                       forKey:NSURLFileSizeKey
+                        error:nil];
+        self.packSizes[@(pack)] = nil != size ? size : @(0);
+        if ((NSNotFound == lastPack) || ((NSUInteger)pack > lastPack)) {
+            lastPack = (NSUInteger)pack;
+        }
+    }
+    self.nextPack = NSNotFound == lastPack ? 0 : lastPack + 1;
+
+    NSURL *indexURL = [self.directory URLByAppendingPathComponent:kThumbnailPackIndexName];
+    if ([fm fileExistsAtPath:[indexURL path]]) {
+        NSData *indexData = [NSData dataWithContentsOfURL:indexURL
+                                                  options:NSDataReadingMappedIfSafe
+                                                    error:&innerError];
+        if (nil == indexData) {
+            if (nil != error) {
+                *error = innerError;
+            }
+            return NO;
+        }
+        NSString *indexString = [[NSString alloc] initWithData:indexData
+                                                      encoding:NSUTF8StringEncoding];
+        // The last part is either empty, or a line we were part way through writing when we
+        // crashed, which could look valid but be wrong, so is always dropped.
+        NSArray<NSString *> *lines = [indexString componentsSeparatedByString:@"\n"];
+        for (NSUInteger index = 0; index + 1 < [lines count]; index++) {
+            [self replayIndexLine:lines[index]];
+        }
+    } else {
+        success = [fm createFileAtPath:[indexURL path]
+                              contents:nil
+                            attributes:nil];
+        if (NO == success) {
+            if (nil != error) {
+                *error = [NSError errorWithDomain:NSCocoaErrorDomain
+                                             code:NSFileWriteUnknownError
+                                         userInfo:@{NSURLErrorKey: indexURL}];
+            }
+            return NO;
+        }
+    }
+
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:indexURL
+                                                             error:&innerError];
+    if (nil == handle) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    success = [handle seekToEndReturningOffset:nil
+                                         error:&innerError];
+    if (NO == success) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    self.indexHandle = handle;
+
+    // Carry on filling the last pack if there's room in it
+    if ((NSNotFound != lastPack) && ([self.packSizes[@(lastPack)] unsignedLongLongValue] < kThumbnailPackMaximumSize)) {
+        self.currentPackHandle = [self openPack:lastPack
+                                          error:nil];
+        if (nil != self.currentPackHandle) {
+            self.currentPack = lastPack;
+        }
+    }
+    return YES;
+}
+
+- (void)replayIndexLine:(NSString *)line {
+    dispatch_assert_queue(self.syncQ);
+
+    // Anything that doesn't make sense is ignored, and the thumbnail will be regenerated when
+    // next needed.
+    NSArray<NSString *> *parts = [line componentsSeparatedByString:@"\t"];
+    if (([parts count] == 2) && [parts[0] isEqualToString:@"D"]) {
+        ThumbnailPackEntry *entry = self.index[parts[1]];
+        if (nil != entry) {
+            self.liveByteCount -= entry.length;
+            [self.index removeObjectForKey:parts[1]];
+        }
+        return;
+    }
+    if (([parts count] != 5) || (NO == [parts[0] isEqualToString:@"P"])) {
+        return;
+    }
+    NSUInteger pack = (NSUInteger)[parts[2] integerValue];
+    unsigned long long offset = (unsigned long long)[parts[3] longLongValue];
+    NSUInteger length = (NSUInteger)[parts[4] integerValue];
+    NSNumber *packSize = self.packSizes[@(pack)];
+    if ((nil == packSize) || (offset + length > [packSize unsignedLongLongValue])) {
+        return;
+    }
+
+    NSString *key = parts[1];
+    ThumbnailPackEntry *previous = self.index[key];
+    if (nil != previous) {
+        self.liveByteCount -= previous.length;
+    }
+    self.index[key] = [[ThumbnailPackEntry alloc] initWithPack:pack
+                                                        offset:offset
+                                                        length:length];
+    self.liveByteCount += length;
+}
+
+- (BOOL)rewriteIndex:(NSError **)error {
+    dispatch_assert_queue(self.syncQ);
+
+    NSMutableString *lines = [NSMutableString string];
+    for (NSString *key in self.index) {
+        ThumbnailPackEntry *entry = self.index[key];
+        [lines appendFormat:@"P\t%@\t%lu\t%llu\t%lu\n", key, (unsigned long)entry.pack, entry.offset, (unsigned long)entry.length];
+    }
+    NSURL *indexURL = [self.directory URLByAppendingPathComponent:kThumbnailPackIndexName];
+    NSError *innerError = nil;
+    BOOL success = [[lines dataUsingEncoding:NSUTF8StringEncoding] writeToURL:indexURL
+                                                                      options:NSDataWritingAtomic
+                                                                        error:&innerError];
+    if (NO == success) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+
+    // The atomic write replaced the file, so the old handle now points at an orphan
+    [self.indexHandle closeAndReturnError:nil];
+    self.indexHandle = [NSFileHandle fileHandleForWritingToURL:indexURL
+                                                         error:&innerError];
+    if (nil != self.indexHandle) {
+        [self.indexHandle seekToEndReturningOffset:nil
+                                             error:&innerError];
+    }
+    if (nil != innerError) {
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (nullable NSFileHandle *)createPack:(NSUInteger)pack
+                                error:(NSError **)error {
+    NSURL *url = [self URLForPack:pack];
+    BOOL success = [[NSFileManager defaultManager] createFileAtPath:[url path]
+                                                           contents:nil
+                                                         attributes:nil];
+    if (NO == success) {
+        if (nil != error) {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain
+                                         code:NSFileWriteUnknownError
+                                     userInfo:@{NSURLErrorKey: url}];
+        }
+        return nil;
+    }
+    return [self openPack:pack
+                    error:error];
+}
+
+- (nullable NSFileHandle *)openPack:(NSUInteger)pack
+                              error:(NSError **)error {
+    NSError *innerError = nil;
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:[self URLForPack:pack]
+                                                             error:&innerError];
+    if (nil != handle) {
+        [handle seekToEndReturningOffset:nil
+                                   error:&innerError];
+    }
+    if (nil != innerError) {
+        [handle closeAndReturnError:nil];
+        if (nil != error) {
+            *error = innerError;
+        }
+        return nil;
+    }
+    return handle;
+}
+
+- (nullable ThumbnailPackEntry *)appendData:(NSData *)data
+                                      error:(NSError **)error {
+    NSParameterAssert(nil != data);
+    dispatch_assert_queue(self.syncQ);
+
+    unsigned long long currentSize = NSNotFound != self.currentPack ? [self.packSizes[@(self.currentPack)] unsignedLongLongValue] : 0;
+    if ((nil == self.currentPackHandle) || ((0 < currentSize) && (currentSize + [data length] > kThumbnailPackMaximumSize))) {
+        [self.currentPackHandle closeAndReturnError:nil];
+        self.currentPackHandle = nil;
+
+        NSUInteger pack = self.nextPack;
+        NSFileHandle *handle = [self createPack:pack
+                                          error:error];
+        if (nil == handle) {
+            return nil;
+        }
+        self.nextPack += 1;
+        self.currentPack = pack;
+        self.currentPackHandle = handle;
+        self.packSizes[@(pack)] = @(0);
+        currentSize = 0;
+    }
+
+    BOOL success = [self.currentPackHandle writeData:data
+                                               error:error];
+    if (NO == success) {
+        return nil;
+    }
+    self.packSizes[@(self.currentPack)] = @(currentSize + [data length]);
+    return [[ThumbnailPackEntry alloc] initWithPack:self.currentPack
+                                             offset:currentSize
+                                             length:[data length]];
+}
+
+- (nullable ThumbnailPackMapping *)mappingForEntry:(ThumbnailPackEntry *)entry {
+    NSParameterAssert(nil != entry);
+    dispatch_assert_queue(self.syncQ);
+
+    // The pack being written to grows, so we may need to map it again to see the newer data
+    ThumbnailPackMapping *mapping = self.mappings[@(entry.pack)];
+    if ((nil != mapping) && (entry.offset + entry.length <= mapping.length)) {
+        return mapping;
+    }
+    NSError *error = nil;
+    mapping = [ThumbnailPackMapping mappingOfFileAtURL:[self URLForPack:entry.pack]
+                                                 error:&error];
+    if (nil == mapping) {
+        NSLog(@"Failed to map thumbnail pack %lu: %@", (unsigned long)entry.pack, error);
+        return nil;
+    }
+    if (entry.offset + entry.length > mapping.length) {
+        NSLog(@"Thumbnail pack %lu is shorter than its index says", (unsigned long)entry.pack);
+        return nil;
+    }
+    self.mappings[@(entry.pack)] = mapping;
+    return mapping;
+}
+
+- (NSData *)dataForEntry:(ThumbnailPackEntry *)entry
+               inMapping:(ThumbnailPackMapping *)mapping {
+    NSParameterAssert(nil != entry);
+    NSParameterAssert(nil != mapping);
+    NSAssert(entry.offset + entry.length <= mapping.length, @"Entry outside of mapping");
+
+    return [[NSData alloc] initWithBytesNoCopy:(void *)(mapping.bytes + entry.offset)
+                                        length:entry.length
+                                   deallocator:^(__unused void * _Nonnull bytes, __unused NSUInteger length) {
+        // Just holds the mapping until the data is done with
+        (void)mapping;
+    }];
+}
+
+@end
@@ -0,0 +1,56 @@
+//
+//  ThumbnailPyramid.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 05/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSInteger, ThumbnailSize) {
+    ThumbnailSizeSmall = 0, // Dense grid
+    ThumbnailSizeMedium = 1, // Normal grid
+    ThumbnailSizeLarge = 2, // Details and single view
+};
+
+@class ThumbnailPackStore;
+
+// Each asset gets its thumbnail at a few sizes, all scaled down from the one QuickLook image and
+// encoded by ImageIO in a lossy format, so we don't pay for decoding or storing anything bigger
+// than the view needs. The asset's thumbnailPath points at the large one, and the others are found
+// alongside it, either in a ThumbnailPackStore or as files.
+@interface ThumbnailPyramid : NSObject
+
+// The longest edge in pixels for a given size.
++ (CGFloat)pixelSizeForSize:(ThumbnailSize)size;
+
+// The smallest size that will look sharp when drawn with the given longest edge in pixels.
++ (ThumbnailSize)sizeForPixelSize:(CGFloat)pixelSize;
+
+// Writes all the sizes into the directory, and returns the URL to store as the thumbnailPath.
++ (nullable NSURL *)writeThumbnailsForImage:(CGImageRef)image
+                                toDirectory:(NSURL *)directory
+                                      error:(NSError * _Nullable *)error;
+
+// As above, but into the pack store, with each size stored under the key plus the size's name.
++ (nullable NSURL *)writeThumbnailsForImage:(CGImageRef)image
+                                        key:(NSString *)key
+                                    toStore:(ThumbnailPackStore *)store
+                                      error:(NSError * _Nullable *)error;
+
+// Older libraries have a single thumbnail.png, in which case that is returned for all sizes.
++ (NSURL *)URLForSize:(ThumbnailSize)size
+        thumbnailPath:(NSURL *)thumbnailPath;
+
++ (NSArray<NSURL *> *)allURLsForThumbnailPath:(NSURL *)thumbnailPath;
+
+// Removes all the sizes, be they files or in the store.
++ (void)removeThumbnailsForThumbnailPath:(NSURL *)thumbnailPath
+                                   store:(nullable ThumbnailPackStore *)store;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,289 @@
+//
+//  ThumbnailPyramid.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 05/12/2023.
+//
+
+#import <CoreServices/CoreServices.h>
+#import <ImageIO/ImageIO.h>
+
+#import "ThumbnailPyramid.h"
+#import "ThumbnailPackStore.h"
+
+NSErrorDomain __nonnull const ThumbnailPyramidErrorDomain = @"com.digitalflapjack.ThumbnailPyramid";
+typedef NS_ERROR_ENUM(ThumbnailPyramidErrorDomain, ThumbnailPyramidErrorCode) {
+    ThumbnailPyramidErrorUnknown = 0,
+    ThumbnailPyramidErrorCouldNotScaleImage = 1,
+    ThumbnailPyramidErrorCouldNotCreateDestination = 2,
+    ThumbnailPyramidErrorCouldNotWriteImage = 3,
+};
+
+static NSString * __nonnull const kThumbnailPyramidHEICType = @"public.heic";
+
+// Picked by eye: artefacts only start to show at the large size when flipping between the
+// thumbnail and the original in single view.
+static const CGFloat kThumbnailPyramidHEICQuality = 0.6;
+static const CGFloat kThumbnailPyramidJPEGQuality = 0.75;
+
+// Follows the Create rule, so the caller must release the result.
+static CGImageRef _Nullable CreateScaledImage(CGImageRef _Nonnull image, CGFloat pixelSize, BOOL opaque) {
+    NSCParameterAssert(NULL != image);
+
+    CGFloat width = (CGFloat)CGImageGetWidth(image);
+    CGFloat height = (CGFloat)CGImageGetHeight(image);
+    if ((width <= 0.0) || (height <= 0.0)) {
+        return NULL;
+    }
+    CGFloat scale = MIN(1.0, pixelSize / MAX(width, height));
+    size_t scaledWidth = (size_t)MAX(1.0, round(width * scale));
+    size_t scaledHeight = (size_t)MAX(1.0, round(height * scale));
+
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+    CGContextRef context = CGBitmapContextCreate(NULL,
+                                                 scaledWidth,
+                                                 scaledHeight,
+                                                 8,
+                                                 0,
+                                                 colorSpace,
+                                                 opaque ? kCGImageAlphaNoneSkipLast : kCGImageAlphaPremultipliedLast);
+    CGColorSpaceRelease(colorSpace);
+    if (NULL == context) {
+        return NULL;
+    }
+
+    CGRect rect = CGRectMake(0.0, 0.0, (CGFloat)scaledWidth, (CGFloat)scaledHeight);
+    if (opaque) {
+        // Otherwise the transparent parts of icons come out black in a JPEG
+        CGContextSetRGBFillColor(context, 1.0, 1.0, 1.0, 1.0);
+        CGContextFillRect(context, rect);
+    }
+    CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
+    CGContextDrawImage(context, rect, image);
+    CGImageRef scaled = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    return scaled;
+}
+
+
+@implementation ThumbnailPyramid
+
++ (CGFloat)pixelSizeForSize:(ThumbnailSize)size {
+    switch (size) {
+        case ThumbnailSizeSmall:
+            return 256.0;
+        case ThumbnailSizeMedium:
+            return 512.0;
+        case ThumbnailSizeLarge:
+            return 1024.0;
+    }
+}
+
++ (ThumbnailSize)sizeForPixelSize:(CGFloat)pixelSize {
+    for (ThumbnailSize size = ThumbnailSizeSmall; size < ThumbnailSizeLarge; size++) {
+        if (pixelSize <= [ThumbnailPyramid pixelSizeForSize:size]) {
+            return size;
+        }
+    }
+    return ThumbnailSizeLarge;
+}
+
++ (NSString *)nameForSize:(ThumbnailSize)size {
+    switch (size) {
+        case ThumbnailSizeSmall:
+            return @"thumbnail-small";
+        case ThumbnailSizeMedium:
+            return @"thumbnail-medium";
+        case ThumbnailSizeLarge:
+            return @"thumbnail-large";
+    }
+}
+
++ (nullable NSURL *)writeThumbnailsForImage:(CGImageRef)image
+                                toDirectory:(NSURL *)directory
+                                      error:(NSError **)error {
+    NSParameterAssert(NULL != image);
+    NSParameterAssert(nil != directory);
+
+    NSString *extension = nil;
+    NSDictionary<NSNumber *, NSData *> *encoded = [ThumbnailPyramid encodeThumbnailsForImage:image
+                                                                               pathExtension:&extension
+                                                                                       error:error];
+    if (nil == encoded) {
+        return nil;
+    }
+
+    // Written atomically, so the grid never sees a half written file if we're regenerating a
+    // thumbnail it is showing.
+    for (NSNumber *size in encoded) {
+        NSURL *url = [[directory URLByAppendingPathComponent:[ThumbnailPyramid nameForSize:[size integerValue]]] URLByAppendingPathExtension:extension];
+        NSError *innerError = nil;
+        BOOL success = [encoded[size] writeToURL:url
+                                         options:NSDataWritingAtomic
+                                           error:&innerError];
+        if (NO == success) {
+            if (nil != error) {
+                *error = innerError;
+            }
+            return nil;
+        }
+    }
+    return [[directory URLByAppendingPathComponent:[ThumbnailPyramid nameForSize:ThumbnailSizeLarge]] URLByAppendingPathExtension:extension];
+}
+
++ (nullable NSURL *)writeThumbnailsForImage:(CGImageRef)image
+                                        key:(NSString *)key
+                                    toStore:(ThumbnailPackStore *)store
+                                      error:(NSError **)error {
+    NSParameterAssert(NULL != image);
+    NSParameterAssert(nil != key);
+    NSParameterAssert(nil != store);
+
+    NSDictionary<NSNumber *, NSData *> *encoded = [ThumbnailPyramid encodeThumbnailsForImage:image
+                                                                               pathExtension:nil
+                                                                                       error:error];
+    if (nil == encoded) {
+        return nil;
+    }
+    NSMutableDictionary<NSString *, NSData *> *thumbnails = [NSMutableDictionary dictionaryWithCapacity:[encoded count]];
+    for (NSNumber *size in encoded) {
+        thumbnails[[key stringByAppendingPathComponent:[ThumbnailPyramid nameForSize:[size integerValue]]]] = encoded[size];
+    }
+    BOOL success = [store storeThumbnails:thumbnails
+                                    error:error];
+    if (NO == success) {
+        return nil;
+    }
+    return [ThumbnailPackStore URLForKey:[key stringByAppendingPathComponent:[ThumbnailPyramid nameForSize:ThumbnailSizeLarge]]];
+}
+
++ (NSURL *)URLForSize:(ThumbnailSize)size
+        thumbnailPath:(NSURL *)thumbnailPath {
+    NSParameterAssert(nil != thumbnailPath);
+
+    NSString *largeName = [ThumbnailPyramid nameForSize:ThumbnailSizeLarge];
+    NSString *packKey = [ThumbnailPackStore keyForURL:thumbnailPath];
+    if (nil != packKey) {
+        if (NO == [[packKey lastPathComponent] isEqualToString:largeName]) {
+            return thumbnailPath;
+        }
+        return [ThumbnailPackStore URLForKey:[[packKey stringByDeletingLastPathComponent] stringByAppendingPathComponent:[ThumbnailPyramid nameForSize:size]]];
+    }
+
+    if (NO == [[[thumbnailPath lastPathComponent] stringByDeletingPathExtension] isEqualToString:largeName]) {
+        return thumbnailPath;
+    }
+    NSURL *directory = [thumbnailPath URLByDeletingLastPathComponent];
+    return [[directory URLByAppendingPathComponent:[ThumbnailPyramid nameForSize:size]] URLByAppendingPathExtension:[thumbnailPath pathExtension]];
+}
+
++ (NSArray<NSURL *> *)allURLsForThumbnailPath:(NSURL *)thumbnailPath {
+    NSParameterAssert(nil != thumbnailPath);
+
+    NSMutableOrderedSet<NSURL *> *urls = [NSMutableOrderedSet orderedSet];
+    for (ThumbnailSize size = ThumbnailSizeSmall; size <= ThumbnailSizeLarge; size++) {
+        [urls addObject:[ThumbnailPyramid URLForSize:size
+                                       thumbnailPath:thumbnailPath]];
+    }
+    return [urls array];
+}
+
++ (void)removeThumbnailsForThumbnailPath:(NSURL *)thumbnailPath
+                                   store:(nullable ThumbnailPackStore *)store {
+    NSParameterAssert(nil != thumbnailPath);
+
+    NSMutableSet<NSString *> *packKeys = [NSMutableSet set];
+    NSFileManager *fm = [NSFileManager defaultManager];
+    for (NSURL *url in [ThumbnailPyramid allURLsForThumbnailPath:thumbnailPath]) {
+        NSString *packKey = [ThumbnailPackStore keyForURL:url];
+        if (nil != packKey) {
+            [packKeys addObject:packKey];
+            continue;
+        }
+        NSError *error = nil;
+        [fm removeItemAtURL:url
+                      error:&error];
+        if (nil != error) {
+            // Just warn on this failure, as a leaked thumbnail does no harm
+            NSLog(@"Failed to remove thumbnail %@: %@", url, error);
+        }
+    }
+    if (0 < [packKeys count]) {
+        [store removeThumbnailsForKeys:packKeys];
+    }
+}
+
+
+#pragma mark - internal
+
++ (nullable NSDictionary<NSNumber *, NSData *> *)encodeThumbnailsForImage:(CGImageRef)image
+                                                            pathExtension:(NSString **)pathExtension
+                                                                    error:(NSError **)error {
+    NSParameterAssert(NULL != image);
+
+    // Not every Mac can encode HEIC, in which case JPEG is still a big win over PNG
+    static BOOL canWriteHEIC = NO;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSArray<NSString *> *types = (NSArray<NSString *> *)CFBridgingRelease(CGImageDestinationCopyTypeIdentifiers());
+        canWriteHEIC = [types containsObject:kThumbnailPyramidHEICType];
+    });
+    NSString *type = canWriteHEIC ? kThumbnailPyramidHEICType : (__bridge NSString *)kUTTypeJPEG;
+    CGFloat quality = canWriteHEIC ? kThumbnailPyramidHEICQuality : kThumbnailPyramidJPEGQuality;
+    if (nil != pathExtension) {
+        *pathExtension = canWriteHEIC ? @"heic" : @"jpg";
+    }
+
+    // Work down from the largest, scaling each from the one before, which is both cheaper and no
+    // worse looking than going from the original each time.
+    NSMutableDictionary<NSNumber *, NSData *> *encoded = [NSMutableDictionary dictionary];
+    CGImageRef previous = CGImageRetain(image);
+    for (ThumbnailSize size = ThumbnailSizeLarge; size >= ThumbnailSizeSmall; size--) {
+        CGImageRef scaled = CreateScaledImage(previous, [ThumbnailPyramid pixelSizeForSize:size], NO == canWriteHEIC);
+        CGImageRelease(previous);
+        if (NULL == scaled) {
+            if (nil != error) {
+                *error = [NSError errorWithDomain:ThumbnailPyramidErrorDomain
+                                             code:ThumbnailPyramidErrorCouldNotScaleImage
+                                         userInfo:@{@"Size": @(size)}];
+            }
+            return nil;
+        }
+
+        NSMutableData *data = [NSMutableData data];
+        CGImageDestinationRef destination = CGImageDestinationCreateWithData((__bridge CFMutableDataRef)data,
+                                                                             (__bridge CFStringRef)type,
+                                                                             1,
+                                                                             NULL);
+        if (NULL == destination) {
+            CGImageRelease(scaled);
+            if (nil != error) {
+                *error = [NSError errorWithDomain:ThumbnailPyramidErrorDomain
+                                             code:ThumbnailPyramidErrorCouldNotCreateDestination
+                                         userInfo:@{@"Type": type}];
+            }
+            return nil;
+        }
+        NSDictionary *properties = @{(__bridge NSString *)kCGImageDestinationLossyCompressionQuality: @(quality)};
+        CGImageDestinationAddImage(destination, scaled, (__bridge CFDictionaryRef)properties);
+        BOOL success = CGImageDestinationFinalize(destination);
+        CFRelease(destination);
+        if (NO == success) {
+            CGImageRelease(scaled);
+            if (nil != error) {
+                *error = [NSError errorWithDomain:ThumbnailPyramidErrorDomain
+                                             code:ThumbnailPyramidErrorCouldNotWriteImage
+                                         userInfo:@{@"Type": type}];
+            }
+            return nil;
+        }
+
+        encoded[@(size)] = data;
+        previous = scaled;
+    }
+    CGImageRelease(previous);
+
+    return [NSDictionary dictionaryWithDictionary:encoded];
+}
+
+@end
@@ -0,0 +1,44 @@
+//
+//  TrashPurgeJob.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 14/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+@class TrashPurgeJob;
+
+NS_ASSUME_NONNULL_BEGIN
+
+@protocol TrashPurgeJobDelegate <NSObject>
+
+// Called on the main queue, at most a few times a second, and always once when the job finishes.
+- (void)trashPurgeJobDidUpdateProgress:(TrashPurgeJob *)job;
+
+@end
+
+// A handle on emptying the trash in LibraryWriteCoordinator. The assets are gone from the store
+// early on, and most of the time is spent removing their files. The progress values are safe to
+// read from any queue, but are only a snapshot.
+@interface TrashPurgeJob : NSObject
+
+@property (nonatomic, weak, readwrite) id<TrashPurgeJobDelegate> delegate;
+
+// Zero until we've found what's in the trash, which is what counted says, so until then the job
+// should be shown as under way but of unknown size rather than as done.
+@property (atomic, readonly) NSUInteger totalItems;
+@property (atomic, readonly) NSUInteger completedItems;
+@property (atomic, readonly, getter=isCounted) BOOL counted;
+
+@property (atomic, readonly, getter=isFinished) BOOL finished;
+
+// The following are for LibraryWriteCoordinator to report progress, and aren't for anyone else to
+// call. The first call to addPendingItems: marks the job as counted, even if it adds none.
+- (void)addPendingItems:(NSUInteger)items;
+- (void)addCompletedItems:(NSUInteger)items;
+- (void)markFinished;
+
+@end
+
+NS_ASSUME_NONNULL_END
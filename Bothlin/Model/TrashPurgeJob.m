@@ -0,0 +1,85 @@
+//
+//  TrashPurgeJob.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 14/12/2023.
+//
+
+#import "TrashPurgeJob.h"
+
+#import "Helpers.h"
+
+// How often we bother the delegate, which is likely going to redraw something on mainQ
+static const NSTimeInterval kTrashPurgeJobProgressInterval = 0.25;
+
+@interface TrashPurgeJob ()
+
+@property (atomic, readwrite) NSUInteger totalItems;
+@property (atomic, readwrite) NSUInteger completedItems;
+@property (atomic, readwrite, getter=isCounted) BOOL counted;
+@property (atomic, readwrite, getter=isFinished) BOOL finished;
+
+// Guards the counters as files are removed from many queues at once
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readwrite, nullable) NSDate *lastPublished;
+
+@end
+
+@implementation TrashPurgeJob
+
+- (instancetype)init {
+    self = [super init];
+    if (nil != self) {
+        self->_syncQ = dispatch_queue_create("com.digitalflapjack.TrashPurgeJob.syncQ", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+- (void)addPendingItems:(NSUInteger)items {
+    dispatch_sync(self.syncQ, ^{
+        self.totalItems += items;
+        self.counted = YES;
+    });
+    [self publishProgress:YES];
+}
+
+- (void)addCompletedItems:(NSUInteger)items {
+    dispatch_sync(self.syncQ, ^{
+        self.completedItems += items;
+    });
+    [self publishProgress:NO];
+}
+
+- (void)markFinished {
+    dispatch_sync(self.syncQ, ^{
+        self.finished = YES;
+    });
+    [self publishProgress:YES];
+}
+
+- (void)publishProgress:(BOOL)force {
+    __block BOOL publish = force;
+    dispatch_sync(self.syncQ, ^{
+        NSDate *now = [NSDate now];
+        if ((nil == self.lastPublished) || ([now timeIntervalSinceDate:self.lastPublished] >= kTrashPurgeJobProgressInterval)) {
+            publish = YES;
+        }
+        if (publish) {
+            self.lastPublished = now;
+        }
+    });
+    if (NO == publish) {
+        return;
+    }
+
+    @weakify(self);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        [self.delegate trashPurgeJobDidUpdateProgress:self];
+    });
+}
+
+@end
@@ -11,6 +11,8 @@
 #import "SingleViewController.h"
 
 @class Asset;
+@class AssetList;
+@class AssetListChanges;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -36,6 +38,9 @@ typedef NS_ENUM(NSInteger, ItemsDisplayStyle) {
            failedToDisplayAsset:(Asset *)asset
                           error:(NSError *)error;
 
+- (void)assetsDisplayController:(AssetsDisplayController *)assetsDisplayController
+    visibleAssetsNeedThumbnails:(NSSet<NSManagedObjectID *> *)assetIDs;
+
 // TODO: Better naming needed, but I hope to remove this endless delegate chain
 // at some point, as it's somewhat tedious.
 - (BOOL)assetsDisplayController:(AssetsDisplayController *)assetsDisplayController
@@ -52,7 +57,8 @@ typedef NS_ENUM(NSInteger, ItemsDisplayStyle) {
 @property (nonatomic, weak, readwrite) id<AssetsDisplayControllerDelegate> delegate;
 @property (nonatomic, readwrite) ItemsDisplayStyle displayStyle;
 
-- (void)setAssets:(NSArray<Asset *> *)assets
+- (void)setAssets:(AssetList *)assets
+          changes:(AssetListChanges *)changes
      withSelected:(NSSet<NSIndexPath *> *)selected;
 
 @end
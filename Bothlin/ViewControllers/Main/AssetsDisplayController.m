@@ -9,6 +9,7 @@
 #import "GridViewController.h"
 #import "SingleViewController.h"
 #import "Helpers.h"
+#import "AssetList.h"
 
 @interface AssetsDisplayController ()
 
@@ -134,11 +135,15 @@
     }
 }
 
-- (void)setAssets:(NSArray<Asset *> *)assets withSelected:(NSSet<NSIndexPath *> *)indexPaths {
+- (void)setAssets:(AssetList *)assets
+          changes:(AssetListChanges *)changes
+     withSelected:(NSSet<NSIndexPath *> *)indexPaths {
     NSParameterAssert(nil != assets);
+    NSParameterAssert(nil != changes);
     NSParameterAssert(nil != indexPaths);
     dispatch_assert_queue(dispatch_get_main_queue());
     [self.gridViewController setAssets:assets
+                               changes:changes
                           withSelected:indexPaths];
     if ([indexPaths count] == 1) {
         NSIndexPath *indexPath = [indexPaths anyObject];
@@ -211,6 +216,13 @@
                        didReceiveDroppedURLs:URLs];
 }
 
+- (void)gridViewController:(GridViewController *)gridViewController
+visibleAssetsNeedThumbnails:(NSSet<NSManagedObjectID *> *)assetIDs {
+    dispatch_assert_queue(dispatch_get_main_queue());
+    [self.delegate assetsDisplayController:self
+               visibleAssetsNeedThumbnails:assetIDs];
+}
+
 - (BOOL)gridViewController:(GridViewController *)gridViewController assets:(NSSet<Asset *> *)assets wasDraggedOnSidebarItem:(SidebarItem *)sidebarItem {
     id<AssetsDisplayControllerDelegate> delegate = self.delegate;
     if (nil == delegate) {
@@ -12,6 +12,10 @@
 #import "KeyCollectionView.h"
 
 @class Asset;
+@class AssetList;
+@class AssetListChanges;
+@class ThumbnailPackStore;
+@class ThumbnailCache;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -28,6 +32,9 @@ NS_ASSUME_NONNULL_BEGIN
 - (BOOL)gridViewController:(GridViewController *)gridViewController
      didReceiveDroppedURLs:(NSSet<NSURL *> *)URLs;
 
+- (void)gridViewController:(GridViewController *)gridViewController
+visibleAssetsNeedThumbnails:(NSSet<NSManagedObjectID *> *)assetIDs;
+
 // TODO: Better naming needed, but I hope to remove this endless delegate chain
 // at some point, as it's somewhat tedious.
 - (BOOL)gridViewController:(GridViewController *)gridViewController
@@ -42,8 +49,16 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, weak, readwrite) IBOutlet KeyCollectionView *collectionView;
 @property (nonatomic, weak, readwrite) IBOutlet DragTargetView *dragTargetView;
 @property (nonatomic, weak, readwrite) id<GridViewControllerDelegate> delegate;
+// Where packed thumbnails are read from; older per file thumbnails don't need it.
+@property (nonatomic, strong, readwrite, nullable) ThumbnailPackStore *thumbnailStore;
+
+// Safe to access from any queue. Exposed so the hit rate can be checked when tuning its budget.
+@property (nonatomic, strong, readonly) ThumbnailCache *thumbnailCache;
 
-- (void)setAssets:(NSArray<Asset *> *)assets
+// Changes should describe how the previous list became this one, and are used to update the grid
+// in place rather than rebuilding it.
+- (void)setAssets:(AssetList *)assets
+          changes:(AssetListChanges *)changes
      withSelected:(NSSet<NSIndexPath *> *)selected;
 
 - (NSUInteger)count;
@@ -5,11 +5,39 @@
 //  Created by Michael Dales on 28/09/2023.
 //
 
+#import <ImageIO/ImageIO.h>
+
 #import "GridViewController.h"
 #import "Asset+CoreDataClass.h"
 #import "Helpers.h"
+#import "PerformanceMetrics.h"
 #import "AssetPromiseProvider.h"
 #import "NSArray+Functional.h"
+#import "ThumbnailPyramid.h"
+#import "ThumbnailPackStore.h"
+#import "ThumbnailCache.h"
+#import "AssetList.h"
+#import "AssetListChanges.h"
+
+// The cache budget, as a count of medium thumbnails at their largest, which is the size the normal
+// grid draws. A medium thumbnail is up to 512 pixels square at four bytes a pixel, so 1MB, and this
+// gives a 256MB budget, enough for a few screens of the normal grid.
+static const NSUInteger kGridThumbnailCacheMediumCount = 256;
+static const NSUInteger kGridThumbnailBytesPerPixel = 4;
+
+// Animating a change means laying out both the old and new grid, which past this size takes long
+// enough to be noticeable, and is too much to follow by eye anyway.
+static const NSUInteger kGridAnimatedUpdateLimit = 2000;
+
+// Thumbnails are loaded for where the scroll will have got to in this long, so they're ready by
+// the time the rows appear.
+static const NSTimeInterval kGridPrefetchLookahead = 0.5;
+// Even when still we load a little either way, and however fast the scroll we don't load so much
+// that it's all been thrown away by the time it's needed.
+static const CGFloat kGridPrefetchMinimumScreens = 0.5;
+static const CGFloat kGridPrefetchMaximumScreens = 3.0;
+// Scroll events further apart than this are a new scroll rather than a continuation.
+static const NSTimeInterval kGridScrollSampleInterval = 0.25;
 
 @interface GridViewController ()
 
@@ -17,10 +45,20 @@
 @property (strong, nonatomic, readonly) dispatch_queue_t thumbnailLoadQ;
 
 // Access only on syncQ
-@property (strong, nonatomic, readwrite) NSArray<Asset *> *assets;
-@property (strong, nonatomic, readwrite) NSDictionary<NSManagedObjectID *, NSImage *> *thumbnailCache;
+@property (strong, nonatomic, readwrite, nullable) AssetList *assets;
+
+// Keyed by object ID so the snapshot doesn't need every asset to exist
+@property (strong, nonatomic, readwrite) NSCollectionViewDiffableDataSource<NSNumber *, NSManagedObjectID *> *dataSource;
 
-@property (strong, nonatomic, readwrite) NSCollectionViewDiffableDataSource<NSNumber *, Asset *> *dataSource;
+// Access only on mainQ. Assets that were shown without a thumbnail, gathered up over a runloop
+// pass so we ask for them together rather than one at a time as cells are made.
+@property (strong, nonatomic, readonly) NSMutableSet<NSManagedObjectID *> *pendingThumbnailRequests;
+
+// Access only on mainQ. Thumbnail loads that haven't finished, so they can be cancelled if their
+// cells scroll away first, and the last scroll position for working out speed and direction.
+@property (strong, nonatomic, readonly) NSMutableDictionary<NSManagedObjectID *, dispatch_block_t> *pendingThumbnailLoads;
+@property (nonatomic, readwrite) CGFloat lastVisibleOriginY;
+@property (nonatomic, readwrite) NSTimeInterval lastVisibleRegionUpdate;
 
 @end
 
@@ -31,8 +69,13 @@
     if (nil != self) {
         self->_syncQ = dispatch_queue_create("com.digitalflapjack.GridViewController.syncQ", DISPATCH_QUEUE_SERIAL);
         self->_thumbnailLoadQ = dispatch_queue_create("com.digitalflapjack.GridViewController.thumbnailLoadQ", DISPATCH_QUEUE_CONCURRENT);
-        self->_assets = @[];
-        self->_thumbnailCache = @{};
+        self->_assets = nil;
+        NSUInteger mediumPixelSize = (NSUInteger)[ThumbnailPyramid pixelSizeForSize:ThumbnailSizeMedium];
+        NSUInteger mediumCost = mediumPixelSize * mediumPixelSize * kGridThumbnailBytesPerPixel;
+        self->_thumbnailCache = [[ThumbnailCache alloc] initWithName:@"GridViewController"
+                                                      totalCostLimit:kGridThumbnailCacheMediumCount * mediumCost];
+        self->_pendingThumbnailRequests = [NSMutableSet set];
+        self->_pendingThumbnailLoads = [NSMutableDictionary dictionary];
     }
     return self;
 }
@@ -46,13 +89,27 @@
     [self.collectionView setDraggingSourceOperationMask:NSDragOperationCopy
                                                forLocal:NO];
 
+    // Keep the loaded part of the asset list following what's on screen
+    NSClipView *clipView = self.collectionView.enclosingScrollView.contentView;
+    [clipView setPostsBoundsChangedNotifications:YES];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(visibleRegionDidChange:)
+                                                 name:NSViewBoundsDidChangeNotification
+                                               object:clipView];
+
     self.dataSource = [[NSCollectionViewDiffableDataSource alloc] initWithCollectionView:self.collectionView
                                                                             itemProvider:^NSCollectionViewItem * _Nullable(NSCollectionView * _Nonnull collectionView,
                                                                                                                            NSIndexPath * _Nonnull indexPath,
-                                                                                                                           Asset * _Nonnull asset) {
+                                                                                                                           NSManagedObjectID * _Nonnull assetID) {
         dispatch_assert_queue(dispatch_get_main_queue());
         dispatch_assert_queue_not(self.syncQ);
 
+        __block Asset *asset = nil;
+        metrics_dispatch_sync(self.syncQ, ^{
+            asset = [self.assets objectAtIndex:(NSUInteger)[indexPath item]];
+        });
+        NSAssert([asset.objectID isEqual:assetID], @"Snapshot and asset list disagree at %@", indexPath);
+
         GridViewItem *viewItem = [collectionView makeItemWithIdentifier:@"GridViewItem"
                                                            forIndexPath:indexPath];
         viewItem.delegate = self;
@@ -60,46 +117,16 @@
         viewItem.textField.stringValue = asset.name;
         [viewItem.favouriteIndicator setHidden:NO == asset.favourite];
 
-        __block NSImage *thumbnail = nil;
-        dispatch_sync(self.syncQ, ^{
-            thumbnail = self.thumbnailCache[asset.objectID];
-        });
+        NSImage *thumbnail = [self.thumbnailCache imageForKey:asset.objectID];
+        if ((nil == thumbnail) && (nil == asset.thumbnailPath)) {
+            // Not generated yet, so leave the placeholder up and ask for it ahead of any backfill,
+            // as it's on screen now. We'll get reloaded when the asset gets its thumbnail.
+            [self requestThumbnailForAsset:asset.objectID];
+            thumbnail = [NSImage imageWithSystemSymbolName:@"photo.artframe" accessibilityDescription:nil];
+        }
         if (nil == thumbnail) {
-            // TODO: move this code to a function
-            NSURL *thumbnailPath = asset.thumbnailPath;
-            @weakify(self);
-            @weakify(viewItem);
-            dispatch_async(self.thumbnailLoadQ, ^{
-                @strongify(self);
-                if (nil == self) {
-                    return;
-                }
-                NSImage *thumbnail = nil;
-                if (nil != thumbnailPath) {
-                    thumbnail = [[NSImage alloc] initByReferencingURL:thumbnailPath];
-                    if (nil != thumbnail) {
-                        dispatch_sync(self.syncQ, ^{
-                            NSMutableDictionary<NSManagedObjectID *, NSImage *> *tmp = [NSMutableDictionary dictionaryWithDictionary:self.thumbnailCache];
-                            tmp[asset.objectID] = thumbnail;
-                            self.thumbnailCache = [NSDictionary dictionaryWithDictionary:tmp];
-                        });
-                    } else {
-                        NSLog(@"Failed to load %@", thumbnailPath);
-                    }
-                }
-                if (nil == thumbnail) {
-                    thumbnail = [NSImage imageWithSystemSymbolName:@"exclamationmark.square" accessibilityDescription:nil];
-                }
-
-                dispatch_async(dispatch_get_main_queue(), ^{
-                    @strongify(viewItem);
-                    if (nil == viewItem) {
-                        return;
-                    }
-                    viewItem.imageView.image = thumbnail;
-                });
-            });
-
+            // The cell will be given the image when it's ready, if it's still showing this asset
+            [self loadThumbnailForAsset:asset];
             thumbnail = [NSImage imageWithSystemSymbolName:@"photo.artframe" accessibilityDescription:nil];
         }
         viewItem.imageView.image = thumbnail;
@@ -113,55 +140,126 @@
 
 #pragma mark - Data management
 
-- (void)setAssets:(NSArray<Asset *> *)assets withSelected:(NSSet<NSIndexPath *> *)indexPaths {
+- (void)setAssets:(AssetList *)assets
+          changes:(AssetListChanges *)changes
+     withSelected:(NSSet<NSIndexPath *> *)indexPaths {
     NSParameterAssert(nil != assets);
+    NSParameterAssert(nil != changes);
     NSParameterAssert(nil != indexPaths);
     dispatch_assert_queue(dispatch_get_main_queue());
 
     NSSet<NSIndexPath *> *currentSelection = [self.collectionView selectionIndexPaths];
     BOOL selectionChanged = ![currentSelection isEqualToSet:indexPaths];
 
-    // Do a quick initial check: are the new and old asset lists different, and are there any faults on
-    // visible items?
-    __block NSSet<NSIndexPath *> *updatedCells = [NSSet set];
-    __block NSArray<Asset *> *updatedAssets = [NSArray array];
+    __block AssetList *oldAssets = nil;
+    metrics_dispatch_sync(self.syncQ, ^{
+        oldAssets = self.assets;
+    });
+    // The lists are immutable, so if it's the same one we've just been told about a selection change
+    if (assets != oldAssets) {
+        [self applyAssets:assets
+                  changes:changes
+                replacing:oldAssets];
+    }
+
+    if (selectionChanged) {
+        [self.collectionView selectItemsAtIndexPaths:indexPaths
+                                      scrollPosition:NSCollectionViewScrollPositionTop];
+    }
+
+    [self updateAssetWindow];
+}
+
+- (void)applyAssets:(AssetList *)assets
+            changes:(AssetListChanges *)changes
+          replacing:(nullable AssetList *)oldAssets {
+    NSParameterAssert(nil != assets);
+    NSParameterAssert(nil != changes);
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    // Visible cells whose asset has been refreshed need redrawing, even if the list is otherwise
+    // the same.
+    NSMutableArray<NSManagedObjectID *> *faultedAssetIDs = [NSMutableArray array];
     for (NSCollectionViewItem *collectionViewItem in [self.collectionView visibleItems]) {
         NSAssert([collectionViewItem isKindOfClass:[GridViewItem class]], @"Collection view containts unexpected %@", [collectionViewItem class]);
         GridViewItem *item = (GridViewItem*)collectionViewItem;
         if (item.asset.fault) {
-            NSIndexPath *indexPath = [self.collectionView indexPathForItem:item];
-            updatedCells = [updatedCells setByAddingObject:indexPath];
-            updatedAssets = [updatedAssets arrayByAddingObject:item.asset];
+            [faultedAssetIDs addObject:item.asset.objectID];
         }
     }
 
-    // This is quite heavy - if we just sent updates from the viewModel rather than
-    // reloading then we could perhaps simplify this, but at the expense of making that relationship
-    // more complicated.
-    NSDiffableDataSourceSnapshot<NSNumber *, Asset *> *newSnapshot = [[NSDiffableDataSourceSnapshot alloc] init];
-    [newSnapshot appendSectionsWithIdentifiers:@[@0]];
-    [newSnapshot appendItemsWithIdentifiers:assets
-                  intoSectionWithIdentifier:@0];
-
-    self->_assets = assets;
+    NSArray<NSManagedObjectID *> *assetIDs = assets.assetIDs;
+    NSMutableArray<NSManagedObjectID *> *reloadAssetIDs = [NSMutableArray array];
+    NSDiffableDataSourceSnapshot<NSNumber *, NSManagedObjectID *> *snapshot = nil;
+
+    // The changes only make sense against the list we're showing, so check they add up before
+    // patching the existing snapshot rather than building a new one from scratch.
+    BOOL incremental = (nil != oldAssets) && (NO == changes.reload) &&
+        (([oldAssets count] - [changes.deletedIndexes count] + [changes.insertedIndexes count]) == [assets count]);
+    if (incremental) {
+        NSArray<NSManagedObjectID *> *oldAssetIDs = oldAssets.assetIDs;
+        snapshot = [self.dataSource snapshot];
+
+        // Moves are done as a delete and an insert, so the inserts can all be done relative to
+        // their neighbours in the new list.
+        NSMutableIndexSet *removedIndexes = [changes.deletedIndexes mutableCopy];
+        NSMutableIndexSet *addedIndexes = [changes.insertedIndexes mutableCopy];
+        [changes.movedIndexes enumerateKeysAndObjectsUsingBlock:^(NSNumber * _Nonnull from, NSNumber * _Nonnull to, __unused BOOL * _Nonnull stop) {
+            [removedIndexes addIndex:[from unsignedIntegerValue]];
+            [addedIndexes addIndex:[to unsignedIntegerValue]];
+        }];
+        NSArray<NSManagedObjectID *> *removedAssetIDs = [oldAssetIDs objectsAtIndexes:removedIndexes];
+        if ([removedAssetIDs count] > 0) {
+            [snapshot deleteItemsWithIdentifiers:removedAssetIDs];
+        }
 
-    if ([updatedAssets count] != 0) {
-        [newSnapshot reloadItemsWithIdentifiers:updatedAssets];
+        // Going backwards means whatever follows an item is already in place
+        NSUInteger count = [assetIDs count];
+        [addedIndexes enumerateIndexesWithOptions:NSEnumerationReverse
+                                       usingBlock:^(NSUInteger idx, __unused BOOL * _Nonnull stop) {
+            NSManagedObjectID *assetID = [assetIDs objectAtIndex:idx];
+            if ((idx + 1) < count) {
+                [snapshot insertItemsWithIdentifiers:@[assetID]
+                            beforeItemWithIdentifier:[assetIDs objectAtIndex:idx + 1]];
+            } else {
+                [snapshot appendItemsWithIdentifiers:@[assetID]
+                           intoSectionWithIdentifier:@0];
+            }
+        }];
+
+        [reloadAssetIDs addObjectsFromArray:[assetIDs objectsAtIndexes:changes.updatedIndexes]];
+    } else {
+        snapshot = [[NSDiffableDataSourceSnapshot alloc] init];
+        [snapshot appendSectionsWithIdentifiers:@[@0]];
+        [snapshot appendItemsWithIdentifiers:assetIDs
+                   intoSectionWithIdentifier:@0];
     }
-    [self.dataSource applySnapshot:newSnapshot
-              animatingDifferences:YES];
 
-    if (selectionChanged) {
-        [self.collectionView selectItemsAtIndexPaths:indexPaths
-                                      scrollPosition:NSCollectionViewScrollPositionTop];
+    // Faulted cells may have just been removed, and updated ones may also be faulted
+    for (NSManagedObjectID *assetID in faultedAssetIDs) {
+        if (NSNotFound != [snapshot indexOfItemIdentifier:assetID]) {
+            [reloadAssetIDs addObject:assetID];
+        }
     }
+    NSArray<NSManagedObjectID *> *uniqueReloadAssetIDs = [[NSOrderedSet orderedSetWithArray:reloadAssetIDs] array];
+    if ([uniqueReloadAssetIDs count] > 0) {
+        [snapshot reloadItemsWithIdentifiers:uniqueReloadAssetIDs];
+    }
+
+    metrics_dispatch_sync(self.syncQ, ^{
+        self.assets = assets;
+    });
+
+    BOOL animate = MAX([oldAssets count], [assets count]) <= kGridAnimatedUpdateLimit;
+    [self.dataSource applySnapshot:snapshot
+              animatingDifferences:animate];
 }
 
 - (NSUInteger)count {
     dispatch_assert_queue_not(self.syncQ);
 
     __block NSUInteger count = 0;
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         count = [self.assets count];
     });
     return count;
@@ -196,6 +294,228 @@
 
 #pragma mark - internal
 
+- (ThumbnailSize)thumbnailSizeForItems {
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    NSSize itemSize = NSZeroSize;
+    NSCollectionViewLayout *layout = self.collectionView.collectionViewLayout;
+    if ([layout isKindOfClass:[NSCollectionViewFlowLayout class]]) {
+        itemSize = ((NSCollectionViewFlowLayout *)layout).itemSize;
+    }
+    CGFloat backingScaleFactor = nil != self.view.window ? self.view.window.backingScaleFactor : 2.0;
+    return [ThumbnailPyramid sizeForPixelSize:MAX(itemSize.width, itemSize.height) * backingScaleFactor];
+}
+
+- (void)visibleRegionDidChange:(__unused NSNotification *)notification {
+    [self updateAssetWindow];
+    [self updateThumbnailPrefetch];
+}
+
+- (void)updateThumbnailPrefetch {
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    NSRect visibleRect = [self.collectionView visibleRect];
+    if (NSIsEmptyRect(visibleRect)) {
+        return;
+    }
+
+    // The collection view is flipped, so a positive speed is scrolling down the grid
+    NSTimeInterval now = [[NSProcessInfo processInfo] systemUptime];
+    NSTimeInterval elapsed = now - self.lastVisibleRegionUpdate;
+    CGFloat velocity = 0.0;
+    if ((elapsed > 0.0) && (elapsed < kGridScrollSampleInterval)) {
+        velocity = (NSMinY(visibleRect) - self.lastVisibleOriginY) / (CGFloat)elapsed;
+    }
+    self.lastVisibleOriginY = NSMinY(visibleRect);
+    self.lastVisibleRegionUpdate = now;
+
+    CGFloat distance = fabs(velocity) * (CGFloat)kGridPrefetchLookahead;
+    distance = MAX(distance, NSHeight(visibleRect) * kGridPrefetchMinimumScreens);
+    distance = MIN(distance, NSHeight(visibleRect) * kGridPrefetchMaximumScreens);
+    NSRect prefetchRect = visibleRect;
+    prefetchRect.size.height = distance;
+    prefetchRect.origin.y = velocity >= 0.0 ? NSMaxY(visibleRect) : NSMinY(visibleRect) - distance;
+
+    __block AssetList *assets = nil;
+    metrics_dispatch_sync(self.syncQ, ^{
+        assets = self.assets;
+    });
+    NSArray<NSCollectionViewLayoutAttributes *> *attributes = [self.collectionView.collectionViewLayout layoutAttributesForElementsInRect:NSUnionRect(visibleRect, prefetchRect)];
+    NSMutableSet<NSManagedObjectID *> *wanted = [NSMutableSet setWithCapacity:[attributes count]];
+    for (NSCollectionViewLayoutAttributes *attribute in attributes) {
+        NSIndexPath *indexPath = attribute.indexPath;
+        if ((nil == indexPath) || (NSCollectionElementCategoryItem != attribute.representedElementCategory)) {
+            continue;
+        }
+        NSInteger index = [indexPath item];
+        if ((0 > index) || ([assets count] <= (NSUInteger)index)) {
+            continue;
+        }
+        Asset *asset = [assets objectAtIndex:(NSUInteger)index];
+        [wanted addObject:asset.objectID];
+        // Visible cells already asked for what they need, and missing thumbnails are only
+        // generated for things on screen.
+        if (NO == NSIntersectsRect(attribute.frame, prefetchRect)) {
+            continue;
+        }
+        if ((nil == asset.thumbnailPath) || (nil != [self.thumbnailCache imageForKey:asset.objectID])) {
+            continue;
+        }
+        [self loadThumbnailForAsset:asset];
+    }
+
+    // Anything not yet started that's now out of range isn't worth the effort
+    for (NSManagedObjectID *assetID in [self.pendingThumbnailLoads allKeys]) {
+        if ([wanted containsObject:assetID]) {
+            continue;
+        }
+        dispatch_block_cancel(self.pendingThumbnailLoads[assetID]);
+        [self.pendingThumbnailLoads removeObjectForKey:assetID];
+    }
+}
+
+- (void)loadThumbnailForAsset:(Asset *)asset {
+    NSParameterAssert(nil != asset);
+    NSParameterAssert(nil != asset.thumbnailPath);
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    NSManagedObjectID *assetID = asset.objectID;
+    if (nil != self.pendingThumbnailLoads[assetID]) {
+        return;
+    }
+    NSURL *thumbnailPath = [ThumbnailPyramid URLForSize:[self thumbnailSizeForItems]
+                                          thumbnailPath:asset.thumbnailPath];
+
+    @weakify(self);
+    dispatch_block_t load = dispatch_block_create(0, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        MetricsIntervalToken loadInterval = metrics_interval_begin(MetricsIntervalThumbnailLoad);
+        NSImage *thumbnail = [self decodedThumbnailAtURL:thumbnailPath
+                                                forAsset:assetID];
+        metrics_interval_end(loadInterval);
+        if (nil != thumbnail) {
+            [self.thumbnailCache setImage:thumbnail
+                                   forKey:assetID];
+        } else {
+            NSLog(@"Failed to load %@", thumbnailPath);
+            thumbnail = [NSImage imageWithSystemSymbolName:@"exclamationmark.square" accessibilityDescription:nil];
+        }
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            [self.pendingThumbnailLoads removeObjectForKey:assetID];
+
+            NSIndexPath *indexPath = [self.dataSource indexPathForItemIdentifier:assetID];
+            if (nil == indexPath) {
+                return;
+            }
+            NSCollectionViewItem *item = [self.collectionView itemAtIndexPath:indexPath];
+            if ((NO == [item isKindOfClass:[GridViewItem class]]) || (NO == [((GridViewItem *)item).asset.objectID isEqual:assetID])) {
+                return;
+            }
+            item.imageView.image = thumbnail;
+        });
+    });
+    self.pendingThumbnailLoads[assetID] = load;
+    metrics_dispatch_async(self.thumbnailLoadQ, load);
+}
+
+// NSImage would otherwise hold off decoding until the first time it's drawn, which is on the main
+// thread just as the cell scrolls into view.
+- (nullable NSImage *)decodedThumbnailAtURL:(NSURL *)thumbnailPath
+                                   forAsset:(NSManagedObjectID *)assetID {
+    NSParameterAssert(nil != thumbnailPath);
+    NSParameterAssert(nil != assetID);
+    dispatch_assert_queue(self.thumbnailLoadQ);
+
+    CGImageSourceRef source = NULL;
+    if (nil != [ThumbnailPackStore keyForURL:thumbnailPath]) {
+        NSData *data = [self.thumbnailStore thumbnailDataForURL:thumbnailPath];
+        if (nil == data) {
+            // Lost from the store somehow, so just make it again
+            @weakify(self);
+            dispatch_async(dispatch_get_main_queue(), ^{
+                @strongify(self);
+                [self requestThumbnailForAsset:assetID];
+            });
+            return nil;
+        }
+        source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+    } else {
+        source = CGImageSourceCreateWithURL((__bridge CFURLRef)thumbnailPath, NULL);
+    }
+    if (NULL == source) {
+        return nil;
+    }
+    NSDictionary *options = @{(__bridge NSString *)kCGImageSourceShouldCacheImmediately: @YES};
+    CGImageRef image = CGImageSourceCreateImageAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+    CFRelease(source);
+    if (NULL == image) {
+        return nil;
+    }
+    NSImage *thumbnail = [[NSImage alloc] initWithCGImage:image
+                                                     size:NSZeroSize];
+    CGImageRelease(image);
+    return thumbnail;
+}
+
+- (void)updateAssetWindow {
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    NSSet<NSIndexPath *> *visible = [self.collectionView indexPathsForVisibleItems];
+    if (0 == [visible count]) {
+        return;
+    }
+    NSInteger first = NSIntegerMax;
+    NSInteger last = 0;
+    for (NSIndexPath *indexPath in visible) {
+        first = MIN(first, [indexPath item]);
+        last = MAX(last, [indexPath item]);
+    }
+
+    __block AssetList *assets = nil;
+    metrics_dispatch_sync(self.syncQ, ^{
+        assets = self.assets;
+    });
+    NSError *error = nil;
+    BOOL success = [assets prefetchAroundRange:NSMakeRange((NSUInteger)first, (NSUInteger)(last - first + 1))
+                                         error:&error];
+    if (nil != error) {
+        NSAssert(NO == success, @"Got error and success");
+        // Not fatal, as the cells will fault in the assets they need one at a time.
+        NSLog(@"Failed to load visible assets: %@", error);
+    }
+}
+
+- (void)requestThumbnailForAsset:(NSManagedObjectID *)assetID {
+    NSParameterAssert(nil != assetID);
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    BOOL needsFlush = 0 == [self.pendingThumbnailRequests count];
+    [self.pendingThumbnailRequests addObject:assetID];
+    if (NO == needsFlush) {
+        return;
+    }
+
+    @weakify(self);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        NSSet<NSManagedObjectID *> *assetIDs = [NSSet setWithSet:self.pendingThumbnailRequests];
+        [self.pendingThumbnailRequests removeAllObjects];
+        [self.delegate gridViewController:self
+                 visibleAssetsNeedThumbnails:assetIDs];
+    });
+}
+
 - (void)selectionChanged {
     // If we're left with an empty selection, then do not send an update, as the collectionView
     // is not allowed to have no selection, and thus we know a selection will be coming along
@@ -307,7 +627,7 @@
     }
 
     __block Asset *asset = nil;
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         NSUInteger index = [indexes firstIndex];
         if (index < [self.assets count]) {
             asset = self.assets[index];
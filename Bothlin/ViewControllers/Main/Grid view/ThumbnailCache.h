@@ -0,0 +1,57 @@
+//
+//  ThumbnailCache.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 07/12/2023.
+//
+
+#import <Cocoa/Cocoa.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// An LRU cache of decoded thumbnails with a budget in bytes. Like NSCache each image has a cost,
+// and the least recently used are evicted once the total goes over the limit, but unlike NSCache
+// the eviction order is predictable, which matters when scrolling back and forth through a large
+// library. On a memory pressure warning it drops to half its limit, and on critical it empties.
+//
+// Safe to use from any queue.
+@interface ThumbnailCache : NSObject
+
+// Lowering the limit evicts straight away.
+@property (atomic, readwrite) NSUInteger totalCostLimit;
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithName:(NSString *)name
+              totalCostLimit:(NSUInteger)totalCostLimit;
+
+// Roughly how many bytes the image will take once decoded.
++ (NSUInteger)costForImage:(NSImage *)image;
+
+// Marks the image as most recently used if present. Counts towards the hit rate.
+- (nullable NSImage *)imageForKey:(id<NSCopying>)key;
+
+- (void)setImage:(NSImage *)image
+          forKey:(id<NSCopying>)key;
+- (void)setImage:(NSImage *)image
+          forKey:(id<NSCopying>)key
+            cost:(NSUInteger)cost;
+
+- (void)removeImageForKey:(id<NSCopying>)key;
+- (void)removeAllImages;
+
+// Evicts least recently used images until the total cost is at most the given amount.
+- (void)trimToCost:(NSUInteger)cost;
+
+- (NSUInteger)count;
+- (NSUInteger)totalCost;
+
+// Counters since the cache was made or the statistics last reset.
+- (NSUInteger)hitCount;
+- (NSUInteger)missCount;
+- (NSUInteger)evictionCount;
+- (double)hitRate;
+- (void)resetStatistics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,330 @@
+//
+//  ThumbnailCache.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 07/12/2023.
+//
+
+#import "ThumbnailCache.h"
+
+#import "Helpers.h"
+
+// A node in the recency list. The list links are unretained as the entries dictionary owns the
+// nodes, and a node is always unlinked before it is removed from there.
+@interface ThumbnailCacheNode : NSObject
+
+@property (nonatomic, strong, readonly) id<NSCopying> key;
+@property (nonatomic, strong, readwrite) NSImage *image;
+@property (nonatomic, readwrite) NSUInteger cost;
+@property (nonatomic, unsafe_unretained, readwrite, nullable) ThumbnailCacheNode *previous;
+@property (nonatomic, unsafe_unretained, readwrite, nullable) ThumbnailCacheNode *next;
+
+- (instancetype)initWithKey:(id<NSCopying>)key;
+
+@end
+
+@implementation ThumbnailCacheNode
+
+- (instancetype)initWithKey:(id<NSCopying>)key {
+    self = [super init];
+    if (nil != self) {
+        self->_key = key;
+    }
+    return self;
+}
+
+@end
+
+
+@interface ThumbnailCache ()
+
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readonly) dispatch_source_t memoryPressureSource;
+
+// Only access on syncQ
+@property (nonatomic, strong, readonly) NSMutableDictionary<id<NSCopying>, ThumbnailCacheNode *> *entries;
+@property (nonatomic, unsafe_unretained, readwrite, nullable) ThumbnailCacheNode *mostRecent;
+@property (nonatomic, unsafe_unretained, readwrite, nullable) ThumbnailCacheNode *leastRecent;
+@property (nonatomic, readwrite) NSUInteger currentCost;
+@property (nonatomic, readwrite) NSUInteger hits;
+@property (nonatomic, readwrite) NSUInteger misses;
+@property (nonatomic, readwrite) NSUInteger evictions;
+
+@end
+
+@implementation ThumbnailCache
+
+@synthesize totalCostLimit = _totalCostLimit;
+
+- (instancetype)initWithName:(NSString *)name
+              totalCostLimit:(NSUInteger)totalCostLimit {
+    NSParameterAssert(nil != name);
+    self = [super init];
+    if (nil != self) {
+        self->_totalCostLimit = totalCostLimit;
+        NSString *label = [NSString stringWithFormat:@"com.digitalflapjack.ThumbnailCache.%@.syncQ", name];
+        self->_syncQ = dispatch_queue_create([label UTF8String], DISPATCH_QUEUE_SERIAL);
+        self->_entries = [NSMutableDictionary dictionary];
+
+        self->_memoryPressureSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE,
+                                                             0,
+                                                             DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                                             self->_syncQ);
+        @weakify(self);
+        dispatch_source_set_event_handler(self->_memoryPressureSource, ^{
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            unsigned long pressure = dispatch_source_get_data(self.memoryPressureSource);
+            if (0 != (pressure & DISPATCH_MEMORYPRESSURE_CRITICAL)) {
+                [self evictToCost:0];
+            } else if (0 != (pressure & DISPATCH_MEMORYPRESSURE_WARN)) {
+                [self evictToCost:self->_totalCostLimit / 2];
+            }
+        });
+        dispatch_resume(self->_memoryPressureSource);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(self->_memoryPressureSource);
+}
+
++ (NSUInteger)costForImage:(NSImage *)image {
+    NSParameterAssert(nil != image);
+
+    // Use the biggest representation, as that's what will get decoded on a retina display.
+    NSInteger pixels = 0;
+    for (NSImageRep *rep in [image representations]) {
+        pixels = MAX(pixels, rep.pixelsWide * rep.pixelsHigh);
+    }
+    if (0 >= pixels) {
+        NSSize size = image.size;
+        pixels = (NSInteger)(size.width * size.height);
+    }
+    return (NSUInteger)MAX(pixels, 1) * 4;
+}
+
+
+#pragma mark - Access
+
+- (NSUInteger)totalCostLimit {
+    __block NSUInteger limit = 0;
+    dispatch_sync(self.syncQ, ^{
+        limit = self->_totalCostLimit;
+    });
+    return limit;
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    dispatch_sync(self.syncQ, ^{
+        self->_totalCostLimit = totalCostLimit;
+        [self evictToCost:totalCostLimit];
+    });
+}
+
+- (nullable NSImage *)imageForKey:(id<NSCopying>)key {
+    NSParameterAssert(nil != key);
+    dispatch_assert_queue_not(self.syncQ);
+
+    __block NSImage *image = nil;
+    dispatch_sync(self.syncQ, ^{
+        ThumbnailCacheNode *node = self.entries[key];
+        if (nil == node) {
+            self.misses += 1;
+            return;
+        }
+        self.hits += 1;
+        [self unlinkNode:node];
+        [self pushNode:node];
+        image = node.image;
+    });
+    return image;
+}
+
+- (void)setImage:(NSImage *)image
+          forKey:(id<NSCopying>)key {
+    [self setImage:image
+            forKey:key
+              cost:[ThumbnailCache costForImage:image]];
+}
+
+- (void)setImage:(NSImage *)image
+          forKey:(id<NSCopying>)key
+            cost:(NSUInteger)cost {
+    NSParameterAssert(nil != image);
+    NSParameterAssert(nil != key);
+    dispatch_assert_queue_not(self.syncQ);
+
+    dispatch_sync(self.syncQ, ^{
+        ThumbnailCacheNode *node = self.entries[key];
+        if (nil != node) {
+            [self unlinkNode:node];
+            self.currentCost -= node.cost;
+        } else {
+            node = [[ThumbnailCacheNode alloc] initWithKey:key];
+            self.entries[key] = node;
+        }
+        node.image = image;
+        node.cost = cost;
+        self.currentCost += cost;
+        [self pushNode:node];
+
+        // If a single image is over budget we still keep it, as it's what the caller is about to
+        // show, and it'll be the first to go next time.
+        [self evictToCost:MAX(self->_totalCostLimit, cost)];
+    });
+}
+
+- (void)removeImageForKey:(id<NSCopying>)key {
+    NSParameterAssert(nil != key);
+    dispatch_assert_queue_not(self.syncQ);
+
+    dispatch_sync(self.syncQ, ^{
+        ThumbnailCacheNode *node = self.entries[key];
+        if (nil == node) {
+            return;
+        }
+        [self unlinkNode:node];
+        self.currentCost -= node.cost;
+        [self.entries removeObjectForKey:key];
+    });
+}
+
+- (void)removeAllImages {
+    dispatch_assert_queue_not(self.syncQ);
+    dispatch_sync(self.syncQ, ^{
+        self.mostRecent = nil;
+        self.leastRecent = nil;
+        self.currentCost = 0;
+        [self.entries removeAllObjects];
+    });
+}
+
+- (void)trimToCost:(NSUInteger)cost {
+    dispatch_assert_queue_not(self.syncQ);
+    dispatch_sync(self.syncQ, ^{
+        [self evictToCost:cost];
+    });
+}
+
+
+#pragma mark - Statistics
+
+- (NSUInteger)count {
+    dispatch_assert_queue_not(self.syncQ);
+    __block NSUInteger count = 0;
+    dispatch_sync(self.syncQ, ^{
+        count = [self.entries count];
+    });
+    return count;
+}
+
+- (NSUInteger)totalCost {
+    dispatch_assert_queue_not(self.syncQ);
+    __block NSUInteger cost = 0;
+    dispatch_sync(self.syncQ, ^{
+        cost = self.currentCost;
+    });
+    return cost;
+}
+
+- (NSUInteger)hitCount {
+    dispatch_assert_queue_not(self.syncQ);
+    __block NSUInteger hits = 0;
+    dispatch_sync(self.syncQ, ^{
+        hits = self.hits;
+    });
+    return hits;
+}
+
+- (NSUInteger)missCount {
+    dispatch_assert_queue_not(self.syncQ);
+    __block NSUInteger misses = 0;
+    dispatch_sync(self.syncQ, ^{
+        misses = self.misses;
+    });
+    return misses;
+}
+
+- (NSUInteger)evictionCount {
+    dispatch_assert_queue_not(self.syncQ);
+    __block NSUInteger evictions = 0;
+    dispatch_sync(self.syncQ, ^{
+        evictions = self.evictions;
+    });
+    return evictions;
+}
+
+- (double)hitRate {
+    dispatch_assert_queue_not(self.syncQ);
+    __block double rate = 0.0;
+    dispatch_sync(self.syncQ, ^{
+        NSUInteger lookups = self.hits + self.misses;
+        if (0 < lookups) {
+            rate = (double)self.hits / (double)lookups;
+        }
+    });
+    return rate;
+}
+
+- (void)resetStatistics {
+    dispatch_assert_queue_not(self.syncQ);
+    dispatch_sync(self.syncQ, ^{
+        self.hits = 0;
+        self.misses = 0;
+        self.evictions = 0;
+    });
+}
+
+
+#pragma mark - internal
+
+- (void)pushNode:(ThumbnailCacheNode *)node {
+    NSParameterAssert(nil != node);
+    dispatch_assert_queue(self.syncQ);
+
+    node.previous = nil;
+    node.next = self.mostRecent;
+    if (nil != self.mostRecent) {
+        self.mostRecent.previous = node;
+    }
+    self.mostRecent = node;
+    if (nil == self.leastRecent) {
+        self.leastRecent = node;
+    }
+}
+
+- (void)unlinkNode:(ThumbnailCacheNode *)node {
+    NSParameterAssert(nil != node);
+    dispatch_assert_queue(self.syncQ);
+
+    if (nil != node.previous) {
+        node.previous.next = node.next;
+    } else {
+        self.mostRecent = node.next;
+    }
+    if (nil != node.next) {
+        node.next.previous = node.previous;
+    } else {
+        self.leastRecent = node.previous;
+    }
+    node.previous = nil;
+    node.next = nil;
+}
+
+- (void)evictToCost:(NSUInteger)cost {
+    dispatch_assert_queue(self.syncQ);
+
+    while ((self.currentCost > cost) && (nil != self.leastRecent)) {
+        ThumbnailCacheNode *node = self.leastRecent;
+        [self unlinkNode:node];
+        self.currentCost -= node.cost;
+        self.evictions += 1;
+        [self.entries removeObjectForKey:node.key];
+    }
+}
+
+@end
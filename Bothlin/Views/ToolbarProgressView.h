@@ -14,6 +14,22 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, readwrite) NSUInteger total;
 @property (nonatomic, readwrite) NSUInteger current;
 
+// Hides itself once current reaches total. The detail, if present, is shown after the count.
+- (void)setProgress:(NSUInteger)current
+              total:(NSUInteger)total
+             detail:(NSString * _Nullable)detail;
+
+// As above, for things other than imports. The format is a localized string that takes current and
+// total as unsigned longs, such as "Emptying trash: %lu of %lu".
+- (void)setProgress:(NSUInteger)current
+              total:(NSUInteger)total
+             format:(NSString *)format
+             detail:(NSString * _Nullable)detail;
+
+// Shows the text with a progress bar that doesn't fill, for work whose size isn't known yet. Stays
+// up until the next setProgress: call.
+- (void)setIndeterminateProgressWithText:(NSString *)text;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -42,15 +42,49 @@
 
 - (void)setProgress:(NSUInteger)current
               total:(NSUInteger)total {
+    [self setProgress:current
+                total:total
+               detail:nil];
+}
+
+- (void)setProgress:(NSUInteger)current
+              total:(NSUInteger)total
+             detail:(NSString * _Nullable)detail {
+    [self setProgress:current
+                total:total
+               format:NSLocalizedString(@"Importing %lu of %lu", nil)
+               detail:detail];
+}
+
+- (void)setProgress:(NSUInteger)current
+              total:(NSUInteger)total
+             format:(NSString *)format
+             detail:(NSString * _Nullable)detail {
+    NSParameterAssert(nil != format);
     self.current = current;
     self.total = total;
 
+    [self.progress stopAnimation:nil];
+    self.progress.indeterminate = NO;
     self.progress.hidden = current >= total;
     self.label.hidden = current >= total;
 
-    self.label.stringValue = [NSString stringWithFormat:@"Importing %lu of %lu", (unsigned long)current, (unsigned long)total];
+    NSString *count = [NSString stringWithFormat:format, (unsigned long)current, (unsigned long)total];
+    self.label.stringValue = nil != detail ? [NSString stringWithFormat:@"%@ (%@)", count, detail] : count;
     self.progress.maxValue = total;
     self.progress.doubleValue = current;
 }
 
+- (void)setIndeterminateProgressWithText:(NSString *)text {
+    NSParameterAssert(nil != text);
+    self.current = 0;
+    self.total = 0;
+
+    self.progress.hidden = NO;
+    self.label.hidden = NO;
+    self.label.stringValue = text;
+    self.progress.indeterminate = YES;
+    [self.progress startAnimation:nil];
+}
+
 @end
@@ -0,0 +1,34 @@
+//
+//  AssetList.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 11/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class Asset;
+
+NS_ASSUME_NONNULL_BEGIN
+
+// An immutable list of assets that only holds their object IDs, so it costs the same whether or
+// not anyone looks at it. Items outside the window are handed out as faults, and items inside it
+// were loaded together in a single fetch, so scrolling through a grid doesn't go to the store once
+// per cell. Only use on the queue of the context it was made with.
+@interface AssetList : NSArray<Asset *>
+
+@property (nonatomic, strong, readonly) NSArray<NSManagedObjectID *> *assetIDs;
+@property (nonatomic, readonly) NSRange window;
+
+- (instancetype)initWithAssetIDs:(NSArray<NSManagedObjectID *> *)assetIDs
+                         context:(NSManagedObjectContext *)context;
+
+// Makes sure the given range, plus some padding either side, is loaded. Does nothing if it already
+// is, otherwise replaces the window with a new one centred on the range.
+- (BOOL)prefetchAroundRange:(NSRange)range
+                      error:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
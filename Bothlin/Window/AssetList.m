@@ -0,0 +1,119 @@
+//
+//  AssetList.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 11/12/2023.
+//
+
+#import "AssetList.h"
+#import "Asset+CoreDataClass.h"
+
+// Several screens worth of the grid either side of what's visible, so a scroll doesn't need a new
+// window until it's gone a fair way, whilst still only holding a tiny part of a big library.
+static const NSUInteger kAssetListWindowPadding = 250;
+
+@interface AssetList ()
+
+@property (nonatomic, strong, readonly) NSManagedObjectContext *context;
+@property (nonatomic, strong, readwrite) NSArray<Asset *> *windowAssets;
+
+@end
+
+@implementation AssetList
+
+- (instancetype)initWithAssetIDs:(NSArray<NSManagedObjectID *> *)assetIDs
+                         context:(NSManagedObjectContext *)context {
+    NSParameterAssert(nil != assetIDs);
+    NSParameterAssert(nil != context);
+    self = [super init];
+    if (nil != self) {
+        self->_assetIDs = [assetIDs copy];
+        self->_context = context;
+        self->_window = NSMakeRange(0, 0);
+        self->_windowAssets = @[];
+    }
+    return self;
+}
+
+#pragma mark - NSArray
+
+- (NSUInteger)count {
+    return [self.assetIDs count];
+}
+
+- (Asset *)objectAtIndex:(NSUInteger)index {
+    if (NSLocationInRange(index, self.window)) {
+        return [self.windowAssets objectAtIndex:index - self.window.location];
+    }
+    // Just a fault, so no trip to the store until someone looks at it
+    return (Asset *)[self.context objectWithID:[self.assetIDs objectAtIndex:index]];
+}
+
+- (id)copyWithZone:(__unused NSZone *)zone {
+    // We're immutable, and the default would make every asset to copy them.
+    return self;
+}
+
+#pragma mark - Window
+
++ (NSArray<NSString *> *)gridPropertyNames {
+    return @[@"name", @"type", @"path", @"thumbnailPath", @"favourite", @"created", @"deletedAt"];
+}
+
+- (BOOL)prefetchAroundRange:(NSRange)range
+                      error:(NSError **)error {
+    NSUInteger count = [self.assetIDs count];
+    if ((0 == range.length) || (range.location >= count)) {
+        return YES;
+    }
+    range.length = MIN(range.length, count - range.location);
+    if (NSIntersectionRange(range, self.window).length == range.length) {
+        return YES;
+    }
+
+    NSUInteger start = range.location > kAssetListWindowPadding ? range.location - kAssetListWindowPadding : 0;
+    NSUInteger end = MIN(NSMaxRange(range) + kAssetListWindowPadding, count);
+    NSRange window = NSMakeRange(start, end - start);
+    NSArray<NSManagedObjectID *> *windowIDs = [self.assetIDs subarrayWithRange:window];
+
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:NSStringFromClass([Asset class])];
+    [request setPredicate:[NSPredicate predicateWithFormat:@"SELF IN %@", windowIDs]];
+    [request setReturnsObjectsAsFaults:NO];
+    // Just what a grid cell or a drag needs. The bookmark, modifications and scanned text can be
+    // large, and are left to fault in for the few assets that get looked at more closely.
+    [request setPropertiesToFetch:[AssetList gridPropertyNames]];
+
+    NSError *innerError = nil;
+    NSArray<Asset *> *result = [self.context executeFetchRequest:request
+                                                           error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == result, @"Got error and fetch results.");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != result, @"Got no error and no fetch results.");
+
+    // The store won't give them back in our order, and some may have gone since the list was made,
+    // in which case they stay as faults like they would outside the window.
+    NSMutableDictionary<NSManagedObjectID *, Asset *> *loaded = [NSMutableDictionary dictionaryWithCapacity:[result count]];
+    for (Asset *asset in result) {
+        loaded[asset.objectID] = asset;
+    }
+    NSMutableArray<Asset *> *windowAssets = [NSMutableArray arrayWithCapacity:[windowIDs count]];
+    for (NSManagedObjectID *assetID in windowIDs) {
+        Asset *asset = loaded[assetID];
+        if (nil == asset) {
+            asset = (Asset *)[self.context objectWithID:assetID];
+        }
+        [windowAssets addObject:asset];
+    }
+
+    self.windowAssets = [NSArray arrayWithArray:windowAssets];
+    self->_window = window;
+
+    return YES;
+}
+
+@end
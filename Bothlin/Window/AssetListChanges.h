@@ -0,0 +1,35 @@
+//
+//  AssetListChanges.h
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 10/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Describes how one version of the asset list became the next. Deleted indexes are in the old list,
+// inserted and updated indexes are in the new list, and moves map an index in the old list to one
+// in the new list. If reload is set the whole list was replaced and the rest is empty.
+@interface AssetListChanges : NSObject
+
+@property (nonatomic, readonly, getter=isReload) BOOL reload;
+@property (nonatomic, strong, readonly) NSIndexSet *deletedIndexes;
+@property (nonatomic, strong, readonly) NSIndexSet *insertedIndexes;
+@property (nonatomic, strong, readonly) NSIndexSet *updatedIndexes;
+@property (nonatomic, strong, readonly) NSDictionary<NSNumber *, NSNumber *> *movedIndexes;
+
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithDeletedIndexes:(NSIndexSet *)deletedIndexes
+                       insertedIndexes:(NSIndexSet *)insertedIndexes
+                        updatedIndexes:(NSIndexSet *)updatedIndexes
+                          movedIndexes:(NSDictionary<NSNumber *, NSNumber *> *)movedIndexes;
+
++ (instancetype)reload;
+
+- (BOOL)isEmpty;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,60 @@
+//
+//  AssetListChanges.m
+//  Bothlin - Copyright 2023 Digital Flapjack Ltd
+//
+//  Created by Michael Dales on 10/12/2023.
+//
+
+#import "AssetListChanges.h"
+
+@implementation AssetListChanges
+
+- (instancetype)initWithDeletedIndexes:(NSIndexSet *)deletedIndexes
+                       insertedIndexes:(NSIndexSet *)insertedIndexes
+                        updatedIndexes:(NSIndexSet *)updatedIndexes
+                          movedIndexes:(NSDictionary<NSNumber *, NSNumber *> *)movedIndexes {
+    NSParameterAssert(nil != deletedIndexes);
+    NSParameterAssert(nil != insertedIndexes);
+    NSParameterAssert(nil != updatedIndexes);
+    NSParameterAssert(nil != movedIndexes);
+    self = [super init];
+    if (nil != self) {
+        self->_reload = NO;
+        self->_deletedIndexes = [deletedIndexes copy];
+        self->_insertedIndexes = [insertedIndexes copy];
+        self->_updatedIndexes = [updatedIndexes copy];
+        self->_movedIndexes = [movedIndexes copy];
+    }
+    return self;
+}
+
++ (instancetype)reload {
+    AssetListChanges *changes = [[AssetListChanges alloc] initWithDeletedIndexes:[NSIndexSet indexSet]
+                                                                 insertedIndexes:[NSIndexSet indexSet]
+                                                                  updatedIndexes:[NSIndexSet indexSet]
+                                                                    movedIndexes:@{}];
+    changes->_reload = YES;
+    return changes;
+}
+
+- (BOOL)isEmpty {
+    return !self.reload &&
+        (0 == [self.deletedIndexes count]) &&
+        (0 == [self.insertedIndexes count]) &&
+        (0 == [self.updatedIndexes count]) &&
+        (0 == [self.movedIndexes count]);
+}
+
+- (NSString *)description {
+    if (self.reload) {
+        return [NSString stringWithFormat:@"<%@ reload>", NSStringFromClass([self class])];
+    }
+    return [NSString stringWithFormat:@"<%@ deleted %@ inserted %@ updated %@ moved %@>",
+            NSStringFromClass([self class]),
+            self.deletedIndexes,
+            self.insertedIndexes,
+            self.updatedIndexes,
+            self.movedIndexes];
+}
+
+@end
@@ -8,6 +8,8 @@
 #import <Cocoa/Cocoa.h>
 #import "LibraryWriteCoordinator.h"
 #import "ModelCoordinatorDelegate.h"
+#import "AssetList.h"
+#import "AssetListChanges.h"
 
 @class Asset;
 @class Group;
@@ -32,8 +34,12 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, strong, readonly, nonnull) NSString *trashDisplayName;
 
 // TODO: Ideally these would a tuple to make KVO like updates easier
-@property (nonatomic, strong, readonly) NSArray<Asset *> *assets;
+// Only holds object IDs, so is cheap however big the library; see AssetList.
+@property (nonatomic, strong, readonly) AssetList *assets;
 @property (nonatomic, strong, readwrite) NSSet<NSIndexPath *> *selectedAssetIndexPaths;
+// How assets got to its current value, so views can patch themselves rather than reload. Read it
+// when observing assets.
+@property (nonatomic, strong, readonly) AssetListChanges *assetChanges;
 @property (nonatomic, strong, readonly) NSSet<Asset *> *selectedAssets;
 
 @property (nonatomic, strong, readonly) NSArray<Group *> *groups;
@@ -45,6 +51,12 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, strong, readonly) NSArray<Tag *> *tags;
 
+// Assets are queried in the background, so changing the sidebar selection or search text updates
+// assets (and fires KVO for it) later on the main queue. Typing is debounced, and a query that's
+// been overtaken by a newer one is dropped. This is how long the last published query took, for
+// profiling.
+@property (atomic, readonly) NSTimeInterval lastQueryDuration;
+
 - (instancetype)initWithViewContext:(NSManagedObjectContext *)viewContext
                    trashDisplayName:(NSString *)trashDisplayName;
 
@@ -12,7 +12,9 @@
 #import "NSArray+Functional.h"
 #import "NSSet+Functional.h"
 #import "Helpers.h"
+#import "PerformanceMetrics.h"
 #import "SidebarItem.h"
+#import "SearchIndex.h"
 
 typedef NS_ENUM(NSUInteger, LibraryViewModelReloadCause) {
     LibraryViewModelReloadCauseUnknwn = 0,
@@ -21,20 +23,37 @@ typedef NS_ENUM(NSUInteger, LibraryViewModelReloadCause) {
     LibraryViewModelReloadCauseSearch,
 };
 
-NSArray<NSString *> * const testTags = @[
-    @"Minecraft",
-    @"QGIS",
-    @"Other",
-];
+// Long enough to skip the intermediate results whilst someone is typing a word, short enough
+// that it still feels live.
+static const NSTimeInterval kSearchDebounceInterval = 0.15;
+
+// Merging a change in costs a binary search and an array insert per asset, so past this it's
+// cheaper to go back to the store for the whole list.
+static const NSUInteger kMaximumIncrementalAssetChanges = 1000;
+
+// How many tags are listed under Popular Tags in the sidebar.
+static const NSUInteger kPopularTagCount = 10;
 
 @interface LibraryViewModel ()
 
 @property (nonatomic, strong, readonly, nonnull) dispatch_queue_t syncQ;
 @property (nonatomic, strong, readonly, nonnull) NSManagedObjectContext *viewContext;
-
-@property (nonatomic, strong, readwrite) NSArray<Asset *> *assets;
+@property (nonatomic, strong, readonly, nonnull) SearchIndex *searchIndex;
+
+// Queries are run on queryQ against their own context, and only the results of the latest one are
+// published. Bumping the generation is how an outstanding query gets cancelled.
+@property (nonatomic, strong, readonly, nonnull) dispatch_queue_t queryQ;
+@property (nonatomic, strong, readonly, nonnull) NSManagedObjectContext *queryContext;
+@property (atomic, readwrite) NSUInteger queryGeneration;
+@property (atomic, readwrite) NSTimeInterval lastQueryDuration;
+// The generation of the query that assets came from. Whilst it lags queryGeneration a query is
+// outstanding, and changes can't be merged into assets as they'd be overwritten.
+@property (nonatomic, readwrite) NSUInteger publishedGeneration;
+
+@property (nonatomic, strong, readwrite) AssetList *assets;
 @property (nonatomic, strong, readwrite) NSArray<Group *> *groups;
 @property (nonatomic, strong, readwrite) NSArray<Tag *> *tags;
+@property (nonatomic, strong, readwrite) NSArray<Tag *> *popularTags;
 @property (nonatomic, strong, readwrite) SidebarItem *sidebarItems;
 
 @end
@@ -44,6 +63,7 @@ NSArray<NSString *> * const testTags = @[
 
 @synthesize assets = _assets;
 @synthesize selectedAssetIndexPaths = _selectedAssetIndexPaths;
+@synthesize assetChanges = _assetChanges;
 @synthesize groups = _groups;
 @synthesize selectedSidebarItem = _selectedSidebarItem;
 @synthesize tags = _tags;
@@ -56,11 +76,21 @@ NSArray<NSString *> * const testTags = @[
     if (nil != self) {
         self->_syncQ = dispatch_queue_create("com.digitalflapjack.LibraryViewModel.syncQ", DISPATCH_QUEUE_SERIAL);
         self->_viewContext = viewContext;
-        self->_assets = @[];
+        self->_searchIndex = [[SearchIndex alloc] initWithPersistentStore:viewContext.persistentStoreCoordinator];
+        [self->_searchIndex rebuild];
+        self->_queryQ = dispatch_queue_create("com.digitalflapjack.LibraryViewModel.queryQ", DISPATCH_QUEUE_SERIAL);
+        NSManagedObjectContext *queryContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+        queryContext.persistentStoreCoordinator = viewContext.persistentStoreCoordinator;
+        self->_queryContext = queryContext;
+        self->_assets = [[AssetList alloc] initWithAssetIDs:@[]
+                                                    context:viewContext];
+        self->_assetChanges = [AssetListChanges reload];
         self->_groups = @[];
         self->_tags = @[];
+        self->_popularTags = @[];
         self->_selectedAssetIndexPaths = [NSSet set];
         self->_sidebarItems = [LibraryViewModel buildMenuWithGroups:@[]
+                                                        popularTags:@[]
                                                    trashDisplayName:trashDisplayName];
         self->_selectedSidebarItem = [[self->_sidebarItems children] firstObject];
         self->_trashDisplayName = [NSString stringWithString:trashDisplayName];
@@ -71,19 +101,28 @@ NSArray<NSString *> * const testTags = @[
 
 #pragma mark - getters
 
-- (NSArray<Asset *> *)assets {
+- (AssetList *)assets {
     dispatch_assert_queue_not(self.syncQ);
-    __block NSArray<Asset *> *val = nil;
-    dispatch_sync(self.syncQ, ^{
+    __block AssetList *val = nil;
+    metrics_dispatch_sync(self.syncQ, ^{
         val = self->_assets;
     });
     return val;
 }
 
+- (AssetListChanges *)assetChanges {
+    dispatch_assert_queue_not(self.syncQ);
+    __block AssetListChanges *val = nil;
+    metrics_dispatch_sync(self.syncQ, ^{
+        val = self->_assetChanges;
+    });
+    return val;
+}
+
 - (NSSet<NSIndexPath *> *)selectedAssetIndexPaths {
     dispatch_assert_queue_not(self.syncQ);
     __block NSSet<NSIndexPath *> *val = nil;
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         val = self->_selectedAssetIndexPaths;
     });
     NSAssert(nil != val, @"Index paths should not be nil");
@@ -93,7 +132,7 @@ NSArray<NSString *> * const testTags = @[
 - (void)setSelectedAssetIndexPaths:(NSSet<NSIndexPath *> *)indexPaths {
     NSParameterAssert(nil != indexPaths);
     dispatch_assert_queue_not(self.syncQ);
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         NSAssert(nil != self->_selectedAssetIndexPaths, @"Internal index paths is nil and shouldn't be");
         if ([self->_selectedAssetIndexPaths isEqualToSet:indexPaths]) {
             return;
@@ -105,7 +144,7 @@ NSArray<NSString *> * const testTags = @[
 - (NSSet<Asset *> *)selectedAssets {
     dispatch_assert_queue_not(self.syncQ);
     __block NSSet<Asset *> *val = [NSSet set];
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         NSAssert(nil != self->_selectedAssetIndexPaths, @"Index path should not be nil");
         // We need compactMap here as updates to the _asset set the the selection are not atomic in all cases, so
         // there are windows when they are briefly out of sync, causing us to not find currently selected
@@ -124,7 +163,7 @@ NSArray<NSString *> * const testTags = @[
 - (NSArray<Group *> *)groups {
     dispatch_assert_queue_not(self.syncQ);
     __block NSArray<Group *> *val;
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         val = self->_groups;
     });
     return val;
@@ -133,7 +172,7 @@ NSArray<NSString *> * const testTags = @[
 - (SidebarItem *)selectedSidebarItem {
     dispatch_assert_queue_not(self.syncQ);
     __block SidebarItem *val = nil;
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         val = self->_selectedSidebarItem;
     });
     return val;
@@ -147,28 +186,19 @@ NSArray<NSString *> * const testTags = @[
     NSAssert(nil != selectedSidebarItem.fetchRequest, @"Allowed selection of a sidebar item with no fetch request.");
 
     dispatch_assert_queue_not(self.syncQ);
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         if (self->_selectedSidebarItem == selectedSidebarItem) {
             return;
         }
         self->_selectedSidebarItem = selectedSidebarItem;
-
-        NSError *error = nil;
-        BOOL success = [self reloadAssetsWithCause:LibraryViewModelReloadCauseViewChange
-                                             error:&error];
-        if (nil != error) {
-            NSAssert(NO == success, @"Got error but also success");
-            [self.delegate libraryViewModel:self
-                           hadErrorOnUpdate:error];
-        }
-        NSAssert(NO != success, @"Got no error and no success");
+        [self reloadAssetsWithCause:LibraryViewModelReloadCauseViewChange];
     });
 }
 
 - (NSArray<Tag *> *)tags {
     dispatch_assert_queue_not(self.syncQ);
     __block NSArray<Tag *> *val;
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         val = self->_tags;
     });
     return val;
@@ -177,19 +207,12 @@ NSArray<NSString *> * const testTags = @[
 - (void)setSearchText:(NSString *)searchText {
     NSParameterAssert(nil != searchText);
     dispatch_assert_queue_not(self.syncQ);
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         if ([self->_searchText compare:searchText] == NSOrderedSame) {
             return;
         }
         self->_searchText = searchText;
-        NSError *error = nil;
-        BOOL success = [self reloadAssetsWithCause:LibraryViewModelReloadCauseSearch
-                                             error:&error];
-        if (nil != error) {
-            [self.delegate libraryViewModel:self
-                           hadErrorOnUpdate:error];
-        }
-        NSAssert(NO != success, @"Got no error and no success");
+        [self reloadAssetsWithCause:LibraryViewModelReloadCauseSearch];
     });
 }
 
@@ -227,6 +250,20 @@ NSArray<NSString *> * const testTags = @[
     }];
     NSSet<NSString *> *classes = [NSSet setWithArray:allClasses];
 
+    // Tag changes always come with the assets they're on, so this is enough to keep search current
+    NSString *assetEntityName = NSStringFromClass([Asset class]);
+    BOOL (^isAsset)(NSManagedObjectID *) = ^BOOL(NSManagedObjectID *objectID) {
+        return [[[objectID entity] name] isEqualToString:assetEntityName];
+    };
+    NSArray<NSManagedObjectID *> *changedAssetIDs = [[inserted arrayByAddingObjectsFromArray:updated] filteredArrayUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(NSManagedObjectID *objectID, __unused NSDictionary *bindings) {
+        return isAsset(objectID);
+    }]];
+    NSArray<NSManagedObjectID *> *deletedAssetIDs = [deleted filteredArrayUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(NSManagedObjectID *objectID, __unused NSDictionary *bindings) {
+        return isAsset(objectID);
+    }]];
+    [self.searchIndex updateAssets:[NSSet setWithArray:changedAssetIDs]
+                      removeAssets:[NSSet setWithArray:deletedAssetIDs]];
+
     if ([classes containsObject:NSStringFromClass([Group class])]) {
         NSError *error = nil;
         BOOL success = [self reloadGroups:&error];
@@ -248,18 +285,11 @@ NSArray<NSString *> * const testTags = @[
     }
 
     if ([classes containsObject:NSStringFromClass([Asset class])]) {
-        // TODO: This is all very crude, but let's get something working
-        // before we end up down a perfect diffing rabbit hole.
-        dispatch_sync(self.syncQ, ^{
-            NSError *error = nil;
-            BOOL success = [self reloadAssetsWithCause:LibraryViewModelReloadCauseUpdate
-                                                 error:&error];
-            if (nil != error) {
-                NSAssert(NO == success, @"Got error and success on reloading assets");
-                [self.delegate libraryViewModel:self
-                               hadErrorOnUpdate:error];
-            } else {
-                NSAssert(NO != success, @"Got no error and no success reloading assets");
+        metrics_dispatch_sync(self.syncQ, ^{
+            BOOL merged = [self applyChangedAssetIDs:[NSSet setWithArray:changedAssetIDs]
+                                     deletedAssetIDs:[NSSet setWithArray:deletedAssetIDs]];
+            if (NO == merged) {
+                [self reloadAssetsWithCause:LibraryViewModelReloadCauseUpdate];
             }
         });
     }
@@ -299,9 +329,10 @@ NSArray<NSString *> * const testTags = @[
     }
     NSAssert(nil != result, @"Got no error and no fetch results.");
 
-    dispatch_sync(self.syncQ, ^{
+    metrics_dispatch_sync(self.syncQ, ^{
         self.groups = result;
         self.sidebarItems = [LibraryViewModel buildMenuWithGroups:result
+                                                      popularTags:self.popularTags
                                                  trashDisplayName:self.trashDisplayName];
     });
 
@@ -329,76 +360,361 @@ NSArray<NSString *> * const testTags = @[
     }
     NSAssert(nil != result, @"Got no error and no fetch results.");
 
-    dispatch_sync(self.syncQ, ^{
+    // The counts are kept up to date as tags are used, so this is a short walk down their index
+    // however many tags or assets there are. The counts include assets in the trash, so a tag
+    // only on trashed assets can still be listed until the trash is emptied.
+    NSFetchRequest *popularRequest = [NSFetchRequest fetchRequestWithEntityName:@"Tag"];
+    [popularRequest setPredicate:[NSPredicate predicateWithFormat:@"assetCount > 0"]];
+    [popularRequest setSortDescriptors:@[
+        [NSSortDescriptor sortDescriptorWithKey:@"assetCount"
+                                      ascending:NO],
+        [NSSortDescriptor sortDescriptorWithKey:@"name"
+                                      ascending:YES],
+    ]];
+    [popularRequest setFetchLimit:kPopularTagCount];
+    NSArray<Tag *> *popular = [self.viewContext executeFetchRequest:popularRequest
+                                                              error:&innerError];
+    if (nil != innerError) {
+        NSAssert(nil == popular, @"Got error and fetch results.");
+        if (nil != error) {
+            *error = innerError;
+        }
+        return NO;
+    }
+    NSAssert(nil != popular, @"Got no error and no fetch results.");
+
+    metrics_dispatch_sync(self.syncQ, ^{
         self.tags = result;
+        // Most tag changes don't change the order, so don't make the sidebar redraw for them
+        if ([popular isEqualToArray:self.popularTags]) {
+            return;
+        }
+        self.popularTags = popular;
+        self.sidebarItems = [LibraryViewModel buildMenuWithGroups:self->_groups
+                                                      popularTags:popular
+                                                 trashDisplayName:self.trashDisplayName];
     });
 
     return YES;
 }
 
-- (BOOL)reloadAssetsWithCause:(__unused LibraryViewModelReloadCause)reloadCause
-                        error:(NSError **)error {
-    // TODO: plumb in reloadCause to let us make a more sensible selection
-    // when an item is deleted from the current view vs we changed views entirely
+- (void)reloadAssetsWithCause:(LibraryViewModelReloadCause)reloadCause {
     dispatch_assert_queue(self.syncQ);
     dispatch_assert_queue(dispatch_get_main_queue());
+    NSAssert(nil != self->_selectedSidebarItem, @"Should always have a sidebar item selected");
 
-    if (nil == self->_selectedSidebarItem) {
-        if (nil != error) {
-            *error = [NSError errorWithDomain:NSPOSIXErrorDomain
-                                         code:EINVAL
-                                     userInfo:nil];
+    // Anything queued or running before this is now out of date
+    self.queryGeneration += 1;
+    NSUInteger generation = self.queryGeneration;
+    NSFetchRequest *request = [self->_selectedSidebarItem.fetchRequest copy];
+    NSString *searchText = [NSString stringWithString:self->_searchText];
+
+    // Only typing is debounced, as other changes come one at a time and the user expects to see
+    // them straight away.
+    int64_t delay = LibraryViewModelReloadCauseSearch == reloadCause ? (int64_t)(kSearchDebounceInterval * NSEC_PER_SEC) : 0;
+    @weakify(self);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay), self.queryQ, ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
         }
-        return NO;
-    }
+        [self runQuery:request
+            searchText:searchText
+            generation:generation];
+    });
+}
 
-    NSFetchRequest *request = [self->_selectedSidebarItem.fetchRequest copy];
-    NSSortDescriptor *sort = [NSSortDescriptor sortDescriptorWithKey:@"created"
-                                                           ascending:YES];
-    if ([self->_searchText length] > 0) {
+- (void)runQuery:(NSFetchRequest *)request
+      searchText:(NSString *)searchText
+      generation:(NSUInteger)generation {
+    NSParameterAssert(nil != request);
+    NSParameterAssert(nil != searchText);
+    dispatch_assert_queue(self.queryQ);
+
+    if (generation != self.queryGeneration) {
+        return;
+    }
+    NSDate *start = [NSDate date];
+
+    NSArray<NSManagedObjectID *> *rankedIDs = nil;
+    if ([searchText length] > 0) {
+        NSPredicate *searchPredicate = nil;
+        if (self.searchIndex.ready) {
+            rankedIDs = [self.searchIndex assetIDsMatchingQuery:searchText];
+            searchPredicate = [NSPredicate predicateWithFormat:@"SELF IN %@", rankedIDs];
+        } else {
+            // Still building the index, so do it the slow way
+            NSPredicate *searchNamePredicate = [NSPredicate predicateWithFormat:@"name CONTAINS[cd] %@", searchText];
+            NSPredicate *searchScannedTextPredicate = [NSPredicate predicateWithFormat:@"scannedText CONTAINS[cd] %@", searchText];
+            searchPredicate = [[NSCompoundPredicate alloc] initWithType:NSOrPredicateType
+                                                          subpredicates:@[searchNamePredicate, searchScannedTextPredicate]];
+        }
         NSPredicate *predicte = [request predicate];
-        NSPredicate *searchNamePredicate = [NSPredicate predicateWithFormat:@"name CONTAINS[cd] %@", self->_searchText];
-        NSPredicate *searchScannedTextPredicate = [NSPredicate predicateWithFormat:@"scannedText CONTAINS[cd] %@", self->_searchText];
-        NSCompoundPredicate *searchPredicate = [[NSCompoundPredicate alloc] initWithType:NSOrPredicateType
-                                                                           subpredicates:@[searchNamePredicate, searchScannedTextPredicate]];
         NSCompoundPredicate *combinedPredicate = [[NSCompoundPredicate alloc] initWithType:NSAndPredicateType
                                                                              subpredicates:@[predicte, searchPredicate]];
         [request setPredicate:combinedPredicate];
     }
+    NSSortDescriptor *sort = [NSSortDescriptor sortDescriptorWithKey:@"created"
+                                                           ascending:YES];
     [request setSortDescriptors:@[sort]];
+    [request setResultType:NSManagedObjectIDResultType];
 
-    NSError *innerError = nil;
-    NSArray<Asset *> *result = [self.viewContext executeFetchRequest:request
-                                                              error:&innerError];
-    if (nil != innerError) {
+    // The search may have taken a while, so check again before going to the store
+    if (generation != self.queryGeneration) {
+        return;
+    }
+
+    __block NSArray<NSManagedObjectID *> *result = nil;
+    __block NSError *error = nil;
+    MetricsIntervalToken fetchInterval = metrics_interval_begin(MetricsIntervalFetch);
+    [self.queryContext performBlockAndWait:^{
+        result = [self.queryContext executeFetchRequest:request
+                                                  error:&error];
+    }];
+    metrics_interval_end(fetchInterval);
+    if (nil != error) {
         NSAssert(nil == result, @"Got error and fetch results.");
-        if (nil != error) {
-            *error = innerError;
+        @weakify(self);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            [self.delegate libraryViewModel:self
+                           hadErrorOnUpdate:error];
+        });
+        return;
+    }
+    NSAssert(nil != result, @"Got no error and no fetch results.");
+
+    if (nil != rankedIDs) {
+        // Show the best matches first rather than by date.
+        NSMutableDictionary<NSManagedObjectID *, NSNumber *> *ranks = [NSMutableDictionary dictionaryWithCapacity:[rankedIDs count]];
+        [rankedIDs enumerateObjectsUsingBlock:^(NSManagedObjectID * _Nonnull assetID, NSUInteger idx, __unused BOOL * _Nonnull stop) {
+            ranks[assetID] = @(idx);
+        }];
+        result = [result sortedArrayUsingComparator:^NSComparisonResult(NSManagedObjectID *a, NSManagedObjectID *b) {
+            return [ranks[a] compare:ranks[b]];
+        }];
+    }
+    NSTimeInterval duration = -[start timeIntervalSinceNow];
+
+    @weakify(self);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        @strongify(self);
+        if (nil == self) {
+            return;
         }
+        if (generation != self.queryGeneration) {
+            return;
+        }
+        self.lastQueryDuration = duration;
+        self.publishedGeneration = generation;
+        metrics_dispatch_sync(self.syncQ, ^{
+            [self publishAssetIDs:result];
+        });
+    });
+}
+
+- (void)publishAssetIDs:(NSArray<NSManagedObjectID *> *)assetIDs {
+    NSParameterAssert(nil != assetIDs);
+    dispatch_assert_queue(self.syncQ);
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    // Nothing is loaded until the grid asks for the part it's showing
+    AssetList *result = [[AssetList alloc] initWithAssetIDs:assetIDs
+                                                    context:self.viewContext];
+
+    [self replaceAssets:result
+            withChanges:[AssetListChanges reload]];
+}
+
+// Merges a change set into the current asset list without going back to the store, inserting by
+// binary search on created, which is what the queries sort on. Returns NO if that can't be done,
+// in which case the caller should do a full reload.
+- (BOOL)applyChangedAssetIDs:(NSSet<NSManagedObjectID *> *)changedAssetIDs
+             deletedAssetIDs:(NSSet<NSManagedObjectID *> *)deletedAssetIDs {
+    NSParameterAssert(nil != changedAssetIDs);
+    NSParameterAssert(nil != deletedAssetIDs);
+    dispatch_assert_queue(self.syncQ);
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    // Search results are ordered by rank not date, nothing has been loaded yet, or there's a query
+    // outstanding that'd overwrite anything we did here.
+    if ([self->_searchText length] > 0) {
         return NO;
     }
-    NSAssert(nil != result, @"Got no error and no fetch results.");
+    if ((0 == self.publishedGeneration) || (self.publishedGeneration != self.queryGeneration)) {
+        return NO;
+    }
+    if (([changedAssetIDs count] + [deletedAssetIDs count]) > kMaximumIncrementalAssetChanges) {
+        return NO;
+    }
+
+    NSPredicate *filter = [self->_selectedSidebarItem.fetchRequest predicate];
+    AssetList *oldAssets = self->_assets;
+    NSArray<NSManagedObjectID *> *oldAssetIDs = oldAssets.assetIDs;
+
+    // Find where the affected assets are now in a single pass
+    NSMutableDictionary<NSManagedObjectID *, NSNumber *> *oldIndexes = [NSMutableDictionary dictionary];
+    [oldAssetIDs enumerateObjectsUsingBlock:^(NSManagedObjectID * _Nonnull assetID, NSUInteger idx, __unused BOOL * _Nonnull stop) {
+        if ([changedAssetIDs containsObject:assetID] || [deletedAssetIDs containsObject:assetID]) {
+            oldIndexes[assetID] = @(idx);
+        }
+    }];
+
+    NSMutableIndexSet *removed = [NSMutableIndexSet indexSet];
+    NSMutableArray<NSManagedObjectID *> *inserted = [NSMutableArray array];
+    NSMutableSet<NSManagedObjectID *> *updated = [NSMutableSet set];
+    NSMutableDictionary<NSManagedObjectID *, NSNumber *> *movedFrom = [NSMutableDictionary dictionary];
+
+    for (NSManagedObjectID *assetID in deletedAssetIDs) {
+        NSNumber *oldIndex = oldIndexes[assetID];
+        if (nil != oldIndex) {
+            [removed addIndex:[oldIndex unsignedIntegerValue]];
+        }
+    }
+    for (NSManagedObjectID *assetID in changedAssetIDs) {
+        if ([deletedAssetIDs containsObject:assetID]) {
+            continue;
+        }
+        Asset *asset = (Asset *)[self.viewContext objectWithID:assetID];
+        BOOL belongs = (nil == filter) || [filter evaluateWithObject:asset];
+        NSNumber *oldIndex = oldIndexes[assetID];
+        if (nil == oldIndex) {
+            if (belongs) {
+                [inserted addObject:assetID];
+            }
+        } else if (NO == belongs) {
+            [removed addIndex:[oldIndex unsignedIntegerValue]];
+        } else if ([LibraryViewModel asset:asset
+                          isInOrderAtIndex:[oldIndex unsignedIntegerValue]
+                                    inList:oldAssets
+                                  skipping:oldIndexes]) {
+            [updated addObject:assetID];
+        } else {
+            movedFrom[assetID] = oldIndex;
+        }
+    }
+
+    if ((0 == [removed count]) && (0 == [inserted count]) && (0 == [updated count]) && (0 == [movedFrom count])) {
+        return YES;
+    }
+
+    NSMutableIndexSet *taken = [removed mutableCopy];
+    for (NSNumber *oldIndex in [movedFrom allValues]) {
+        [taken addIndex:[oldIndex unsignedIntegerValue]];
+    }
+    NSMutableArray<NSManagedObjectID *> *newAssetIDs = [oldAssetIDs mutableCopy];
+    [newAssetIDs removeObjectsAtIndexes:taken];
+    NSManagedObjectContext *viewContext = self.viewContext;
+    for (NSManagedObjectID *assetID in [inserted arrayByAddingObjectsFromArray:[movedFrom allKeys]]) {
+        NSUInteger index = [newAssetIDs indexOfObject:assetID
+                                        inSortedRange:NSMakeRange(0, [newAssetIDs count])
+                                              options:NSBinarySearchingInsertionIndex | NSBinarySearchingLastEqual
+                                      usingComparator:^NSComparisonResult(NSManagedObjectID * _Nonnull a, NSManagedObjectID * _Nonnull b) {
+            Asset *assetA = (Asset *)[viewContext objectWithID:a];
+            Asset *assetB = (Asset *)[viewContext objectWithID:b];
+            return [assetA.created compare:assetB.created];
+        }];
+        [newAssetIDs insertObject:assetID
+                          atIndex:index];
+    }
+
+    // And a second pass to find where they ended up
+    NSSet<NSManagedObjectID *> *insertedSet = [NSSet setWithArray:inserted];
+    NSMutableIndexSet *insertedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *updatedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableDictionary<NSNumber *, NSNumber *> *movedIndexes = [NSMutableDictionary dictionaryWithCapacity:[movedFrom count]];
+    [newAssetIDs enumerateObjectsUsingBlock:^(NSManagedObjectID * _Nonnull assetID, NSUInteger idx, __unused BOOL * _Nonnull stop) {
+        if ([insertedSet containsObject:assetID]) {
+            [insertedIndexes addIndex:idx];
+        } else if ([updated containsObject:assetID]) {
+            [updatedIndexes addIndex:idx];
+        } else {
+            NSNumber *oldIndex = movedFrom[assetID];
+            if (nil != oldIndex) {
+                movedIndexes[oldIndex] = @(idx);
+            }
+        }
+    }];
+
+    AssetListChanges *changes = [[AssetListChanges alloc] initWithDeletedIndexes:removed
+                                                                 insertedIndexes:insertedIndexes
+                                                                  updatedIndexes:updatedIndexes
+                                                                    movedIndexes:movedIndexes];
+    [self replaceAssets:[[AssetList alloc] initWithAssetIDs:newAssetIDs
+                                                    context:self.viewContext]
+            withChanges:changes];
+    return YES;
+}
+
+// Checks the asset still sorts between its nearest neighbours that aren't also being changed.
++ (BOOL)asset:(Asset *)asset
+isInOrderAtIndex:(NSUInteger)index
+       inList:(NSArray<Asset *> *)assets
+     skipping:(NSDictionary<NSManagedObjectID *, NSNumber *> *)affected {
+    NSParameterAssert(nil != asset);
+    NSParameterAssert(nil != assets);
+    NSParameterAssert(nil != affected);
+
+    for (NSUInteger before = index; before > 0; before--) {
+        Asset *neighbour = [assets objectAtIndex:before - 1];
+        if (nil != affected[neighbour.objectID]) {
+            continue;
+        }
+        if ([neighbour.created compare:asset.created] == NSOrderedDescending) {
+            return NO;
+        }
+        break;
+    }
+    for (NSUInteger after = index + 1; after < [assets count]; after++) {
+        Asset *neighbour = [assets objectAtIndex:after];
+        if (nil != affected[neighbour.objectID]) {
+            continue;
+        }
+        if ([neighbour.created compare:asset.created] == NSOrderedAscending) {
+            return NO;
+        }
+        break;
+    }
+    return YES;
+}
+
+- (void)replaceAssets:(AssetList *)assets
+          withChanges:(AssetListChanges *)changes {
+    NSParameterAssert(nil != assets);
+    NSParameterAssert(nil != changes);
+    dispatch_assert_queue(self.syncQ);
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    // TODO: plumb in reloadCause to let us make a more sensible selection
+    // when an item is deleted from the current view vs we changed views entirely
 
     // Are any of the old selected assets in the new data? If so, keep them selected?
     // If not default to just having the most recent by time
     // TODO: one day the assumption this is the last item will not be true
-    NSSet<NSIndexPath *> *newSelectionIndexPaths = [result count] > 0 ?
-        [NSSet setWithObject: [NSIndexPath indexPathForItem:((NSInteger)[result count] - 1) inSection:0]] :
+    NSSet<NSIndexPath *> *newSelectionIndexPaths = [assets count] > 0 ?
+        [NSSet setWithObject: [NSIndexPath indexPathForItem:((NSInteger)[assets count] - 1) inSection:0]] :
         [NSSet set];
-    if (([result count] > 0) && ([self->_assets count] > 0)) {
-        NSSet<NSIndexPath *> *selected = [self->_selectedAssetIndexPaths compactMapUsingBlock:^id _Nullable(NSIndexPath * _Nonnull indexPath) {
+    if (([assets count] > 0) && ([self->_assets count] > 0)) {
+        NSArray<NSManagedObjectID *> *oldAssetIDs = self->_assets.assetIDs;
+        NSSet<NSManagedObjectID *> *selectedAssetIDs = [self->_selectedAssetIndexPaths compactMapUsingBlock:^id _Nullable(NSIndexPath * _Nonnull indexPath) {
             NSInteger idx = [indexPath item];
-            if ((NSNotFound == idx) || (0 > idx) || ([self->_assets count] < idx)) {
-                return nil;
-            }
-            Asset *selected = [self->_assets objectAtIndex:(NSUInteger)[indexPath item]];
-            NSUInteger newIndex = [result indexOfObject:selected];
-            if (NSNotFound == newIndex) {
+            if ((NSNotFound == idx) || (0 > idx) || ([oldAssetIDs count] <= (NSUInteger)idx)) {
                 return nil;
             }
-            return [NSIndexPath indexPathForItem:(NSInteger)newIndex inSection:0];
+            return [oldAssetIDs objectAtIndex:(NSUInteger)idx];
         }];
-        if ([selected count] > 0) {
+        // Look for all of them in one pass rather than searching the list for each
+        NSIndexSet *stillSelected = [assets.assetIDs indexesOfObjectsPassingTest:^BOOL(NSManagedObjectID * _Nonnull assetID, __unused NSUInteger idx, __unused BOOL * _Nonnull stop) {
+            return [selectedAssetIDs containsObject:assetID];
+        }];
+        if ([stillSelected count] > 0) {
+            NSMutableSet<NSIndexPath *> *selected = [NSMutableSet setWithCapacity:[stillSelected count]];
+            [stillSelected enumerateIndexesUsingBlock:^(NSUInteger idx, __unused BOOL * _Nonnull stop) {
+                [selected addObject:[NSIndexPath indexPathForItem:(NSInteger)idx inSection:0]];
+            }];
             newSelectionIndexPaths = selected;
         }
     }
@@ -406,16 +722,16 @@ NSArray<NSString *> * const testTags = @[
     [self willChangeValueForKey:NSStringFromSelector(@selector(assets))];
     [self willChangeValueForKey:NSStringFromSelector(@selector(selectedAssetIndexPaths))];
 
-    self->_assets = result;
+    self->_assets = assets;
+    self->_assetChanges = changes;
     self->_selectedAssetIndexPaths = newSelectionIndexPaths;
 
     [self didChangeValueForKey:NSStringFromSelector(@selector(assets))];
     [self didChangeValueForKey:NSStringFromSelector(@selector(selectedAssetIndexPaths))];
-
-    return YES;
 }
 
 + (SidebarItem * _Nonnull)buildMenuWithGroups:(NSArray<Group *> * _Nonnull)groups
+                                  popularTags:(NSArray<Tag *> * _Nonnull)popularTags
                              trashDisplayName:(NSString *)trashDisplayName {
     // TODO: Can we load this from JSON/plist?
     NSFetchRequest *everythingRequest = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
@@ -462,12 +778,17 @@ NSArray<NSString *> * const testTags = @[
     SidebarItem *tags = [[SidebarItem alloc] initWithTitle:@"Popular Tags"
                                                 symbolName:@"tag"
                                           dragResponseType:SidebarItemDragResponseNone
-                                                  children:[testTags mapUsingBlock:^SidebarItem * _Nonnull(NSString * _Nonnull title) {
-        return [[SidebarItem alloc] initWithTitle:title
+                                                  children:[popularTags mapUsingBlock:^SidebarItem * _Nonnull(Tag * _Nonnull tag) {
+        // The related object is for things we can import into, which a tag isn't
+        NSFetchRequest *tagRequest = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+        NSPredicate *tagPredicate = [NSPredicate predicateWithFormat: @"ANY tags == %@", tag];
+        NSPredicate *notDeletedPredicate = [NSPredicate predicateWithFormat: @"deletedAt == nil"];
+        [tagRequest setPredicate:[NSCompoundPredicate andPredicateWithSubpredicates:@[tagPredicate, notDeletedPredicate]]];
+        return [[SidebarItem alloc] initWithTitle:tag.name
                                        symbolName:nil
                                  dragResponseType:SidebarItemDragResponseNone
                                          children:nil
-                                     fetchRequest:nil
+                                     fetchRequest:tagRequest
                                     relatedObject:nil
                                              uuid:[NSUUID UUID]];
     }]
@@ -11,10 +11,12 @@
 #import "SidebarController.h"
 #import "DetailsController.h"
 #import "LibraryViewModel.h"
+#import "ImportJob.h"
+#import "TrashPurgeJob.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
-@interface RootWindowController : NSWindowController <NSToolbarDelegate, AssetsDisplayControllerDelegate, NSTextFieldDelegate, SidebarControllerDelegate, LibraryViewModelDelegate, NSSearchFieldDelegate, DetailsControllerDelegate, NSComboBoxDataSource, NSSharingServicePickerToolbarItemDelegate>
+@interface RootWindowController : NSWindowController <NSToolbarDelegate, AssetsDisplayControllerDelegate, NSTextFieldDelegate, SidebarControllerDelegate, LibraryViewModelDelegate, NSSearchFieldDelegate, DetailsControllerDelegate, NSComboBoxDataSource, NSSharingServicePickerToolbarItemDelegate, ImportJobDelegate, TrashPurgeJobDelegate>
 
 // Group creation panel and controls.
 @property (nonatomic, weak, readwrite) IBOutlet NSPanel *groupCreatePanel;
@@ -35,10 +37,14 @@ NS_ASSUME_NONNULL_BEGIN
 
 // Menu and toolbar actions
 - (IBAction)import:(id)sender;
+- (IBAction)cancelImports:(id)sender;
 - (IBAction)showGroupCreatePanel:(id)sender;
 - (IBAction)debugRegenerateThumbnail:(id)sender;
 - (IBAction)debugRegenerateScannedText:(id)sender;
 
+// Shows the job's progress in the toolbar whilst no imports are running.
+- (void)trackTrashPurgeJob:(TrashPurgeJob *)job;
+
 // Group creation panel actions
 - (IBAction)groupCreateOK:(id)sender;
 - (IBAction)groupCreateCancel:(id)sender;
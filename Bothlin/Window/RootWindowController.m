@@ -40,6 +40,9 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
 @property (nonatomic, strong, readonly) DetailsController *details;
 @property (nonatomic, strong, readonly) NSSplitViewController *splitViewController;
 @property (nonatomic, strong, readonly) ToolbarProgressView *progressView;
+// Only accessed on mainQ
+@property (nonatomic, strong, readonly) NSMutableArray<ImportJob *> *activeImportJobs;
+@property (nonatomic, strong, readwrite, nullable) TrashPurgeJob *activeTrashPurgeJob;
 
 @property (nonatomic, strong, readonly) LibraryViewModel *viewModel;
 
@@ -61,6 +64,7 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
         self->_details = [[DetailsController alloc] initWithNibName:@"DetailsController" bundle:nil];
         self->_splitViewController = [[NSSplitViewController alloc] init];
         self->_progressView = [[ToolbarProgressView alloc] initWithFrame:NSMakeRect(0.0, 0.0, 250.0, 28.0)];
+        self->_activeImportJobs = [NSMutableArray array];
         self->_viewModel = [[LibraryViewModel alloc] initWithViewContext:viewContext
                                                         trashDisplayName:trashDisplayName];
 
@@ -106,18 +110,35 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
     LibraryWriteCoordinator *library = appDelegate.libraryController;
     library.delegate = self.viewModel;
     library.thumbnailDelegate = self.viewModel;
+    self.assetsDisplay.gridViewController.thumbnailStore = appDelegate.thumbnailStore;
     ImportCoordinator *importer = appDelegate.importCoordinator;
     importer.delegate = self.viewModel;
 
     self.viewModel.delegate = self;
 
+    // Pick up any imports that were cancelled or interrupted last time we ran
+    @weakify(self);
+    NSArray<ImportJob *> *resumedJobs = [importer resumeInterruptedImports:^(BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, NSError * _Nullable error) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            [self importDidFinish:success
+                           assets:assets
+                            error:error];
+        });
+    }];
+    for (ImportJob *job in resumedJobs) {
+        [self trackImportJob:job];
+    }
+
     // TODO: This is a back, but I've not found a nicer way to achieve this. If I call NSWindow makeFirstResponder
     // directly here, it seems to get overriden by the last panel in the SplitView (in our case the detail view)
     // some time after the window is launched - you can see a call to [NSWindow _realMakeFirstResponder] happen
     // fron NSApp main after this - but I've no idea how to stop that happening. It seems thus just
     // overriding that once the app is going is the least stateful way I can think of to achieve what I want
     // without subclassing everything everywhere to override things.
-    @weakify(self);
     dispatch_async(dispatch_get_main_queue(), ^{
         @strongify(self);
         if (nil == self) {
@@ -157,7 +178,8 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
         }
         dispatch_assert_queue(dispatch_get_main_queue());
         [self.assetsDisplay setAssets:self.viewModel.assets
-                        withSelected:self.viewModel.selectedAssetIndexPaths];
+                              changes:self.viewModel.assetChanges
+                         withSelected:self.viewModel.selectedAssetIndexPaths];
         [self updateToolbar];
 
     }
@@ -177,6 +199,7 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
         }
         dispatch_assert_queue(dispatch_get_main_queue());
         [self.assetsDisplay setAssets:self.viewModel.assets
+                              changes:self.viewModel.assetChanges
                          withSelected:self.viewModel.selectedAssetIndexPaths];
         NSSet<Asset *> *selectedAssets = [self.viewModel selectedAssets];
         [self.details setItemForDisplay:[selectedAssets count] == 1 ? [selectedAssets anyObject] : nil];
@@ -269,22 +292,87 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
     ImportCoordinator *importer = appDelegate.importCoordinator;
 
     // This is async, so returns immediately
-     [importer importURLs:[NSSet setWithArray:urls]
-                 toGroup:relatedObject
-                 callback:^(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError *error) {
-         dispatch_async(dispatch_get_main_queue(), ^{
-             if (nil != error) {
-                 NSAssert(NO == success, @"Got error and success from saving.");
-                 NSAssert(nil == assets, @"Got error and success from saving.");
-                 NSAlert *alert = [NSAlert alertWithError:error];
-                 [alert runModal];
-             } else {
-                 AppDelegate *appDelegate = (AppDelegate*)[NSApplication sharedApplication].delegate;
-                 LibraryWriteCoordinator *library = appDelegate.libraryController;
-                 [library generateThumbnailForAssets:assets];
-                 [library generateScannedTextForAssets:assets];
-             }
-         });
+    @weakify(self);
+    ImportJob *job = [importer importURLs:[NSSet setWithArray:urls]
+                                  toGroup:relatedObject
+                                 callback:^(BOOL success, NSSet<NSManagedObjectID *> *assets, NSError *error) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            @strongify(self);
+            if (nil == self) {
+                return;
+            }
+            [self importDidFinish:success
+                           assets:assets
+                            error:error];
+        });
+    }];
+    [self trackImportJob:job];
+}
+
+- (void)importDidFinish:(BOOL)success
+                 assets:(NSSet<NSManagedObjectID *> *)assets
+                  error:(NSError * _Nullable)error {
+    dispatch_assert_queue(dispatch_get_main_queue());
+    NSParameterAssert(nil != assets);
+
+    // Even if the import stopped early, whatever made it in still needs processing
+    AppDelegate *appDelegate = (AppDelegate*)[NSApplication sharedApplication].delegate;
+    LibraryWriteCoordinator *library = appDelegate.libraryController;
+    [library generateThumbnailForAssets:assets];
+    [library generateScannedTextForAssets:assets];
+
+    if (nil != error) {
+        NSAssert(NO == success, @"Got error and success from import.");
+        if (([error.domain isEqualToString:NSCocoaErrorDomain]) && (NSUserCancelledError == error.code)) {
+            return;
+        }
+        NSAlert *alert = [NSAlert alertWithError:error];
+        [alert runModal];
+    }
+}
+
+- (void)trackImportJob:(ImportJob *)job {
+    dispatch_assert_queue(dispatch_get_main_queue());
+    NSParameterAssert(nil != job);
+
+    job.delegate = self;
+    [self.activeImportJobs addObject:job];
+    [self importJobDidUpdateProgress:job];
+}
+
+- (void)trackTrashPurgeJob:(TrashPurgeJob *)job {
+    dispatch_assert_queue(dispatch_get_main_queue());
+    NSParameterAssert(nil != job);
+
+    job.delegate = self;
+    self.activeTrashPurgeJob = job;
+    [self trashPurgeJobDidUpdateProgress:job];
+}
+
+- (IBAction)cancelImports:(id)sender {
+    dispatch_assert_queue(dispatch_get_main_queue());
+    if (0 == [self.activeImportJobs count]) {
+        return;
+    }
+
+    NSAlert *alert = [[NSAlert alloc] init];
+    alert.messageText = NSLocalizedString(@"Stop importing?", nil);
+    alert.informativeText = NSLocalizedString(@"Files already imported will be kept, and the rest of the import will continue next time $APP is opened.", nil);
+    [alert addButtonWithTitle:NSLocalizedString(@"Continue Import", nil)];
+    [alert addButtonWithTitle:NSLocalizedString(@"Stop", nil)];
+    @weakify(self);
+    [alert beginSheetModalForWindow:self.window
+                  completionHandler:^(NSModalResponse returnCode) {
+        @strongify(self);
+        if (nil == self) {
+            return;
+        }
+        if (NSAlertFirstButtonReturn == returnCode) {
+            return;
+        }
+        for (ImportJob *job in self.activeImportJobs) {
+            [job cancel];
+        }
     }];
 }
 
@@ -384,6 +472,73 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
 }
 
 
+#pragma mark - ImportJobDelegate
+
+- (void)importJobDidUpdateProgress:(ImportJob *)job {
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    if (job.isFinished) {
+        [self.activeImportJobs removeObject:job];
+    }
+    if ((0 == [self.activeImportJobs count]) && (nil != self.activeTrashPurgeJob)) {
+        [self trashPurgeJobDidUpdateProgress:self.activeTrashPurgeJob];
+        return;
+    }
+
+    // If there's more than one import going on we show them as one
+    NSUInteger completed = 0;
+    NSUInteger total = 0;
+    double filesPerSecond = 0.0;
+    NSTimeInterval remaining = 0.0;
+    for (ImportJob *activeJob in self.activeImportJobs) {
+        completed += activeJob.completedFiles;
+        total += activeJob.totalFiles;
+        filesPerSecond += activeJob.filesPerSecond;
+        // They run in parallel, so the slowest one decides when we're done, unless any one
+        // doesn't have an estimate yet, in which case neither do we
+        if (activeJob.estimatedTimeRemaining < 0.0) {
+            remaining = -1.0;
+        } else if (0.0 <= remaining) {
+            remaining = MAX(remaining, activeJob.estimatedTimeRemaining);
+        }
+    }
+
+    NSString *detail = nil;
+    if ((0.0 < filesPerSecond) && (0.0 <= remaining)) {
+        NSDateComponentsFormatter *formatter = [[NSDateComponentsFormatter alloc] init];
+        formatter.unitsStyle = NSDateComponentsFormatterUnitsStyleAbbreviated;
+        formatter.maximumUnitCount = 2;
+        detail = [NSString stringWithFormat:NSLocalizedString(@"%.0f/s, %@ left", nil), filesPerSecond, [formatter stringFromTimeInterval:remaining]];
+    }
+    [self.progressView setProgress:completed
+                             total:total
+                            detail:detail];
+}
+
+
+#pragma mark - TrashPurgeJobDelegate
+
+- (void)trashPurgeJobDidUpdateProgress:(TrashPurgeJob *)job {
+    dispatch_assert_queue(dispatch_get_main_queue());
+
+    if (job.isFinished && (job == self.activeTrashPurgeJob)) {
+        self.activeTrashPurgeJob = nil;
+    }
+    // Imports have the progress view whilst they run
+    if (0 < [self.activeImportJobs count]) {
+        return;
+    }
+    if ((NO == job.isCounted) && (NO == job.isFinished)) {
+        [self.progressView setIndeterminateProgressWithText:NSLocalizedString(@"Emptying trash", nil)];
+        return;
+    }
+    [self.progressView setProgress:job.completedItems
+                             total:job.isFinished ? job.completedItems : job.totalItems
+                            format:NSLocalizedString(@"Emptying trash: %lu of %lu", nil)
+                            detail:nil];
+}
+
+
 #pragma mark - LibraryViewModelDelegate
 
 - (void)libraryViewModel:(LibraryViewModel *)libraryViewModel hadErrorOnUpdate:(NSError *)error {
@@ -614,6 +769,14 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
     [alert runModal];
 }
 
+- (void)assetsDisplayController:(__unused AssetsDisplayController *)assetsDisplayController
+    visibleAssetsNeedThumbnails:(NSSet<NSManagedObjectID *> *)assetIDs {
+    dispatch_assert_queue(dispatch_get_main_queue());
+    AppDelegate *appDelegate = (AppDelegate*)[NSApplication sharedApplication].delegate;
+    LibraryWriteCoordinator *library = appDelegate.libraryController;
+    [library generateThumbnailForVisibleAssets:assetIDs];
+}
+
 
 #pragma mark - Group creation panel
 
@@ -926,6 +1089,7 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
         NSToolbarFlexibleSpaceItemIdentifier,
         kImportToolbarItemIdentifier,
         NSToolbarSidebarTrackingSeparatorItemIdentifier,
+        kProgressToolbarItemIdentifier,
         NSToolbarFlexibleSpaceItemIdentifier,
         kShareToolbarItemIdentifier,
         kFavouriteToolbarItemIdentifier,
@@ -942,6 +1106,7 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
 - (NSArray<NSToolbarIdentifier> *)toolbarAllowedItemIdentifiers:(NSToolbar *)toolbar {
     return @[
         kImportToolbarItemIdentifier,
+        kProgressToolbarItemIdentifier,
         NSToolbarFlexibleSpaceItemIdentifier,
         kSearchToolbarItemIdentifier,
         kItemDisplayStyleItemIdentifier,
@@ -973,9 +1138,9 @@ NSString * __nonnull const kFavouriteToolbarItemIdentifier = @"FavouriteToolbarI
         NSToolbarItem *item = [[NSToolbarItem alloc] initWithItemIdentifier:itemIdentifier];
         item.title = NSLocalizedString(@"Progress", nil);
         item.paletteLabel = NSLocalizedString(@"Progress", nil);
-        item.toolTip = NSLocalizedString(@"Import progress", nil);
+        item.toolTip = NSLocalizedString(@"Import progress, click to stop", nil);
         item.target = self;
-        item.action = @selector(import:);
+        item.action = @selector(cancelImports:);
         item.view = self.progressView;
         
         return item;
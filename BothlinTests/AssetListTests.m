@@ -0,0 +1,128 @@
+//
+//  AssetListTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 11/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "AssetList.h"
+#import "TestModelHelpers.h"
+#import "Asset+CoreDataClass.h"
+#import "NSArray+Functional.h"
+
+@interface AssetListTests : XCTestCase
+
+@end
+
+@implementation AssetListTests
+
+- (void)testBehavesAsArray {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:10
+                                                      inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+    NSArray<NSManagedObjectID *> *assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+
+    AssetList *list = [[AssetList alloc] initWithAssetIDs:assetIDs
+                                                  context:moc];
+    XCTAssertEqual([list count], 10);
+    XCTAssertEqualObjects(list, assets);
+    XCTAssertEqualObjects(list.assetIDs, assetIDs);
+    XCTAssertEqual([list copy], list, @"Expected copy to not copy the assets");
+
+    AssetList *empty = [[AssetList alloc] initWithAssetIDs:@[]
+                                                   context:moc];
+    XCTAssertEqual([empty count], 0);
+    XCTAssertNil([empty firstObject]);
+}
+
+- (void)testWindowIsLoaded {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:1000
+                                                      inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+    NSArray<NSManagedObjectID *> *assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+    assets = nil;
+    [moc reset];
+
+    AssetList *list = [[AssetList alloc] initWithAssetIDs:assetIDs
+                                                  context:moc];
+    XCTAssertEqual(list.window.length, 0);
+    XCTAssertTrue([[list objectAtIndex:500] isFault], @"Expected nothing to be loaded yet");
+
+    NSError *error = nil;
+    BOOL success = [list prefetchAroundRange:NSMakeRange(500, 20)
+                                       error:&error];
+    XCTAssertNil(error);
+    XCTAssertTrue(success);
+    XCTAssertTrue(NSLocationInRange(500, list.window));
+    XCTAssertTrue(NSLocationInRange(519, list.window));
+    XCTAssertLessThan(list.window.length, [list count], @"Expected only part of the list to be loaded");
+    XCTAssertFalse([[list objectAtIndex:510] isFault]);
+    XCTAssertEqualObjects([[list objectAtIndex:510] objectID], assetIDs[510]);
+
+    // Scrolling a little stays in the same window
+    NSRange window = list.window;
+    success = [list prefetchAroundRange:NSMakeRange(510, 20)
+                                  error:&error];
+    XCTAssertTrue(success);
+    XCTAssertTrue(NSEqualRanges(window, list.window));
+
+    // And past the end is clipped
+    success = [list prefetchAroundRange:NSMakeRange(990, 20)
+                                  error:&error];
+    XCTAssertTrue(success);
+    XCTAssertEqual(NSMaxRange(list.window), [list count]);
+}
+
+- (void)testWindowLeavesHeavyPropertiesToFault {
+    NSManagedObjectContext *moc = [TestModelHelpers sqliteManagedObjectContextForTests];
+    __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:10
+                                                          inContext:moc];
+        for (Asset *asset in assets) {
+            asset.scannedText = [@"" stringByPaddingToLength:10000
+                                                  withString:@"text "
+                                             startingAtIndex:0];
+        }
+        XCTAssertTrue([moc save:nil]);
+        assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+        [moc reset];
+
+        AssetList *list = [[AssetList alloc] initWithAssetIDs:assetIDs
+                                                      context:moc];
+        XCTAssertTrue([list prefetchAroundRange:NSMakeRange(0, 10)
+                                          error:nil]);
+        Asset *asset = [list objectAtIndex:5];
+        XCTAssertFalse([asset isFault]);
+        XCTAssertEqualObjects(asset.name, @"test 5.png");
+
+        // Change the text behind the list's back. Had the window fetched it, the asset would still
+        // hold the old text, so only seeing the new text shows it was left for when it's asked for.
+        NSManagedObjectContext *other = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+        other.persistentStoreCoordinator = moc.persistentStoreCoordinator;
+        [other performBlockAndWait:^{
+            Asset *otherAsset = [other existingObjectWithID:asset.objectID
+                                                      error:nil];
+            XCTAssertNotNil(otherAsset);
+            otherAsset.scannedText = @"changed";
+            XCTAssertTrue([other save:nil]);
+        }];
+        XCTAssertEqualObjects(asset.scannedText, @"changed");
+    }];
+}
+
+- (void)testGridFetchIndexes {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSEntityDescription *entity = [NSEntityDescription entityForName:@"Asset"
+                                              inManagedObjectContext:moc];
+    NSArray<NSString *> *names = [entity.indexes mapUsingBlock:^id _Nonnull(NSFetchIndexDescription * _Nonnull index) { return index.name; }];
+    XCTAssertTrue([names containsObject:@"byDeletedAtCreatedIndex"]);
+    XCTAssertTrue([names containsObject:@"byFavouriteCreatedIndex"]);
+    XCTAssertTrue([names containsObject:@"byCreatedIndex"]);
+}
+
+@end
@@ -0,0 +1,160 @@
+//
+//  AssetWorkSchedulerTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 04/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "AssetWorkScheduler.h"
+#import "TestModelHelpers.h"
+#import "Group+CoreDataClass.h"
+#import "NSArray+Functional.h"
+
+@interface AssetWorkSchedulerRecorder : NSObject
+
+@property (nonatomic, strong, readonly) dispatch_queue_t syncQ;
+@property (nonatomic, strong, readonly) dispatch_semaphore_t batchSemaphore;
+
+// Only access on syncQ
+@property (nonatomic, strong, readonly) NSMutableArray<NSManagedObjectID *> *handled;
+@property (nonatomic, strong, readonly) NSMutableArray<void (^)(void)> *completions;
+@property (nonatomic, readwrite) NSUInteger completedCount;
+
+@end
+
+@implementation AssetWorkSchedulerRecorder
+
+- (instancetype)init {
+    self = [super init];
+    if (nil != self) {
+        self->_syncQ = dispatch_queue_create("com.digitalflapjack.AssetWorkSchedulerRecorder.syncQ", DISPATCH_QUEUE_SERIAL);
+        self->_batchSemaphore = dispatch_semaphore_create(0);
+        self->_handled = [NSMutableArray array];
+        self->_completions = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (AssetWorkBatchHandler)handler {
+    return ^(NSArray<NSManagedObjectID *> *assetIDs, void (^itemCompleted)(NSManagedObjectID *assetID)) {
+        dispatch_sync(self.syncQ, ^{
+            [self.handled addObjectsFromArray:assetIDs];
+            for (NSManagedObjectID *assetID in assetIDs) {
+                [self.completions addObject:^{ itemCompleted(assetID); }];
+            }
+        });
+        dispatch_semaphore_signal(self.batchSemaphore);
+    };
+}
+
+- (NSArray<NSManagedObjectID *> *)handledSoFar {
+    __block NSArray<NSManagedObjectID *> *handled = nil;
+    dispatch_sync(self.syncQ, ^{
+        handled = [NSArray arrayWithArray:self.handled];
+    });
+    return handled;
+}
+
+- (NSUInteger)inProgress {
+    __block NSUInteger count = 0;
+    dispatch_sync(self.syncQ, ^{
+        count = [self.handled count] - self.completedCount;
+    });
+    return count;
+}
+
+- (void)completeAll {
+    __block NSArray<void (^)(void)> *completions = nil;
+    dispatch_sync(self.syncQ, ^{
+        completions = [NSArray arrayWithArray:self.completions];
+        [self.completions removeAllObjects];
+        self.completedCount += [completions count];
+    });
+    for (void (^completion)(void) in completions) {
+        completion();
+    }
+}
+
+@end
+
+
+@interface AssetWorkSchedulerTests : XCTestCase
+
+@end
+
+@implementation AssetWorkSchedulerTests
+
+- (void)testDuplicatesAreCoalescedAndConcurrencyIsCapped {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Group *> *groups = [TestModelHelpers generateGroups:10
+                                                      inContext:moc];
+    NSSet<NSManagedObjectID *> *objectIDs = [NSSet setWithArray:[groups mapUsingBlock:^id _Nonnull(Group * _Nonnull group) { return group.objectID; }]];
+
+    AssetWorkSchedulerRecorder *recorder = [[AssetWorkSchedulerRecorder alloc] init];
+    AssetWorkScheduler *scheduler = [[AssetWorkScheduler alloc] initWithName:@"test"
+                                                          maximumConcurrency:3
+                                                                   batchSize:3
+                                                                 targetQueue:dispatch_get_global_queue(QOS_CLASS_UTILITY, 0)
+                                                                batchHandler:[recorder handler]];
+
+    [scheduler scheduleAssets:objectIDs
+                     priority:AssetWorkPriorityBackground];
+    [scheduler scheduleAssets:objectIDs
+                     priority:AssetWorkPriorityVisible];
+    XCTAssertEqual([scheduler outstandingCount], 10);
+
+    while ([[recorder handledSoFar] count] < 10) {
+        long result = dispatch_semaphore_wait(recorder.batchSemaphore, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
+        XCTAssertEqual(result, 0, @"Timed out waiting for batch");
+        if (0 != result) {
+            return;
+        }
+        XCTAssertLessThanOrEqual([recorder inProgress], 3);
+        [recorder completeAll];
+    }
+    [recorder completeAll];
+
+    NSArray<NSManagedObjectID *> *handled = [recorder handledSoFar];
+    XCTAssertEqual([handled count], 10);
+    XCTAssertEqualObjects([NSSet setWithArray:handled], objectIDs);
+    XCTAssertEqual([scheduler outstandingCount], 0);
+}
+
+- (void)testVisibleWorkJumpsBackgroundWork {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Group *> *groups = [TestModelHelpers generateGroups:3
+                                                      inContext:moc];
+
+    AssetWorkSchedulerRecorder *recorder = [[AssetWorkSchedulerRecorder alloc] init];
+    AssetWorkScheduler *scheduler = [[AssetWorkScheduler alloc] initWithName:@"test"
+                                                          maximumConcurrency:1
+                                                                   batchSize:1
+                                                                 targetQueue:dispatch_get_global_queue(QOS_CLASS_UTILITY, 0)
+                                                                batchHandler:[recorder handler]];
+
+    for (Group *group in groups) {
+        [scheduler scheduleAssets:[NSSet setWithObject:group.objectID]
+                         priority:AssetWorkPriorityBackground];
+    }
+    long result = dispatch_semaphore_wait(recorder.batchSemaphore, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
+    XCTAssertEqual(result, 0, @"Timed out waiting for batch");
+
+    // Whilst the first is still in progress, the last one becomes visible
+    [scheduler scheduleAssets:[NSSet setWithObject:groups[2].objectID]
+                     priority:AssetWorkPriorityVisible];
+    XCTAssertEqual([scheduler outstandingCount], 3);
+
+    for (NSUInteger index = 1; index < 3; index++) {
+        [recorder completeAll];
+        result = dispatch_semaphore_wait(recorder.batchSemaphore, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
+        XCTAssertEqual(result, 0, @"Timed out waiting for batch");
+    }
+    [recorder completeAll];
+
+    NSArray<NSManagedObjectID *> *expected = @[groups[0].objectID, groups[2].objectID, groups[1].objectID];
+    XCTAssertEqualObjects([recorder handledSoFar], expected);
+}
+
+@end
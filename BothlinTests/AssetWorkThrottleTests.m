@@ -0,0 +1,99 @@
+//
+//  AssetWorkThrottleTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 08/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "AssetWorkThrottle.h"
+
+@interface AssetWorkThrottleTests : XCTestCase
+
+@end
+
+@implementation AssetWorkThrottleTests
+
+- (void)testGrowsWhenIdle {
+    NSUInteger next = [AssetWorkThrottle concurrencyAfter:2
+                                              loadPerCore:0.2
+                                             thermalState:NSProcessInfoThermalStateNominal
+                                             lowPowerMode:NO
+                                                  minimum:1
+                                                  maximum:4];
+    XCTAssertEqual(next, 3);
+
+    next = [AssetWorkThrottle concurrencyAfter:4
+                                   loadPerCore:0.2
+                                  thermalState:NSProcessInfoThermalStateNominal
+                                  lowPowerMode:NO
+                                       minimum:1
+                                       maximum:4];
+    XCTAssertEqual(next, 4);
+}
+
+- (void)testHoldsInBetween {
+    NSUInteger next = [AssetWorkThrottle concurrencyAfter:3
+                                              loadPerCore:0.8
+                                             thermalState:NSProcessInfoThermalStateNominal
+                                             lowPowerMode:NO
+                                                  minimum:1
+                                                  maximum:8];
+    XCTAssertEqual(next, 3);
+
+    // Warm but not hot means we don't grow, even if the load is low
+    next = [AssetWorkThrottle concurrencyAfter:3
+                                   loadPerCore:0.2
+                                  thermalState:NSProcessInfoThermalStateFair
+                                  lowPowerMode:NO
+                                       minimum:1
+                                       maximum:8];
+    XCTAssertEqual(next, 3);
+}
+
+- (void)testBacksOffUnderLoad {
+    NSUInteger next = [AssetWorkThrottle concurrencyAfter:6
+                                              loadPerCore:1.5
+                                             thermalState:NSProcessInfoThermalStateNominal
+                                             lowPowerMode:NO
+                                                  minimum:1
+                                                  maximum:8];
+    XCTAssertEqual(next, 3);
+
+    next = [AssetWorkThrottle concurrencyAfter:6
+                                   loadPerCore:0.2
+                                  thermalState:NSProcessInfoThermalStateSerious
+                                  lowPowerMode:NO
+                                       minimum:1
+                                       maximum:8];
+    XCTAssertEqual(next, 3);
+
+    next = [AssetWorkThrottle concurrencyAfter:1
+                                   loadPerCore:3.0
+                                  thermalState:NSProcessInfoThermalStateNominal
+                                  lowPowerMode:NO
+                                       minimum:1
+                                       maximum:8];
+    XCTAssertEqual(next, 1);
+}
+
+- (void)testDropsToMinimumWhenCriticalOrLowPower {
+    NSUInteger next = [AssetWorkThrottle concurrencyAfter:6
+                                              loadPerCore:0.2
+                                             thermalState:NSProcessInfoThermalStateCritical
+                                             lowPowerMode:NO
+                                                  minimum:2
+                                                  maximum:8];
+    XCTAssertEqual(next, 2);
+
+    next = [AssetWorkThrottle concurrencyAfter:6
+                                   loadPerCore:0.2
+                                  thermalState:NSProcessInfoThermalStateNominal
+                                  lowPowerMode:YES
+                                       minimum:2
+                                       maximum:8];
+    XCTAssertEqual(next, 2);
+}
+
+@end
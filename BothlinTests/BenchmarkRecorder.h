@@ -0,0 +1,41 @@
+//
+//  BenchmarkRecorder.h
+//  BothlinTests
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Times named steps of a benchmark run, writes them out as JSON, and compares them against the
+// baselines checked in alongside the tests. A step without a baseline fails, so that new steps and
+// new sizes get a baseline recorded rather than going unchecked.
+//
+// The results go to BOTHLIN_BENCHMARK_OUTPUT if set, or the temporary directory if not. Setting
+// BOTHLIN_BENCHMARK_RECORD writes them into the baselines file instead, for when a change is
+// expected to move the numbers.
+@interface BenchmarkRecorder : NSObject
+
+// The scale is part of each step's key, so different sized libraries have their own baselines.
+- (instancetype)init NS_UNAVAILABLE;
+- (instancetype)initWithScale:(NSUInteger)scale;
+
+// Runs the block, which should only return once the work is done, and records how long it took.
+- (NSTimeInterval)measure:(NSString *)name
+                    block:(void (^)(void))block;
+
+// Steps that took longer than their baseline allows, or have no baseline, as human readable
+// descriptions. Always empty when recording.
+- (NSArray<NSString *> *)regressions;
+
+- (BOOL)writeResults:(NSError **)error;
+
+// Which library sizes to run, from BOTHLIN_BENCHMARKS, say "10000,100000". Empty if unset, as
+// the larger sizes take a long time to build.
++ (NSSet<NSNumber *> *)requestedScales;
+
+@end
+
+NS_ASSUME_NONNULL_END
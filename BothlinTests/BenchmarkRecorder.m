@@ -0,0 +1,178 @@
+//
+//  BenchmarkRecorder.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import "BenchmarkRecorder.h"
+
+// How much slower than the baseline a step can be before it counts as a regression, unless the
+// baselines file says otherwise. Timings on a shared machine are noisy, so this is fairly loose.
+static const double kBenchmarkDefaultTolerance = 0.25;
+
+// Steps this quick are mostly noise, so are never counted as regressions.
+static const NSTimeInterval kBenchmarkMinimumSignificantTime = 0.05;
+
+@interface BenchmarkRecorder ()
+
+@property (nonatomic, readonly) NSUInteger scale;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, NSNumber *> *results;
+@property (nonatomic, strong, readonly) NSDictionary<NSString *, NSNumber *> *baselines;
+@property (nonatomic, readonly) double tolerance;
+
+@end
+
+@implementation BenchmarkRecorder
+
+- (instancetype)initWithScale:(NSUInteger)scale {
+    self = [super init];
+    if (nil != self) {
+        self->_scale = scale;
+        self->_results = [NSMutableDictionary dictionary];
+
+        NSDictionary *file = [BenchmarkRecorder readBaselinesFile];
+        NSNumber *tolerance = file[@"tolerance"];
+        self->_tolerance = nil != tolerance ? [tolerance doubleValue] : kBenchmarkDefaultTolerance;
+        NSDictionary *baselines = file[@"baselines"];
+        self->_baselines = nil != baselines ? baselines : @{};
+    }
+    return self;
+}
+
++ (NSURL *)baselinesURL {
+    // Found via the source tree rather than the test bundle, so that recording can update it
+    NSString *testsDirectory = [[NSString stringWithUTF8String:__FILE__] stringByDeletingLastPathComponent];
+    return [NSURL fileURLWithPath:[testsDirectory stringByAppendingPathComponent:@"BenchmarkBaselines.json"]];
+}
+
++ (NSDictionary *)readBaselinesFile {
+    NSData *data = [NSData dataWithContentsOfURL:[BenchmarkRecorder baselinesURL]];
+    if (nil == data) {
+        return @{};
+    }
+    NSError *error = nil;
+    NSDictionary *file = [NSJSONSerialization JSONObjectWithData:data
+                                                         options:0
+                                                           error:&error];
+    if ((nil == file) || (NO == [file isKindOfClass:[NSDictionary class]])) {
+        NSLog(@"Failed to read benchmark baselines: %@", error);
+        return @{};
+    }
+    return file;
+}
+
++ (NSSet<NSNumber *> *)requestedScales {
+    NSString *value = [[[NSProcessInfo processInfo] environment] objectForKey:@"BOTHLIN_BENCHMARKS"];
+    if (0 == [value length]) {
+        return [NSSet set];
+    }
+    NSMutableSet<NSNumber *> *scales = [NSMutableSet set];
+    for (NSString *part in [value componentsSeparatedByString:@","]) {
+        NSInteger scale = [[part stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] integerValue];
+        if (0 < scale) {
+            [scales addObject:@(scale)];
+        }
+    }
+    return [NSSet setWithSet:scales];
+}
+
++ (BOOL)recording {
+    return nil != [[[NSProcessInfo processInfo] environment] objectForKey:@"BOTHLIN_BENCHMARK_RECORD"];
+}
+
+- (NSString *)keyForName:(NSString *)name {
+    return [NSString stringWithFormat:@"%@/%lu", name, (unsigned long)self.scale];
+}
+
+- (NSTimeInterval)measure:(NSString *)name
+                    block:(void (^)(void))block {
+    NSParameterAssert(nil != name);
+    NSParameterAssert(nil != block);
+
+    NSDate *start = [NSDate date];
+    block();
+    NSTimeInterval duration = -[start timeIntervalSinceNow];
+    [self.results setObject:@(duration)
+                     forKey:[self keyForName:name]];
+    NSLog(@"Benchmark %@: %.3fs", [self keyForName:name], duration);
+    return duration;
+}
+
+- (NSArray<NSString *> *)regressions {
+    NSMutableArray<NSString *> *regressions = [NSMutableArray array];
+    for (NSString *key in [[self.results allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        NSNumber *baseline = self.baselines[key];
+        if (nil == baseline) {
+            // Otherwise an empty or out of date baselines file would quietly turn the check off
+            if (NO == [BenchmarkRecorder recording]) {
+                [regressions addObject:[NSString stringWithFormat:@"%@ has no baseline, so run with BOTHLIN_BENCHMARK_RECORD set to record one", key]];
+            }
+            continue;
+        }
+        NSTimeInterval duration = [self.results[key] doubleValue];
+        NSTimeInterval limit = [baseline doubleValue] * (1.0 + self.tolerance);
+        if ((duration > limit) && (duration > kBenchmarkMinimumSignificantTime)) {
+            [regressions addObject:[NSString stringWithFormat:@"%@ took %.3fs against a baseline of %.3fs", key, duration, [baseline doubleValue]]];
+        }
+    }
+    return [NSArray arrayWithArray:regressions];
+}
+
+- (BOOL)writeResults:(NSError **)error {
+    NSDictionary<NSString *, NSString *> *environment = [[NSProcessInfo processInfo] environment];
+
+    NSURL *url = nil;
+    NSDictionary *output = nil;
+    if ([BenchmarkRecorder recording]) {
+        // Keep the baselines for other scales, and whatever else is in there
+        NSMutableDictionary *file = [[BenchmarkRecorder readBaselinesFile] mutableCopy];
+        NSMutableDictionary *baselines = [NSMutableDictionary dictionaryWithDictionary:self.baselines];
+        [baselines addEntriesFromDictionary:self.results];
+        file[@"baselines"] = baselines;
+        if (nil == file[@"tolerance"]) {
+            file[@"tolerance"] = @(kBenchmarkDefaultTolerance);
+        }
+        url = [BenchmarkRecorder baselinesURL];
+        output = file;
+    } else {
+        NSString *path = environment[@"BOTHLIN_BENCHMARK_OUTPUT"];
+        if (0 == [path length]) {
+            path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"bothlin-benchmarks-%lu.json", (unsigned long)self.scale]];
+        }
+        url = [NSURL fileURLWithPath:path];
+
+        NSMutableDictionary *comparison = [NSMutableDictionary dictionaryWithCapacity:[self.results count]];
+        for (NSString *key in self.results) {
+            NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithObject:self.results[key]
+                                                                            forKey:@"seconds"];
+            if (nil != self.baselines[key]) {
+                entry[@"baseline"] = self.baselines[key];
+            }
+            comparison[key] = entry;
+        }
+        output = @{
+            @"scale": @(self.scale),
+            @"tolerance": @(self.tolerance),
+            @"date": [[[NSISO8601DateFormatter alloc] init] stringFromDate:[NSDate date]],
+            @"results": comparison,
+            @"regressions": [self regressions],
+        };
+    }
+
+    NSData *data = [NSJSONSerialization dataWithJSONObject:output
+                                                   options:NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys
+                                                     error:error];
+    if (nil == data) {
+        return NO;
+    }
+    BOOL success = [data writeToURL:url
+                            options:NSDataWritingAtomic
+                              error:error];
+    if (NO != success) {
+        NSLog(@"Benchmark results written to %@", [url path]);
+    }
+    return success;
+}
+
+@end
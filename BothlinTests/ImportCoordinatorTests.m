@@ -8,6 +8,9 @@
 #import <XCTest/XCTest.h>
 
 #import "ImportCoordinator.h"
+#import "TestModelHelpers.h"
+#import "Asset+CoreDataClass.h"
+#import "AssetExtension.h"
 
 @interface ImportCoordinatorTests : XCTestCase
 
@@ -47,4 +50,396 @@
     XCTAssertEqual([filteredURLs count], [urls count] - 2);
 }
 
+- (void)testImportDirectoryTree {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    NSURL *nestedDirectory = [sourceDirectory URLByAppendingPathComponent:@"nested"];
+    NSError *error = nil;
+    BOOL success = [fm createDirectoryAtURL:nestedDirectory
+                withIntermediateDirectories:YES
+                                 attributes:nil
+                                      error:&error];
+    XCTAssertTrue(success);
+    XCTAssertNil(error);
+    success = [fm createDirectoryAtURL:storageDirectory
+           withIntermediateDirectories:YES
+                            attributes:nil
+                                 error:&error];
+    XCTAssertTrue(success);
+    XCTAssertNil(error);
+
+    // Enough files to need more than one writer batch, split across two levels
+    NSUInteger fileCount = 600;
+    for (NSUInteger index = 0; index < fileCount; index++) {
+        NSURL *directory = (index % 2) ? nestedDirectory : sourceDirectory;
+        NSURL *fileURL = [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"%lu.txt", index]];
+        NSData *data = [[NSString stringWithFormat:@"%lu", index] dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssertTrue([data writeToURL:fileURL atomically:NO]);
+    }
+    XCTAssertTrue([[NSData data] writeToURL:[sourceDirectory URLByAppendingPathComponent:@"desktop.ini"] atomically:NO]);
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block BOOL importSuccess = NO;
+    __block NSSet<NSManagedObjectID *> *importedAssets = nil;
+    __block NSError *importError = nil;
+    [importer importURLs:[NSSet setWithObject:sourceDirectory]
+                 toGroup:nil
+                callback:^(BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, NSError * _Nullable error) {
+        importSuccess = success;
+        importedAssets = assets;
+        importError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+
+    XCTAssertTrue(importSuccess);
+    XCTAssertNil(importError);
+    XCTAssertEqual([importedAssets count], fileCount);
+
+    NSFetchRequest *fetchRequest = [Asset fetchRequest];
+    NSArray<Asset *> *assets = [moc executeFetchRequest:fetchRequest
+                                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([assets count], fileCount);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)testImportSkipsDuplicateContent {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    NSError *error = nil;
+    for (NSURL *directory in @[sourceDirectory, storageDirectory]) {
+        BOOL success = [fm createDirectoryAtURL:directory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&error];
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+    }
+
+    // Two files with the same contents and one different
+    NSData *data = [@"same" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([data writeToURL:[sourceDirectory URLByAppendingPathComponent:@"a.txt"] atomically:NO]);
+    XCTAssertTrue([data writeToURL:[sourceDirectory URLByAppendingPathComponent:@"b.txt"] atomically:NO]);
+    XCTAssertTrue([[@"different" dataUsingEncoding:NSUTF8StringEncoding] writeToURL:[sourceDirectory URLByAppendingPathComponent:@"c.txt"] atomically:NO]);
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+
+    // Import the folder twice, the second time everything should be a duplicate
+    for (NSNumber *expected in @[@2, @0]) {
+        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+        __block BOOL importSuccess = NO;
+        __block NSSet<NSManagedObjectID *> *importedAssets = nil;
+        [importer importURLs:[NSSet setWithObject:sourceDirectory]
+                     toGroup:nil
+                    callback:^(BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, __unused NSError * _Nullable error) {
+            importSuccess = success;
+            importedAssets = assets;
+            dispatch_semaphore_signal(sem);
+        }];
+        dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+        XCTAssertTrue(importSuccess);
+        XCTAssertEqual([importedAssets count], [expected unsignedIntegerValue]);
+    }
+
+    NSArray<Asset *> *assets = [moc executeFetchRequest:[Asset fetchRequest]
+                                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([assets count], 2);
+    NSSet<NSString *> *hashes = [NSSet setWithArray:[assets valueForKey:@"contentHash"]];
+    XCTAssertEqual([hashes count], 2);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)testReimportOfTrashedFileIsNotDuplicate {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    NSError *error = nil;
+    for (NSURL *directory in @[sourceDirectory, storageDirectory]) {
+        BOOL success = [fm createDirectoryAtURL:directory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&error];
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+    }
+    NSData *data = [@"trash me" dataUsingEncoding:NSUTF8StringEncoding];
+    NSURL *firstURL = [sourceDirectory URLByAppendingPathComponent:@"a.txt"];
+    NSURL *secondURL = [sourceDirectory URLByAppendingPathComponent:@"b.txt"];
+    XCTAssertTrue([data writeToURL:firstURL atomically:NO]);
+    XCTAssertTrue([data writeToURL:secondURL atomically:NO]);
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+    importer.transferMode = ImportCoordinatorTransferModeMove;
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSSet<NSManagedObjectID *> *importedAssets = nil;
+    [importer importURLs:[NSSet setWithObject:firstURL]
+                 toGroup:nil
+                callback:^(__unused BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, __unused NSError * _Nullable error) {
+        importedAssets = assets;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual([importedAssets count], 1);
+
+    Asset *trashed = [moc existingObjectWithID:[importedAssets anyObject]
+                                         error:&error];
+    XCTAssertNil(error);
+    trashed.deletedAt = [NSDate now];
+    XCTAssertTrue([moc save:&error]);
+
+    // The same content again, which must become a new asset rather than a link to the trashed one,
+    // as in move mode the file in storage is the only copy left
+    [importer importURLs:[NSSet setWithObject:secondURL]
+                 toGroup:nil
+                callback:^(__unused BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, __unused NSError * _Nullable error) {
+        importedAssets = assets;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual([importedAssets count], 1);
+    XCTAssertFalse([importedAssets containsObject:trashed.objectID]);
+
+    Asset *reimported = [moc existingObjectWithID:[importedAssets anyObject]
+                                            error:&error];
+    XCTAssertNil(error);
+    XCTAssertNil(reimported.deletedAt);
+    XCTAssertTrue([fm fileExistsAtPath:reimported.path.path]);
+    XCTAssertFalse([fm fileExistsAtPath:secondURL.path]);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)testImportedAssetsAwaitTextScan {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    NSError *error = nil;
+    for (NSURL *directory in @[sourceDirectory, storageDirectory]) {
+        BOOL success = [fm createDirectoryAtURL:directory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&error];
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+    }
+    NSURL *sourceURL = [sourceDirectory URLByAppendingPathComponent:@"a.txt"];
+    XCTAssertTrue([[@"scan me" dataUsingEncoding:NSUTF8StringEncoding] writeToURL:sourceURL atomically:NO]);
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block NSSet<NSManagedObjectID *> *importedAssets = nil;
+    [importer importURLs:[NSSet setWithObject:sourceURL]
+                 toGroup:nil
+                callback:^(__unused BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, __unused NSError * _Nullable error) {
+        importedAssets = assets;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual([importedAssets count], 1);
+
+    // This is what carryOutCleanUp picks up on launch, so a new asset must be in it
+    NSFetchRequest *pending = [Asset fetchRequest];
+    [pending setPredicate:[Asset awaitingTextScanPredicate]];
+    NSArray<Asset *> *assets = [moc executeFetchRequest:pending
+                                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([assets count], 1);
+    XCTAssertEqualObjects([assets firstObject].objectID, [importedAssets anyObject]);
+    XCTAssertNil([assets firstObject].scannedText);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)testImportMoveModeReportsStrategy {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    NSError *error = nil;
+    for (NSURL *directory in @[sourceDirectory, storageDirectory]) {
+        BOOL success = [fm createDirectoryAtURL:directory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&error];
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+    }
+    NSURL *sourceURL = [sourceDirectory URLByAppendingPathComponent:@"a.txt"];
+    XCTAssertTrue([[@"move me" dataUsingEncoding:NSUTF8StringEncoding] writeToURL:sourceURL atomically:NO]);
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+    importer.transferMode = ImportCoordinatorTransferModeMove;
+    NSMutableArray<NSNumber *> *strategies = [NSMutableArray array];
+    importer.transferReportHandler = ^(__unused NSURL * _Nonnull source, __unused NSURL * _Nonnull destination, FileTransferStrategy strategy) {
+        @synchronized (strategies) {
+            [strategies addObject:@(strategy)];
+        }
+    };
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block BOOL importSuccess = NO;
+    [importer importURLs:[NSSet setWithObject:sourceURL]
+                 toGroup:nil
+                callback:^(BOOL success, __unused NSSet<NSManagedObjectID *> * _Nonnull assets, __unused NSError * _Nullable error) {
+        importSuccess = success;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+
+    XCTAssertTrue(importSuccess);
+    XCTAssertEqualObjects(strategies, @[@(FileTransferStrategyMove)]);
+    XCTAssertFalse([fm fileExistsAtPath:sourceURL.path]);
+
+    NSArray<Asset *> *assets = [moc executeFetchRequest:[Asset fetchRequest]
+                                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([assets count], 1);
+    XCTAssertTrue([fm fileExistsAtPath:[assets firstObject].path.path]);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)testFailedImportDoesNotResume {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    // A snap with no Info.plist, which will fail however many times we try
+    NSURL *snapURL = [root URLByAppendingPathComponent:@"broken.embersnap"];
+    NSError *error = nil;
+    for (NSURL *directory in @[snapURL, storageDirectory]) {
+        BOOL success = [fm createDirectoryAtURL:directory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&error];
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+    }
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block BOOL importSuccess = YES;
+    __block NSError *importError = nil;
+    [importer importURLs:[NSSet setWithObject:snapURL]
+                 toGroup:nil
+                callback:^(BOOL success, __unused NSSet<NSManagedObjectID *> * _Nonnull assets, NSError * _Nullable error) {
+        importSuccess = success;
+        importError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertFalse(importSuccess);
+    XCTAssertNotNil(importError);
+    XCTAssertNotEqual(importError.code, NSUserCancelledError);
+
+    // The failure was reported, so it shouldn't come back next launch
+    NSArray<ImportJob *> *jobs = [importer resumeInterruptedImports:nil];
+    XCTAssertEqual([jobs count], 0);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)testCancelledImportResumes {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    NSError *error = nil;
+    for (NSURL *directory in @[sourceDirectory, storageDirectory]) {
+        BOOL success = [fm createDirectoryAtURL:directory
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:&error];
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+    }
+    NSUInteger fileCount = 50;
+    for (NSUInteger index = 0; index < fileCount; index++) {
+        NSURL *fileURL = [sourceDirectory URLByAppendingPathComponent:[NSString stringWithFormat:@"%lu.txt", index]];
+        NSData *data = [[NSString stringWithFormat:@"%lu", index] dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssertTrue([data writeToURL:fileURL atomically:NO]);
+    }
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block BOOL importSuccess = YES;
+    __block NSError *importError = nil;
+    ImportJob *job = [importer importURLs:[NSSet setWithObject:sourceDirectory]
+                                  toGroup:nil
+                                 callback:^(BOOL success, __unused NSSet<NSManagedObjectID *> * _Nonnull assets, NSError * _Nullable error) {
+        importSuccess = success;
+        importError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    XCTAssertNotNil(job);
+    [job cancel];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertFalse(importSuccess);
+    XCTAssertEqual(importError.code, NSUserCancelledError);
+    XCTAssertTrue(job.isFinished);
+
+    NSArray<ImportJob *> *jobs = [importer resumeInterruptedImports:^(BOOL success, __unused NSSet<NSManagedObjectID *> * _Nonnull assets, __unused NSError * _Nullable error) {
+        importSuccess = success;
+        dispatch_semaphore_signal(sem);
+    }];
+    XCTAssertEqual([jobs count], 1);
+    XCTAssertEqualObjects([jobs firstObject].jobID, job.jobID);
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertTrue(importSuccess);
+
+    NSArray<Asset *> *assets = [moc executeFetchRequest:[Asset fetchRequest]
+                                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([assets count], fileCount);
+
+    // Having finished, there should be nothing left to resume
+    jobs = [importer resumeInterruptedImports:nil];
+    XCTAssertEqual([jobs count], 0);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
 @end
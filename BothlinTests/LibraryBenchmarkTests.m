@@ -0,0 +1,293 @@
+//
+//  LibraryBenchmarkTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "BenchmarkRecorder.h"
+#import "TestModelHelpers.h"
+#import "ImportCoordinator.h"
+#import "LibraryViewModel.h"
+#import "LibraryWriteCoordinator.h"
+#import "SearchIndex.h"
+#import "SidebarItem.h"
+#import "AssetList.h"
+#import "AssetListChanges.h"
+#import "GridViewController.h"
+#import "Asset+CoreDataClass.h"
+
+// Long enough for the biggest library on a slow machine; these are for timing, not for catching hangs.
+static const NSTimeInterval kBenchmarkTimeout = 1800.0;
+
+// How many of the assets are changed at once in the grid merge, which is kept under the point
+// where the view model gives up and queries again.
+static const NSUInteger kBenchmarkMergeCount = 500;
+
+// A typical window, so the grid lays out about as many items as it would for a user.
+static const NSRect kBenchmarkGridFrame = {{0.0, 0.0}, {1200.0, 800.0}};
+
+// Times the paths that get slow as the library grows, against a library of the given size in a
+// SQLite store. These only run for the sizes listed in BOTHLIN_BENCHMARKS, and fail if any step
+// is slower than its baseline in BenchmarkBaselines.json allows. See BenchmarkRecorder.
+@interface LibraryBenchmarkTests : XCTestCase
+
+@end
+
+@implementation LibraryBenchmarkTests
+
+- (void)test10kAssets {
+    XCTSkipUnless([[BenchmarkRecorder requestedScales] containsObject:@10000], @"Set BOTHLIN_BENCHMARKS to run benchmarks");
+    [self runBenchmarksWithAssetCount:10000];
+}
+
+- (void)test100kAssets {
+    XCTSkipUnless([[BenchmarkRecorder requestedScales] containsObject:@100000], @"Set BOTHLIN_BENCHMARKS to run benchmarks");
+    [self runBenchmarksWithAssetCount:100000];
+}
+
+- (void)test1MAssets {
+    XCTSkipUnless([[BenchmarkRecorder requestedScales] containsObject:@1000000], @"Set BOTHLIN_BENCHMARKS to run benchmarks");
+    [self runBenchmarksWithAssetCount:1000000];
+}
+
+- (void)selectSidebarItem:(SidebarItem *)item
+              ofViewModel:(LibraryViewModel *)viewModel {
+    XCTestExpectation *expectation = [self keyValueObservingExpectationForObject:viewModel
+                                                                         keyPath:NSStringFromSelector(@selector(assets))
+                                                                         handler:nil];
+    viewModel.selectedSidebarItem = item;
+    [self waitForExpectations:@[expectation]
+                      timeout:kBenchmarkTimeout];
+}
+
+// Includes laying the grid out again, as the snapshot isn't much use to the user until that's done.
+- (void)applyAssets:(AssetList *)assets
+            changes:(AssetListChanges *)changes
+             toGrid:(GridViewController *)grid {
+    [grid setAssets:assets
+            changes:changes
+       withSelected:[NSSet set]];
+    [grid.view layoutSubtreeIfNeeded];
+}
+
+- (void)runBenchmarksWithAssetCount:(NSUInteger)assetCount {
+    BenchmarkRecorder *recorder = [[BenchmarkRecorder alloc] initWithScale:assetCount];
+    NSManagedObjectContext *moc = [TestModelHelpers sqliteManagedObjectContextForTests];
+    NSPersistentStoreCoordinator *store = moc.persistentStoreCoordinator;
+
+    // Not something the app does, but worth knowing how long the rest took to set up
+    [recorder measure:@"generate"
+                block:^{
+        [moc performBlockAndWait:^{
+            [TestModelHelpers generateLibraryWithAssetCount:assetCount
+                                                  inContext:moc];
+        }];
+    }];
+
+    [self benchmarkImportIntoStore:store
+                        assetCount:assetCount
+                          recorder:recorder];
+
+    // Sidebar switches, each of which is a fresh query
+    LibraryViewModel *viewModel = [[LibraryViewModel alloc] initWithViewContext:moc
+                                                               trashDisplayName:@"Trash"];
+    XCTAssertTrue([viewModel reloadGroups:nil]);
+    NSArray<SidebarItem *> *sidebar = [viewModel.sidebarItems children];
+    SidebarItem *everything = sidebar[0];
+    SidebarItem *favourites = sidebar[1];
+    SidebarItem *group = [sidebar[2].children firstObject];
+    XCTAssertNotNil(group);
+    [recorder measure:@"reload_favourites"
+                block:^{
+        [self selectSidebarItem:favourites
+                    ofViewModel:viewModel];
+    }];
+    [recorder measure:@"reload_group"
+                block:^{
+        [self selectSidebarItem:group
+                    ofViewModel:viewModel];
+    }];
+    [recorder measure:@"reload_everything"
+                block:^{
+        [self selectSidebarItem:everything
+                    ofViewModel:viewModel];
+    }];
+    NSArray<NSManagedObjectID *> *assetIDs = viewModel.assets.assetIDs;
+    XCTAssertGreaterThanOrEqual([assetIDs count], assetCount);
+
+    // The grid showing the whole library, as after a sidebar switch
+    GridViewController *grid = [[GridViewController alloc] initWithNibName:@"GridViewController"
+                                                                    bundle:[NSBundle bundleForClass:[GridViewController class]]];
+    NSWindow *window = [[NSWindow alloc] initWithContentRect:kBenchmarkGridFrame
+                                                   styleMask:NSWindowStyleMaskBorderless
+                                                     backing:NSBackingStoreBuffered
+                                                       defer:NO];
+    window.contentView = grid.view;
+    [recorder measure:@"grid_apply_reload"
+                block:^{
+        [self applyAssets:viewModel.assets
+                  changes:[AssetListChanges reload]
+                   toGrid:grid];
+    }];
+    XCTAssertEqual([grid count], [assetIDs count]);
+
+    [self benchmarkSearchInStore:store
+                        recorder:recorder];
+
+    // A batch of changes that move assets around the grid, merged without a query
+    NSArray<NSManagedObjectID *> *mergeIDs = [assetIDs subarrayWithRange:NSMakeRange(0, MIN(kBenchmarkMergeCount, [assetIDs count]))];
+    [moc performBlockAndWait:^{
+        for (NSManagedObjectID *assetID in mergeIDs) {
+            Asset *asset = [moc existingObjectWithID:assetID
+                                               error:nil];
+            asset.created = [NSDate dateWithTimeIntervalSinceNow:(NSTimeInterval)arc4random_uniform(1000000)];
+        }
+        XCTAssertTrue([moc save:nil]);
+    }];
+    LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:store
+                                                                          delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+    [recorder measure:@"grid_merge"
+                block:^{
+        [viewModel modelCoordinator:library
+                          didUpdate:@{NSUpdatedObjectsKey:mergeIDs}];
+    }];
+    XCTAssertFalse(viewModel.assetChanges.reload, @"Expected the merge to not need a query");
+    [recorder measure:@"grid_apply_merge"
+                block:^{
+        [self applyAssets:viewModel.assets
+                  changes:viewModel.assetChanges
+                   toGrid:grid];
+    }];
+    XCTAssertEqual([grid count], [viewModel.assets count]);
+
+    [self benchmarkBulkChangesToAssets:assetIDs
+                               library:library
+                              recorder:recorder];
+
+    NSError *error = nil;
+    BOOL success = [recorder writeResults:&error];
+    XCTAssertTrue(success, @"Failed to write benchmark results: %@", error);
+    NSArray<NSString *> *regressions = [recorder regressions];
+    XCTAssertEqual([regressions count], 0, @"Benchmarks regressed: %@", [regressions componentsJoinedByString:@", "]);
+}
+
+- (void)benchmarkImportIntoStore:(NSPersistentStoreCoordinator *)store
+                      assetCount:(NSUInteger)assetCount
+                        recorder:(BenchmarkRecorder *)recorder {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *root = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *sourceDirectory = [root URLByAppendingPathComponent:@"source"];
+    NSURL *storageDirectory = [root URLByAppendingPathComponent:@"storage"];
+    XCTAssertTrue([fm createDirectoryAtURL:sourceDirectory
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:nil]);
+    XCTAssertTrue([fm createDirectoryAtURL:storageDirectory
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:nil]);
+
+    // A typical drop of files, into a library that's already big, which is what makes the
+    // duplicate checks and tag lookups expensive
+    NSUInteger fileCount = MIN(MAX(assetCount / 100, (NSUInteger)100), (NSUInteger)2000);
+    for (NSUInteger index = 0; index < fileCount; index++) {
+        NSURL *fileURL = [sourceDirectory URLByAppendingPathComponent:[NSString stringWithFormat:@"%lu.txt", index]];
+        NSData *data = [[NSString stringWithFormat:@"benchmark %lu", index] dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssertTrue([data writeToURL:fileURL atomically:NO]);
+    }
+
+    ImportCoordinator *importer = [[ImportCoordinator alloc] initWithPersistentStore:store
+                                                                    storageDirectory:storageDirectory
+                                                               delegateCallbackQueue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0)];
+    __block NSSet<NSManagedObjectID *> *imported = nil;
+    [recorder measure:@"import"
+                block:^{
+        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+        [importer importURLs:[NSSet setWithObject:sourceDirectory]
+                     toGroup:nil
+                    callback:^(BOOL success, NSSet<NSManagedObjectID *> * _Nonnull assets, NSError * _Nullable error) {
+            XCTAssertTrue(success);
+            XCTAssertNil(error);
+            imported = assets;
+            dispatch_semaphore_signal(sem);
+        }];
+        dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    }];
+    XCTAssertEqual([imported count], fileCount);
+
+    [fm removeItemAtURL:root
+                  error:nil];
+}
+
+- (void)benchmarkSearchInStore:(NSPersistentStoreCoordinator *)store
+                      recorder:(BenchmarkRecorder *)recorder {
+    SearchIndex *searchIndex = [[SearchIndex alloc] initWithPersistentStore:store];
+    [recorder measure:@"search_index_build"
+                block:^{
+        [searchIndex rebuild];
+        while (NO == searchIndex.ready) {
+            [NSThread sleepForTimeInterval:0.01];
+        }
+    }];
+
+    // A mix of common words, prefixes as if typing, and several words at once
+    NSArray<NSString *> *queries = @[@"error", @"er", @"build failed", @"mine", @"qgis layer export", @"screenshot 1", @"nothingmatches"];
+    [recorder measure:@"search_query"
+                block:^{
+        for (NSString *query in queries) {
+            [searchIndex assetIDsMatchingQuery:query];
+        }
+    }];
+}
+
+- (void)benchmarkBulkChangesToAssets:(NSArray<NSManagedObjectID *> *)assetIDs
+                             library:(LibraryWriteCoordinator *)library
+                            recorder:(BenchmarkRecorder *)recorder {
+    NSSet<NSManagedObjectID *> *allIDs = [NSSet setWithArray:assetIDs];
+    [recorder measure:@"bulk_favourite"
+                block:^{
+        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+        [library setFavouriteStateOnAssets:allIDs
+                                  newState:YES
+                                  callback:^(BOOL success, NSError * _Nullable error, __unused BOOL newState) {
+            XCTAssertTrue(success);
+            XCTAssertNil(error);
+            dispatch_semaphore_signal(sem);
+        }];
+        dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    }];
+
+    // A tenth of the library, spread through it rather than all at one end
+    NSMutableSet<NSManagedObjectID *> *deleteIDs = [NSMutableSet setWithCapacity:[assetIDs count] / 10];
+    for (NSUInteger index = 0; index < [assetIDs count]; index += 10) {
+        [deleteIDs addObject:assetIDs[index]];
+    }
+    [recorder measure:@"bulk_delete"
+                block:^{
+        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+        [library toggleSoftDeleteAssets:deleteIDs
+                               callback:^(BOOL success, NSError * _Nullable error) {
+            XCTAssertTrue(success);
+            XCTAssertNil(error);
+            dispatch_semaphore_signal(sem);
+        }];
+        dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    }];
+
+    // The generated assets have no files, so this is mostly the store side of the purge
+    [recorder measure:@"trash_purge"
+                block:^{
+        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+        [library moveDeletedAssetsToTrash:^(BOOL success, NSError * _Nullable error) {
+            XCTAssertTrue(success);
+            XCTAssertNil(error);
+            dispatch_semaphore_signal(sem);
+        }];
+        dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    }];
+}
+
+@end
@@ -12,6 +12,7 @@
 #import "NSArray+Functional.h"
 #import "Asset+CoreDataClass.h"
 #import "Group+CoreDataClass.h"
+#import "Tag+CoreDataClass.h"
 #import "SidebarItem.h"
 #import "TestModelHelpers.h"
 
@@ -21,6 +22,16 @@
 
 @implementation LibraryViewModelTests
 
+// Assets are queried in the background and published on the main queue, so we need to let the
+// run loop go until that happens.
+- (void)waitForAssetsOfViewModel:(LibraryViewModel *)viewModel {
+    XCTestExpectation *expectation = [self keyValueObservingExpectationForObject:viewModel
+                                                                         keyPath:NSStringFromSelector(@selector(assets))
+                                                                         handler:nil];
+    [self waitForExpectations:@[expectation]
+                      timeout:5.0];
+}
+
 - (void)testNoDataAfterInit {
     NSManagedObjectContext *moc = [TestModelHelpers  managedObjectContextForTests];
     LibraryViewModel *viewModel = [[LibraryViewModel alloc] initWithViewContext:moc
@@ -82,6 +93,7 @@
     __block NSArray<NSManagedObjectID *> *assetIDs = nil;
     [moc performBlockAndWait:^{
         NSArray *assets = [TestModelHelpers generateAssets:count inContext:moc];
+        XCTAssertTrue([moc save:nil]);
         assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
     }];
     NSAssert(nil != assetIDs, @"Failed to generate asset ID list");
@@ -90,6 +102,8 @@
     [viewModel modelCoordinator:writeCoordinator
                       didUpdate:@{NSInsertedObjectsKey:assetIDs}];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 5, @"Expected empty asset list");
 
@@ -115,6 +129,7 @@
         // Mark first item as deleted
         [[assets firstObject] setDeletedAt:[NSDate now]];
 
+        XCTAssertTrue([moc save:nil]);
         assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
     }];
     NSAssert(nil != assetIDs, @"Failed to generate asset ID list");
@@ -123,6 +138,8 @@
     [viewModel modelCoordinator:writeCoordinator
                       didUpdate:@{NSInsertedObjectsKey:assetIDs}];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 4, @"Expected empty asset list");
 
@@ -138,6 +155,8 @@
     NSAssert([[trashSidebarItem title] compare:viewModel.trashDisplayName] == NSOrderedSame, @"Expected last sidebar item to be trash");
     [viewModel setSelectedSidebarItem:trashSidebarItem];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 1, @"Expected empty asset list");
 
@@ -159,6 +178,7 @@
     __block NSArray<NSManagedObjectID *> *assetIDs = nil;
     [moc performBlockAndWait:^{
         NSArray *assets = [TestModelHelpers generateAssets:count inContext:moc];
+        XCTAssertTrue([moc save:nil]);
         assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
     }];
     NSAssert(nil != assetIDs, @"Failed to generate asset ID list");
@@ -169,6 +189,8 @@
 
     [viewModel setSearchText:@"test 3"];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 1, @"Expected empty asset list");
 
@@ -190,6 +212,7 @@
     __block NSArray<NSManagedObjectID *> *assetIDs = nil;
     [moc performBlockAndWait:^{
         NSArray *assets = [TestModelHelpers generateAssets:count inContext:moc];
+        XCTAssertTrue([moc save:nil]);
         assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
     }];
     NSAssert(nil != assetIDs, @"Failed to generate asset ID list");
@@ -200,6 +223,8 @@
 
     [viewModel setSearchText:@"foo"];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 0, @"Expected empty asset list");
 
@@ -210,6 +235,36 @@
     XCTAssertEqual([viewModel.selectedAssets count], 0, @"Expected empty selected asset list");
 }
 
+- (void)testOnlyLatestSearchIsPublished {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    LibraryViewModel *viewModel = [[LibraryViewModel alloc] initWithViewContext:moc
+                                                               trashDisplayName:@"Trash"];
+
+    __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+    [moc performBlockAndWait:^{
+        NSArray *assets = [TestModelHelpers generateAssets:5 inContext:moc];
+        XCTAssertTrue([moc save:nil]);
+        assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+    }];
+    NSAssert(nil != assetIDs, @"Failed to generate asset ID list");
+
+    LibraryWriteCoordinator *writeCoordinator = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator];
+    [viewModel modelCoordinator:writeCoordinator
+                      didUpdate:@{NSInsertedObjectsKey:assetIDs}];
+    [self waitForAssetsOfViewModel:viewModel];
+    XCTAssertEqual([viewModel.assets count], 5, @"Expected full asset list");
+
+    // Typing quickly should only result in the final query being shown
+    [viewModel setSearchText:@"t"];
+    [viewModel setSearchText:@"te"];
+    [viewModel setSearchText:@"test"];
+    [viewModel setSearchText:@"test 2"];
+    [self waitForAssetsOfViewModel:viewModel];
+
+    XCTAssertEqual([viewModel.assets count], 1, @"Expected just the last search's results");
+    XCTAssertEqualObjects([[viewModel.assets firstObject] name], @"test 2.png");
+}
+
 - (void)testSimpleGroupTest {
     NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
     LibraryViewModel *viewModel = [[LibraryViewModel alloc] initWithViewContext:moc
@@ -262,6 +317,7 @@
         // Add first asset to first group
         [[groups firstObject] addContains:[NSSet setWithObject:[assets firstObject]]];
 
+        XCTAssertTrue([moc save:nil]);
         groupIDs = [groups mapUsingBlock:^id _Nonnull(Group * _Nonnull group) { return group.objectID; }];
         assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
     }];
@@ -273,6 +329,8 @@
     [viewModel modelCoordinator:writeCoordinator
                       didUpdate:@{NSInsertedObjectsKey:allInsertedIDs}];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.groups, @"Should not be nil");
     XCTAssertEqual([viewModel.groups count], groupCount, @"Expected group list");
 
@@ -292,11 +350,15 @@
 
     [viewModel setSelectedSidebarItem:[[groupSidebarItem children] firstObject]];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 1, @"Expected asset list");
 
     [viewModel setSelectedSidebarItem:[[groupSidebarItem children] lastObject]];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], 0, @"Expected no asset list");
 }
@@ -322,6 +384,7 @@
             [group addContains:[NSSet setWithObject:[assets objectAtIndex:index]]];
         }
 
+        XCTAssertTrue([moc save:nil]);
         groupIDs = [groups mapUsingBlock:^id _Nonnull(Group * _Nonnull group) { return group.objectID; }];
         assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
     }];
@@ -333,6 +396,8 @@
     [viewModel modelCoordinator:writeCoordinator
                       didUpdate:@{NSInsertedObjectsKey:allInsertedIDs}];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.groups, @"Should not be nil");
     XCTAssertEqual([viewModel.groups count], groupCount, @"Expected group list");
 
@@ -359,6 +424,8 @@
     XCTAssertEqual([firstGroupSidebarItem.title compare:@"group 0"], NSOrderedSame, @"Expected group 0, got %@", firstGroupSidebarItem.title);
     [viewModel setSelectedSidebarItem:firstGroupSidebarItem];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], assetCount / 2, @"Expected asset list");
     XCTAssertEqual([viewModel.selectedAssets count], 1, @"Expected just one asset selected");
@@ -371,6 +438,8 @@
     XCTAssertEqual([secondGroupSidebarItem.title compare:@"group 1"], NSOrderedSame, @"Expected group 1, got %@", secondGroupSidebarItem.title);
     [viewModel setSelectedSidebarItem:secondGroupSidebarItem];
 
+    [self waitForAssetsOfViewModel:viewModel];
+
     XCTAssertNotNil(viewModel.assets, @"Should not be nil");
     XCTAssertEqual([viewModel.assets count], assetCount / 2, @"Expected no asset list");
     XCTAssertEqual([viewModel.selectedAssets count], 1, @"Expected just one asset selected");
@@ -378,5 +447,101 @@
     XCTAssertEqual(selectedObjectID, secondGroupSelectedObjectID, @"Expected selection to be changed");
 }
 
+- (void)testChangesAreMergedIncrementally {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    LibraryViewModel *viewModel = [[LibraryViewModel alloc] initWithViewContext:moc
+                                                               trashDisplayName:@"Trash"];
+
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:4 inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+    NSArray<NSManagedObjectID *> *assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+
+    // The first update has to go to the store, as there's nothing loaded to merge into
+    LibraryWriteCoordinator *writeCoordinator = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator];
+    [viewModel modelCoordinator:writeCoordinator
+                      didUpdate:@{NSInsertedObjectsKey:assetIDs}];
+    [self waitForAssetsOfViewModel:viewModel];
+    XCTAssertEqualObjects(viewModel.assets, assets);
+    XCTAssertTrue(viewModel.assetChanges.reload);
+
+    [viewModel setSelectedAssetIndexPaths:[NSSet setWithObject:[NSIndexPath indexPathForItem:1 inSection:0]]];
+
+    // One new asset that sorts first, one that's moved to the trash, and one that now sorts last.
+    // These are applied straight away without a query.
+    Asset *added = [[TestModelHelpers generateAssets:1 inContext:moc] firstObject];
+    added.created = [NSDate distantPast];
+    assets[2].deletedAt = [NSDate now];
+    assets[0].created = [NSDate distantFuture];
+    XCTAssertTrue([moc save:nil]);
+    [viewModel modelCoordinator:writeCoordinator
+                      didUpdate:@{NSInsertedObjectsKey:@[added.objectID],
+                                  NSUpdatedObjectsKey:@[assets[2].objectID, assets[0].objectID]}];
+
+    XCTAssertEqualObjects(viewModel.assets, (@[added, assets[1], assets[3], assets[0]]));
+    AssetListChanges *changes = viewModel.assetChanges;
+    XCTAssertFalse(changes.reload);
+    XCTAssertEqualObjects(changes.deletedIndexes, [NSIndexSet indexSetWithIndex:2]);
+    XCTAssertEqualObjects(changes.insertedIndexes, [NSIndexSet indexSetWithIndex:0]);
+    XCTAssertEqualObjects(changes.movedIndexes, (@{@0: @3}));
+    XCTAssertEqual([changes.updatedIndexes count], 0);
+    XCTAssertEqualObjects(viewModel.selectedAssets, [NSSet setWithObject:assets[1]], @"Expected selection to follow the asset");
+
+    // Changes that don't affect the order are just updates
+    assets[1].notes = @"Some notes";
+    XCTAssertTrue([moc save:nil]);
+    [viewModel modelCoordinator:writeCoordinator
+                      didUpdate:@{NSUpdatedObjectsKey:@[assets[1].objectID]}];
+    XCTAssertEqualObjects(viewModel.assets, (@[added, assets[1], assets[3], assets[0]]));
+    XCTAssertEqualObjects(viewModel.assetChanges.updatedIndexes, [NSIndexSet indexSetWithIndex:1]);
+    XCTAssertTrue([viewModel.assetChanges.deletedIndexes count] == 0);
+
+    NSManagedObjectID *removedID = assets[3].objectID;
+    [moc deleteObject:assets[3]];
+    XCTAssertTrue([moc save:nil]);
+    [viewModel modelCoordinator:writeCoordinator
+                      didUpdate:@{NSDeletedObjectsKey:@[removedID]}];
+    XCTAssertEqualObjects(viewModel.assets, (@[added, assets[1], assets[0]]));
+    XCTAssertEqualObjects(viewModel.assetChanges.deletedIndexes, [NSIndexSet indexSetWithIndex:2]);
+}
+
+- (void)testPopularTagsInSidebar {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    LibraryViewModel *viewModel = [[LibraryViewModel alloc] initWithViewContext:moc
+                                                               trashDisplayName:@"Trash"];
+
+    NSUInteger count = 15;
+    __block NSArray<NSManagedObjectID *> *tagIDs = nil;
+    [moc performBlockAndWait:^{
+        NSMutableSet<NSString *> *names = [NSMutableSet set];
+        for (NSUInteger index = 0; index < count; index++) {
+            [names addObject:[NSString stringWithFormat:@"tag %02lu", index]];
+        }
+        NSArray<Tag *> *tags = [TestModelHelpers generateTags:names
+                                                    inContext:moc];
+        for (Tag *tag in tags) {
+            tag.assetCount = @([[tag.name substringFromIndex:4] integerValue]);
+        }
+        tagIDs = [tags mapUsingBlock:^id _Nonnull(Tag * _Nonnull tag) { return tag.objectID; }];
+    }];
+
+    LibraryWriteCoordinator *writeCoordinator = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator];
+    [viewModel modelCoordinator:writeCoordinator
+                      didUpdate:@{NSInsertedObjectsKey:tagIDs}];
+
+    SidebarItem *tagsSidebarItem = nil;
+    for (SidebarItem *item in [viewModel.sidebarItems children]) {
+        if ([[item title] compare:@"Popular Tags"] == NSOrderedSame) {
+            tagsSidebarItem = item;
+            break;
+        }
+    }
+    NSAssert(nil != tagsSidebarItem, @"Failed to find sidebar item");
+    NSArray<NSString *> *titles = [[tagsSidebarItem children] mapUsingBlock:^id _Nonnull(SidebarItem * _Nonnull item) { return item.title; }];
+    XCTAssertEqualObjects(titles, (@[@"tag 14", @"tag 13", @"tag 12", @"tag 11", @"tag 10", @"tag 09", @"tag 08", @"tag 07", @"tag 06", @"tag 05"]));
+    for (SidebarItem *item in [tagsSidebarItem children]) {
+        XCTAssertNotNil(item.fetchRequest, @"Expected tags to be selectable");
+        XCTAssertNil(item.relatedOject, @"Expected tags to not be import targets");
+    }
+}
 
 @end
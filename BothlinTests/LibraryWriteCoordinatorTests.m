@@ -15,11 +15,13 @@
 #import "Group+CoreDataClass.h"
 #import "Tag+CoreDataClass.h"
 #import "TestModelHelpers.h"
+#import "TrashPurgeJob.h"
 
 @interface DelegateRecorder : NSObject <ModelCoordinatorDelegate>
 
 @property (nonatomic, strong, readwrite, nullable) NSDictionary *changeNotificationData;
 @property (nonatomic, strong, readwrite, nullable) dispatch_semaphore_t updateSemaphore;
+@property (atomic, readwrite) NSUInteger updateCount;
 
 @end
 
@@ -27,7 +29,10 @@
 
 - (void)modelCoordinator:(__unused id)modelCoordinator
                didUpdate:(NSDictionary *)changeNotificationData {
-    self.changeNotificationData = changeNotificationData;
+    @synchronized (self) {
+        self.changeNotificationData = changeNotificationData;
+        self.updateCount += 1;
+    }
     if (nil != self.updateSemaphore) {
         dispatch_semaphore_signal(self.updateSemaphore);
     }
@@ -148,6 +153,240 @@
     }
 }
 
+- (void)testBulkChangesWithSQLiteStore {
+    NSManagedObjectContext *moc = [TestModelHelpers sqliteManagedObjectContextForTests];
+    LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                          delegateCallbackQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)];
+    DelegateRecorder *delegate = [[DelegateRecorder alloc] init];
+    delegate.updateSemaphore = dispatch_semaphore_create(0);
+    library.delegate = delegate;
+
+    // Enough to need more than one chunk when changing groups
+    NSUInteger count = 1200;
+    __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+    __block NSManagedObjectID *groupID = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:count
+                                                          inContext:moc];
+        [assets enumerateObjectsUsingBlock:^(Asset * _Nonnull asset, NSUInteger idx, __unused BOOL * _Nonnull stop) {
+            asset.deletedAt = (0 == idx % 2) ? [NSDate now] : nil;
+        }];
+        Group *group = [[TestModelHelpers generateGroups:1
+                                               inContext:moc] firstObject];
+        XCTAssertTrue([moc save:nil]);
+        assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+        groupID = group.objectID;
+    }];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block BOOL innerSuccess = NO;
+    __block NSError *innerError = nil;
+    [library setFavouriteStateOnAssets:[NSSet setWithArray:assetIDs]
+                              newState:YES
+                              callback:^(BOOL success, NSError * _Nullable error, __unused BOOL newState) {
+        innerSuccess = success;
+        innerError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertTrue(innerSuccess);
+    XCTAssertNil(innerError, @"Expected no error: %@", innerError);
+    dispatch_semaphore_wait(delegate.updateSemaphore, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual([delegate.changeNotificationData[NSUpdatedObjectsKey] count], count);
+
+    [library toggleSoftDeleteAssets:[NSSet setWithArray:assetIDs]
+                           callback:^(BOOL success, NSError * _Nullable error) {
+        innerSuccess = success;
+        innerError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertTrue(innerSuccess);
+    XCTAssertNil(innerError, @"Expected no error: %@", innerError);
+    dispatch_semaphore_wait(delegate.updateSemaphore, DISPATCH_TIME_FOREVER);
+
+    [library addAssets:[NSSet setWithArray:assetIDs]
+               toGroup:groupID
+              callback:^(BOOL success, NSError * _Nullable error) {
+        innerSuccess = success;
+        innerError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertTrue(innerSuccess);
+    XCTAssertNil(innerError, @"Expected no error: %@", innerError);
+    dispatch_semaphore_wait(delegate.updateSemaphore, DISPATCH_TIME_FOREVER);
+
+    [moc performBlockAndWait:^{
+        // The batch updates didn't go through this context, so make sure we read from the store
+        [moc reset];
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+        [fetch setPredicate:[NSPredicate predicateWithFormat:@"favourite == YES"]];
+        XCTAssertEqual([moc countForFetchRequest:fetch error:nil], count);
+        [fetch setPredicate:[NSPredicate predicateWithFormat:@"deletedAt != nil"]];
+        XCTAssertEqual([moc countForFetchRequest:fetch error:nil], count / 2);
+
+        Asset *first = [moc existingObjectWithID:[assetIDs firstObject] error:nil];
+        XCTAssertNil(first.deletedAt, @"Expected trashed asset to be restored");
+        Asset *second = [moc existingObjectWithID:[assetIDs objectAtIndex:1] error:nil];
+        XCTAssertNotNil(second.deletedAt, @"Expected asset to be trashed");
+
+        Group *group = [moc existingObjectWithID:groupID error:nil];
+        XCTAssertEqual([group.contains count], count);
+    }];
+}
+
+- (void)testWritesAreCoalesced {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                          delegateCallbackQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)];
+    DelegateRecorder *delegate = [[DelegateRecorder alloc] init];
+    delegate.updateSemaphore = dispatch_semaphore_create(0);
+    library.delegate = delegate;
+
+    NSUInteger count = 20;
+    __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:count
+                                                          inContext:moc];
+        XCTAssertTrue([moc save:nil]);
+        assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+    }];
+
+    // None of these wait on the store, so they arrive together and are saved together
+    dispatch_group_t group = dispatch_group_create();
+    for (NSManagedObjectID *assetID in assetIDs) {
+        dispatch_group_enter(group);
+        [library setFavouriteStateOnAssets:[NSSet setWithObject:assetID]
+                                  newState:YES
+                                  callback:^(BOOL success, NSError * _Nullable error, __unused BOOL newState) {
+            XCTAssertTrue(success);
+            XCTAssertNil(error, @"Expected no error: %@", error);
+            dispatch_group_leave(group);
+        }];
+    }
+    dispatch_group_enter(group);
+    [library createGroup:@"Coalesced"
+                callback:^(BOOL success, NSError * _Nullable error) {
+        XCTAssertTrue(success);
+        XCTAssertNil(error, @"Expected no error: %@", error);
+        dispatch_group_leave(group);
+    }];
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    dispatch_semaphore_wait(delegate.updateSemaphore, DISPATCH_TIME_FOREVER);
+    XCTAssertLessThan(delegate.updateCount, count + 1, @"Expected updates to be merged");
+
+    [moc performBlockAndWait:^{
+        [moc reset];
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+        [fetch setPredicate:[NSPredicate predicateWithFormat:@"favourite == YES"]];
+        XCTAssertEqual([moc countForFetchRequest:fetch error:nil], count);
+        NSFetchRequest *groupFetch = [NSFetchRequest fetchRequestWithEntityName:@"Group"];
+        XCTAssertEqual([moc countForFetchRequest:groupFetch error:nil], 1);
+    }];
+}
+
+- (void)testCallbacksFollowDelegateUpdateInOrder {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                          delegateCallbackQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)];
+    DelegateRecorder *delegate = [[DelegateRecorder alloc] init];
+    library.delegate = delegate;
+
+    __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:2
+                                                          inContext:moc];
+        XCTAssertTrue([moc save:nil]);
+        assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+    }];
+
+    // A mix of atomic and non-atomic changes, which are saved separately but called back in order
+    NSMutableArray<NSString *> *order = [NSMutableArray array];
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    [library createGroup:@"First"
+                callback:^(BOOL success, __unused NSError * _Nullable error) {
+        XCTAssertTrue(success);
+        XCTAssertGreaterThan(delegate.updateCount, 0, @"Expected the delegate update first");
+        [order addObject:@"first"];
+    }];
+    [library setFavouriteStateOnAssets:[NSSet setWithArray:assetIDs]
+                              newState:YES
+                              callback:^(BOOL success, __unused NSError * _Nullable error, __unused BOOL newState) {
+        XCTAssertTrue(success);
+        [order addObject:@"favourite"];
+    }];
+    [library createGroup:@"Second"
+                callback:^(BOOL success, __unused NSError * _Nullable error) {
+        XCTAssertTrue(success);
+        [order addObject:@"second"];
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+
+    NSArray<NSString *> *expected = @[@"first", @"favourite", @"second"];
+    XCTAssertEqualObjects(order, expected);
+}
+
+- (void)testEmptyTrashWithSQLiteStore {
+    NSManagedObjectContext *moc = [TestModelHelpers sqliteManagedObjectContextForTests];
+    LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                          delegateCallbackQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)];
+    DelegateRecorder *delegate = [[DelegateRecorder alloc] init];
+    delegate.updateSemaphore = dispatch_semaphore_create(0);
+    library.delegate = delegate;
+
+    // The generated assets point at files that don't exist, so nothing real gets trashed
+    NSUInteger count = 10;
+    __block NSManagedObjectID *groupID = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:count
+                                                          inContext:moc];
+        [assets enumerateObjectsUsingBlock:^(Asset * _Nonnull asset, NSUInteger idx, __unused BOOL * _Nonnull stop) {
+            asset.deletedAt = (0 == idx % 2) ? [NSDate now] : nil;
+        }];
+        Group *group = [[TestModelHelpers generateGroups:1
+                                               inContext:moc] firstObject];
+        [group addContains:[NSSet setWithArray:assets]];
+        XCTAssertTrue([moc save:nil]);
+        groupID = group.objectID;
+    }];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block BOOL innerSuccess = NO;
+    __block NSError *innerError = nil;
+    TrashPurgeJob *job = [library moveDeletedAssetsToTrash:^(BOOL success, NSError * _Nullable error) {
+        innerSuccess = success;
+        innerError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    XCTAssertNotNil(job);
+    // The command waits to be coalesced with others, so nothing has been counted yet
+    XCTAssertFalse(job.isCounted);
+    XCTAssertFalse(job.isFinished);
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertTrue(innerSuccess);
+    XCTAssertNil(innerError, @"Expected no error: %@", innerError);
+    XCTAssertTrue(job.isFinished);
+    XCTAssertTrue(job.isCounted);
+    XCTAssertEqual(job.totalItems, count / 2);
+    XCTAssertEqual(job.completedItems, count / 2);
+
+    dispatch_semaphore_wait(delegate.updateSemaphore, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual([delegate.changeNotificationData[NSDeletedObjectsKey] count], count / 2);
+
+    [moc performBlockAndWait:^{
+        [moc reset];
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Asset"];
+        XCTAssertEqual([moc countForFetchRequest:fetch error:nil], count / 2);
+        [fetch setPredicate:[NSPredicate predicateWithFormat:@"deletedAt != nil"]];
+        XCTAssertEqual([moc countForFetchRequest:fetch error:nil], 0);
+
+        Group *group = [moc existingObjectWithID:groupID error:nil];
+        XCTAssertEqual([group.contains count], count / 2);
+    }];
+}
+
 - (void)testAddAssetToGroup {
     NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
     LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
@@ -481,4 +720,77 @@
     XCTAssertEqual([tagMemberIDs count], 0, @"Should only be one item in tag");
 }
 
+- (void)testTagCountsFollowChanges {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    LibraryWriteCoordinator *library = [[LibraryWriteCoordinator alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                          delegateCallbackQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)];
+
+    __block NSArray<NSManagedObjectID *> *assetIDs = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:3
+                                                          inContext:moc];
+        assets[2].deletedAt = [NSDate now];
+        XCTAssertTrue([moc save:nil]);
+        assetIDs = [assets mapUsingBlock:^id _Nonnull(Asset * _Nonnull asset) { return asset.objectID; }];
+    }];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    void (^signal)(BOOL, NSError *) = ^(BOOL success, NSError * _Nullable error) {
+        XCTAssertTrue(success);
+        XCTAssertNil(error);
+        dispatch_semaphore_signal(sem);
+    };
+    NSNumber *(^tagCount)(void) = ^NSNumber *(void) {
+        __block NSNumber *count = nil;
+        [moc performBlockAndWait:^{
+            [moc reset];
+            NSArray<Tag *> *tags = [moc executeFetchRequest:[Tag fetchRequest]
+                                                      error:nil];
+            XCTAssertEqual([tags count], 1);
+            count = [tags firstObject].assetCount;
+        }];
+        return count;
+    };
+
+    [library addAssets:[NSSet setWithArray:assetIDs]
+                toTags:[NSSet setWithObject:@"Hello"]
+              callback:signal];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqualObjects(tagCount(), @3);
+
+    // Already tagged, so no change
+    [library addAssets:[NSSet setWithObject:assetIDs[0]]
+                toTags:[NSSet setWithObject:@"hello"]
+              callback:signal];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqualObjects(tagCount(), @3);
+
+    __block NSManagedObjectID *tagID = nil;
+    [moc performBlockAndWait:^{
+        tagID = [[moc executeFetchRequest:[Tag fetchRequest] error:nil] firstObject].objectID;
+    }];
+    [library removeTags:[NSSet setWithObject:tagID]
+             fromAssets:[NSSet setWithObject:assetIDs[0]]
+               callback:signal];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqualObjects(tagCount(), @2);
+
+    [library moveDeletedAssetsToTrash:signal];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqualObjects(tagCount(), @1);
+
+    // Lose the count as if it were from before they were kept, and get it back again
+    [moc performBlockAndWait:^{
+        Tag *tag = [moc existingObjectWithID:tagID error:nil];
+        tag.assetCount = nil;
+        XCTAssertTrue([moc save:nil]);
+    }];
+    [library countUncountedTags];
+    // Commands run in order, so once this one's done the count is too
+    [library createGroup:@"Barrier"
+                callback:signal];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqualObjects(tagCount(), @1);
+}
+
 @end
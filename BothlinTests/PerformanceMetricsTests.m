@@ -0,0 +1,82 @@
+//
+//  PerformanceMetricsTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 16/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "PerformanceMetrics.h"
+
+@interface PerformanceMetricsTests : XCTestCase
+
+@end
+
+@implementation PerformanceMetricsTests
+
+- (void)setUp {
+    [PerformanceMetrics reset];
+}
+
+- (void)testQueueWaitAndRunTimes {
+    dispatch_queue_t queue = dispatch_queue_create("com.digitalflapjack.PerformanceMetricsTests.queue", DISPATCH_QUEUE_SERIAL);
+
+    // The second block has to wait for the first to finish
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    metrics_dispatch_async(queue, ^{
+        [NSThread sleepForTimeInterval:0.1];
+    });
+    metrics_dispatch_async(queue, ^{
+        dispatch_semaphore_signal(sem);
+    });
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    __block BOOL ran = NO;
+    metrics_dispatch_sync(queue, ^{
+        ran = YES;
+    });
+    XCTAssertTrue(ran);
+
+    NSDictionary<NSString *, NSNumber *> *entry = [PerformanceMetrics summary][@"queues"][@"com.digitalflapjack.PerformanceMetricsTests.queue"];
+    XCTAssertNotNil(entry);
+    XCTAssertEqual([entry[@"count"] unsignedIntegerValue], 3);
+    XCTAssertGreaterThanOrEqual([entry[@"runMax"] doubleValue], 0.1);
+    XCTAssertGreaterThanOrEqual([entry[@"waitMax"] doubleValue], 0.05);
+    XCTAssertGreaterThanOrEqual([entry[@"runTotal"] doubleValue], [entry[@"runMax"] doubleValue]);
+}
+
+- (void)testIntervals {
+    MetricsIntervalToken token = metrics_interval_begin(MetricsIntervalSave);
+    [NSThread sleepForTimeInterval:0.01];
+    metrics_interval_end(token);
+
+    NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *intervals = [PerformanceMetrics summary][@"intervals"];
+    // Work left over from other tests may also land here, so this can only check a minimum
+    XCTAssertGreaterThanOrEqual([intervals[@"Save"][@"count"] unsignedIntegerValue], 1);
+    XCTAssertGreaterThanOrEqual([intervals[@"Save"][@"total"] doubleValue], 0.01);
+
+    XCTAssertTrue([[PerformanceMetrics summaryReport] containsString:@"Save"]);
+}
+
+- (void)testExportSummary {
+    MetricsIntervalToken token = metrics_interval_begin(MetricsIntervalFetch);
+    metrics_interval_end(token);
+
+    NSURL *url = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSString stringWithFormat:@"%@.json", [[NSUUID UUID] UUIDString]]];
+    NSError *error = nil;
+    BOOL success = [PerformanceMetrics exportSummaryToURL:url
+                                                    error:&error];
+    XCTAssertTrue(success);
+    XCTAssertNil(error);
+
+    NSData *data = [NSData dataWithContentsOfURL:url];
+    XCTAssertNotNil(data);
+    NSDictionary *summary = [NSJSONSerialization JSONObjectWithData:data
+                                                            options:0
+                                                              error:nil];
+    XCTAssertGreaterThanOrEqual([summary[@"intervals"][@"Fetch"][@"count"] unsignedIntegerValue], 1);
+    [[NSFileManager defaultManager] removeItemAtURL:url
+                                              error:nil];
+}
+
+@end
@@ -0,0 +1,128 @@
+//
+//  SearchIndexTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 09/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "SearchIndex.h"
+#import "TestModelHelpers.h"
+#import "Asset+CoreDataClass.h"
+#import "Tag+CoreDataClass.h"
+
+@interface SearchIndexTests : XCTestCase
+
+@end
+
+@implementation SearchIndexTests
+
+- (void)testTokens {
+    XCTAssertEqualObjects([SearchIndex tokensForString:@"Café au-lait, 2023!"], (@[@"cafe", @"au", @"lait", @"2023"]));
+    XCTAssertEqualObjects([SearchIndex tokensForString:@"  "], @[]);
+}
+
+- (void)testPrefixMatchAndRanking {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:4
+                                                      inContext:moc];
+    assets[0].name = @"holiday.png";
+    assets[1].name = @"other.png";
+    assets[1].scannedText = @"holiday plans";
+    assets[2].name = @"receipt.png";
+    assets[2].notes = @"Holiday abroad";
+    assets[3].name = @"Café menu.jpg";
+    NSArray<Tag *> *tags = [TestModelHelpers generateTags:[NSSet setWithObject:@"Holiday"]
+                                                inContext:moc];
+    [assets[3] addTags:[NSSet setWithArray:tags]];
+    NSError *error = nil;
+    BOOL success = [moc save:&error];
+    XCTAssertNil(error);
+    XCTAssertTrue(success);
+
+    SearchIndex *index = [[SearchIndex alloc] initWithPersistentStore:moc.persistentStoreCoordinator];
+    [index rebuild];
+
+    // Searches wait behind the build
+    NSArray<NSManagedObjectID *> *result = [index assetIDsMatchingQuery:@"holiday"];
+    XCTAssertTrue(index.ready);
+    NSArray<NSManagedObjectID *> *expected = @[assets[0].objectID, assets[3].objectID, assets[2].objectID, assets[1].objectID];
+    XCTAssertEqualObjects(result, expected);
+
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"HOLI"], expected);
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"cafe"], @[assets[3].objectID]);
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"café men"], @[assets[3].objectID]);
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"holiday plans"], @[assets[1].objectID]);
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"holiday missing"], @[]);
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@""], @[]);
+}
+
+- (void)testIncrementalUpdates {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:2
+                                                      inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+
+    SearchIndex *index = [[SearchIndex alloc] initWithPersistentStore:moc.persistentStoreCoordinator];
+    [index rebuild];
+    XCTAssertEqual([[index assetIDsMatchingQuery:@"test"] count], 2);
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"invoice"], @[]);
+
+    assets[0].scannedText = @"invoice total";
+    Asset *added = [[TestModelHelpers generateAssets:1
+                                           inContext:moc] firstObject];
+    added.name = @"invoice.pdf";
+    XCTAssertTrue([moc save:nil]);
+    [index updateAssets:[NSSet setWithObjects:assets[0].objectID, added.objectID, nil]
+           removeAssets:[NSSet set]];
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"invoice"], (@[added.objectID, assets[0].objectID]));
+    // New terms go into the sorted terms in place, so prefixes find them too
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"inv"], (@[added.objectID, assets[0].objectID]));
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"tot"], @[assets[0].objectID]);
+
+    // Old words go when the text changes
+    assets[0].scannedText = @"";
+    XCTAssertTrue([moc save:nil]);
+    [index updateAssets:[NSSet setWithObject:assets[0].objectID]
+           removeAssets:[NSSet set]];
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"invoice"], @[added.objectID]);
+
+    NSManagedObjectID *removedID = added.objectID;
+    [moc deleteObject:added];
+    XCTAssertTrue([moc save:nil]);
+    [index updateAssets:[NSSet set]
+           removeAssets:[NSSet setWithObject:removedID]];
+    XCTAssertEqualObjects([index assetIDsMatchingQuery:@"invoice"], @[]);
+    XCTAssertEqual([[index assetIDsMatchingQuery:@"test"] count], 2);
+}
+
+- (void)testLargeUpdateIsAppliedInChunks {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    // More than the index updates in one go
+    NSUInteger count = 600;
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:count
+                                                      inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+
+    SearchIndex *index = [[SearchIndex alloc] initWithPersistentStore:moc.persistentStoreCoordinator];
+    [index rebuild];
+    XCTAssertEqual([[index assetIDsMatchingQuery:@"renamed"] count], 0);
+
+    NSMutableSet<NSManagedObjectID *> *assetIDs = [NSMutableSet setWithCapacity:count];
+    for (Asset *asset in assets) {
+        asset.name = [NSString stringWithFormat:@"renamed %@", asset.name];
+        [assetIDs addObject:asset.objectID];
+    }
+    XCTAssertTrue([moc save:nil]);
+    [index updateAssets:assetIDs
+           removeAssets:[NSSet set]];
+
+    // The first search only waits for the first chunk, the rest having been queued behind it
+    NSUInteger firstCount = [[index assetIDsMatchingQuery:@"renamed"] count];
+    XCTAssertGreaterThan(firstCount, 0);
+    XCTAssertLessThan(firstCount, count);
+    XCTAssertEqual([[index assetIDsMatchingQuery:@"renamed"] count], count);
+}
+
+@end
@@ -0,0 +1,108 @@
+//
+//  SecureURLCacheTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 16/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "SecureURLCache.h"
+#import "TestModelHelpers.h"
+#import "Asset+CoreDataClass.h"
+
+@interface SecureURLCacheTests : XCTestCase
+
+@property (nonatomic, strong, readwrite) NSURL *directory;
+
+@end
+
+@implementation SecureURLCacheTests
+
+- (void)setUp {
+    self.directory = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    [[NSFileManager defaultManager] createDirectoryAtURL:self.directory
+                             withIntermediateDirectories:YES
+                                              attributes:nil
+                                                   error:nil];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.directory
+                                              error:nil];
+}
+
+- (NSData *)bookmarkForFileNamed:(NSString *)name {
+    NSURL *url = [self.directory URLByAppendingPathComponent:name];
+    XCTAssertTrue([[NSData data] writeToURL:url
+                                 atomically:NO]);
+    NSData *bookmark = [url bookmarkDataWithOptions:NSURLBookmarkCreationWithSecurityScope
+                     includingResourceValuesForKeys:nil
+                                      relativeToURL:nil
+                                              error:nil];
+    XCTAssertNotNil(bookmark);
+    return bookmark;
+}
+
+- (void)testResolvedOnceUntilBookmarkChanges {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:1
+                                                      inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+    NSManagedObjectID *assetID = assets[0].objectID;
+
+    SecureURLCache *cache = [[SecureURLCache alloc] initWithCountLimit:10];
+    NSData *first = [self bookmarkForFileNamed:@"first.txt"];
+
+    NSError *error = nil;
+    NSURL *url = [cache URLForAssetID:assetID
+                             bookmark:first
+                    refreshedBookmark:nil
+                                error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects([url lastPathComponent], @"first.txt");
+
+    // Same instance, so it didn't go back to the bookmark
+    NSURL *again = [cache URLForAssetID:assetID
+                               bookmark:first
+                      refreshedBookmark:nil
+                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(again, url);
+
+    // The asset now has a different bookmark, so the old entry mustn't be used
+    NSData *second = [self bookmarkForFileNamed:@"second.txt"];
+    NSURL *changed = [cache URLForAssetID:assetID
+                                 bookmark:second
+                        refreshedBookmark:nil
+                                    error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects([changed lastPathComponent], @"second.txt");
+
+    [cache removeURLsForAssetIDs:[NSSet setWithObject:assetID]];
+    NSURL *removed = [cache URLForAssetID:assetID
+                                 bookmark:second
+                        refreshedBookmark:nil
+                                    error:&error];
+    XCTAssertNil(error);
+    XCTAssertNotEqual(removed, changed);
+    XCTAssertEqualObjects([removed lastPathComponent], @"second.txt");
+}
+
+- (void)testBadBookmark {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    NSArray<Asset *> *assets = [TestModelHelpers generateAssets:1
+                                                      inContext:moc];
+    XCTAssertTrue([moc save:nil]);
+
+    SecureURLCache *cache = [[SecureURLCache alloc] initWithCountLimit:10];
+    NSError *error = nil;
+    NSURL *url = [cache URLForAssetID:assets[0].objectID
+                             bookmark:[@"not a bookmark" dataUsingEncoding:NSUTF8StringEncoding]
+                    refreshedBookmark:nil
+                                error:&error];
+    XCTAssertNil(url);
+    XCTAssertNotNil(error);
+}
+
+@end
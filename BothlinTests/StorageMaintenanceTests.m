@@ -0,0 +1,136 @@
+//
+//  StorageMaintenanceTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 15/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "StorageMaintenance.h"
+#import "TestModelHelpers.h"
+#import "Asset+CoreDataClass.h"
+
+@interface StorageMaintenanceTests : XCTestCase
+
+@property (nonatomic, strong, readwrite) NSURL *storageDirectory;
+
+@end
+
+@implementation StorageMaintenanceTests
+
+- (void)setUp {
+    NSString *name = [[NSUUID UUID] UUIDString];
+    self.storageDirectory = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    [[NSFileManager defaultManager] createDirectoryAtURL:self.storageDirectory
+                             withIntermediateDirectories:YES
+                                              attributes:nil
+                                                   error:nil];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.storageDirectory
+                                              error:nil];
+}
+
+// Writes a file, and backdates it and its parent so the scan doesn't think it's part of
+// something still in progress.
+- (NSURL *)makeOldFile:(NSString *)relativePath {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSURL *url = [self.storageDirectory URLByAppendingPathComponent:relativePath];
+    XCTAssertTrue([fm createDirectoryAtURL:[url URLByDeletingLastPathComponent]
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:nil]);
+    XCTAssertTrue([[NSMutableData dataWithLength:4096] writeToURL:url
+                                                       atomically:NO]);
+    [self backdate:url];
+    return url;
+}
+
+- (void)backdate:(NSURL *)url {
+    NSDictionary *attributes = @{NSFileModificationDate: [NSDate dateWithTimeIntervalSinceNow:-7 * 24 * 60 * 60]};
+    XCTAssertTrue([[NSFileManager defaultManager] setAttributes:attributes
+                                                   ofItemAtPath:[url path]
+                                                          error:nil]);
+}
+
+- (void)testScanAndReclaim {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *keptName = [[NSUUID UUID] UUIDString];
+    NSString *missingName = [[NSUUID UUID] UUIDString];
+    NSString *orphanName = [[NSUUID UUID] UUIDString];
+    NSString *newName = [[NSUUID UUID] UUIDString];
+
+    NSURL *keptOriginal = [self makeOldFile:[NSString stringWithFormat:@"%@/original/kept.png", keptName]];
+    NSURL *keptThumbnail = [self makeOldFile:[NSString stringWithFormat:@"%@/thumbnail-large.heic", keptName]];
+    NSURL *keptSmallThumbnail = [self makeOldFile:[NSString stringWithFormat:@"%@/thumbnail-small.heic", keptName]];
+    NSURL *staleThumbnail = [self makeOldFile:[NSString stringWithFormat:@"%@/thumbnail.png", keptName]];
+    [self makeOldFile:[NSString stringWithFormat:@"%@/original/orphan.png", orphanName]];
+    NSURL *orphanDirectory = [self.storageDirectory URLByAppendingPathComponent:orphanName];
+    [self backdate:[orphanDirectory URLByAppendingPathComponent:@"original"]];
+    [self backdate:orphanDirectory];
+    [self backdate:[self.storageDirectory URLByAppendingPathComponent:keptName]];
+
+    // Could be an import in flight, so must be left alone
+    NSURL *newFile = [self.storageDirectory URLByAppendingPathComponent:[NSString stringWithFormat:@"%@/original/new.png", newName]];
+    XCTAssertTrue([fm createDirectoryAtURL:[newFile URLByDeletingLastPathComponent]
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:nil]);
+    XCTAssertTrue([[NSData data] writeToURL:newFile
+                                 atomically:NO]);
+
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    __block NSManagedObjectID *missingID = nil;
+    [moc performBlockAndWait:^{
+        NSArray<Asset *> *assets = [TestModelHelpers generateAssets:2
+                                                          inContext:moc];
+        assets[0].path = keptOriginal;
+        assets[0].thumbnailPath = keptThumbnail;
+        assets[1].path = [self.storageDirectory URLByAppendingPathComponent:[NSString stringWithFormat:@"%@/original/missing.png", missingName]];
+        XCTAssertTrue([moc save:nil]);
+        missingID = assets[1].objectID;
+    }];
+
+    StorageMaintenance *maintenance = [[StorageMaintenance alloc] initWithPersistentStore:moc.persistentStoreCoordinator
+                                                                         storageDirectory:self.storageDirectory
+                                                                           thumbnailStore:nil];
+
+    dispatch_semaphore_t sem = dispatch_semaphore_create(0);
+    __block StorageScanReport *report = nil;
+    __block NSError *scanError = nil;
+    [maintenance scan:^(StorageScanReport * _Nullable innerReport, NSError * _Nullable error) {
+        report = innerReport;
+        scanError = error;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertNil(scanError);
+    XCTAssertNotNil(report);
+
+    XCTAssertEqual([report.orphanDirectories count], 1);
+    XCTAssertEqualObjects([report.orphanDirectories.firstObject lastPathComponent], orphanName);
+    XCTAssertEqual([report.staleThumbnails count], 1);
+    XCTAssertEqualObjects([report.staleThumbnails.firstObject lastPathComponent], [staleThumbnail lastPathComponent]);
+    XCTAssertEqualObjects(report.missingOriginals, @[missingID]);
+    XCTAssertGreaterThanOrEqual(report.reclaimableBytes, 2 * 4096);
+
+    __block unsigned long long reclaimed = 0;
+    [maintenance reclaim:report
+                callback:^(unsigned long long reclaimedBytes) {
+        reclaimed = reclaimedBytes;
+        dispatch_semaphore_signal(sem);
+    }];
+    dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual(reclaimed, report.reclaimableBytes);
+
+    XCTAssertFalse([fm fileExistsAtPath:[orphanDirectory path]]);
+    XCTAssertFalse([fm fileExistsAtPath:[staleThumbnail path]]);
+    XCTAssertTrue([fm fileExistsAtPath:[keptOriginal path]]);
+    XCTAssertTrue([fm fileExistsAtPath:[keptThumbnail path]]);
+    XCTAssertTrue([fm fileExistsAtPath:[keptSmallThumbnail path]]);
+    XCTAssertTrue([fm fileExistsAtPath:[newFile path]]);
+}
+
+@end
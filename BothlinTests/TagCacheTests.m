@@ -0,0 +1,100 @@
+//
+//  TagCacheTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 13/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TagCache.h"
+#import "TestModelHelpers.h"
+#import "Tag+CoreDataClass.h"
+
+@interface TagCacheTests : XCTestCase
+
+@end
+
+@implementation TagCacheTests
+
+- (void)testNamesIgnoreCase {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    TagCache *cache = [[TagCache alloc] initWithContext:moc];
+
+    NSSet<Tag *> *inserted = nil;
+    NSError *error = nil;
+    NSDictionary<NSString *, Tag *> *tags = [cache tagsForNames:[NSSet setWithObjects:@"Hello", @"HELLO", @"world", nil]
+                                                   insertedTags:&inserted
+                                                          error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([tags count], 2);
+    XCTAssertEqual([inserted count], 2);
+    Tag *hello = tags[[TagCache normalisedNameForTag:@"hello"]];
+    XCTAssertNotNil(hello);
+    XCTAssertFalse(hello.objectID.isTemporaryID);
+    XCTAssertEqualObjects([hello.name lowercaseString], @"hello");
+    XCTAssertTrue([moc save:nil]);
+
+    // Second time round it's already known
+    tags = [cache tagsForNames:[NSSet setWithObject:@"hELLo"]
+                  insertedTags:&inserted
+                         error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual([inserted count], 0);
+    XCTAssertEqual(tags[[TagCache normalisedNameForTag:@"hello"]], hello);
+
+    NSArray<Tag *> *all = [moc executeFetchRequest:[Tag fetchRequest]
+                                             error:nil];
+    XCTAssertEqual([all count], 2);
+}
+
+- (void)testOlderTagsGetNormalisedName {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    Tag *old = [NSEntityDescription insertNewObjectForEntityForName:@"Tag"
+                                             inManagedObjectContext:moc];
+    old.name = @"Holiday";
+    XCTAssertTrue([moc save:nil]);
+
+    TagCache *cache = [[TagCache alloc] initWithContext:moc];
+    NSSet<Tag *> *inserted = nil;
+    NSDictionary<NSString *, Tag *> *tags = [cache tagsForNames:[NSSet setWithObject:@"holiday"]
+                                                   insertedTags:&inserted
+                                                          error:nil];
+    XCTAssertEqual([inserted count], 0);
+    XCTAssertEqual([tags allValues].firstObject, old);
+    XCTAssertEqualObjects(old.normalisedName, [TagCache normalisedNameForTag:@"Holiday"]);
+}
+
+- (void)testChangesFromOtherContexts {
+    NSManagedObjectContext *moc = [TestModelHelpers managedObjectContextForTests];
+    TagCache *cache = [[TagCache alloc] initWithContext:moc];
+    NSSet<Tag *> *inserted = nil;
+    NSDictionary<NSString *, Tag *> *tags = [cache tagsForNames:[NSSet setWithObject:@"Gone"]
+                                                   insertedTags:&inserted
+                                                          error:nil];
+    XCTAssertEqual([inserted count], 1);
+    NSManagedObjectID *goneID = [[tags allValues] firstObject].objectID;
+    XCTAssertTrue([moc save:nil]);
+
+    NSManagedObjectContext *other = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+    other.persistentStoreCoordinator = moc.persistentStoreCoordinator;
+    [other performBlockAndWait:^{
+        [other deleteObject:[other objectWithID:goneID]];
+        [TestModelHelpers generateTags:[NSSet setWithObject:@"New"]
+                             inContext:other];
+        XCTAssertTrue([other save:nil]);
+    }];
+    [moc reset];
+
+    // The tag made elsewhere is found rather than duplicated, and the deleted one is made afresh
+    tags = [cache tagsForNames:[NSSet setWithObjects:@"new", @"gone", nil]
+                  insertedTags:&inserted
+                         error:nil];
+    XCTAssertEqual([tags count], 2);
+    XCTAssertEqual([inserted count], 1);
+    XCTAssertEqualObjects([inserted anyObject].name, @"gone");
+    XCTAssertNotEqualObjects([inserted anyObject].objectID, goneID);
+    XCTAssertEqualObjects(tags[[TagCache normalisedNameForTag:@"new"]].name, @"New");
+}
+
+@end
@@ -17,6 +17,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 + (NSManagedObjectContext *)managedObjectContextForTests;
 
+// For things that only work with SQLite, such as batch updates. The store is in a temporary file.
++ (NSManagedObjectContext *)sqliteManagedObjectContextForTests;
+
 + (NSArray<Asset *> *)generateAssets:(NSUInteger)assetCount
                            inContext:(NSManagedObjectContext *)moc;
 
@@ -26,6 +29,12 @@ NS_ASSUME_NONNULL_BEGIN
 + (NSArray<Tag *> *)generateTags:(NSSet<NSString *> *)tagNames
                        inContext:(NSManagedObjectContext *)moc;
 
+// A library shaped like a real one, for benchmarks: every asset has scanned text, some are
+// favourites or in groups, and tags are used unevenly. The same count always makes the same
+// library. It's saved as it goes, so the context never holds all of it.
++ (void)generateLibraryWithAssetCount:(NSUInteger)assetCount
+                            inContext:(NSManagedObjectContext *)moc;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -9,18 +9,31 @@
 #import "Asset+CoreDataClass.h"
 #import "Group+CoreDataClass.h"
 #import "Tag+CoreDataClass.h"
+#import "TagCache.h"
 
 @implementation TestModelHelpers
 
 + (NSManagedObjectContext *)managedObjectContextForTests {
+    return [TestModelHelpers managedObjectContextWithStoreType:NSInMemoryStoreType
+                                                           URL:nil];
+}
+
++ (NSManagedObjectContext *)sqliteManagedObjectContextForTests {
+    NSURL *storeURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSString stringWithFormat:@"%@.sqlite", [[NSUUID UUID] UUIDString]]];
+    return [TestModelHelpers managedObjectContextWithStoreType:NSSQLiteStoreType
+                                                           URL:storeURL];
+}
+
++ (NSManagedObjectContext *)managedObjectContextWithStoreType:(NSString *)storeType
+                                                          URL:(NSURL *)storeURL {
     static NSManagedObjectModel *model = nil;
     if (!model) {
-        NSURL *modelURL = [[NSBundle mainBundle] URLForResource:[NSString stringWithFormat:@"LibraryModel.momd/LibraryModel %d", 2] withExtension:@"mom"];
+        NSURL *modelURL = [[NSBundle mainBundle] URLForResource:[NSString stringWithFormat:@"LibraryModel.momd/LibraryModel %d", 6] withExtension:@"mom"];
         model = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
     }
 
     NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
-    NSPersistentStore *store = [psc addPersistentStoreWithType:NSInMemoryStoreType configuration:nil URL:nil options:nil error:nil];
+    NSPersistentStore *store = [psc addPersistentStoreWithType:storeType configuration:nil URL:storeURL options:nil error:nil];
     NSAssert(store, @"Should have a store by now");
 
     NSManagedObjectContext *moc = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
@@ -69,10 +82,96 @@
         Tag *tag = [NSEntityDescription insertNewObjectForEntityForName:@"Tag"
                                                  inManagedObjectContext:moc];
         tag.name = [tagNamesArray objectAtIndex:index];
+        tag.normalisedName = [TagCache normalisedNameForTag:tag.name];
+        tag.assetCount = @0;
         tags[index] = tag;
     }
     return [NSArray arrayWithArray:tags];
 
 }
 
+// Assets are saved and turned back into faults this many at a time.
+static const NSUInteger kGeneratedLibrarySaveBatchSize = 5000;
+
+// Enough variety that searches for any one word match a fraction of the library, not all of it.
+static NSArray<NSString *> *GeneratedLibraryWords(void) {
+    return @[@"error", @"build", @"failed", @"terminal", @"window", @"settings", @"invoice", @"receipt",
+             @"minecraft", @"qgis", @"map", @"layer", @"export", @"chart", @"slack", @"message",
+             @"meeting", @"calendar", @"notes", @"draft", @"photo", @"album", @"browser", @"tab",
+             @"github", @"review", @"commit", @"branch", @"python", @"compile", @"warning", @"debug",
+             @"network", @"download", @"upload", @"account", @"password", @"login", @"profile", @"report"];
+}
+
++ (void)generateLibraryWithAssetCount:(NSUInteger)assetCount
+                            inContext:(NSManagedObjectContext *)moc {
+    NSParameterAssert(nil != moc);
+
+    // A fixed seed, so runs at the same scale can be compared
+    unsigned short seed[3] = {0xB0, 0x7E, 0x11};
+    NSArray<NSString *> *words = GeneratedLibraryWords();
+
+    NSUInteger groupCount = MAX((NSUInteger)5, assetCount / 2000);
+    NSUInteger tagCount = MIN(MAX((NSUInteger)20, assetCount / 200), (NSUInteger)5000);
+    NSArray<Group *> *groups = [TestModelHelpers generateGroups:groupCount
+                                                      inContext:moc];
+    NSMutableSet<NSString *> *tagNames = [NSMutableSet setWithCapacity:tagCount];
+    for (NSUInteger index = 0; index < tagCount; index++) {
+        [tagNames addObject:[NSString stringWithFormat:@"%@ %lu", words[index % [words count]], index]];
+    }
+    NSArray<Tag *> *tags = [TestModelHelpers generateTags:tagNames
+                                                inContext:moc];
+
+    NSDate *start = [NSDate dateWithTimeIntervalSinceNow:-(NSTimeInterval)assetCount * 60.0];
+    NSMutableArray<Asset *> *batch = [NSMutableArray arrayWithCapacity:kGeneratedLibrarySaveBatchSize];
+    for (NSUInteger index = 0; index < assetCount; index++) {
+        Asset *asset = [NSEntityDescription insertNewObjectForEntityForName:@"Asset"
+                                                     inManagedObjectContext:moc];
+        NSString *uuid = [[NSUUID UUID] UUIDString];
+        asset.name = [NSString stringWithFormat:@"Screenshot %lu.png", index];
+        asset.path = [NSURL fileURLWithPath:[NSString stringWithFormat:@"/tmp/bothlin-benchmark/%@/original/%@", uuid, asset.name]];
+        asset.bookmark = [NSData data];
+        asset.added = [start dateByAddingTimeInterval:(NSTimeInterval)index * 60.0];
+        asset.created = asset.added;
+        asset.type = @"public.png";
+        asset.favourite = (0 == (nrand48(seed) % 20));
+
+        NSMutableArray<NSString *> *text = [NSMutableArray arrayWithCapacity:40];
+        long wordCount = 10 + (nrand48(seed) % 30);
+        for (long word = 0; word < wordCount; word++) {
+            [text addObject:words[(NSUInteger)nrand48(seed) % [words count]]];
+        }
+        asset.scannedText = [text componentsJoinedByString:@" "];
+
+        if (0 == (nrand48(seed) % 3)) {
+            [asset addGroupsObject:groups[(NSUInteger)nrand48(seed) % groupCount]];
+        }
+
+        // Squaring skews the pick towards the first few tags, like real usage
+        long tagsOnAsset = nrand48(seed) % 4;
+        for (long tagIndex = 0; tagIndex < tagsOnAsset; tagIndex++) {
+            double pick = erand48(seed);
+            Tag *tag = tags[(NSUInteger)(pick * pick * (double)tagCount)];
+            if (NO == [asset.tags containsObject:tag]) {
+                [asset addTagsObject:tag];
+                tag.assetCount = @([tag.assetCount unsignedLongLongValue] + 1);
+            }
+        }
+
+        [batch addObject:asset];
+        if ((kGeneratedLibrarySaveBatchSize == [batch count]) || (index + 1 == assetCount)) {
+            @autoreleasepool {
+                NSError *error = nil;
+                BOOL success = [moc save:&error];
+                NSAssert(NO != success, @"Failed to save generated library: %@", error);
+                // Groups and tags too, else they'd each hold every asset they've been given
+                for (NSManagedObject *saved in [[batch arrayByAddingObjectsFromArray:groups] arrayByAddingObjectsFromArray:tags]) {
+                    [moc refreshObject:saved
+                          mergeChanges:NO];
+                }
+                [batch removeAllObjects];
+            }
+        }
+    }
+}
+
 @end
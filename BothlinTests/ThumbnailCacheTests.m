@@ -0,0 +1,144 @@
+//
+//  ThumbnailCacheTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 07/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "ThumbnailCache.h"
+
+@interface ThumbnailCacheTests : XCTestCase
+
+@end
+
+@implementation ThumbnailCacheTests
+
+- (NSImage *)image {
+    return [[NSImage alloc] initWithSize:NSMakeSize(10.0, 10.0)];
+}
+
+- (void)testLookupAndHitRate {
+    ThumbnailCache *cache = [[ThumbnailCache alloc] initWithName:@"test"
+                                                  totalCostLimit:100];
+    NSImage *image = [self image];
+    [cache setImage:image forKey:@"a" cost:10];
+
+    XCTAssertEqual([cache imageForKey:@"a"], image);
+    XCTAssertNil([cache imageForKey:@"b"]);
+    XCTAssertEqual([cache imageForKey:@"a"], image);
+    XCTAssertNil([cache imageForKey:@"c"]);
+
+    XCTAssertEqual([cache hitCount], 2);
+    XCTAssertEqual([cache missCount], 2);
+    XCTAssertEqualWithAccuracy([cache hitRate], 0.5, 0.0001);
+
+    [cache resetStatistics];
+    XCTAssertEqual([cache hitCount], 0);
+    XCTAssertEqual([cache missCount], 0);
+    XCTAssertEqual([cache hitRate], 0.0);
+}
+
+- (void)testEvictsLeastRecentlyUsed {
+    ThumbnailCache *cache = [[ThumbnailCache alloc] initWithName:@"test"
+                                                  totalCostLimit:30];
+    [cache setImage:[self image] forKey:@"a" cost:10];
+    [cache setImage:[self image] forKey:@"b" cost:10];
+    [cache setImage:[self image] forKey:@"c" cost:10];
+    XCTAssertEqual([cache count], 3);
+    XCTAssertEqual([cache totalCost], 30);
+
+    // Touch a so that b is now the oldest
+    XCTAssertNotNil([cache imageForKey:@"a"]);
+    [cache setImage:[self image] forKey:@"d" cost:10];
+
+    XCTAssertEqual([cache count], 3);
+    XCTAssertEqual([cache totalCost], 30);
+    XCTAssertEqual([cache evictionCount], 1);
+    XCTAssertNil([cache imageForKey:@"b"]);
+    XCTAssertNotNil([cache imageForKey:@"a"]);
+    XCTAssertNotNil([cache imageForKey:@"c"]);
+    XCTAssertNotNil([cache imageForKey:@"d"]);
+}
+
+- (void)testEvictsByCost {
+    ThumbnailCache *cache = [[ThumbnailCache alloc] initWithName:@"test"
+                                                  totalCostLimit:30];
+    [cache setImage:[self image] forKey:@"a" cost:10];
+    [cache setImage:[self image] forKey:@"b" cost:10];
+    [cache setImage:[self image] forKey:@"c" cost:25];
+
+    XCTAssertEqual([cache count], 1);
+    XCTAssertEqual([cache totalCost], 25);
+    XCTAssertNotNil([cache imageForKey:@"c"]);
+
+    // Something bigger than the whole budget is still kept until the next insert
+    [cache setImage:[self image] forKey:@"d" cost:50];
+    XCTAssertEqual([cache count], 1);
+    XCTAssertNotNil([cache imageForKey:@"d"]);
+    [cache setImage:[self image] forKey:@"e" cost:10];
+    XCTAssertEqual([cache count], 1);
+    XCTAssertNil([cache imageForKey:@"d"]);
+}
+
+- (void)testReplacingUpdatesCost {
+    ThumbnailCache *cache = [[ThumbnailCache alloc] initWithName:@"test"
+                                                  totalCostLimit:100];
+    NSImage *second = [self image];
+    [cache setImage:[self image] forKey:@"a" cost:10];
+    [cache setImage:second forKey:@"a" cost:40];
+
+    XCTAssertEqual([cache count], 1);
+    XCTAssertEqual([cache totalCost], 40);
+    XCTAssertEqual([cache imageForKey:@"a"], second);
+
+    [cache removeImageForKey:@"a"];
+    XCTAssertEqual([cache count], 0);
+    XCTAssertEqual([cache totalCost], 0);
+}
+
+- (void)testTrimmingAndLimitChanges {
+    ThumbnailCache *cache = [[ThumbnailCache alloc] initWithName:@"test"
+                                                  totalCostLimit:100];
+    for (NSUInteger index = 0; index < 10; index++) {
+        [cache setImage:[self image]
+                 forKey:@(index)
+                   cost:10];
+    }
+    XCTAssertEqual([cache totalCost], 100);
+
+    [cache trimToCost:50];
+    XCTAssertEqual([cache totalCost], 50);
+    XCTAssertNil([cache imageForKey:@(4)]);
+    XCTAssertNotNil([cache imageForKey:@(5)]);
+
+    cache.totalCostLimit = 20;
+    XCTAssertEqual([cache totalCost], 20);
+
+    [cache removeAllImages];
+    XCTAssertEqual([cache count], 0);
+    XCTAssertEqual([cache totalCost], 0);
+
+    // And it still works after being emptied
+    [cache setImage:[self image] forKey:@"a" cost:10];
+    XCTAssertNotNil([cache imageForKey:@"a"]);
+}
+
+- (void)testCostForImage {
+    NSBitmapImageRep *rep = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                                    pixelsWide:200
+                                                                    pixelsHigh:100
+                                                                 bitsPerSample:8
+                                                               samplesPerPixel:4
+                                                                      hasAlpha:YES
+                                                                      isPlanar:NO
+                                                                colorSpaceName:NSDeviceRGBColorSpace
+                                                                   bytesPerRow:0
+                                                                  bitsPerPixel:0];
+    NSImage *image = [[NSImage alloc] initWithSize:NSMakeSize(100.0, 50.0)];
+    [image addRepresentation:rep];
+    XCTAssertEqual([ThumbnailCache costForImage:image], 200 * 100 * 4);
+}
+
+@end
@@ -0,0 +1,155 @@
+//
+//  ThumbnailPackStoreTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 06/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "ThumbnailPackStore.h"
+
+@interface ThumbnailPackStoreTests : XCTestCase
+
+@property (nonatomic, strong, readwrite) NSURL *storageDirectory;
+
+@end
+
+@implementation ThumbnailPackStoreTests
+
+- (void)setUp {
+    NSString *name = [[NSUUID UUID] UUIDString];
+    self.storageDirectory = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.storageDirectory
+                                              error:nil];
+}
+
+- (NSData *)dataOfLength:(NSUInteger)length seed:(uint8_t)seed {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = [data mutableBytes];
+    for (NSUInteger index = 0; index < length; index++) {
+        bytes[index] = (uint8_t)(seed + index);
+    }
+    return data;
+}
+
+- (void)testStoreAndRead {
+    ThumbnailPackStore *store = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+    NSData *small = [self dataOfLength:100 seed:1];
+    NSData *large = [self dataOfLength:1000 seed:2];
+
+    NSError *error = nil;
+    BOOL success = [store storeThumbnails:@{@"asset/small": small, @"asset/large": large}
+                                    error:&error];
+    XCTAssertNil(error);
+    XCTAssertTrue(success);
+
+    XCTAssertEqualObjects([store thumbnailDataForKey:@"asset/small"], small);
+    XCTAssertEqualObjects([store thumbnailDataForURL:[ThumbnailPackStore URLForKey:@"asset/large"]], large);
+    XCTAssertNil([store thumbnailDataForKey:@"asset/missing"]);
+    XCTAssertEqual([store liveBytes], 1100);
+    XCTAssertEqual([store totalBytes], 1100);
+}
+
+- (void)testURLsRoundTrip {
+    NSURL *url = [ThumbnailPackStore URLForKey:@"1234-5678/thumbnail-large"];
+    XCTAssertEqualObjects([ThumbnailPackStore keyForURL:url], @"1234-5678/thumbnail-large");
+    XCTAssertNil([ThumbnailPackStore keyForURL:[NSURL fileURLWithPath:@"/tmp/thumbnail.png"]]);
+}
+
+- (void)testReplaceAndRemoveSurviveReopening {
+    NSData *first = [self dataOfLength:100 seed:1];
+    NSData *second = [self dataOfLength:200 seed:2];
+    NSData *other = [self dataOfLength:300 seed:3];
+    @autoreleasepool {
+        ThumbnailPackStore *store = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+        XCTAssertTrue([store storeThumbnails:@{@"a": first, @"b": other} error:nil]);
+        XCTAssertTrue([store storeThumbnails:@{@"a": second} error:nil]);
+        [store removeThumbnailsForKeys:[NSSet setWithObject:@"b"]];
+
+        XCTAssertEqualObjects([store thumbnailDataForKey:@"a"], second);
+        XCTAssertNil([store thumbnailDataForKey:@"b"]);
+        XCTAssertEqual([store liveBytes], 200);
+        XCTAssertEqual([store totalBytes], 600);
+    }
+
+    ThumbnailPackStore *reopened = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+    XCTAssertEqualObjects([reopened thumbnailDataForKey:@"a"], second);
+    XCTAssertNil([reopened thumbnailDataForKey:@"b"]);
+    XCTAssertEqual([reopened liveBytes], 200);
+    XCTAssertEqual([reopened totalBytes], 600);
+}
+
+- (void)testTruncatedIndexLineIsIgnored {
+    NSData *data = [self dataOfLength:100 seed:1];
+    @autoreleasepool {
+        ThumbnailPackStore *store = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+        XCTAssertTrue([store storeThumbnails:@{@"a": data} error:nil]);
+    }
+
+    // Simulate a crash part way through writing a record for another thumbnail
+    NSURL *indexURL = [[self.storageDirectory URLByAppendingPathComponent:kThumbnailPackDirectoryName] URLByAppendingPathComponent:@"index.log"];
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:indexURL error:nil];
+    [handle seekToEndReturningOffset:nil error:nil];
+    [handle writeData:[@"P\tb\t0\t0\t5" dataUsingEncoding:NSUTF8StringEncoding] error:nil];
+    [handle closeAndReturnError:nil];
+
+    ThumbnailPackStore *reopened = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+    XCTAssertEqualObjects([reopened thumbnailDataForKey:@"a"], data);
+    XCTAssertNil([reopened thumbnailDataForKey:@"b"]);
+}
+
+- (void)testCompactionReclaimsDeadSpace {
+    ThumbnailPackStore *store = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+    NSMutableDictionary<NSString *, NSData *> *expected = [NSMutableDictionary dictionary];
+    for (NSUInteger index = 0; index < 50; index++) {
+        NSString *key = [NSString stringWithFormat:@"asset-%lu", (unsigned long)index];
+        NSData *data = [self dataOfLength:1000 + index seed:(uint8_t)index];
+        XCTAssertTrue([store storeThumbnails:@{key: data} error:nil]);
+        expected[key] = data;
+    }
+    NSMutableSet<NSString *> *removed = [NSMutableSet set];
+    for (NSUInteger index = 0; index < 50; index += 2) {
+        [removed addObject:[NSString stringWithFormat:@"asset-%lu", (unsigned long)index]];
+    }
+    [store removeThumbnailsForKeys:removed];
+    [expected removeObjectsForKeys:[removed allObjects]];
+
+    // Data handed out before compaction should still be good afterwards
+    NSData *heldData = [store thumbnailDataForKey:@"asset-1"];
+    NSData *heldCopy = [NSData dataWithData:heldData];
+
+    unsigned long long liveBytes = [store liveBytes];
+    XCTAssertLessThan(liveBytes, [store totalBytes]);
+
+    NSError *error = nil;
+    BOOL success = [store compact:&error];
+    XCTAssertNil(error);
+    XCTAssertTrue(success);
+    XCTAssertEqual([store liveBytes], liveBytes);
+    XCTAssertEqual([store totalBytes], liveBytes);
+    XCTAssertEqualObjects(heldData, heldCopy);
+
+    for (NSString *key in expected) {
+        XCTAssertEqualObjects([store thumbnailDataForKey:key], expected[key], @"Mismatch for %@", key);
+    }
+    for (NSString *key in removed) {
+        XCTAssertNil([store thumbnailDataForKey:key]);
+    }
+
+    // And new writes after compaction still land somewhere sensible
+    NSData *late = [self dataOfLength:500 seed:9];
+    XCTAssertTrue([store storeThumbnails:@{@"late": late} error:nil]);
+    XCTAssertEqualObjects([store thumbnailDataForKey:@"late"], late);
+
+    ThumbnailPackStore *reopened = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.storageDirectory];
+    for (NSString *key in expected) {
+        XCTAssertEqualObjects([reopened thumbnailDataForKey:key], expected[key], @"Mismatch for %@ after reopening", key);
+    }
+    XCTAssertEqualObjects([reopened thumbnailDataForKey:@"late"], late);
+}
+
+@end
@@ -0,0 +1,156 @@
+//
+//  ThumbnailPyramidTests.m
+//  BothlinTests
+//
+//  Created by Michael Dales on 05/12/2023.
+//
+
+#import <XCTest/XCTest.h>
+#import <ImageIO/ImageIO.h>
+
+#import "ThumbnailPyramid.h"
+#import "ThumbnailPackStore.h"
+
+@interface ThumbnailPyramidTests : XCTestCase
+
+@property (nonatomic, strong, readwrite) NSURL *directory;
+
+@end
+
+@implementation ThumbnailPyramidTests
+
+- (void)setUp {
+    NSString *name = [[NSUUID UUID] UUIDString];
+    self.directory = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    NSError *error = nil;
+    BOOL success = [[NSFileManager defaultManager] createDirectoryAtURL:self.directory
+                                            withIntermediateDirectories:YES
+                                                             attributes:nil
+                                                                  error:&error];
+    XCTAssertNil(error);
+    XCTAssertTrue(success);
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.directory
+                                              error:nil];
+}
+
+- (CGImageRef)newImageWithWidth:(size_t)width height:(size_t)height CF_RETURNS_RETAINED {
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, kCGImageAlphaPremultipliedLast);
+    CGColorSpaceRelease(colorSpace);
+    CGContextSetRGBFillColor(context, 0.2, 0.4, 0.8, 1.0);
+    CGContextFillRect(context, CGRectMake(0.0, 0.0, (CGFloat)width, (CGFloat)height));
+    CGImageRef image = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    return image;
+}
+
+- (CGSize)pixelSizeOfImageAtURL:(NSURL *)url {
+    CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)url, NULL);
+    if (NULL == source) {
+        return CGSizeZero;
+    }
+    NSDictionary *properties = (NSDictionary *)CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source, 0, NULL));
+    CFRelease(source);
+    return CGSizeMake([properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue],
+                      [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] doubleValue]);
+}
+
+- (void)testWritesAllSizesFromOneImage {
+    CGImageRef image = [self newImageWithWidth:2000 height:1000];
+    NSError *error = nil;
+    NSURL *thumbnailPath = [ThumbnailPyramid writeThumbnailsForImage:image
+                                                          toDirectory:self.directory
+                                                                error:&error];
+    CGImageRelease(image);
+    XCTAssertNil(error);
+    XCTAssertNotNil(thumbnailPath);
+    XCTAssertEqualObjects([[thumbnailPath lastPathComponent] stringByDeletingPathExtension], @"thumbnail-large");
+
+    NSArray<NSURL *> *urls = [ThumbnailPyramid allURLsForThumbnailPath:thumbnailPath];
+    XCTAssertEqual([urls count], 3);
+    for (ThumbnailSize size = ThumbnailSizeSmall; size <= ThumbnailSizeLarge; size++) {
+        NSURL *url = [ThumbnailPyramid URLForSize:size
+                                    thumbnailPath:thumbnailPath];
+        XCTAssertTrue([urls containsObject:url]);
+        CGFloat expected = [ThumbnailPyramid pixelSizeForSize:size];
+        CGSize actual = [self pixelSizeOfImageAtURL:url];
+        XCTAssertEqual(actual.width, expected, @"Wrong width for %@", url);
+        XCTAssertEqual(actual.height, expected / 2.0, @"Wrong height for %@", url);
+    }
+
+    NSArray<NSString *> *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[self.directory path]
+                                                                                       error:nil];
+    XCTAssertEqual([contents count], 3, @"Expected no stray files, got %@", contents);
+}
+
+- (void)testWritesAllSizesIntoStore {
+    ThumbnailPackStore *store = [[ThumbnailPackStore alloc] initWithStorageDirectory:self.directory];
+    CGImageRef image = [self newImageWithWidth:2000 height:1000];
+    NSError *error = nil;
+    NSURL *thumbnailPath = [ThumbnailPyramid writeThumbnailsForImage:image
+                                                                  key:@"1234"
+                                                              toStore:store
+                                                                error:&error];
+    CGImageRelease(image);
+    XCTAssertNil(error);
+    XCTAssertNotNil(thumbnailPath);
+    XCTAssertEqualObjects([ThumbnailPackStore keyForURL:thumbnailPath], @"1234/thumbnail-large");
+
+    NSArray<NSURL *> *urls = [ThumbnailPyramid allURLsForThumbnailPath:thumbnailPath];
+    XCTAssertEqual([urls count], 3);
+    for (ThumbnailSize size = ThumbnailSizeSmall; size <= ThumbnailSizeLarge; size++) {
+        NSURL *url = [ThumbnailPyramid URLForSize:size
+                                    thumbnailPath:thumbnailPath];
+        XCTAssertTrue([urls containsObject:url]);
+        NSData *data = [store thumbnailDataForURL:url];
+        XCTAssertNotNil(data, @"No data for %@", url);
+        CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+        XCTAssertTrue(NULL != source);
+        if (NULL != source) {
+            NSDictionary *properties = (NSDictionary *)CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source, 0, NULL));
+            CFRelease(source);
+            XCTAssertEqual([properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue], [ThumbnailPyramid pixelSizeForSize:size]);
+        }
+    }
+
+    [ThumbnailPyramid removeThumbnailsForThumbnailPath:thumbnailPath
+                                                 store:store];
+    for (NSURL *url in urls) {
+        XCTAssertNil([store thumbnailDataForURL:url]);
+    }
+}
+
+- (void)testSmallImagesAreNotScaledUp {
+    CGImageRef image = [self newImageWithWidth:100 height:50];
+    NSError *error = nil;
+    NSURL *thumbnailPath = [ThumbnailPyramid writeThumbnailsForImage:image
+                                                          toDirectory:self.directory
+                                                                error:&error];
+    CGImageRelease(image);
+    XCTAssertNil(error);
+    XCTAssertNotNil(thumbnailPath);
+
+    CGSize actual = [self pixelSizeOfImageAtURL:thumbnailPath];
+    XCTAssertEqual(actual.width, 100.0);
+    XCTAssertEqual(actual.height, 50.0);
+}
+
+- (void)testLegacyThumbnailIsUsedForAllSizes {
+    NSURL *legacy = [NSURL fileURLWithPath:@"/tmp/library/1234/thumbnail.png"];
+    for (ThumbnailSize size = ThumbnailSizeSmall; size <= ThumbnailSizeLarge; size++) {
+        XCTAssertEqualObjects([ThumbnailPyramid URLForSize:size thumbnailPath:legacy], legacy);
+    }
+    XCTAssertEqualObjects([ThumbnailPyramid allURLsForThumbnailPath:legacy], @[legacy]);
+}
+
+- (void)testSizeForPixelSize {
+    XCTAssertEqual([ThumbnailPyramid sizeForPixelSize:100.0], ThumbnailSizeSmall);
+    XCTAssertEqual([ThumbnailPyramid sizeForPixelSize:500.0], ThumbnailSizeMedium);
+    XCTAssertEqual([ThumbnailPyramid sizeForPixelSize:900.0], ThumbnailSizeLarge);
+    XCTAssertEqual([ThumbnailPyramid sizeForPixelSize:5000.0], ThumbnailSizeLarge);
+}
+
+@end